@@ -46,6 +46,12 @@ Hash Hash::of(void* data, size_t size) {
 // Note:  Since this is in static space it will be automatically initialized to zero.
 const Hash Hash::NULL_HASH;
 
+Hash Hash::fromBytes(const unsigned char* bytes) {
+  Hash result;
+  memcpy(result.hash, bytes, sizeof(result.hash));
+  return result;
+}
+
 std::string Hash::toString() const {
   std::string result;
   result.reserve(sizeof(hash) * 2);
@@ -65,7 +71,7 @@ Hash::Builder& Hash::Builder::add(const std::string& data) {
   return *this;
 }
 
-Hash::Builder& Hash::Builder::add(void* data, size_t size) {
+Hash::Builder& Hash::Builder::add(const void* data, size_t size) {
   SHA256_Update(&context, data, size);
   return *this;
 }
@@ -33,7 +33,7 @@ public:
   public:
     Builder();
     Builder& add(const std::string& data);
-    Builder& add(void* data, size_t size);
+    Builder& add(const void* data, size_t size);
     Hash build();
 
   private:
@@ -46,6 +46,11 @@ public:
 
   std::string toString() const;
 
+  // Raw access to the hash bytes, e.g. for persisting them.
+  static const size_t SIZE = 32;
+  inline const unsigned char* bytes() const { return hash; }
+  static Hash fromBytes(const unsigned char* bytes);
+
   inline bool operator==(const Hash& other) const {
     return memcmp(hash, other.hash, sizeof(hash)) == 0;
   }
@@ -74,7 +79,7 @@ public:
 
 private:
   union {
-    unsigned char hash[32];
+    unsigned char hash[SIZE];
     size_t shortHash;
   };
 };
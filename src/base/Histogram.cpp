@@ -0,0 +1,68 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Histogram.h"
+
+#include <string.h>
+
+namespace ekam {
+
+Histogram::Histogram(): count(0), sum(0), max(0) {
+  memset(buckets, 0, sizeof(buckets));
+}
+
+void Histogram::add(uint64_t value) {
+  int bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+  ++buckets[bucket];
+  ++count;
+  sum += value;
+  if (value > max) {
+    max = value;
+  }
+}
+
+uint64_t Histogram::getPercentile(double fraction) const {
+  if (count == 0) {
+    return 0;
+  }
+
+  uint64_t target = static_cast<uint64_t>(fraction * count);
+  if (target >= count) {
+    target = count - 1;
+  }
+
+  uint64_t seen = 0;
+  for (int i = 0; i < BUCKET_COUNT; i++) {
+    seen += buckets[i];
+    if (seen > target) {
+      uint64_t upperBound = i == 0 ? 0 : i == 64 ? UINT64_MAX : (UINT64_C(1) << i) - 1;
+      return upperBound < max ? upperBound : max;
+    }
+  }
+  return max;
+}
+
+void Histogram::dump(FILE* out, const char* name, const char* unit) const {
+  fprintf(out, "%-20s %9llu count %9.0f%s mean %9llu%s p50 %9llu%s p90 %9llu%s p99 "
+               "%9llu%s max\n",
+          name, (unsigned long long)count, getMean(), unit,
+          (unsigned long long)getPercentile(0.5), unit,
+          (unsigned long long)getPercentile(0.9), unit,
+          (unsigned long long)getPercentile(0.99), unit,
+          (unsigned long long)max, unit);
+}
+
+}  // namespace ekam
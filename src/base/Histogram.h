@@ -0,0 +1,57 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KENTONSCODE_BASE_HISTOGRAM_H_
+#define KENTONSCODE_BASE_HISTOGRAM_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+namespace ekam {
+
+// Counts values in power-of-two buckets:  bucket 0 holds zero, bucket i holds [2^(i-1), 2^i).
+// Adding is a few instructions, so it can sit on hot paths like the event loop.  Percentiles are
+// only accurate to within a factor of two, which is plenty for telling a stall from a blip.
+class Histogram {
+public:
+  Histogram();
+
+  void add(uint64_t value);
+
+  uint64_t getCount() const { return count; }
+  uint64_t getMax() const { return max; }
+  double getMean() const { return count == 0 ? 0.0 : static_cast<double>(sum) / count; }
+
+  // Upper bound of the bucket containing the value `fraction` of the way through, e.g. 0.99 for
+  // the 99th percentile.  Never more than the maximum.
+  uint64_t getPercentile(double fraction) const;
+
+  // Writes one line in the style of the other stats:  the name, then count, mean, median, 90th
+  // and 99th percentiles and maximum, with values followed by `unit`.
+  void dump(FILE* out, const char* name, const char* unit) const;
+
+private:
+  static const int BUCKET_COUNT = 65;
+
+  uint64_t buckets[BUCKET_COUNT];
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+};
+
+}  // namespace ekam
+
+#endif  // KENTONSCODE_BASE_HISTOGRAM_H_
@@ -0,0 +1,76 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Histogram.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace ekam {
+namespace {
+
+#define ASSERT(EXPRESSION)                                                    \
+  if (!(EXPRESSION)) {                                                        \
+    fprintf(stderr, "%s:%d: FAILED: %s\n", __FILE__, __LINE__, #EXPRESSION);  \
+    exit(1);                                                                  \
+  }
+
+void testEmpty() {
+  Histogram histogram;
+  ASSERT(histogram.getCount() == 0);
+  ASSERT(histogram.getMax() == 0);
+  ASSERT(histogram.getMean() == 0.0);
+  ASSERT(histogram.getPercentile(0.5) == 0);
+}
+
+void testPercentiles() {
+  Histogram histogram;
+  for (int i = 0; i < 90; i++) {
+    histogram.add(3);
+  }
+  for (int i = 0; i < 9; i++) {
+    histogram.add(100);
+  }
+  histogram.add(5000);
+
+  ASSERT(histogram.getCount() == 100);
+  ASSERT(histogram.getMax() == 5000);
+  ASSERT(histogram.getMean() == (90 * 3 + 9 * 100 + 5000) / 100.0);
+
+  // Each is the top of its power-of-two bucket.
+  ASSERT(histogram.getPercentile(0.5) == 3);
+  ASSERT(histogram.getPercentile(0.9) == 127);
+  ASSERT(histogram.getPercentile(0.98) == 127);
+  ASSERT(histogram.getPercentile(0.99) == 5000);
+  ASSERT(histogram.getPercentile(1.0) == 5000);
+}
+
+void testExtremes() {
+  Histogram histogram;
+  histogram.add(0);
+  histogram.add(UINT64_MAX);
+  ASSERT(histogram.getPercentile(0.0) == 0);
+  ASSERT(histogram.getPercentile(1.0) == UINT64_MAX);
+}
+
+}  // namespace
+}  // namespace ekam
+
+int main(int argc, char* argv[]) {
+  ekam::testEmpty();
+  ekam::testPercentiles();
+  ekam::testExtremes();
+  return 0;
+}
@@ -0,0 +1,299 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "IgnoreRules.h"
+
+#include <algorithm>
+
+namespace ekam {
+
+IgnoreRules::IgnoreRules() {}
+IgnoreRules::~IgnoreRules() {}
+
+void IgnoreRules::parse(const std::string& text) {
+  std::string::size_type pos = 0;
+  while (pos < text.size()) {
+    std::string::size_type end = text.find_first_of('\n', pos);
+    if (end == std::string::npos) {
+      end = text.size();
+    }
+    std::string line(text, pos, end - pos);
+    pos = end + 1;
+
+    if (!line.empty() && line[line.size() - 1] == '\r') {
+      line.resize(line.size() - 1);
+    }
+    // Trailing spaces are ignored unless escaped.
+    while (!line.empty() && line[line.size() - 1] == ' ' &&
+           (line.size() < 2 || line[line.size() - 2] != '\\')) {
+      line.resize(line.size() - 1);
+    }
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+
+    addPattern(line);
+  }
+}
+
+void IgnoreRules::addPattern(std::string pattern) {
+  Rule rule;
+  rule.negated = false;
+  rule.directoryOnly = false;
+
+  if (pattern[0] == '!') {
+    rule.negated = true;
+    pattern.erase(0, 1);
+  }
+
+  while (!pattern.empty() && pattern[pattern.size() - 1] == '/') {
+    rule.directoryOnly = true;
+    pattern.resize(pattern.size() - 1);
+  }
+
+  rule.anchored = pattern.find_first_of('/') != std::string::npos;
+  if (rule.anchored && pattern[0] == '/') {
+    pattern.erase(0, 1);
+  }
+
+  if (pattern.empty()) {
+    return;
+  }
+
+  compile(pattern, &rule.tokens);
+
+  int index = rules.size();
+  const std::vector<Token>& tokens = rule.tokens;
+  if (!rule.anchored && tokens.size() == 1 && tokens[0].type == Token::LITERAL) {
+    nameRules[tokens[0].literal].push_back(index);
+  } else if (!rule.anchored && tokens.size() == 2 && tokens[0].type == Token::STAR &&
+             tokens[1].type == Token::LITERAL) {
+    size_t length = tokens[1].literal.size();
+    suffixRules[tokens[1].literal].push_back(index);
+    if (std::find(suffixLengths.begin(), suffixLengths.end(), length) == suffixLengths.end()) {
+      suffixLengths.push_back(length);
+    }
+  } else {
+    generalRules.push_back(index);
+  }
+
+  rules.push_back(rule);
+}
+
+void IgnoreRules::compile(const std::string& pattern, std::vector<Token>* output) {
+  auto appendLiteral = [output](char c) {
+    if (output->empty() || output->back().type != Token::LITERAL) {
+      output->push_back(Token());
+      output->back().type = Token::LITERAL;
+    }
+    output->back().literal.push_back(c);
+  };
+  auto append = [output](Token::Type type) {
+    output->push_back(Token());
+    output->back().type = type;
+  };
+
+  for (size_t i = 0; i < pattern.size(); i++) {
+    char c = pattern[i];
+    switch (c) {
+      case '*': {
+        bool atComponentStart = i == 0 || pattern[i - 1] == '/';
+        if (i + 1 < pattern.size() && pattern[i + 1] == '*' && atComponentStart) {
+          if (i + 2 == pattern.size()) {
+            append(Token::ANYTHING);
+            i += 1;
+            break;
+          } else if (pattern[i + 2] == '/') {
+            append(Token::ANY_DIRECTORIES);
+            i += 2;
+            break;
+          }
+        }
+        // Any other run of stars is the same as one.
+        while (i + 1 < pattern.size() && pattern[i + 1] == '*') {
+          ++i;
+        }
+        append(Token::STAR);
+        break;
+      }
+
+      case '?':
+        append(Token::ANY_CHAR);
+        break;
+
+      case '[': {
+        size_t j = i + 1;
+        bool negated = false;
+        if (j < pattern.size() && (pattern[j] == '!' || pattern[j] == '^')) {
+          negated = true;
+          ++j;
+        }
+
+        std::bitset<256> chars;
+        bool first = true;
+        for (; j < pattern.size() && (first || pattern[j] != ']'); j++) {
+          first = false;
+          unsigned char low = pattern[j];
+          if (low == '\\' && j + 1 < pattern.size()) {
+            low = pattern[++j];
+          }
+          unsigned char high = low;
+          if (j + 2 < pattern.size() && pattern[j + 1] == '-' && pattern[j + 2] != ']') {
+            high = pattern[j + 2];
+            j += 2;
+          }
+          for (unsigned int k = low; k <= high; k++) {
+            chars.set(k);
+          }
+        }
+
+        if (j >= pattern.size()) {
+          // No closing bracket:  the bracket is literal.
+          appendLiteral(c);
+        } else {
+          append(Token::CHAR_CLASS);
+          output->back().chars = negated ? ~chars : chars;
+          i = j;
+        }
+        break;
+      }
+
+      case '\\':
+        if (i + 1 < pattern.size()) {
+          c = pattern[++i];
+        }
+        appendLiteral(c);
+        break;
+
+      default:
+        appendLiteral(c);
+        break;
+    }
+  }
+}
+
+bool IgnoreRules::matchTokens(const std::vector<Token>& tokens, size_t tokenPos,
+                              const std::string& text, size_t textPos) {
+  if (tokenPos == tokens.size()) {
+    return textPos == text.size();
+  }
+
+  const Token& token = tokens[tokenPos];
+  switch (token.type) {
+    case Token::LITERAL:
+      return text.compare(textPos, token.literal.size(), token.literal) == 0 &&
+             matchTokens(tokens, tokenPos + 1, text, textPos + token.literal.size());
+
+    case Token::STAR:
+      for (size_t end = textPos; ; end++) {
+        if (matchTokens(tokens, tokenPos + 1, text, end)) {
+          return true;
+        }
+        if (end == text.size() || text[end] == '/') {
+          return false;
+        }
+      }
+
+    case Token::ANY_CHAR:
+      return textPos < text.size() && text[textPos] != '/' &&
+             matchTokens(tokens, tokenPos + 1, text, textPos + 1);
+
+    case Token::CHAR_CLASS:
+      return textPos < text.size() && text[textPos] != '/' &&
+             token.chars[static_cast<unsigned char>(text[textPos])] &&
+             matchTokens(tokens, tokenPos + 1, text, textPos + 1);
+
+    case Token::ANY_DIRECTORIES:
+      if (matchTokens(tokens, tokenPos + 1, text, textPos)) {
+        return true;
+      }
+      for (size_t i = textPos; i < text.size(); i++) {
+        if (text[i] == '/' && matchTokens(tokens, tokenPos + 1, text, i + 1)) {
+          return true;
+        }
+      }
+      return false;
+
+    case Token::ANYTHING:
+      return true;
+  }
+
+  return false;
+}
+
+int IgnoreRules::findLastApplicable(const std::vector<int>& candidates, bool isDirectory) const {
+  for (auto iter = candidates.rbegin(); iter != candidates.rend(); ++iter) {
+    if (isDirectory || !rules[*iter].directoryOnly) {
+      return *iter;
+    }
+  }
+  return -1;
+}
+
+bool IgnoreRules::matches(const std::string& path, bool isDirectory) const {
+  if (rules.empty()) {
+    return false;
+  }
+
+  std::string::size_type slashPos = path.find_last_of('/');
+  std::string basename = slashPos == std::string::npos ? path : path.substr(slashPos + 1);
+
+  // Find the last rule that matches.
+  int best = -1;
+
+  auto nameIter = nameRules.find(basename);
+  if (nameIter != nameRules.end()) {
+    best = std::max(best, findLastApplicable(nameIter->second, isDirectory));
+  }
+
+  for (size_t length: suffixLengths) {
+    if (basename.size() >= length) {
+      auto suffixIter = suffixRules.find(basename.substr(basename.size() - length));
+      if (suffixIter != suffixRules.end()) {
+        best = std::max(best, findLastApplicable(suffixIter->second, isDirectory));
+      }
+    }
+  }
+
+  for (auto iter = generalRules.rbegin(); iter != generalRules.rend() && *iter > best; ++iter) {
+    const Rule& rule = rules[*iter];
+    if (rule.directoryOnly && !isDirectory) {
+      continue;
+    }
+    if (matchTokens(rule.tokens, 0, rule.anchored ? path : basename, 0)) {
+      best = *iter;
+      break;
+    }
+  }
+
+  return best >= 0 && !rules[best].negated;
+}
+
+bool IgnoreRules::matchesPathOrParent(const std::string& path, bool isDirectory) const {
+  if (rules.empty()) {
+    return false;
+  }
+
+  for (std::string::size_type pos = path.find_first_of('/'); pos != std::string::npos;
+       pos = path.find_first_of('/', pos + 1)) {
+    if (matches(path.substr(0, pos), true)) {
+      return true;
+    }
+  }
+  return matches(path, isDirectory);
+}
+
+}  // namespace ekam
@@ -0,0 +1,104 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KENTONSCODE_BASE_IGNORERULES_H_
+#define KENTONSCODE_BASE_IGNORERULES_H_
+
+#include <bitset>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ekam {
+
+// A set of exclusion patterns in .gitignore syntax:
+//
+//   # comment           Blank lines and comments are skipped.
+//   name                Matches an entry with this name at any depth.
+//   dir/                Trailing slash:  matches directories only.
+//   path/to/thing       Contains a slash:  matched against the whole path from the top.
+//   /thing              Leading slash:  anchored at the top.
+//   *.o  ?  [a-z]       Wildcards, none of which match a slash.
+//   a/**/b  **/c  d/**  "**" matches any number of directories.
+//   !pattern            Re-include something excluded by an earlier pattern.
+//
+// Later patterns take precedence.  Patterns are compiled when added:  plain names and "*suffix"
+// patterns, by far the most common, are found by hash lookup, so only the remaining patterns
+// are actually matched against each path.
+class IgnoreRules {
+public:
+  IgnoreRules();
+  ~IgnoreRules();
+
+  // Add the patterns in the text of an ignore file.
+  void parse(const std::string& text);
+
+  inline bool empty() const { return rules.empty(); }
+  inline size_t size() const { return rules.size(); }
+
+  // Whether the entry at `path` -- relative to the top, with no leading or trailing slash -- is
+  // excluded.  Its parent directories are not checked:  code walking a tree simply doesn't
+  // descend into excluded directories.
+  bool matches(const std::string& path, bool isDirectory) const;
+
+  // Like matches(), but also true if any parent directory of `path` is excluded.
+  bool matchesPathOrParent(const std::string& path, bool isDirectory) const;
+
+private:
+  struct Token {
+    enum Type {
+      LITERAL,
+      STAR,              // *     Anything within one path component.
+      ANY_CHAR,          // ?
+      CHAR_CLASS,        // [...]
+      ANY_DIRECTORIES,   // **/   Zero or more whole directories.
+      ANYTHING           // /**   at the end:  everything beneath.
+    };
+
+    Type type;
+    std::string literal;
+    std::bitset<256> chars;
+  };
+
+  struct Rule {
+    std::vector<Token> tokens;
+    bool negated;
+    bool directoryOnly;
+    bool anchored;  // Matched against the whole path rather than just the last component.
+  };
+
+  std::vector<Rule> rules;
+
+  // Indexes of rules which are a plain name, by that name, and of rules which are "*" followed by
+  // a plain suffix, by the suffix.  Each list is in increasing order.
+  std::unordered_map<std::string, std::vector<int> > nameRules;
+  std::unordered_map<std::string, std::vector<int> > suffixRules;
+  std::vector<size_t> suffixLengths;
+
+  // Indexes of all other rules, in increasing order.
+  std::vector<int> generalRules;
+
+  void addPattern(std::string pattern);
+  int findLastApplicable(const std::vector<int>& candidates, bool isDirectory) const;
+
+  static void compile(const std::string& pattern, std::vector<Token>* output);
+  static bool matchTokens(const std::vector<Token>& tokens, size_t tokenPos,
+                          const std::string& text, size_t textPos);
+};
+
+}  // namespace ekam
+
+#endif  // KENTONSCODE_BASE_IGNORERULES_H_
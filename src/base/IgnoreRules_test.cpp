@@ -0,0 +1,148 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "IgnoreRules.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace ekam {
+namespace {
+
+#define ASSERT(EXPRESSION)                                                    \
+  if (!(EXPRESSION)) {                                                        \
+    fprintf(stderr, "%s:%d: FAILED: %s\n", __FILE__, __LINE__, #EXPRESSION);  \
+    exit(1);                                                                  \
+  }
+
+void testNames() {
+  IgnoreRules rules;
+  rules.parse(
+      "# comment\n"
+      "\n"
+      "node_modules\n"
+      "*.o\n"
+      "build/\n"
+      "  \n");
+
+  ASSERT(rules.size() == 3);
+  ASSERT(rules.matches("node_modules", true));
+  ASSERT(rules.matches("a/b/node_modules", true));
+  ASSERT(rules.matches("a/b/node_modules", false));
+  ASSERT(!rules.matches("a/b/node_modules2", true));
+  ASSERT(rules.matches("foo.o", false));
+  ASSERT(rules.matches("x/foo.o", false));
+  ASSERT(!rules.matches("foo.oo", false));
+  ASSERT(!rules.matches("foo.c++", false));
+  ASSERT(rules.matches("build", true));
+  ASSERT(rules.matches("x/build", true));
+  ASSERT(!rules.matches("build", false));
+  ASSERT(!rules.matches("# comment", false));
+}
+
+void testAnchored() {
+  IgnoreRules rules;
+  rules.parse(
+      "/deps\n"
+      "third_party/big\n"
+      "doc/*.html\n"
+      "data/**/fixtures\n"
+      "**/generated\n"
+      "out/**\n");
+
+  ASSERT(rules.matches("deps", true));
+  ASSERT(!rules.matches("x/deps", true));
+  ASSERT(rules.matches("third_party/big", true));
+  ASSERT(!rules.matches("x/third_party/big", true));
+  ASSERT(rules.matches("doc/index.html", false));
+  ASSERT(!rules.matches("doc/api/index.html", false));
+  ASSERT(rules.matches("data/fixtures", true));
+  ASSERT(rules.matches("data/a/b/fixtures", true));
+  ASSERT(!rules.matches("data/a/b/fixtures2", true));
+  ASSERT(rules.matches("generated", true));
+  ASSERT(rules.matches("a/b/generated", false));
+  ASSERT(rules.matches("out/x", false));
+  ASSERT(rules.matches("out/x/y", false));
+  ASSERT(!rules.matches("out", true));
+}
+
+void testWildcards() {
+  IgnoreRules rules;
+  rules.parse(
+      "test-?.dat\n"
+      "[Tt]emp*\n"
+      "*.[!ch]\n"
+      "\\#literal\n"
+      "[unclosed\n");
+
+  ASSERT(rules.matches("test-1.dat", false));
+  ASSERT(!rules.matches("test-12.dat", false));
+  ASSERT(rules.matches("Temp", true));
+  ASSERT(rules.matches("x/tempfile", false));
+  ASSERT(!rules.matches("xtemp", false));
+  ASSERT(rules.matches("foo.x", false));
+  ASSERT(!rules.matches("foo.c", false));
+  ASSERT(!rules.matches("foo.h", false));
+  ASSERT(rules.matches("#literal", false));
+  ASSERT(rules.matches("[unclosed", false));
+}
+
+void testNegation() {
+  IgnoreRules rules;
+  rules.parse(
+      "*.log\n"
+      "!important.log\n"
+      "tmp*\n"
+      "!tmp-keep\n"
+      "tmp-keep\n");
+
+  ASSERT(rules.matches("a.log", false));
+  ASSERT(!rules.matches("important.log", false));
+  ASSERT(!rules.matches("x/important.log", false));
+  ASSERT(rules.matches("tmp1", false));
+  // Last matching rule wins.
+  ASSERT(rules.matches("tmp-keep", false));
+}
+
+void testParents() {
+  IgnoreRules rules;
+  rules.parse(
+      "vendor/\n"
+      "!vendor/keep.c++\n");
+
+  ASSERT(!rules.matches("vendor/lib.c++", false));
+  ASSERT(rules.matchesPathOrParent("vendor/lib.c++", false));
+  ASSERT(rules.matchesPathOrParent("a/vendor/lib/x.c++", false));
+  // A file can't be re-included if its parent directory is excluded.
+  ASSERT(rules.matchesPathOrParent("vendor/keep.c++", false));
+  ASSERT(!rules.matchesPathOrParent("vendors/lib.c++", false));
+
+  IgnoreRules empty;
+  ASSERT(empty.empty());
+  ASSERT(!empty.matches("anything", false));
+  ASSERT(!empty.matchesPathOrParent("any/thing", false));
+}
+
+}  // namespace
+}  // namespace ekam
+
+int main(int argc, char* argv[]) {
+  ekam::testNames();
+  ekam::testAnchored();
+  ekam::testWildcards();
+  ekam::testNegation();
+  ekam::testParents();
+  return 0;
+}
@@ -18,6 +18,8 @@
 #define KENTONSCODE_BASE_TABLE_H_
 
 #include <unordered_map>
+#include <type_traits>
+#include <utility>
 #include <vector>
 #include <stdlib.h>
 
@@ -43,6 +45,7 @@ public:
     return 0;
   }
   inline void swap(DummyMap& other) {}
+  inline size_t size() const { return 0; }
 };
 
 template <typename Choices, int index>
@@ -59,18 +62,24 @@ struct ChooseType<Choices, 2> : public Choices::Choice2 {};
 template <typename T, typename Hasher = std::hash<T>, typename Eq = std::equal_to<T> >
 struct IndexedColumn {
   typedef T Value;
+  typedef Hasher HashFunc;
+  typedef Eq EqualFunc;
   typedef std::unordered_multimap<T, int, Hasher, Eq> Index;
 };
 
 template <typename T, typename Hasher = std::hash<T>, typename Eq = std::equal_to<T> >
 struct UniqueColumn {
   typedef T Value;
+  typedef Hasher HashFunc;
+  typedef Eq EqualFunc;
   typedef std::unordered_map<T, int, Hasher, Eq> Index;
 };
 
 template <typename T, typename Hasher = std::hash<T>, typename Eq = std::equal_to<T> >
 struct Column {
   typedef T Value;
+  typedef Hasher HashFunc;
+  typedef Eq EqualFunc;
   typedef DummyMap<T, int> Index;
 };
 
@@ -79,7 +88,24 @@ struct EmptyColumn {
   typedef DummyMap<Value, int> Index;
 };
 
-template <typename Column0, typename Column1 = EmptyColumn, typename Column2 = EmptyColumn>
+// Passed as the fourth parameter to Table to additionally index rows by the combination of two
+// columns, so that rows matching both values can be found (or erased) without scanning all rows
+// matching either one.  The two columns need not be indexed individually.
+template <int firstColumn, int secondColumn>
+struct CompositeIndex {
+  static const bool ENABLED = true;
+  static const int FIRST = firstColumn;
+  static const int SECOND = secondColumn;
+};
+
+struct NoCompositeIndex {
+  static const bool ENABLED = false;
+  static const int FIRST = 0;
+  static const int SECOND = 0;
+};
+
+template <typename Column0, typename Column1 = EmptyColumn, typename Column2 = EmptyColumn,
+          typename Composite = NoCompositeIndex>
 class Table {
 private:
   struct Columns {
@@ -104,6 +130,28 @@ private:
   template <int columnNumber>
   class Column : public ChooseType<Columns, columnNumber> {};
 
+  typedef Column<Composite::FIRST> CompositeFirst;
+  typedef Column<Composite::SECOND> CompositeSecond;
+  typedef std::pair<typename CompositeFirst::Value, typename CompositeSecond::Value> CompositeKey;
+
+  struct CompositeHashFunc {
+    inline size_t operator()(const CompositeKey& key) const {
+      size_t first = typename CompositeFirst::HashFunc()(key.first);
+      size_t second = typename CompositeSecond::HashFunc()(key.second);
+      return first ^ (second + 0x9e3779b9 + (first << 6) + (first >> 2));
+    }
+  };
+  struct CompositeEqualFunc {
+    inline bool operator()(const CompositeKey& a, const CompositeKey& b) const {
+      return typename CompositeFirst::EqualFunc()(a.first, b.first) &&
+             typename CompositeSecond::EqualFunc()(a.second, b.second);
+    }
+  };
+
+  typedef typename std::conditional<Composite::ENABLED,
+      std::unordered_multimap<CompositeKey, int, CompositeHashFunc, CompositeEqualFunc>,
+      DummyMap<CompositeKey, int> >::type CompositeIndexMap;
+
 public:
   Table() : deletedCount(0) {}
   ~Table() {}
@@ -197,18 +245,51 @@ public:
     const Table& table;
     const Row* current;
     std::pair<InnerIter, InnerIter> range;
+
+    friend class Table;
+  };
+
+  // Like SearchIterator, but over rows matching both columns of the table's CompositeIndex.
+  class CompositeSearchIterator {
+  public:
+    CompositeSearchIterator(const Table& table,
+                            const typename CompositeFirst::Value& first,
+                            const typename CompositeSecond::Value& second)
+        : table(table), current(NULL),
+          range(table.compositeIndex.equal_range(CompositeKey(first, second))) {}
+
+    inline bool next() {
+      while (range.first != range.second) {
+        const Row* row = &table.rows[range.first->second];
+        ++range.first;
+        if (!row->deleted) {
+          current = row;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    template <int cellColumnNumber>
+    inline const typename Column<cellColumnNumber>::Value& cell() const {
+      return Column<cellColumnNumber>::cell(*current);
+    }
+
+  private:
+    typedef typename CompositeIndexMap::const_iterator InnerIter;
+    const Table& table;
+    const Row* current;
+    std::pair<InnerIter, InnerIter> range;
+
+    friend class Table;
   };
 
+  // Find any row with the given value.  Erasing by another column (or by the CompositeIndex)
+  // leaves this column's index pointing at deleted rows, so skip past those.
   template <int columnNumber>
   const Row* find(const typename Column<columnNumber>::Value& value) const {
-    typename Column<columnNumber>::Index::const_iterator iter =
-        Column<columnNumber>::index(*this).find(value);
-    if (iter == Column<columnNumber>::index(*this).end()) {
-      return NULL;
-    } else {
-      const Row* row = &rows[iter->second];
-      return row->deleted ? NULL : row;
-    }
+    SearchIterator<columnNumber> iter(*this, value);
+    return iter.next() ? iter.current : NULL;
   }
 
   template <int columnNumber>
@@ -237,6 +318,43 @@ public:
     return count;
   }
 
+  // Find any row matching both values of the CompositeIndex.
+  const Row* findComposite(const typename CompositeFirst::Value& first,
+                           const typename CompositeSecond::Value& second) const {
+    CompositeSearchIterator iter(*this, first, second);
+    return iter.next() ? iter.current : NULL;
+  }
+
+  bool hasComposite(const typename CompositeFirst::Value& first,
+                    const typename CompositeSecond::Value& second) const {
+    return findComposite(first, second) != NULL;
+  }
+
+  // Erase all rows matching both values of the CompositeIndex.
+  size_t eraseComposite(const typename CompositeFirst::Value& first,
+                        const typename CompositeSecond::Value& second) {
+    typedef typename CompositeIndexMap::iterator CompositeIterator;
+    std::pair<CompositeIterator, CompositeIterator> range =
+        compositeIndex.equal_range(CompositeKey(first, second));
+
+    size_t count = 0;
+    for (CompositeIterator iter = range.first; iter != range.second; ++iter) {
+      if (!rows[iter->second].deleted) {
+        rows[iter->second].deleted = true;
+        ++count;
+      }
+    }
+
+    deletedCount += count;
+    if (deletedCount >= 16 && deletedCount > rows.size() / 2) {
+      refresh();
+    } else {
+      compositeIndex.erase(range.first, range.second);
+    }
+
+    return count;
+  }
+
   void add(const typename Column<0>::Value& value0,
            const typename Column<1>::Value& value1 = EmptyColumn::Value(),
            const typename Column<2>::Value& value2 = EmptyColumn::Value()) {
@@ -244,6 +362,7 @@ public:
     handleInsertResult(index1.insert(typename Column<1>::Index::value_type(value1, rows.size())));
     handleInsertResult(index2.insert(typename Column<2>::Index::value_type(value2, rows.size())));
     rows.push_back(Row(value0, value1, value2));
+    addToCompositeIndex(std::integral_constant<bool, Composite::ENABLED>());
   }
 
   template <int columnNumber>
@@ -266,11 +385,18 @@ public:
   int capacity() {
     return rows.capacity();
   }
+  // Number of erased rows still occupying space until the next refresh.
+  int tombstoneCount() {
+    return deletedCount;
+  }
 
   template <int columnNumber>
   int indexSize() {
     return Column<columnNumber>::index(this)->size();
   }
+  int compositeIndexSize() {
+    return compositeIndex.size();
+  }
 
 private:
   std::vector<Row> rows;
@@ -279,6 +405,7 @@ private:
   typename Column<0>::Index index0;
   typename Column<1>::Index index1;
   typename Column<2>::Index index2;
+  CompositeIndexMap compositeIndex;
 
   void refresh() {
     std::vector<int> newLocations;
@@ -304,22 +431,33 @@ private:
     refreshColumn<0>(newLocations);
     refreshColumn<1>(newLocations);
     refreshColumn<2>(newLocations);
+    refreshIndex(&compositeIndex, newLocations);
   }
 
   template <int columnNumber>
   void refreshColumn(const std::vector<int>& newLocations) {
-    typedef Column<columnNumber> C;
-    typedef typename C::Index::iterator ColumnIterator;
-    typename C::Index newIndex;
-    for (ColumnIterator iter = C::index(this)->begin();
-         iter != C::index(this)->end(); ++iter) {
+    refreshIndex(Column<columnNumber>::index(this), newLocations);
+  }
+
+  template <typename Index>
+  void refreshIndex(Index* index, const std::vector<int>& newLocations) {
+    typedef typename Index::iterator IndexIterator;
+    Index newIndex;
+    for (IndexIterator iter = index->begin(); iter != index->end(); ++iter) {
       int newLocation = newLocations[iter->second];
       if (newLocation != -1) {
         newIndex.insert(std::make_pair(iter->first, newLocation));
       }
     }
-    C::index(this)->swap(newIndex);
+    index->swap(newIndex);
+  }
+
+  void addToCompositeIndex(std::true_type) {
+    const Row& row = rows.back();
+    compositeIndex.insert(typename CompositeIndexMap::value_type(
+        CompositeKey(CompositeFirst::cell(row), CompositeSecond::cell(row)), rows.size() - 1));
   }
+  void addToCompositeIndex(std::false_type) {}
 
   template <typename Iterator>
   void handleInsertResult(const std::pair<Iterator, bool>& result) {
@@ -0,0 +1,346 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Replays a trace of Table operations shaped like Driver's DependencyTable and reports
+// throughput, latency percentiles and peak memory per kind of operation.  Run this before and
+// after any change to base/Table.h.
+//
+// usage:  Table_benchmark [-s <scale>] [-w <file>] [<trace-file>]
+//
+// Without a trace file, a synthetic trace is generated:  a scan phase that adds every action's
+// dependency edges (tags drawn from a skewed distribution, so that a few "popular headers" have
+// huge fan-out), followed by rebuild cycles in which an action is reset (erase by ACTION), its
+// dependents are looked up by TAG, and its edges are re-added.  -s multiplies the size of the
+// trace; -w writes the generated trace to a file so that it can be edited or replayed.
+//
+// Trace files have one operation per line:
+//   a <tag> <action> <provision>    add a row
+//   s <tag>                         iterate all rows with the tag
+//   c <tag> <action>                composite (tag, action) existence check
+//   e <action>                      erase all rows for the action
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Table.h"
+#include "Hash.h"
+
+namespace ekam {
+namespace {
+
+class DependencyTable : public Table<IndexedColumn<Hash, Hash::StlHashFunc>,
+                                     IndexedColumn<int>,
+                                     IndexedColumn<int>,
+                                     CompositeIndex<0, 1> > {
+public:
+  static const int TAG = 0;
+  static const int ACTION = 1;
+  static const int PROVISION = 2;
+};
+
+enum OpType {
+  ADD,
+  SEARCH,
+  COMPOSITE,
+  ERASE,
+  OP_TYPE_COUNT
+};
+
+const char* const OP_NAMES[OP_TYPE_COUNT] = {
+  "add", "search<TAG>", "hasComposite", "erase<ACTION>"
+};
+
+struct Op {
+  OpType type;
+  int tag;
+  int action;
+  int provision;
+};
+
+class Random {
+public:
+  Random() : state(0x9e3779b97f4a7c15ull) {}
+
+  uint64_t next() {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+  }
+
+  int uniform(int n) {
+    return next() % n;
+  }
+
+  // Roughly Zipf-distributed:  low values are much more likely.
+  int skewed(int n) {
+    double u = (next() >> 11) * (1.0 / 9007199254740992.0);
+    return std::min(n - 1, static_cast<int>(n * u * u * u));
+  }
+
+private:
+  uint64_t state;
+};
+
+void generateTrace(int scale, std::vector<Op>* trace) {
+  Random random;
+  int actionCount = 2000 * scale;
+  int tagCount = 1000 * scale;
+  int fanOut = 40;
+
+  std::vector<std::vector<int> > deps(actionCount);
+
+  // Scan:  every action records its dependencies.
+  for (int action = 0; action < actionCount; action++) {
+    for (int i = 0; i < fanOut; i++) {
+      int tag = random.skewed(tagCount);
+      deps[action].push_back(tag);
+      trace->push_back(Op { ADD, tag, action, tag });
+    }
+  }
+
+  // Rebuild cycles.
+  for (int cycle = 0; cycle < actionCount; cycle++) {
+    int action = random.uniform(actionCount);
+
+    // reset():  drop all of the action's edges.
+    trace->push_back(Op { ERASE, 0, action, 0 });
+
+    // resetDependentActions():  the action's output is looked up by tag.
+    trace->push_back(Op { SEARCH, action % tagCount, 0, 0 });
+
+    // Re-run:  the action records its dependencies again, checking for duplicates first.
+    for (int tag: deps[action]) {
+      trace->push_back(Op { COMPOSITE, tag, action, 0 });
+      trace->push_back(Op { ADD, tag, action, tag });
+    }
+  }
+}
+
+bool readTrace(const char* filename, std::vector<Op>* trace) {
+  FILE* in = fopen(filename, "r");
+  if (in == NULL) {
+    perror(filename);
+    return false;
+  }
+
+  char code;
+  while (fscanf(in, " %c", &code) == 1) {
+    Op op = { ADD, 0, 0, 0 };
+    int matched;
+    switch (code) {
+      case 'a':
+        op.type = ADD;
+        matched = fscanf(in, "%d %d %d", &op.tag, &op.action, &op.provision) == 3;
+        break;
+      case 's':
+        op.type = SEARCH;
+        matched = fscanf(in, "%d", &op.tag) == 1;
+        break;
+      case 'c':
+        op.type = COMPOSITE;
+        matched = fscanf(in, "%d %d", &op.tag, &op.action) == 2;
+        break;
+      case 'e':
+        op.type = ERASE;
+        matched = fscanf(in, "%d", &op.action) == 1;
+        break;
+      default:
+        matched = false;
+        break;
+    }
+    if (!matched) {
+      fprintf(stderr, "%s: malformed trace line after %zu operations\n",
+              filename, trace->size());
+      fclose(in);
+      return false;
+    }
+    trace->push_back(op);
+  }
+
+  fclose(in);
+  return true;
+}
+
+void writeTrace(const char* filename, const std::vector<Op>& trace) {
+  FILE* out = fopen(filename, "w");
+  if (out == NULL) {
+    perror(filename);
+    exit(1);
+  }
+  for (const Op& op: trace) {
+    switch (op.type) {
+      case ADD: fprintf(out, "a %d %d %d\n", op.tag, op.action, op.provision); break;
+      case SEARCH: fprintf(out, "s %d\n", op.tag); break;
+      case COMPOSITE: fprintf(out, "c %d %d\n", op.tag, op.action); break;
+      case ERASE: fprintf(out, "e %d\n", op.action); break;
+      case OP_TYPE_COUNT: break;
+    }
+  }
+  fclose(out);
+}
+
+inline uint64_t nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+long maxRssKb() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+uint64_t percentile(std::vector<uint32_t>* samples, double p) {
+  if (samples->empty()) return 0;
+  size_t index = std::min(samples->size() - 1, static_cast<size_t>(samples->size() * p));
+  std::nth_element(samples->begin(), samples->begin() + index, samples->end());
+  return (*samples)[index];
+}
+
+void replay(const std::vector<Op>& trace) {
+  // Tags are hashed up front so that hashing isn't counted against the table.
+  int maxTag = 0;
+  for (const Op& op: trace) {
+    maxTag = std::max(maxTag, op.tag);
+  }
+  std::vector<Hash> tags;
+  tags.reserve(maxTag + 1);
+  for (int i = 0; i <= maxTag; i++) {
+    tags.push_back(Hash::of("tag:" + std::to_string(i)));
+  }
+
+  std::vector<uint32_t> latencies[OP_TYPE_COUNT];
+  uint64_t totalNs[OP_TYPE_COUNT] = { 0 };
+  uint64_t rowsVisited = 0;
+  int refreshCount = 0;
+  long rssBefore = maxRssKb();
+
+  DependencyTable table;
+  uint64_t start = nowNs();
+
+  for (const Op& op: trace) {
+    uint64_t opStart = nowNs();
+    switch (op.type) {
+      case ADD:
+        table.add(tags[op.tag], op.action, op.provision);
+        break;
+      case SEARCH:
+        for (DependencyTable::SearchIterator<DependencyTable::TAG> iter(table, tags[op.tag]);
+             iter.next();) {
+          ++rowsVisited;
+        }
+        break;
+      case COMPOSITE:
+        rowsVisited += table.hasComposite(tags[op.tag], op.action);
+        break;
+      case ERASE: {
+        int tombstonesBefore = table.tombstoneCount();
+        table.erase<DependencyTable::ACTION>(op.action);
+        if (table.tombstoneCount() < tombstonesBefore) {
+          ++refreshCount;
+        }
+        break;
+      }
+      case OP_TYPE_COUNT:
+        break;
+    }
+    uint64_t elapsed = nowNs() - opStart;
+    latencies[op.type].push_back(static_cast<uint32_t>(std::min<uint64_t>(elapsed, UINT32_MAX)));
+    totalNs[op.type] += elapsed;
+  }
+
+  double totalSeconds = (nowNs() - start) / 1e9;
+
+  printf("%-14s %10s %12s %10s %10s %10s\n",
+         "operation", "count", "ops/sec", "p50 ns", "p99 ns", "max ns");
+  for (int i = 0; i < OP_TYPE_COUNT; i++) {
+    std::vector<uint32_t>& samples = latencies[i];
+    if (samples.empty()) continue;
+    double seconds = totalNs[i] / 1e9;
+    uint64_t p50 = percentile(&samples, 0.50);
+    uint64_t p99 = percentile(&samples, 0.99);
+    uint64_t max = *std::max_element(samples.begin(), samples.end());
+    printf("%-14s %10zu %12.0f %10llu %10llu %10llu\n", OP_NAMES[i], samples.size(),
+           seconds > 0 ? samples.size() / seconds : 0.0, (unsigned long long)p50,
+           (unsigned long long)p99, (unsigned long long)max);
+  }
+
+  printf("\n");
+  printf("total:          %zu ops in %.3f s (%.0f ops/sec)\n",
+         trace.size(), totalSeconds, trace.size() / totalSeconds);
+  printf("rows visited:   %llu\n", (unsigned long long)rowsVisited);
+  printf("refreshes:      %d\n", refreshCount);
+  printf("final table:    %d rows, %d tombstones, %d capacity\n",
+         table.size(), table.tombstoneCount(), table.capacity());
+  printf("peak RSS:       %ld KiB (%ld KiB before replay)\n", maxRssKb(), rssBefore);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int scale = 1;
+  const char* writeFile = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:w:")) != -1) {
+    switch (opt) {
+      case 's':
+        scale = atoi(optarg);
+        if (scale < 1) {
+          fprintf(stderr, "%s: invalid scale: %s\n", argv[0], optarg);
+          return 1;
+        }
+        break;
+      case 'w':
+        writeFile = optarg;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-s <scale>] [-w <file>] [<trace-file>]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  std::vector<Op> trace;
+  if (optind < argc) {
+    if (!readTrace(argv[optind], &trace)) {
+      return 1;
+    }
+  } else {
+    generateTrace(scale, &trace);
+  }
+
+  if (writeFile != NULL) {
+    writeTrace(writeFile, trace);
+  }
+
+  replay(trace);
+  return 0;
+}
+
+}  // namespace ekam
+
+int main(int argc, char* argv[]) {
+  return ekam::main(argc, argv);
+}
@@ -222,10 +222,115 @@ void testTable() {
   }
 }
 
+void testCompositeIndex() {
+  typedef Table<IndexedColumn<std::string>, IndexedColumn<int>, Column<char>,
+                CompositeIndex<0, 1> > MyTable;
+  MyTable table;
+
+  table.add("foo", 1, 'a');
+  table.add("foo", 2, 'b');
+  table.add("foo", 2, 'c');
+  table.add("bar", 1, 'd');
+  table.add("bar", 2, 'e');
+
+  ASSERT(table.compositeIndexSize() == 5);
+  ASSERT(table.hasComposite("foo", 1));
+  ASSERT(!table.hasComposite("baz", 1));
+  ASSERT(!table.hasComposite("foo", 3));
+
+  const MyTable::Row* row = table.findComposite("bar", 1);
+  ASSERT(row != NULL);
+  ASSERT(row->cell<2>() == 'd');
+
+  {
+    std::multiset<char> values;
+    MyTable::CompositeSearchIterator iter(table, "foo", 2);
+    ASSERT(iter.next());
+    values.insert(iter.cell<2>());
+    ASSERT(iter.next());
+    values.insert(iter.cell<2>());
+    ASSERT(!iter.next());
+    ASSERT(values.count('b') == 1);
+    ASSERT(values.count('c') == 1);
+  }
+
+  ASSERT(table.eraseComposite("foo", 2) == 2);
+  ASSERT(table.size() == 3);
+  ASSERT(!table.hasComposite("foo", 2));
+  ASSERT(table.hasComposite("foo", 1));
+  ASSERT(table.hasComposite("bar", 2));
+  ASSERT(table.eraseComposite("foo", 2) == 0);
+
+  // Replacing a row:  lookups through single columns must not see the erased ones either.
+  table.add("foo", 2, 'f');
+  ASSERT(table.findComposite("foo", 2)->cell<2>() == 'f');
+  {
+    MyTable::SearchIterator<1> iter(table, 2);
+    std::multiset<char> values;
+    while (iter.next()) {
+      values.insert(iter.cell<2>());
+    }
+    ASSERT(values.size() == 2);
+    ASSERT(values.count('e') == 1);
+    ASSERT(values.count('f') == 1);
+  }
+  ASSERT(table.eraseComposite("foo", 2) == 1);
+
+  // The single-column indexes still point at rows erased through the composite index; find()
+  // must look past them to the live rows.
+  {
+    typedef Table<IndexedColumn<std::string>, IndexedColumn<int>, IndexedColumn<char>,
+                  CompositeIndex<0, 1> > IndexedTable;
+    IndexedTable other;
+    other.add("t1", 1, 'a');
+    other.add("t2", 1, 'b');
+    other.add("t1", 2, 'c');
+    ASSERT(other.eraseComposite("t1", 1) == 1);
+
+    const IndexedTable::Row* found = other.find<0>("t1");
+    ASSERT(found != NULL);
+    ASSERT(found->cell<2>() == 'c');
+    found = other.find<1>(1);
+    ASSERT(found != NULL);
+    ASSERT(found->cell<2>() == 'b');
+    ASSERT(other.find<2>('b') != NULL);
+    ASSERT(other.find<2>('a') == NULL);
+
+    ASSERT(other.eraseComposite("t2", 1) == 1);
+    ASSERT(other.find<1>(1) == NULL);
+    ASSERT(!other.has<1>(1));
+    ASSERT(other.has<0>("t1"));
+    ASSERT(other.find<0>("t2") == NULL);
+  }
+
+  // Erasing by a single column must also hide the rows from composite lookups.
+  table.erase<0>("bar");
+  ASSERT(!table.hasComposite("bar", 1));
+  ASSERT(!table.hasComposite("bar", 2));
+  ASSERT(table.size() == 1);
+
+  // Force a refresh and make sure the composite index is rebuilt correctly.
+  for (int i = 0; i < 40; i++) {
+    table.add("qux", i, 'q');
+  }
+  for (int i = 0; i < 30; i++) {
+    ASSERT(table.eraseComposite("qux", i) == 1);
+  }
+  ASSERT(table.tombstoneCount() < 16);
+  ASSERT(table.size() == 11);
+  ASSERT(table.compositeIndexSize() == 11);
+  ASSERT(table.hasComposite("foo", 1));
+  ASSERT(!table.hasComposite("qux", 5));
+  row = table.findComposite("qux", 35);
+  ASSERT(row != NULL);
+  ASSERT(row->cell<1>() == 35);
+}
+
 }  // namespace
 }  // namespace ekam
 
 int main(int argc, char* argv[]) {
   ekam::testTable();
+  ekam::testCompositeIndex();
   return 0;
 }
@@ -29,6 +29,7 @@
 namespace ekam {
 
 class ActionFactory;
+class Cgroup;
 
 class ProcessExitCallback {
 public:
@@ -64,6 +65,10 @@ public:
 
   virtual void passed() = 0;
   virtual void failed() = 0;
+
+  // The cgroup the action's subprocesses should be started in, or null if actions aren't being
+  // isolated.
+  virtual Cgroup* getCgroup() = 0;
 };
 
 class Action {
@@ -19,6 +19,21 @@
 
 namespace ekam {
 
+std::string splitToken(std::string* line) {
+  std::string::size_type pos = line->find_first_of(' ');
+  std::string result;
+  if (pos == std::string::npos) {
+    result = *line;
+    line->clear();
+  } else {
+    result.assign(*line, 0, pos);
+    line->erase(0, pos + 1);
+  }
+  return result;
+}
+
+// =======================================================================================
+
 Logger::Logger(BuildContext* context, OwnedPtr<ByteStream> stream)
     : context(context), stream(stream.release()) {}
 Logger::~Logger() {}
@@ -48,7 +63,8 @@ Promise<void> Logger::run(EventManager* eventManager) {
 
 // =======================================================================================
 
-LineReader::LineReader(ByteStream* stream) : stream(stream) {}
+LineReader::LineReader(ByteStream* stream, bool readAhead)
+    : stream(stream), readAhead(readAhead) {}
 LineReader::~LineReader() {}
 
 Promise<OwnedPtr<std::string>> LineReader::readLine(EventManager* eventManager) {
@@ -59,7 +75,10 @@ Promise<OwnedPtr<std::string>> LineReader::readLine(EventManager* eventManager)
     return newFulfilledPromise(result.release());
   }
 
-  return eventManager->when(stream->readAsync(eventManager, buffer, sizeof(buffer)))(
+  Promise<size_t> read = readAhead ?
+      stream->readAsync(eventManager, buffer, sizeof(buffer)) :
+      stream->readWhenReadable(eventManager, buffer, sizeof(buffer));
+  return eventManager->when(read)(
     [=](size_t size) -> Promise<OwnedPtr<std::string>> {
       if (size == 0) {
         if (leftover.empty()) {
@@ -78,4 +97,145 @@ Promise<OwnedPtr<std::string>> LineReader::readLine(EventManager* eventManager)
     });
 }
 
+// =======================================================================================
+
+FileRequestHandler::FileRequestHandler(BuildContext* context, File* input) : context(context) {
+  if (input != NULL) {
+    this->input = input->clone();
+    knownFiles.add(input->canonicalName(), input->clone());
+  }
+}
+FileRequestHandler::~FileRequestHandler() {}
+
+bool FileRequestHandler::handle(const std::string& line, ByteStream* responseStream) {
+  std::string args = line;
+  std::string command = splitToken(&args);
+
+  std::vector<std::string> paths;
+  if (command == "findProvider") {
+    paths.push_back(findProvider(args));
+  } else if (command == "findInput") {
+    paths.push_back(findInput(args));
+  } else if (command == "newOutput") {
+    paths.push_back(newOutput(args));
+  } else if (command == "findModifiers") {
+    paths = findModifiers(args);
+    // A blank line ends the list.
+    paths.push_back(std::string());
+  } else if (command == "newProvider") {
+    // TODO:  Create a new output file and register it as a provider.
+    context->log("newProvider not implemented");
+    context->failed();
+    return true;
+  } else if (command == "noteInput") {
+    // The action is reading some file outside the working directory.  For now we ignore this.
+    // TODO:  Pay attention?  We could trigger rebuilds when installed tools are updated, etc.
+    return true;
+  } else {
+    return false;
+  }
+
+  for (auto& path: paths) {
+    responseStream->writeAll(path.data(), path.size());
+    responseStream->writeAll("\n", 1);
+  }
+  return true;
+}
+
+std::string FileRequestHandler::findProvider(const std::string& tag) {
+  std::string request = "findProvider " + tag;
+  std::string path = findInCache(request);
+  if (path.empty()) {
+    File* provider = context->findProvider(Tag::fromName(tag));
+    if (provider != NULL) {
+      path = remember(request, provider, File::READ);
+    }
+  }
+  return path;
+}
+
+std::string FileRequestHandler::findInput(const std::string& name) {
+  std::string request = "findInput " + name;
+  std::string path = findInCache(request);
+  if (path.empty()) {
+    File* provider;
+    if (input != NULL && name == input->canonicalName()) {
+      provider = input.get();
+    } else {
+      path = findInCache("newOutput " + name);
+      if (!path.empty()) {
+        // File was originally created by this action.
+        return path;
+      }
+      provider = context->findInput(name);
+    }
+    if (provider != NULL) {
+      path = remember(request, provider, File::READ);
+    }
+  }
+  return path;
+}
+
+std::vector<std::string> FileRequestHandler::findModifiers(const std::string& name) {
+  std::vector<File*> results;
+  if (input != NULL) {
+    auto dir = input->parent();
+    for (;;) {
+      File* provider = context->findProvider(Tag::fromName(
+          "canonical:" + dir->relative(name)->canonicalName()));
+      if (provider != NULL) {
+        results.push_back(provider);
+      }
+      if (!dir->hasParent()) {
+        break;
+      }
+      dir = dir->parent();
+    }
+  }
+
+  // Greatest ancestor first.
+  std::vector<std::string> paths;
+  for (auto iter = results.rbegin(); iter != results.rend(); ++iter) {
+    OwnedPtr<File::DiskRef> diskRef = (*iter)->getOnDisk(File::READ);
+    std::string path = diskRef->path();
+    diskRefs.add(diskRef.release());
+    knownFiles.add(path, (*iter)->clone());
+    paths.push_back(path);
+  }
+  return paths;
+}
+
+std::string FileRequestHandler::newOutput(const std::string& name) {
+  std::string request = "newOutput " + name;
+  std::string path = findInCache(request);
+  if (path.empty()) {
+    OwnedPtr<File> file = context->newOutput(name);
+    path = remember(request, file.get(), File::WRITE);
+  }
+  return path;
+}
+
+File* FileRequestHandler::getKnownFile(const std::string& name) {
+  return knownFiles.get(name);
+}
+
+std::string FileRequestHandler::findInCache(const std::string& request) {
+  CacheMap::const_iterator iter = cache.find(request);
+  if (iter == cache.end()) {
+    return std::string();
+  } else {
+    return iter->second->path();
+  }
+}
+
+std::string FileRequestHandler::remember(const std::string& request, File* file,
+                                         File::Usage usage) {
+  OwnedPtr<File::DiskRef> diskRef = file->getOnDisk(usage);
+  std::string path = diskRef->path();
+  cache.insert(std::make_pair(request, diskRef.get()));
+  diskRefs.add(diskRef.release());
+  knownFiles.add(path, file->clone());
+  return path;
+}
+
 }  // namespace ekam
@@ -18,12 +18,17 @@
 #define KENTONSCODE_EKAM_ACTIONUTIL_H_
 
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "os/ByteStream.h"
 #include "Action.h"
 
 namespace ekam {
 
+// Removes and returns the text before the first space in `line`, or all of it.
+std::string splitToken(std::string* line);
+
 class Logger {
 public:
   Logger(BuildContext* context, OwnedPtr<ByteStream> stream);
@@ -41,17 +46,58 @@ private:
 
 class LineReader {
 public:
-  LineReader(ByteStream* stream);
+  // If `readAhead` is false, nothing past the last line returned is read from the stream, except
+  // what arrived along with it.
+  LineReader(ByteStream* stream, bool readAhead);
   ~LineReader();
 
   Promise<OwnedPtr<std::string>> readLine(EventManager* eventManager);
 
 private:
   ByteStream* stream;
+  bool readAhead;
   std::string leftover;
   char buffer[4096];
 };
 
+// Answers the requests for files that rules -- and tools running under intercept.so -- make on
+// behalf of an action:  findInput, findProvider, findModifiers, newOutput, newProvider and
+// noteInput.  Files returned are remembered, so that the action can refer to them by path later.
+class FileRequestHandler {
+public:
+  // `input` is the file that triggered the action, if any.
+  FileRequestHandler(BuildContext* context, File* input);
+  ~FileRequestHandler();
+
+  // If `line` is one of the requests above, answers it on `responseStream` and returns true.
+  bool handle(const std::string& line, ByteStream* responseStream);
+
+  // The same requests, made directly.  These return disk paths, or an empty string if there is
+  // no such file.
+  std::string findProvider(const std::string& tag);
+  std::string findInput(const std::string& name);
+  std::vector<std::string> findModifiers(const std::string& name);
+  std::string newOutput(const std::string& name);
+
+  // A file returned by one of the above, given its disk path, or the input, given its canonical
+  // name.  Null if unknown.
+  File* getKnownFile(const std::string& name);
+
+private:
+  BuildContext* context;
+  OwnedPtr<File> input;  // nullable
+
+  OwnedPtrMap<std::string, File> knownFiles;
+
+  // Paths already returned, by request line.
+  typedef std::unordered_map<std::string, File::DiskRef*> CacheMap;
+  CacheMap cache;
+  OwnedPtrVector<File::DiskRef> diskRefs;
+
+  std::string findInCache(const std::string& request);
+  std::string remember(const std::string& request, File* file, File::Usage usage);
+};
+
 }  // namespace ekam
 
 #endif  // KENTONSCODE_EKAM_ACTIONUTIL_H_
@@ -200,8 +200,11 @@ private:
 ConsoleDashboard::TaskImpl::TaskImpl(ConsoleDashboard* dashboard,
                                      const std::string& verb, const std::string& noun,
                                      Silence silence)
-    : dashboard(dashboard), state(PENDING), silence(silence), verb(verb), noun(noun) {}
+    : dashboard(dashboard), state(PENDING), silence(silence), verb(verb), noun(noun) {
+  dashboard->tasks.insert(this);
+}
 ConsoleDashboard::TaskImpl::~TaskImpl() {
+  dashboard->tasks.erase(this);
   if (state == RUNNING) {
     dashboard->clearRunning();
     removeFromRunning();
@@ -332,6 +335,14 @@ OwnedPtr<Dashboard::Task> ConsoleDashboard::beginTask(
   return newOwned<TaskImpl>(this, verb, noun, silence);
 }
 
+size_t ConsoleDashboard::retainedLogBytes() {
+  size_t result = 0;
+  for (TaskImpl* task: tasks) {
+    result += task->outputText.capacity();
+  }
+  return result;
+}
+
 void ConsoleDashboard::clearRunning() {
   if (lastDebugMessageCount != DebugMessage::getMessageCount()) {
     // Some debug messages were printed.  We don't want to clobber them.  So we can't clear.
@@ -18,6 +18,7 @@
 #define KENTONSCODE_EKAM_CONSOLEDASHBOARD_H_
 
 #include <vector>
+#include <unordered_set>
 #include <stdio.h>
 #include "Dashboard.h"
 
@@ -30,6 +31,7 @@ public:
 
   // implements Dashboard ----------------------------------------------------------------
   OwnedPtr<Task> beginTask(const std::string& verb, const std::string& noun, Silence silence);
+  size_t retainedLogBytes();
 
 private:
   class TaskImpl;
@@ -39,6 +41,7 @@ private:
   FILE* out;
   int maxDisplayedLogLines;
 
+  std::unordered_set<TaskImpl*> tasks;
   std::vector<TaskImpl*> runningTasks;
   int runningTasksLineCount;
   int lastDebugMessageCount;
@@ -18,16 +18,19 @@
 
 #include <unordered_set>
 #include <stdlib.h>
+#include <string.h>
 
 #include "base/Debug.h"
 #include "os/ByteStream.h"
+#include "os/ObjectSymbols.h"
 #include "os/Subprocess.h"
 #include "ActionUtil.h"
 
 namespace ekam {
 
 // compile action:  produces object file, tags for all symbols declared therein.
-//   (Compile action is now implemented in compile.ekam-rule.)
+//   (Compile action is implemented in compile.ekam-rule, or by CppCompileActionFactory below if
+//   EKAM_BUILTIN_COMPILE=on.)
 // link action:  triggers on "main" tag.
 
 namespace {
@@ -207,6 +210,7 @@ Promise<void> LinkAction::startTarget(
   const char* cxx = getenv("CXX");
 
   auto subprocess = newOwned<Subprocess>();
+  subprocess->setCgroup(context->getCgroup());
 
   std::string compiler = cxx == NULL ? "c++" : cxx;
 
@@ -338,4 +342,634 @@ OwnedPtr<Action> CppActionFactory::tryMakeAction(const Tag& id, File* file) {
   return nullptr;
 }
 
+// =======================================================================================
+
+namespace {
+
+std::vector<std::string> splitWords(const std::string& text) {
+  std::vector<std::string> words;
+  std::string::size_type pos = 0;
+  for (;;) {
+    pos = text.find_first_not_of(" \t\n", pos);
+    if (pos == std::string::npos) {
+      break;
+    }
+    std::string::size_type end = text.find_first_of(" \t\n", pos);
+    if (end == std::string::npos) {
+      end = text.size();
+    }
+    words.push_back(text.substr(pos, end - pos));
+    pos = end;
+  }
+  return words;
+}
+
+bool endsWith(const std::string& text, const std::string& suffix) {
+  return text.size() >= suffix.size() &&
+         text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool startsWith(const std::string& text, const std::string& prefix) {
+  return text.compare(0, prefix.size(), prefix) == 0;
+}
+
+// Suffix of the CXXFLAGS_* variable for a cross-compilation target.
+std::string flagsSuffixFor(std::string target) {
+  for (char& c: target) {
+    if (c == '-') c = '_';
+  }
+  return target;
+}
+
+// Sources the compile.ekam-flags files named by the arguments, if any, starting from the same
+// defaults as compile.ekam-rule, then prints the settings we use as NUL-terminated NAME=value
+// pairs.  Run even when there are no flags files, so that the defaults live in one place.
+const char EVALUATE_FLAGS_SCRIPT[] =
+    "set -e\n"
+    "CXX=${CXX:-c++}\n"
+    "CXXFLAGS=${CXXFLAGS:--O2 -DNDEBUG}\n"
+    "CC=${CC:-cc}\n"
+    "CFLAGS=${CFLAGS:--O2 -DNDEBUG}\n"
+    "for MODIFIER; do . \"$MODIFIER\" 1>&2; done\n"
+    "for VAR in CXX CXXFLAGS CC CFLAGS CXX_WRAPPER CROSS_TARGETS NM NMFLAGS; do\n"
+    "  eval \"printf '%s=%s\\0' $VAR \\\"\\${$VAR:-}\\\"\"\n"
+    "done\n"
+    "for SUFFIX in host $(echo \"${CROSS_TARGETS:-}\" | tr - _); do\n"
+    "  eval \"printf 'CXXFLAGS_%s=%s\\0' $SUFFIX \\\"\\${CXXFLAGS_$SUFFIX:-}\\\"\"\n"
+    "done\n";
+
+// Collects everything written to a stream.
+class OutputReader {
+public:
+  OutputReader(OwnedPtr<ByteStream> stream) : stream(stream.release()) {}
+  ~OutputReader() {}
+
+  Promise<void> run(EventManager* eventManager) {
+    return eventManager->when(stream->readAsync(eventManager, buffer, sizeof(buffer)))(
+      [=](size_t size) -> Promise<void> {
+        if (size == 0) {
+          return newFulfilledPromise();
+        }
+        text.append(buffer, size);
+        return run(eventManager);
+      });
+  }
+
+  const std::string& getText() { return text; }
+
+private:
+  OwnedPtr<ByteStream> stream;
+  std::string text;
+  char buffer[4096];
+};
+
+// Answers intercept.so's requests from a compiler run.
+class InterceptedRequestReader {
+public:
+  InterceptedRequestReader(BuildContext* context, FileRequestHandler* files,
+                           OwnedPtr<ByteStream> requestStream,
+                           OwnedPtr<ByteStream> responseStream)
+      : context(context), files(files), requestStream(requestStream.release()),
+        responseStream(responseStream.release()), lineReader(this->requestStream.get(), true) {}
+  ~InterceptedRequestReader() {}
+
+  Promise<void> readAll(EventManager* eventManager) {
+    return eventManager->when(lineReader.readLine(eventManager))(
+      [=](OwnedPtr<std::string> line) -> Promise<void> {
+        if (line == nullptr) {
+          return newFulfilledPromise();
+        }
+
+        if (!files->handle(*line, responseStream.get())) {
+          context->log("invalid command: " + *line + "\n");
+          context->failed();
+        }
+        return readAll(eventManager);
+      }, [=](MaybeException<OwnedPtr<std::string>> error) {
+        try {
+          error.get();
+        } catch (const std::exception& e) {
+          context->log(e.what());
+          context->failed();
+          throw;
+        } catch (...) {
+          context->log("unknown exception");
+          context->failed();
+          throw;
+        }
+      });
+  }
+
+private:
+  BuildContext* context;
+  FileRequestHandler* files;
+  OwnedPtr<ByteStream> requestStream;
+  OwnedPtr<ByteStream> responseStream;
+  LineReader lineReader;
+};
+
+}  // namespace
+
+class CppCompileAction : public Action {
+public:
+  CppCompileAction(CppCompileActionFactory* factory, File* file, bool isC,
+                   const std::string& moduleName)
+      : factory(factory), file(file->clone()), isC(isC), moduleName(moduleName) {}
+  ~CppCompileAction() {}
+
+  // implements Action -------------------------------------------------------------------
+  std::string getVerb() { return "compile"; }
+  Promise<void> start(EventManager* eventManager, BuildContext* context);
+
+private:
+  class Compilation;
+
+  CppCompileActionFactory* factory;
+  OwnedPtr<File> file;
+  bool isC;
+  std::string moduleName;
+};
+
+// One run of the action.
+class CppCompileAction::Compilation {
+public:
+  Compilation(CppCompileAction* action, BuildContext* context)
+      : action(action), context(context), files(context, action->file.get()), failed(false) {}
+  ~Compilation() {}
+
+  Promise<void> run(EventManager* eventManager) {
+    return eventManager->when(loadSettings(eventManager))(
+      [this, eventManager](Void) -> Promise<void> {
+        if (failed) {
+          return newFulfilledPromise();
+        }
+
+        interceptor = files.findProvider("special:ekam-interceptor");
+        if (interceptor.empty()) {
+          context->log("error:  couldn't find intercept.so.\n");
+          context->failed();
+          return newFulfilledPromise();
+        }
+
+        // Ask where the output goes ourselves.  The compiler will make the same request when it
+        // runs, and get the same answer.
+        objectPath = files.newOutput(action->moduleName + ".o");
+
+        return compileTargets(eventManager, 0);
+      });
+  }
+
+private:
+  struct Target {
+    std::string compiler;
+    std::string outputSuffix;
+    std::string flagsSuffix;
+    std::vector<std::string> extraArgs;
+  };
+
+  CppCompileAction* action;
+  BuildContext* context;
+  FileRequestHandler files;
+  bool failed;
+
+  CppCompileActionFactory::Settings settings;
+  std::vector<Target> targets;
+  std::string interceptor;
+  std::string objectPath;
+
+  std::string get(const std::string& name) {
+    auto iter = settings.find(name);
+    return iter == settings.end() ? std::string() : iter->second;
+  }
+
+  Promise<void> loadSettings(EventManager* eventManager) {
+    std::vector<std::string> modifiers = files.findModifiers("compile.ekam-flags");
+
+    std::string key;
+    bool usesInput = false;
+    for (auto& path: modifiers) {
+      std::string content = files.getKnownFile(path)->readAll();
+      // A flags file could look at the file being compiled, though few do.
+      usesInput = usesInput || content.find("INPUT") != std::string::npos;
+      key += path + '\0' + content + '\0';
+    }
+    if (usesInput) {
+      key += action->file->canonicalName();
+    }
+
+    auto iter = action->factory->settingsCache.find(key);
+    if (iter != action->factory->settingsCache.end()) {
+      settings = iter->second;
+      chooseTargets();
+      return newFulfilledPromise();
+    }
+
+    auto subprocess = newOwned<Subprocess>();
+    subprocess->setCgroup(context->getCgroup());
+    subprocess->addArgument("sh");
+    subprocess->addArgument("-c");
+    subprocess->addArgument(EVALUATE_FLAGS_SCRIPT);
+    subprocess->addArgument("sh");
+    for (auto& path: modifiers) {
+      subprocess->addArgument(path);
+    }
+    subprocess->setEnvironmentVariable("INPUT", action->file->canonicalName());
+
+    auto output = newOwned<OutputReader>(subprocess->captureStdout());
+    auto logger = newOwned<Logger>(context, subprocess->captureStderr());
+
+    auto subprocessWaitOp = eventManager->when(subprocess->start(eventManager))(
+      [this](ProcessExitCode exitCode) {
+        if (exitCode.wasSignaled() || exitCode.getExitCode() != 0) {
+          failed = true;
+          context->failed();
+        }
+      });
+    auto outputOp = output->run(eventManager);
+    auto logOp = logger->run(eventManager);
+
+    return eventManager->when(subprocessWaitOp, outputOp, logOp, subprocess, output, logger)(
+      [this, key](Void, Void, Void, OwnedPtr<Subprocess>, OwnedPtr<OutputReader> output,
+                  OwnedPtr<Logger>) {
+        if (failed) {
+          return;
+        }
+
+        const std::string& text = output->getText();
+        std::string::size_type pos = 0;
+        std::string::size_type end;
+        while ((end = text.find_first_of('\0', pos)) != std::string::npos) {
+          std::string::size_type equalsPos = text.find_first_of('=', pos);
+          if (equalsPos < end) {
+            settings[text.substr(pos, equalsPos - pos)] =
+                text.substr(equalsPos + 1, end - equalsPos - 1);
+          }
+          pos = end + 1;
+        }
+
+        action->factory->settingsCache[key] = settings;
+        chooseTargets();
+      });
+  }
+
+  void chooseTargets() {
+    std::string compiler = get(action->isC ? "CC" : "CXX");
+
+    Target host;
+    host.compiler = compiler;
+    host.outputSuffix = ".o";
+    host.flagsSuffix = "host";
+    targets.push_back(host);
+
+    std::string::size_type slashPos = compiler.find_last_of('/');
+    bool isClang = compiler.find("clang", slashPos == std::string::npos ? 0 : slashPos) !=
+                   std::string::npos;
+
+    for (auto& name: splitWords(get("CROSS_TARGETS"))) {
+      Target target;
+      target.outputSuffix = "." + name + ".o";
+      target.flagsSuffix = flagsSuffixFor(name);
+      if (isClang) {
+        target.compiler = compiler;
+        target.extraArgs.push_back("-target");
+        target.extraArgs.push_back(name);
+        target.extraArgs.push_back("-isystem/usr/" + name + "/include");
+      } else {
+        target.compiler = name + "-" + compiler;
+      }
+      targets.push_back(target);
+    }
+  }
+
+  // Compiles for each target in turn, stopping at the first failure, then tags the host object.
+  Promise<void> compileTargets(EventManager* eventManager, size_t index) {
+    if (index == targets.size()) {
+      return readSymbols(eventManager);
+    }
+
+    return eventManager->when(compile(eventManager, targets[index]))(
+      [this, eventManager, index](Void) -> Promise<void> {
+        if (failed) {
+          return newFulfilledPromise();
+        }
+        return compileTargets(eventManager, index + 1);
+      });
+  }
+
+  Promise<void> compile(EventManager* eventManager, const Target& target) {
+    std::string flags = get("CXXFLAGS_" + target.flagsSuffix);
+    if (flags.empty()) {
+      flags = get(action->isC ? "CFLAGS" : "CXXFLAGS");
+    }
+
+    // Tests depend on registering global objects, and we only care about global constructors in
+    // runtime code anyway.
+    if (flags.find("-Wglobal-constructors") != std::string::npos &&
+        endsWith(action->moduleName, "-test")) {
+      flags += " -Wno-global-constructors";
+    }
+
+    auto subprocess = newOwned<Subprocess>();
+    subprocess->setCgroup(context->getCgroup());
+    for (auto& word: splitWords(get("CXX_WRAPPER"))) {
+      subprocess->addArgument(word);
+    }
+    for (auto& word: splitWords(target.compiler)) {
+      subprocess->addArgument(word);
+    }
+    subprocess->addArgument("-I/ekam-provider/c++header");
+    for (auto& word: splitWords(flags)) {
+      subprocess->addArgument(word);
+    }
+    for (auto& arg: target.extraArgs) {
+      subprocess->addArgument(arg);
+    }
+    subprocess->addArgument("-c");
+    subprocess->addArgument("/ekam-provider/canonical/" + action->file->canonicalName());
+    subprocess->addArgument("-o");
+    subprocess->addArgument(action->moduleName + target.outputSuffix);
+
+    // intercept.so turns the compiler's filesystem calls into requests to us, made on
+    // descriptors 3 and 4.  The DYLD_ variables are the OSX equivalent of LD_PRELOAD.
+    subprocess->setEnvironmentVariable("LD_PRELOAD", interceptor);
+    subprocess->setEnvironmentVariable("DYLD_FORCE_FLAT_NAMESPACE", "");
+    subprocess->setEnvironmentVariable("DYLD_INSERT_LIBRARIES", interceptor);
+    OwnedPtr<ByteStream> requestStream = subprocess->captureOutputFd(3);
+    OwnedPtr<ByteStream> responseStream = subprocess->captureInputFd(4);
+    OwnedPtr<ByteStream> logStream = subprocess->captureStdoutAndStderr();
+
+    auto subprocessWaitOp = eventManager->when(subprocess->start(eventManager))(
+      [this](ProcessExitCode exitCode) {
+        if (exitCode.wasSignaled() || exitCode.getExitCode() != 0) {
+          failed = true;
+          context->failed();
+        }
+      });
+
+    auto requests = newOwned<InterceptedRequestReader>(
+        context, &files, requestStream.release(), responseStream.release());
+    auto requestOp = requests->readAll(eventManager);
+
+    auto logger = newOwned<Logger>(context, logStream.release());
+    auto logOp = logger->run(eventManager);
+
+    return eventManager->when(subprocessWaitOp, requestOp, logOp, subprocess, requests, logger)(
+        [](Void, Void, Void, OwnedPtr<Subprocess>, OwnedPtr<InterceptedRequestReader>,
+           OwnedPtr<Logger>){});
+  }
+
+  // The object's symbols, from its ELF symbol table, or else from nm.
+  Promise<void> readSymbols(EventManager* eventManager) {
+    std::vector<ObjectSymbol> symbols;
+    std::string error;
+    try {
+      if (!readObjectSymbols(objectPath, &symbols, &error)) {
+        DEBUG_INFO << error << "; using nm.";
+      } else if (isLtoPlaceholder(symbols)) {
+        DEBUG_INFO << objectPath << ": LTO object; using nm.";
+      } else {
+        provideSymbols(formatSymbolList(symbols), symbols);
+        return newFulfilledPromise();
+      }
+    } catch (const OsError& e) {
+      context->log(std::string(e.what()) + "\n");
+      failed = true;
+      context->failed();
+      return newFulfilledPromise();
+    }
+
+    // Not ELF -- LLVM bitcode from -flto, say, or a Mach-O object -- or GCC's LTO placeholders.
+    // Do what compile.ekam-rule does.
+    auto subprocess = newOwned<Subprocess>();
+    subprocess->setCgroup(context->getCgroup());
+    subprocess->addArgument(get("NM").empty() ? "nm" : get("NM"));
+    for (auto& word: splitWords(get("NMFLAGS"))) {
+      subprocess->addArgument(word);
+    }
+    subprocess->addArgument(objectPath);
+
+    auto output = newOwned<OutputReader>(subprocess->captureStdout());
+    auto logger = newOwned<Logger>(context, subprocess->captureStderr());
+
+    auto subprocessWaitOp = eventManager->when(subprocess->start(eventManager))(
+      [this](ProcessExitCode exitCode) {
+        if (exitCode.wasSignaled() || exitCode.getExitCode() != 0) {
+          failed = true;
+          context->failed();
+        }
+      });
+    auto outputOp = output->run(eventManager);
+    auto logOp = logger->run(eventManager);
+
+    return eventManager->when(subprocessWaitOp, outputOp, logOp, subprocess, output, logger)(
+      [this](Void, Void, Void, OwnedPtr<Subprocess>, OwnedPtr<OutputReader> output,
+             OwnedPtr<Logger>) {
+        if (!failed) {
+          provideSymbols(output->getText(), parseSymbolList(output->getText()));
+        }
+      });
+  }
+
+  void provideSymbols(const std::string& symbolList, const std::vector<ObjectSymbol>& symbols) {
+    files.getKnownFile(files.newOutput(action->moduleName + ".o.syms"))->writeAll(symbolList);
+    files.getKnownFile(files.newOutput(action->moduleName + ".o.deps"))->writeAll(
+        formatDependencyList(symbols));
+
+    std::vector<Tag> tags = getObjectFileTags(action->moduleName + ".o", symbols);
+    if (!tags.empty()) {
+      context->provide(files.getKnownFile(objectPath), tags);
+    }
+  }
+};
+
+Promise<void> CppCompileAction::start(EventManager* eventManager, BuildContext* context) {
+  auto compilation = newOwned<Compilation>(this, context);
+  auto op = compilation->run(eventManager);
+  return eventManager->when(op, compilation)(
+      [](Void, OwnedPtr<Compilation>){});
+}
+
+// ---------------------------------------------------------------------------------------
+
+std::string formatSymbolList(const std::vector<ObjectSymbol>& symbols) {
+  std::string result;
+  for (auto& symbol: symbols) {
+    char line[32];
+    if (symbol.type == 'U' || symbol.type == 'w' || symbol.type == 'v') {
+      snprintf(line, sizeof(line), "%16s %c ", "", symbol.type);
+    } else {
+      snprintf(line, sizeof(line), "%016llx %c ", (unsigned long long)symbol.value, symbol.type);
+    }
+    result.append(line);
+    result.append(symbol.name);
+    result.push_back('\n');
+  }
+  return result;
+}
+
+bool isLtoPlaceholder(const std::vector<ObjectSymbol>& symbols) {
+  for (auto& symbol: symbols) {
+    if (startsWith(symbol.name, "__gnu_lto_")) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::vector<ObjectSymbol> parseSymbolList(const std::string& text) {
+  std::vector<ObjectSymbol> result;
+  std::string::size_type pos = 0;
+  while (pos < text.size()) {
+    std::string::size_type end = text.find_first_of('\n', pos);
+    if (end == std::string::npos) {
+      end = text.size();
+    }
+    std::vector<std::string> words = splitWords(text.substr(pos, end - pos));
+    pos = end + 1;
+
+    // "<value> <type> <name>", or "<type> <name>" if undefined.  Anything else is a file name or
+    // a blank line.
+    ObjectSymbol symbol;
+    symbol.value = 0;
+    if (words.size() == 3 && words[1].size() == 1) {
+      symbol.value = strtoull(words[0].c_str(), NULL, 16);
+      symbol.type = words[1][0];
+      symbol.name = words[2];
+    } else if (words.size() == 2 && words[0].size() == 1) {
+      symbol.type = words[0][0];
+      symbol.name = words[1];
+    } else {
+      continue;
+    }
+    result.push_back(symbol);
+  }
+  return result;
+}
+
+std::string formatDependencyList(const std::vector<ObjectSymbol>& symbols) {
+  std::string result;
+  for (auto& symbol: symbols) {
+    if (symbol.type == 'U') {
+      result.append(symbol.name);
+      result.push_back('\n');
+    }
+  }
+  return result;
+}
+
+std::vector<Tag> getObjectFileTags(const std::string& objectName,
+                                   const std::vector<ObjectSymbol>& symbols) {
+  auto dependsOn = [&](const char* text) {
+    for (auto& symbol: symbols) {
+      if (symbol.type == 'U' && symbol.name.find(text) != std::string::npos) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  std::vector<Tag> tags;
+  bool isTest = false;
+
+  if (endsWith(objectName, "/gtest_main.o")) {
+    tags.push_back(Tag::fromName("gtest:main"));
+  } else if (endsWith(objectName, "/kj/test.o") || objectName == "kj/test.o") {
+    tags.push_back(Tag::fromName("kjtest:main"));
+  } else if (endsWith(objectName, "_test.o") || endsWith(objectName, "_unittest.o") ||
+             endsWith(objectName, "_regtest.o") || endsWith(objectName, "-test.o")) {
+    // Is this a gtest test that needs to link against gtest_main?
+    bool hasMain = false;
+    for (auto& symbol: symbols) {
+      if (symbol.type != 'U' && (symbol.name == "main" || symbol.name == "_main")) {
+        hasMain = true;
+      }
+    }
+    if (dependsOn("7testing8internal23MakeAndRegisterTestInfo") && !hasMain) {
+      tags.push_back(Tag::fromName("gtest:test"));
+      isTest = true;
+    }
+
+    // Is this a KJ test that needs to link against kj/test.o?
+    if (dependsOn("N2kj8TestCaseC")) {
+      tags.push_back(Tag::fromName("kjtest:test"));
+      isTest = true;
+    }
+  } else {
+    // Node v0.10 exports a symbol like "modname_module", and calls v8::HandleScope::HandleScope().
+    // Node v4 exports "_module", possibly with an "L" (const) in its mangling, and calls
+    // v8::HandleScope::HandleScope(v8::Isolate*).
+    bool isNodeModule = false;
+    for (auto& symbol: symbols) {
+      if (symbol.type == 'D') {
+        std::string::size_type end =
+            symbol.name.find_first_not_of("abcdefghijklmnopqrstuvwxyz0123456789");
+        if (end != std::string::npos && end > 0 &&
+            symbol.name.compare(end, 7, "_module") == 0 &&
+            dependsOn("_ZN2v811HandleScopeC1Ev")) {
+          isNodeModule = true;
+        }
+      } else if (symbol.type == 'd') {
+        if ((startsWith(symbol.name, "_Z7_module") || startsWith(symbol.name, "_ZL7_module")) &&
+            dependsOn("_ZN2v811HandleScopeC1EPNS_7IsolateE")) {
+          isNodeModule = true;
+        }
+      }
+    }
+    if (isNodeModule) {
+      tags.push_back(Tag::fromName("nodejs:module"));
+    }
+  }
+
+  if (!isTest) {
+    // Tell Ekam about the symbols provided by this file.  But not for tests, because we don't
+    // want other things to accidentally link against tests.
+    for (auto& symbol: symbols) {
+      if (strchr("ABCDGRSTV", symbol.type) != NULL) {
+        tags.push_back(Tag::fromName("c++symbol:" + symbol.name));
+      }
+    }
+  }
+
+  return tags;
+}
+
+// ---------------------------------------------------------------------------------------
+
+const Tag CppCompileActionFactory::SOURCE_TYPES[] = {
+  Tag::fromName("filetype:.cpp"),
+  Tag::fromName("filetype:.cc"),
+  Tag::fromName("filetype:.C"),
+  Tag::fromName("filetype:.cxx"),
+  Tag::fromName("filetype:.c++"),
+  Tag::fromName("filetype:.c")
+};
+
+CppCompileActionFactory::CppCompileActionFactory() {}
+CppCompileActionFactory::~CppCompileActionFactory() {}
+
+void CppCompileActionFactory::enumerateTriggerTags(
+    std::back_insert_iterator<std::vector<Tag> > iter) {
+  for (unsigned int i = 0; i < (sizeof(SOURCE_TYPES) / sizeof(SOURCE_TYPES[0])); i++) {
+    *iter++ = SOURCE_TYPES[i];
+  }
+}
+
+OwnedPtr<Action> CppCompileActionFactory::tryMakeAction(const Tag& id, File* file) {
+  std::string base, ext;
+  splitExtension(file->canonicalName(), &base, &ext);
+
+  if (file->basename() == "intercept.c") {
+    // Hack: Skip interceptor. It screws everything up since it appears to define syscalls like
+    //   write().
+    return nullptr;
+  }
+
+  if (ext == ".cpp" || ext == ".cc" || ext == ".C" || ext == ".cxx" || ext == ".c++") {
+    return newOwned<CppCompileAction>(this, file, false, base);
+  } else if (ext == ".c") {
+    return newOwned<CppCompileAction>(this, file, true, base);
+  }
+  return nullptr;
+}
+
 }  // namespace ekam
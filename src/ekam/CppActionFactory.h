@@ -17,9 +17,13 @@
 #ifndef KENTONSCODE_EKAM_CPPACTIONFACTORY_H_
 #define KENTONSCODE_EKAM_CPPACTIONFACTORY_H_
 
+#include <map>
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include <iterator>
 #include "Action.h"
+#include "os/ObjectSymbols.h"
 
 namespace ekam {
 
@@ -40,6 +44,50 @@ private:
   static const Tag NODEJS_MODULE;
 };
 
+// Compiles C and C++ source files the way compile.ekam-rule does, but without the shell:  runs
+// the compiler under intercept.so, then reads the object file's symbol table itself to tag it,
+// falling back to nm for objects that aren't ELF.  Only used if EKAM_BUILTIN_COMPILE=on, in which
+// case compile.ekam-rule stands aside.
+class CppCompileActionFactory: public ActionFactory {
+public:
+  CppCompileActionFactory();
+  ~CppCompileActionFactory();
+
+  // implements ActionFactory ------------------------------------------------------------
+  void enumerateTriggerTags(std::back_insert_iterator<std::vector<Tag> > iter);
+  OwnedPtr<Action> tryMakeAction(const Tag& id, File* file);
+
+private:
+  friend class CppCompileAction;
+
+  static const Tag SOURCE_TYPES[];
+
+  // CXX, CXXFLAGS, etc., after sourcing a set of compile.ekam-flags files (or none).  That takes
+  // a shell, so the results are kept, by the files' contents.
+  typedef std::map<std::string, std::string> Settings;
+  std::unordered_map<std::string, Settings> settingsCache;
+};
+
+// What the compile action derives from an object file's symbols, exactly as compile.ekam-rule
+// does with nm, grep and sed.
+
+// The symbols as nm lists them, which is what .o.syms files hold.
+std::string formatSymbolList(const std::vector<ObjectSymbol>& symbols);
+
+// True if the symbols are GCC's placeholders for an LTO object, which only nm (through the LTO
+// plugin) can see past.
+bool isLtoPlaceholder(const std::vector<ObjectSymbol>& symbols);
+
+// The reverse of formatSymbolList(), for nm's output.
+std::vector<ObjectSymbol> parseSymbolList(const std::string& text);
+
+// The undefined symbols, one per line, which is what .o.deps files hold.
+std::string formatDependencyList(const std::vector<ObjectSymbol>& symbols);
+
+// The tags to provide for the object file with the given canonical name.
+std::vector<Tag> getObjectFileTags(const std::string& objectName,
+                                   const std::vector<ObjectSymbol>& symbols);
+
 }  // namespace ekam
 
 #endif  // KENTONSCODE_EKAM_CPPACTIONFACTORY_H_
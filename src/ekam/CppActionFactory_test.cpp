@@ -0,0 +1,265 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Checks the built-in compile action's symbol lists and tags against compile.ekam-rule's, by
+// running the rule on prebuilt objects with a stand-in compiler and answering its requests.
+
+#include "CppActionFactory.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace ekam {
+namespace {
+
+#define ASSERT(EXPRESSION)                                                    \
+  if (!(EXPRESSION)) {                                                        \
+    fprintf(stderr, "%s:%d: FAILED: %s\n", __FILE__, __LINE__, #EXPRESSION);  \
+    exit(1);                                                                  \
+  }
+
+std::string makeTempDir() {
+  char pattern[] = "/tmp/ekam-test-XXXXXX";
+  ASSERT(mkdtemp(pattern) != NULL);
+  return pattern;
+}
+
+void writeFile(const std::string& path, const std::string& content) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0777);
+  ASSERT(fd >= 0);
+  ASSERT(write(fd, content.data(), content.size()) == (ssize_t)content.size());
+  close(fd);
+}
+
+bool readFile(const std::string& path, std::string* content) {
+  FILE* file = fopen(path.c_str(), "r");
+  if (file == NULL) {
+    return false;
+  }
+  char buffer[4096];
+  size_t n;
+  content->clear();
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    content->append(buffer, n);
+  }
+  fclose(file);
+  return true;
+}
+
+// Copies the object named by $PREBUILT to wherever the compiler was asked to write.
+const char FAKE_COMPILER[] =
+    "#! /bin/sh\n"
+    "while test $# -gt 1; do\n"
+    "  if test \"$1\" = -o; then exec cp \"$PREBUILT\" \"$2\"; fi\n"
+    "  shift\n"
+    "done\n"
+    "exit 1\n";
+
+// Symbols that the rule looks for, declared under their mangled names.
+const char SOURCE_PRELUDE[] =
+    "extern void makeAndRegisterTestInfo() "
+    "__asm__(\"_ZN7testing8internal23MakeAndRegisterTestInfoEv\");\n"
+    "extern void kjTestCase() __asm__(\"_ZN2kj8TestCaseC1Ev\");\n"
+    "extern void handleScope() __asm__(\"_ZN2v811HandleScopeC1Ev\");\n";
+
+struct Case {
+  const char* objectName;
+  const char* source;
+  const char* tag;  // One of the tags the rule should provide.
+  const char* flags;  // For compiling the object.
+};
+
+const Case CASES[] = {
+  { "lib.o",
+    "int globalData = 1;\n"
+    "int globalBss;\n"
+    "__attribute__((weak)) int weakData = 3;\n"
+    "static int localData = 2;\n"
+    "void undefinedFunction();\n"
+    "inline int inlineFunction() { return localData; }\n"
+    "int globalFunction() { undefinedFunction(); return inlineFunction() + globalBss; }\n",
+    "c++symbol:globalData", "-O0" },
+  { "sub/gtest_main.o",
+    "int main() { makeAndRegisterTestInfo(); return 0; }\n",
+    "gtest:main", "-O0" },
+  { "kj/test.o",
+    "void runTests() { kjTestCase(); }\n",
+    "kjtest:main", "-O0" },
+  { "gtest_test.o",
+    "void testBody() { makeAndRegisterTestInfo(); }\n",
+    "gtest:test", "-O0" },
+  { "kj-test.o",
+    "void testBody() { kjTestCase(); }\n",
+    "kjtest:test", "-O0" },
+  { "main_test.o",
+    "int main() { makeAndRegisterTestInfo(); return 0; }\n",
+    "c++symbol:main", "-O0" },
+  { "addon.o",
+    "extern \"C\" { int addon_module = 1; }\n"
+    "void init() { handleScope(); }\n",
+    "nodejs:module", "-O0" },
+  { "lto.o",
+    "int ltoFunction() { return 1; }\n",
+    "c++symbol:_Z11ltoFunctionv", "-O2 -flto" },
+};
+
+// Runs the rule's shell script in `dir` to "compile" `input`, answering its requests.
+void runRule(const std::string& dir, const std::string& rule, const std::string& input,
+             std::vector<std::string>* provided) {
+  int toRule[2], fromRule[2];
+  ASSERT(pipe(toRule) == 0);
+  ASSERT(pipe(fromRule) == 0);
+
+  pid_t pid = fork();
+  ASSERT(pid >= 0);
+  if (pid == 0) {
+    dup2(toRule[0], STDIN_FILENO);
+    dup2(fromRule[1], STDOUT_FILENO);
+    close(toRule[0]);
+    close(toRule[1]);
+    close(fromRule[0]);
+    close(fromRule[1]);
+    if (chdir(dir.c_str()) < 0) {
+      _exit(1);
+    }
+    execl("/bin/sh", "sh", "-c", rule.c_str(), "compile.ekam-rule", input.c_str(), (char*)NULL);
+    _exit(1);
+  }
+  close(toRule[0]);
+  close(fromRule[1]);
+
+  FILE* requests = fdopen(fromRule[0], "r");
+  FILE* responses = fdopen(toRule[1], "w");
+  ASSERT(requests != NULL && responses != NULL);
+
+  char line[4096];
+  while (fgets(line, sizeof(line), requests) != NULL) {
+    std::string request(line, strcspn(line, "\n"));
+    std::string::size_type spacePos = request.find_first_of(' ');
+    std::string command = request.substr(0, spacePos);
+    std::string arg = spacePos == std::string::npos ? "" : request.substr(spacePos + 1);
+
+    if (command == "findModifiers") {
+      fputs("\n", responses);
+    } else if (command == "findProvider" && arg == "special:ekam-interceptor") {
+      fputs((dir + "/empty.so\n").c_str(), responses);
+    } else if (command == "newOutput") {
+      fputs((dir + "/" + arg + "\n").c_str(), responses);
+    } else if (command == "provide") {
+      std::string::size_type tagPos = arg.find_first_of(' ');
+      ASSERT(arg.substr(0, tagPos) == dir + "/" + input.substr(0, input.size() - 4) + ".o");
+      provided->push_back(arg.substr(tagPos + 1));
+    } else {
+      fprintf(stderr, "unexpected request: %s\n", request.c_str());
+      ASSERT(false);
+    }
+    fflush(responses);
+  }
+  fclose(requests);
+  fclose(responses);
+
+  int status;
+  ASSERT(waitpid(pid, &status, 0) == pid);
+  ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+bool sameTags(std::vector<Tag> actual, const std::vector<std::string>& expectedNames) {
+  std::vector<Tag> expected;
+  for (auto& name: expectedNames) {
+    expected.push_back(Tag::fromName(name));
+  }
+  std::sort(actual.begin(), actual.end());
+  std::sort(expected.begin(), expected.end());
+  return actual == expected;
+}
+
+void testMatchesRule(const std::string& dir) {
+  std::string rule;
+  if (!readFile("src/ekam/rules/compile.ekam-rule", &rule) &&
+      !readFile("ekam/rules/compile.ekam-rule", &rule)) {
+    fprintf(stderr, "Can't find compile.ekam-rule; skipping.\n");
+    return;
+  }
+
+  // The rule preloads intercept.so into the compiler, which doesn't need it here.
+  std::string command = "c++ -shared -x c++ /dev/null -o " + dir + "/empty.so 2>/dev/null";
+  if (system(command.c_str()) != 0) {
+    fprintf(stderr, "No C++ compiler; skipping.\n");
+    return;
+  }
+
+  writeFile(dir + "/fake-c++", FAKE_COMPILER);
+  ASSERT(mkdir((dir + "/sub").c_str(), 0777) == 0);
+  ASSERT(mkdir((dir + "/kj").c_str(), 0777) == 0);
+  setenv("CXX", (dir + "/fake-c++").c_str(), 1);
+  setenv("LC_ALL", "C", 1);
+  unsetenv("CXX_WRAPPER");
+  unsetenv("CROSS_TARGETS");
+  unsetenv("NM");
+  unsetenv("NMFLAGS");
+  unsetenv("EKAM_BUILTIN_COMPILE");
+
+  for (auto& testCase: CASES) {
+    std::string objectName = testCase.objectName;
+    std::string prebuilt = dir + "/prebuilt.o";
+    writeFile(dir + "/prebuilt.c++", std::string(SOURCE_PRELUDE) + testCase.source);
+    command = std::string("c++ ") + testCase.flags + " -c " + dir + "/prebuilt.c++ -o " + prebuilt;
+    ASSERT(system(command.c_str()) == 0);
+    setenv("PREBUILT", prebuilt.c_str(), 1);
+
+    std::vector<std::string> provided;
+    std::string input = objectName.substr(0, objectName.size() - 2) + ".c++";
+    runRule(dir, rule, input, &provided);
+    ASSERT(std::find(provided.begin(), provided.end(), testCase.tag) != provided.end());
+
+    std::string ruleSymbols, ruleDeps;
+    ASSERT(readFile(dir + "/" + objectName + ".syms", &ruleSymbols));
+    ASSERT(readFile(dir + "/" + objectName + ".deps", &ruleDeps));
+
+    std::vector<ObjectSymbol> symbols;
+    std::string error;
+    ASSERT(readObjectSymbols(prebuilt, &symbols, &error));
+    if (isLtoPlaceholder(symbols)) {
+      ASSERT(strstr(testCase.flags, "-flto") != NULL);
+    } else {
+      ASSERT(formatSymbolList(symbols) == ruleSymbols);
+      ASSERT(formatDependencyList(symbols) == ruleDeps);
+      ASSERT(sameTags(getObjectFileTags(objectName, symbols), provided));
+    }
+
+    // As when the action falls back to nm, writing its output as the symbol list.
+    std::vector<ObjectSymbol> parsed = parseSymbolList(ruleSymbols);
+    ASSERT(formatDependencyList(parsed) == ruleDeps);
+    ASSERT(sameTags(getObjectFileTags(objectName, parsed), provided));
+  }
+
+  ASSERT(system(("rm -rf " + dir).c_str()) == 0);
+}
+
+}  // namespace
+}  // namespace ekam
+
+int main(int argc, char* argv[]) {
+  ekam::testMatchesRule(ekam::makeTempDir());
+  return 0;
+}
@@ -21,4 +21,10 @@ namespace ekam {
 Dashboard::~Dashboard() {}
 Dashboard::Task::~Task() {}
 
+void Dashboard::Task::setResourceUsage(const ResourceUsage& usage) {}
+
+size_t Dashboard::retainedLogBytes() {
+  return 0;
+}
+
 }
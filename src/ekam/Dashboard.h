@@ -17,8 +17,10 @@
 #ifndef KENTONSCODE_EKAM_DASHBOARD_H_
 #define KENTONSCODE_EKAM_DASHBOARD_H_
 
+#include <stddef.h>
 #include <string>
 #include "base/OwnedPtr.h"
+#include "os/ResourceUsage.h"
 
 namespace ekam {
 
@@ -41,6 +43,10 @@ public:
 
     virtual void setState(TaskState state) = 0;
     virtual void addOutput(const std::string& text) = 0;
+
+    // Resources used by the task's subprocesses, reported when it finishes.  Ignored by
+    // default.
+    virtual void setResourceUsage(const ResourceUsage& usage);
   };
 
   enum Silence {
@@ -50,6 +56,10 @@ public:
 
   virtual OwnedPtr<Task> beginTask(const std::string& verb, const std::string& noun,
                                    Silence silence) = 0;
+
+  // Bytes of task output currently held in memory by this dashboard (and any it wraps), for
+  // diagnostics.
+  virtual size_t retainedLogBytes();
 };
 
 class EventManager;
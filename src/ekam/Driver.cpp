@@ -17,6 +17,7 @@
 #include "Driver.h"
 
 #include <queue>
+#include <algorithm>
 #include <memory>
 #include <stdexcept>
 #include <errno.h>
@@ -24,7 +25,10 @@
 #include <stdio.h>
 
 #include "base/Debug.h"
+#include "os/Cgroup.h"
+#include "os/DiskFile.h"
 #include "os/EventGroup.h"
+#include "IntermediateStore.h"
 
 namespace ekam {
 
@@ -40,6 +44,14 @@ int fileDepth(const std::string& name) {
   return result;
 }
 
+template <typename TableType>
+void dumpTableStats(FILE* out, const char* name, TableType* table) {
+  fprintf(out, "%-20s %9d rows %9d tombstones %9d capacity   index sizes: %d %d %d %d\n",
+          name, table->size(), table->tombstoneCount(), table->capacity(),
+          table->template indexSize<0>(), table->template indexSize<1>(),
+          table->template indexSize<2>(), table->compositeIndexSize());
+}
+
 int commonPrefixLength(const std::string& srcName, const std::string& bestMatchName) {
   std::string::size_type n = std::min(srcName.size(), bestMatchName.size());
   for (unsigned int i = 0; i < n; i++) {
@@ -75,6 +87,8 @@ public:
   void passed();
   void failed();
 
+  Cgroup* getCgroup();
+
   // implements ExceptionHandler ---------------------------------------------------------
   void threwException(const std::exception& e);
   void threwUnknownException();
@@ -100,11 +114,19 @@ private:
 
   EventGroup eventGroup;
 
+  // Null unless the driver has a CgroupTree.  Declared before runningAction so that the action's
+  // subprocesses are gone before it is.
+  OwnedPtr<Cgroup> cgroup;
+
   Promise<void> asyncCallbackOp;
 
   bool isRunning;
   Promise<void> runningAction;
 
+  // Fires if the action runs past its verb's time limit.  Waits on the driver's event manager
+  // rather than the event group, so as not to keep the action alive.
+  Promise<void> timeoutOp;
+
   OwnedPtrVector<File> outputs;
 
   struct Installation {
@@ -123,6 +145,9 @@ private:
   bool currentlyExecutingReturned = false;
 
   void ensureRunning();
+  void timedOut(int seconds);
+  Cgroup* freezeIfRequested();
+  void removeCgroup();
   void queueDoneCallback();
   void returned();
   void reset();
@@ -153,13 +178,31 @@ void Driver::ActionDriver::start() {
 
   state = RUNNING;
   isRunning = true;
+  eventGroup.resetResourceUsage();
   dashboardTask->setState(Dashboard::RUNNING);
 
+  if (driver->cgroupTree != nullptr) {
+    try {
+      cgroup = driver->cgroupTree->newCgroup(driver->getCgroupSettings(action->getVerb()));
+    } catch (const OsError& e) {
+      DEBUG_WARNING << "Running action without a cgroup: " << e.what();
+    }
+  }
+
   asyncCallbackOp = eventGroup.when()(
     [this]() {
       asyncCallbackOp.release();
       runningAction = action->start(&eventGroup, this);
     });
+
+  int timeout = driver->getTimeout(action->getVerb());
+  if (timeout > 0) {
+    timeoutOp = driver->eventManager->when(driver->eventManager->afterDelay(timeout * 1000))(
+      [this, timeout](Void) {
+        timeoutOp.release();
+        timedOut(timeout);
+      });
+  }
 }
 
 File* Driver::ActionDriver::findProvider(Tag tag) {
@@ -167,7 +210,14 @@ File* Driver::ActionDriver::findProvider(Tag tag) {
 
   Provision* provision = choosePreferredProvider(tag);
 
-  driver->dependencyTable.add(tag, this, provision);
+  // Actions often look up the same tag many times (e.g. a header included from several places).
+  // Keep one edge per tag, recording whichever provider the action saw last:  an edge to a
+  // provider it no longer uses would only get it reset when that provider changes, for nothing.
+  const DependencyTable::Row* previous = driver->dependencyTable.findComposite(tag, this);
+  if (previous == NULL || previous->cell<DependencyTable::PROVISION>() != provision) {
+    driver->dependencyTable.eraseComposite(tag, this);
+    driver->dependencyTable.add(tag, this, provision);
+  }
   if (provision == NULL) {
     return NULL;
   } else {
@@ -233,9 +283,14 @@ void Driver::ActionDriver::log(const std::string& text) {
 OwnedPtr<File> Driver::ActionDriver::newOutput(const std::string& path) {
   ensureRunning();
   OwnedPtr<File> file = driver->tmp->relative(path);
+  file->invalidateCache();
 
   recursivelyCreateDirectory(file->parent().get());
 
+  if (driver->intermediateStore != nullptr) {
+    driver->intermediateStore->place(file.get());
+  }
+
   OwnedPtr<File> result = file->clone();
 
   std::vector<Tag> tags;
@@ -291,12 +346,71 @@ void Driver::ActionDriver::failed() {
   }
 }
 
+Cgroup* Driver::ActionDriver::getCgroup() {
+  return cgroup.get();
+}
+
 void Driver::ActionDriver::ensureRunning() {
   if (!isRunning) {
     throw std::runtime_error("Action is not running.");
   }
 }
 
+void Driver::ActionDriver::timedOut(int seconds) {
+  if (state != RUNNING) {
+    // Already finished; the done callback just hasn't run yet.
+    return;
+  }
+
+  // Cancelling the action destroys its subprocesses, killing their process groups.
+  Cgroup* frozenCgroup = freezeIfRequested();
+  runningAction.release();
+  asyncCallbackOp.release();
+  dashboardTask->addOutput("ekam: " + action->getVerb() + " timed out after " +
+                           std::to_string(seconds) + " seconds; " +
+                           (frozenCgroup == nullptr ? std::string("killed")
+                                                    : "frozen in " + frozenCgroup->getPath()) +
+                           ".\n");
+  failed();
+}
+
+Cgroup* Driver::ActionDriver::freezeIfRequested() {
+  if (cgroup == nullptr || !driver->freezeCancelledActions) {
+    return nullptr;
+  }
+
+  cgroup->freeze();
+  if (!cgroup->isFrozen()) {
+    return nullptr;
+  }
+
+  DEBUG_INFO << "Froze cancelled action in " << cgroup->getPath() << ": "
+             << action->getVerb() << " " << srcfile->canonicalName();
+  Cgroup* result = cgroup.get();
+  driver->frozenCgroups.add(cgroup.release());
+  return result;
+}
+
+void Driver::ActionDriver::removeCgroup() {
+  if (cgroup == nullptr) {
+    return;
+  }
+
+  if (cgroup->getOomKillCount() > 0) {
+    // Report what happened rather than leaving the user to puzzle over a SIGKILL.
+    uint64_t peak = cgroup->getPeakMemory();
+    if (peak == 0) {
+      peak = eventGroup.getResourceUsage().maxRssKilobytes * 1024;
+    }
+    dashboardTask->addOutput("ekam: " + action->getVerb() + " ran out of memory (memory.max = " +
+                             cgroup->read("memory.max") + "); peak usage " +
+                             std::to_string(peak >> 20) + " MB.\n");
+    state = FAILED;
+  }
+
+  cgroup.clear();
+}
+
 void Driver::ActionDriver::queueDoneCallback() {
   asyncCallbackOp = driver->eventManager->when()(
     [this]() {
@@ -358,8 +472,12 @@ void Driver::ActionDriver::returned() {
 
   // Cancel anything still running.
   runningAction.release();
+  timeoutOp.release();
   isRunning = false;
 
+  // Kills any stragglers, and notices if the action ran out of memory.
+  removeCgroup();
+
   // Pull self out of driver->activeActions.
   OwnedPtr<ActionDriver> self;
   for (int i = 0; i < driver->activeActions.size(); i++) {
@@ -371,6 +489,18 @@ void Driver::ActionDriver::returned() {
 
   driver->completedActionPtrs.add(this, self.release());
 
+  if (eventGroup.getResourceUsage().processCount > 0) {
+    dashboardTask->setResourceUsage(eventGroup.getResourceUsage());
+  }
+
+  // The action's subprocesses may have created, replaced or deleted any of its outputs.
+  for (int i = 0; i < outputs.size(); i++) {
+    outputs.get(i)->invalidateCache();
+    if (driver->intermediateStore != nullptr) {
+      driver->intermediateStore->seal(outputs.get(i));
+    }
+  }
+
   if (state == FAILED) {
     // Failed, possibly due to missing dependencies.
     provisions.clear();
@@ -386,6 +516,14 @@ void Driver::ActionDriver::returned() {
     // files and then delete them immediately.
     OwnedPtrVector<Provision> provisionsToFilter;
     provisions.swap(&provisionsToFilter);
+
+    // Check and hash all the outputs in one batch rather than one syscall at a time.
+    std::vector<File*> files;
+    for (int i = 0; i < provisionsToFilter.size(); i++) {
+      files.push_back(provisionsToFilter.get(i)->file.get());
+    }
+    DiskFile::prefetch(files);
+
     for (int i = 0; i < provisionsToFilter.size(); i++) {
       if (provisionsToFilter.get(i)->file->exists()) {
         provisions.add(provisionsToFilter.release(i));
@@ -410,6 +548,8 @@ void Driver::ActionDriver::returned() {
     for (size_t i = 0; i < installations.size(); i++) {
       File* installDir = driver->installDirs[installations[i].location];
       OwnedPtr<File> target = installDir->relative(installations[i].name);
+      // Install directories are not watched, and users do delete things from them.
+      target->invalidateCache();
       if (target->exists()) {
         target->unlink();
       } else {
@@ -420,6 +560,9 @@ void Driver::ActionDriver::returned() {
         }
         recursivelyCreateDirectory(target->parent().get());
       }
+      if (driver->intermediateStore != nullptr) {
+        driver->intermediateStore->materialize(installations[i].file);
+      }
       target->link(installations[i].file);
     }
   }
@@ -437,8 +580,11 @@ void Driver::ActionDriver::reset() {
 
   if (isRunning) {
     dashboardTask->setState(Dashboard::BLOCKED);
+    freezeIfRequested();
     runningAction.release();
     asyncCallbackOp.release();
+    timeoutOp.release();
+    cgroup.clear();
 
     for (int i = 0; i < driver->activeActions.size(); i++) {
       if (driver->activeActions.get(i) == this) {
@@ -570,7 +716,8 @@ Driver::Driver(EventManager* eventManager, Dashboard* dashboard, File* tmp,
                File* installDirs[BuildContext::INSTALL_LOCATION_COUNT], int maxConcurrentActions,
                ActivityObserver* activityObserver)
     : eventManager(eventManager), dashboard(dashboard), tmp(tmp),
-      maxConcurrentActions(maxConcurrentActions), activityObserver(activityObserver) {
+      maxConcurrentActions(maxConcurrentActions), activityObserver(activityObserver),
+      intermediateStore(nullptr), cgroupTree(nullptr), freezeCancelledActions(false) {
   if (!tmp->isDirectory()) {
     tmp->createDirectory();
   }
@@ -582,6 +729,53 @@ Driver::Driver(EventManager* eventManager, Dashboard* dashboard, File* tmp,
 
 Driver::~Driver() {}
 
+void Driver::setIntermediateStore(IntermediateStore* store) {
+  intermediateStore = store;
+}
+
+void Driver::setTimeout(const std::string& verb, int seconds) {
+  timeouts[verb] = seconds;
+}
+
+int Driver::getTimeout(const std::string& verb) {
+  auto iter = timeouts.find(verb);
+  if (iter == timeouts.end()) {
+    iter = timeouts.find("*");
+    if (iter == timeouts.end()) {
+      return 0;
+    }
+  }
+  return iter->second;
+}
+
+void Driver::setCgroupTree(CgroupTree* tree) {
+  cgroupTree = tree;
+}
+
+void Driver::setCgroupSetting(const std::string& verb, const std::string& name,
+                              const std::string& value) {
+  cgroupSettings[verb].push_back(std::make_pair(name, value));
+}
+
+Driver::CgroupSettings Driver::getCgroupSettings(const std::string& verb) {
+  CgroupSettings result = cgroupSettings["*"];
+  if (verb != "*") {
+    auto iter = cgroupSettings.find(verb);
+    if (iter != cgroupSettings.end()) {
+      result.insert(result.end(), iter->second.begin(), iter->second.end());
+    }
+  }
+  return result;
+}
+
+void Driver::setFreezeCancelledActions(bool freeze) {
+  freezeCancelledActions = freeze;
+}
+
+void Driver::killFrozenActions() {
+  frozenCgroups.clear();
+}
+
 void Driver::addActionFactory(ActionFactory* factory) {
   std::vector<Tag> triggerTags;
   factory->enumerateTriggerTags(std::back_inserter(triggerTags));
@@ -801,6 +995,57 @@ void Driver::fireTriggers(const Tag& tag, Provision* provision) {
   }
 }
 
+void Driver::dumpStats(FILE* out) {
+  dumpTableStats(out, "triggers", &triggers);
+  dumpTableStats(out, "tagTable", &tagTable);
+  dumpTableStats(out, "dependencyTable", &dependencyTable);
+  dumpTableStats(out, "actionTriggersTable", &actionTriggersTable);
+  fprintf(out, "%-20s %9d\n", "activeActions", activeActions.size());
+  fprintf(out, "%-20s %9d\n", "pendingActions", pendingActions.size());
+  fprintf(out, "%-20s %9d\n", "completedActionPtrs", completedActionPtrs.size());
+  fprintf(out, "%-20s %9d\n", "rootProvisions", rootProvisions.size());
+  fprintf(out, "%-20s %9zu bytes\n", "dashboard logs", dashboard->retainedLogBytes());
+  if (intermediateStore != nullptr) {
+    intermediateStore->dumpStats(out);
+  }
+
+  // What the completed actions' subprocesses cost, and which actions cost the most.
+  const size_t TOP_ACTION_COUNT = 10;
+  ResourceUsage total;
+  std::vector<ActionDriver*> actions;
+  for (OwnedPtrMap<ActionDriver*, ActionDriver>::Iterator iter(completedActionPtrs); iter.next();) {
+    total.add(iter.key()->eventGroup.getResourceUsage());
+    actions.push_back(iter.key());
+  }
+  fprintf(out, "%-20s %9u processes, %s\n", "action resources", total.processCount,
+          total.toString().c_str());
+
+  size_t count = std::min(actions.size(), TOP_ACTION_COUNT);
+  std::partial_sort(actions.begin(), actions.begin() + count, actions.end(),
+      [](ActionDriver* a, ActionDriver* b) {
+        return a->eventGroup.getResourceUsage().cpuMicros() >
+               b->eventGroup.getResourceUsage().cpuMicros();
+      });
+  fprintf(out, "most CPU:\n");
+  for (size_t i = 0; i < count; i++) {
+    const ResourceUsage& usage = actions[i]->eventGroup.getResourceUsage();
+    fprintf(out, "  %9.2fs  %s: %s\n", usage.cpuMicros() / 1e6,
+            actions[i]->action->getVerb().c_str(), actions[i]->srcfile->canonicalName().c_str());
+  }
+
+  std::partial_sort(actions.begin(), actions.begin() + count, actions.end(),
+      [](ActionDriver* a, ActionDriver* b) {
+        return a->eventGroup.getResourceUsage().maxRssKilobytes >
+               b->eventGroup.getResourceUsage().maxRssKilobytes;
+      });
+  fprintf(out, "most memory:\n");
+  for (size_t i = 0; i < count; i++) {
+    const ResourceUsage& usage = actions[i]->eventGroup.getResourceUsage();
+    fprintf(out, "  %8lluMB  %s: %s\n", (unsigned long long)(usage.maxRssKilobytes / 1024),
+            actions[i]->action->getVerb().c_str(), actions[i]->srcfile->canonicalName().c_str());
+  }
+}
+
 bool Driver::dumpErrors() {
   bool hasFailures = false;
   for (OwnedPtrMap<ActionDriver*, ActionDriver>::Iterator iter(completedActionPtrs); iter.next();) {
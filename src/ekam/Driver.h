@@ -21,6 +21,7 @@
 #include <unordered_set>
 #include <memory>
 #include <set>
+#include <stdio.h>
 
 #include "base/OwnedPtr.h"
 #include "os/File.h"
@@ -31,6 +32,10 @@
 
 namespace ekam {
 
+class IntermediateStore;
+class CgroupTree;
+class Cgroup;
+
 class Driver {
 public:
   class ActivityObserver {
@@ -46,9 +51,38 @@ public:
 
   void addActionFactory(ActionFactory* factory);
 
+  // Keep action outputs in the given store (which must outlive the Driver) instead of directly
+  // in tmp/.
+  void setIntermediateStore(IntermediateStore* store);
+
+  // Kill actions with the given verb (e.g. "compile", "test") which run for longer than `seconds`
+  // and mark them failed.  The verb "*" sets the limit for all verbs not given their own.  Zero
+  // means no limit, which is the default.
+  void setTimeout(const std::string& verb, int seconds);
+
+  // Run each action in its own cgroup under the given tree (which must outlive the Driver).
+  void setCgroupTree(CgroupTree* tree);
+
+  // Write `value` to the interface file `name` (e.g. "memory.max") of the cgroups of actions with
+  // the given verb.  Settings for the verb "*" apply to all verbs, but are written first, so a
+  // verb's own settings win.
+  void setCgroupSetting(const std::string& verb, const std::string& name,
+                        const std::string& value);
+
+  // When an action is cancelled or times out, freeze its processes and leave them for inspection
+  // instead of killing them.  They are killed by killFrozenActions() or when the Driver is
+  // destroyed.
+  void setFreezeCancelledActions(bool freeze);
+  void killFrozenActions();
+
   void addSourceFile(File* file);
   void removeSourceFile(File* file);
 
+  // Write a human-readable summary of the driver's in-memory state (table sizes, retained
+  // actions, dashboard logs) to the given stream.  Useful for figuring out where memory goes in
+  // a long-running continuous build.
+  void dumpStats(FILE* out);
+
 private:
   class ActionDriver;
 
@@ -62,6 +96,22 @@ private:
 
   ActivityObserver* activityObserver;
 
+  IntermediateStore* intermediateStore;  // May be null.
+
+  // Seconds, by verb.
+  std::unordered_map<std::string, int> timeouts;
+  int getTimeout(const std::string& verb);
+
+  CgroupTree* cgroupTree;  // May be null.
+
+  // Cgroup interface file settings, by verb.
+  typedef std::vector<std::pair<std::string, std::string> > CgroupSettings;
+  std::unordered_map<std::string, CgroupSettings> cgroupSettings;
+  CgroupSettings getCgroupSettings(const std::string& verb);
+
+  bool freezeCancelledActions;
+  OwnedPtrVector<Cgroup> frozenCgroups;
+
   class TriggerTable : public Table<IndexedColumn<Tag, Tag::HashFunc>,
                                     IndexedColumn<ActionFactory*> > {
   public:
@@ -89,7 +139,8 @@ private:
 
   class DependencyTable : public Table<IndexedColumn<Tag, Tag::HashFunc>,
                                        IndexedColumn<ActionDriver*>,
-                                       IndexedColumn<Provision*> > {
+                                       IndexedColumn<Provision*>,
+                                       CompositeIndex<0, 1> > {
   public:
     static const int TAG = 0;
     static const int ACTION = 1;
@@ -18,7 +18,11 @@
 
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <algorithm>
 #include <map>
+#include <unordered_set>
 
 #include "os/Subprocess.h"
 #include "ActionUtil.h"
@@ -28,28 +32,108 @@ namespace ekam {
 
 namespace {
 
-std::string splitToken(std::string* line) {
-  std::string::size_type pos = line->find_first_of(' ');
-  std::string result;
-  if (pos == std::string::npos) {
-    result = *line;
-    line->clear();
-  } else {
-    result.assign(*line, 0, pos);
-    line->erase(0, pos + 1);
-  }
-  return result;
-}
+bool workersEnabled = true;
 
 }  // namespace
 
 // =======================================================================================
 
+// A rule that said "worker" when learned, started once and then sent one action at a time on
+// its stdin.
+class RuleWorker {
+public:
+  RuleWorker(File* executable) {
+    subprocess.addArgument(executable, File::READ);
+    subprocess.setEnvironmentVariable("EKAM_RULE_WORKER", "1");
+    responseStream = subprocess.captureStdin();
+    requestStream = subprocess.captureStdout();
+    logStream = subprocess.captureStderr();
+    subprocess.startDetached();
+  }
+  ~RuleWorker() {}
+
+  void run(File* input) {
+    std::string line = "run " + input->canonicalName() + "\n";
+    responseStream->writeAll(line.data(), line.size());
+  }
+
+  // Each action gets its own descriptors for the worker's pipes, so that whatever is watching
+  // them belongs to the action's event manager and goes away with the action.
+  OwnedPtr<ByteStream> openRequestStream() { return duplicate(requestStream.get()); }
+  OwnedPtr<ByteStream> openResponseStream() { return duplicate(responseStream.get()); }
+  OwnedPtr<ByteStream> openLogStream() { return duplicate(logStream.get()); }
+
+private:
+  Subprocess subprocess;
+  OwnedPtr<ByteStream> requestStream;
+  OwnedPtr<ByteStream> responseStream;
+  OwnedPtr<ByteStream> logStream;
+
+  static OwnedPtr<ByteStream> duplicate(ByteStream* stream) {
+    int fd = fcntl(stream->getHandle()->get(), F_DUPFD_CLOEXEC, 0);
+    if (fd < 0) {
+      throw OsError(stream->getHandle()->getName(), "dup", errno);
+    }
+    return newOwned<ByteStream>(fd, stream->getHandle()->getName());
+  }
+};
+
+// The idle workers for one rule.  Workers are busy for as long as the action using them, so the
+// pool never grows past the number of concurrent actions.
+class RuleWorkerPool {
+public:
+  RuleWorkerPool(File* executable) : executable(executable->clone()) {
+    allPools.insert(this);
+  }
+  ~RuleWorkerPool() {
+    allPools.erase(this);
+  }
+
+  // Returns an idle worker that has been sent the action, starting a new one if necessary.
+  OwnedPtr<RuleWorker> run(File* input) {
+    while (!idleWorkers.empty()) {
+      OwnedPtr<RuleWorker> worker = idleWorkers.releaseBack();
+      try {
+        worker->run(input);
+        return worker.release();
+      } catch (const OsError& e) {
+        // Worker exited while idle.
+        DEBUG_WARNING << executable->canonicalName() << ": discarding rule worker: " << e.what();
+      }
+    }
+
+    auto worker = newOwned<RuleWorker>(executable.get());
+    worker->run(input);
+    return worker.release();
+  }
+
+  void release(OwnedPtr<RuleWorker> worker) {
+    idleWorkers.add(worker.release());
+  }
+
+  static void stopAll() {
+    for (RuleWorkerPool* pool: allPools) {
+      pool->idleWorkers.clear();
+    }
+  }
+
+private:
+  OwnedPtr<File> executable;
+  OwnedPtrVector<RuleWorker> idleWorkers;
+
+  static std::unordered_set<RuleWorkerPool*> allPools;
+};
+
+std::unordered_set<RuleWorkerPool*> RuleWorkerPool::allPools;
+
+// =======================================================================================
+
 class PluginDerivedActionFactory : public ActionFactory {
 public:
   PluginDerivedActionFactory(OwnedPtr<File> executable,
                              std::string&& verb,
                              bool silent,
+                             bool useWorkers,
                              std::vector<Tag>&& triggers);
   ~PluginDerivedActionFactory();
 
@@ -62,14 +146,16 @@ private:
   std::string verb;
   bool silent;
   std::vector<Tag> triggers;
+  OwnedPtr<RuleWorkerPool> workers;  // nullable
 };
 
 // =======================================================================================
 
 class PluginDerivedAction : public Action {
 public:
-  PluginDerivedAction(File* executable, const std::string& verb, bool silent, File* file)
-      : executable(executable->clone()), verb(verb), silent(silent) {
+  PluginDerivedAction(File* executable, const std::string& verb, bool silent, File* file,
+                      RuleWorkerPool* workers)
+      : executable(executable->clone()), verb(verb), silent(silent), workers(workers) {
     if (file != NULL) {
       this->file = file->clone();
     }
@@ -83,26 +169,29 @@ public:
 
 private:
   class CommandReader;
+  class WorkerLogger;
 
   OwnedPtr<File> executable;
   std::string verb;
   bool silent;
   OwnedPtr<File> file;  // nullable
+  RuleWorkerPool* workers;  // nullable
+
+  Promise<void> startOnWorker(EventManager* eventManager, BuildContext* context);
 };
 
 class PluginDerivedAction::CommandReader {
 public:
+  // If `forWorker` is true, the action ends with "done" rather than at EOF, which instead means
+  // the worker died.
   CommandReader(BuildContext* context, OwnedPtr<ByteStream> requestStream,
-                OwnedPtr<ByteStream> responseStream, File* executable, File* input)
+                OwnedPtr<ByteStream> responseStream, File* executable, File* input,
+                bool forWorker)
       : context(context), executable(executable->clone()),
         requestStream(requestStream.release()),
         responseStream(responseStream.release()),
-        lineReader(this->requestStream.get()), silent(false) {
-    if (input != NULL) {
-      this->input = input->clone();
-      knownFiles.add(input->canonicalName(), input->clone());
-    }
-
+        lineReader(this->requestStream.get(), !forWorker), files(context, input),
+        forWorker(forWorker), done(false), silent(false), useWorkers(false) {
     std::string junk;
     splitExtension(executable->basename(), &verb, &junk);
   }
@@ -112,11 +201,20 @@ public:
     return eventManager->when(lineReader.readLine(eventManager))(
       [=](OwnedPtr<std::string> line) -> Promise<void> {
         if (line == nullptr) {
-          eof();
+          if (forWorker) {
+            context->log("rule worker exited in the middle of an action\n");
+            context->failed();
+          } else {
+            eof();
+          }
           return newFulfilledPromise();
         }
 
         consume(*line);
+        if (done) {
+          eof();
+          return newFulfilledPromise();
+        }
         return readAll(eventManager);
       }, [=](MaybeException<OwnedPtr<std::string>> error) {
         try {
@@ -133,9 +231,12 @@ public:
       });
   }
 
+  // Whether a worker finished the action and is ready for another.
+  bool isDone() { return done; }
+
 private:
   void consume(const std::string& line) {
-    if (findInCache(line)) return;
+    if (files.handle(line, responseStream.get())) return;
 
     std::string args = line;
     std::string command = splitToken(&args);
@@ -146,77 +247,16 @@ private:
       silent = true;
     } else if (command == "trigger") {
       triggers.push_back(Tag::fromName(args));
-    } else if (command == "findProvider" || command == "findInput") {
-      File* provider;
-      if (command == "findProvider") {
-        provider = context->findProvider(Tag::fromName(args));
-      } else if (input != NULL && args == input->canonicalName()) {
-        provider = input.get();
-      } else if (findInCache("newOutput " + args)) {
-        // File was originally created by this action.  findInCache() already wrote the path,
-        // so just return.
-        return;
-      } else {
-        provider = context->findInput(args);
-      }
-      if (provider != NULL) {
-        OwnedPtr<File::DiskRef> diskRef = provider->getOnDisk(File::READ);
-        std::string path = diskRef->path();
-        cache.insert(std::make_pair(line, diskRef.get()));
-        diskRefs.add(diskRef.release());
-        responseStream->writeAll(path.data(), path.size());
-
-        knownFiles.add(path, provider->clone());
-      }
-      responseStream->writeAll("\n", 1);
-    } else if (command == "findModifiers") {
-      auto dir = input->parent();
-      std::vector<File*> results;
-      for (;;) {
-        File* provider = context->findProvider(Tag::fromName(
-            "canonical:" + dir->relative(args)->canonicalName()));
-        if (provider != NULL) {
-          results.push_back(provider);
-        }
-        if (!dir->hasParent()) {
-          break;
-        }
-        dir = dir->parent();
-      }
-
-      for (auto iter = results.rbegin(); iter != results.rend(); ++iter) {
-        File* provider = *iter;
-        OwnedPtr<File::DiskRef> diskRef = provider->getOnDisk(File::READ);
-        std::string path = diskRef->path();
-        diskRefs.add(diskRef.release());
-        responseStream->writeAll(path.data(), path.size());
-        knownFiles.add(path, provider->clone());
-        responseStream->writeAll("\n", 1);
+    } else if (command == "worker") {
+      useWorkers = workersEnabled;
+    } else if (command == "done" && forWorker) {
+      if (!args.empty() && args != "0") {
+        context->failed();
       }
-
-      responseStream->writeAll("\n", 1);
-    } else if (command == "newProvider") {
-      // TODO:  Create a new output file and register it as a provider.
-      context->log("newProvider not implemented");
-      context->failed();
-    } else if (command == "noteInput") {
-      // The action is reading some file outside the working directory.  For now we ignore this.
-      // TODO:  Pay attention?  We could trigger rebuilds when installed tools are updated, etc.
-    } else if (command == "newOutput") {
-      OwnedPtr<File> file = context->newOutput(args);
-
-      OwnedPtr<File::DiskRef> diskRef = file->getOnDisk(File::WRITE);
-      std::string path = diskRef->path();
-
-      cache.insert(std::make_pair(line, diskRef.get()));
-      diskRefs.add(diskRef.release());
-      knownFiles.add(path, file.release());
-
-      responseStream->writeAll(path.data(), path.size());
-      responseStream->writeAll("\n", 1);
+      done = true;
     } else if (command == "provide") {
       std::string filename = splitToken(&args);
-      File* file = knownFiles.get(filename);
+      File* file = files.getKnownFile(filename);
       if (file == NULL) {
         context->log("File passed to \"provide\" not created with \"newOutput\" nor noted as an "
                      "input: " + filename + "\n");
@@ -226,7 +266,7 @@ private:
       }
     } else if (command == "install") {
       std::string filename = splitToken(&args);
-      File* file = knownFiles.get(filename);
+      File* file = files.getKnownFile(filename);
 
       if (file == NULL) {
         context->log("File passed to \"install\" not created with \"newOutput\" nor noted as an "
@@ -286,45 +326,108 @@ private:
 
     // Also register new triggers.
     context->addActionType(newOwned<PluginDerivedActionFactory>(
-        executable.release(), std::move(verb), silent, std::move(triggers)));
+        executable.release(), std::move(verb), silent, useWorkers, std::move(triggers)));
   }
 
 private:
   BuildContext* context;
   OwnedPtr<File> executable;
-  OwnedPtr<File> input;  // nullable
   OwnedPtr<ByteStream> requestStream;
   OwnedPtr<ByteStream> responseStream;
   LineReader lineReader;
+  FileRequestHandler files;
+  bool forWorker;
+  bool done;
 
   std::string verb;
   bool silent;
+  bool useWorkers;
   std::vector<Tag> triggers;
 
-  OwnedPtrMap<std::string, File> knownFiles;
-
-  typedef std::unordered_map<std::string, File::DiskRef*> CacheMap;
-  CacheMap cache;
-  OwnedPtrVector<File::DiskRef> diskRefs;
-
   typedef std::multimap<File*, Tag> ProvisionMap;
   ProvisionMap provisions;
+};
 
-  bool findInCache(const std::string& line) {
-    CacheMap::const_iterator iter = cache.find(line);
-    if (iter == cache.end()) {
-      return false;
-    } else {
-      std::string path = iter->second->path();
-      responseStream->writeAll(path.data(), path.size());
-      responseStream->writeAll("\n", 1);
-      return true;
+// Forwards a worker's stderr to the action it is working on.  The worker's stderr doesn't reach
+// EOF between actions, so unlike Logger this never reads ahead, and drain() picks up whatever is
+// left once the worker says it is done.
+class PluginDerivedAction::WorkerLogger {
+public:
+  WorkerLogger(BuildContext* context, OwnedPtr<ByteStream> stream)
+      : context(context), stream(stream.release()) {}
+  ~WorkerLogger() {}
+
+  void start(EventManager* eventManager) {
+    runOp = run(eventManager);
+  }
+
+  void drain() {
+    int available = 0;
+    while (ioctl(stream->getHandle()->get(), FIONREAD, &available) == 0 && available > 0) {
+      size_t size = stream->read(buffer, std::min<size_t>(available, sizeof(buffer)));
+      if (size == 0) {
+        break;
+      }
+      context->log(std::string(buffer, size));
     }
   }
+
+private:
+  BuildContext* context;
+  OwnedPtr<ByteStream> stream;
+  Promise<void> runOp;
+  char buffer[4096];
+
+  Promise<void> run(EventManager* eventManager) {
+    return eventManager->when(stream->readWhenReadable(eventManager, buffer, sizeof(buffer)))(
+      [=](size_t size) -> Promise<void> {
+        if (size == 0) {
+          // The worker exited.
+          return newFulfilledPromise();
+        }
+        context->log(std::string(buffer, size));
+        return run(eventManager);
+      });
+  }
 };
 
+Promise<void> PluginDerivedAction::startOnWorker(EventManager* eventManager,
+                                                 BuildContext* context) {
+  OwnedPtr<RuleWorker> worker;
+  try {
+    worker = workers->run(file.get());
+  } catch (const OsError& e) {
+    context->log(std::string("starting rule worker: ") + e.what() + "\n");
+    context->failed();
+    return newFulfilledPromise();
+  }
+
+  auto commandReader = newOwned<CommandReader>(
+      context, worker->openRequestStream(), worker->openResponseStream(), executable.get(),
+      file.get(), true);
+  auto commandOp = commandReader->readAll(eventManager);
+
+  auto logger = newOwned<WorkerLogger>(context, worker->openLogStream());
+  logger->start(eventManager);
+
+  RuleWorkerPool* workers = this->workers;
+  return eventManager->when(commandOp, worker, commandReader, logger)(
+      [workers](Void, OwnedPtr<RuleWorker> worker, OwnedPtr<CommandReader> commandReader,
+                OwnedPtr<WorkerLogger> logger) {
+        logger->drain();
+        if (commandReader->isDone()) {
+          workers->release(worker.release());
+        }
+      });
+}
+
 Promise<void> PluginDerivedAction::start(EventManager* eventManager, BuildContext* context) {
+  if (workers != NULL && file != NULL) {
+    return startOnWorker(eventManager, context);
+  }
+
   auto subprocess = newOwned<Subprocess>();
+  subprocess->setCgroup(context->getCgroup());
 
   subprocess->addArgument(executable.get(), File::READ);
   if (file != NULL) {
@@ -343,7 +446,8 @@ Promise<void> PluginDerivedAction::start(EventManager* eventManager, BuildContex
     });
 
   auto commandReader = newOwned<CommandReader>(
-      context, commandStream.release(), responseStream.release(), executable.get(), file.get());
+      context, commandStream.release(), responseStream.release(), executable.get(), file.get(),
+      false);
   auto commandOp = commandReader->readAll(eventManager);
 
   OwnedPtr<Logger> logger = newOwned<Logger>(context, logStream.release());
@@ -358,10 +462,14 @@ Promise<void> PluginDerivedAction::start(EventManager* eventManager, BuildContex
 PluginDerivedActionFactory::PluginDerivedActionFactory(OwnedPtr<File> executable,
                                                        std::string&& verb,
                                                        bool silent,
+                                                       bool useWorkers,
                                                        std::vector<Tag>&& triggers)
     : executable(executable.release()), silent(silent) {
   this->verb.swap(verb);
   this->triggers.swap(triggers);
+  if (useWorkers) {
+    workers = newOwned<RuleWorkerPool>(this->executable.get());
+  }
 }
 PluginDerivedActionFactory::~PluginDerivedActionFactory() {}
 
@@ -372,7 +480,7 @@ void PluginDerivedActionFactory::enumerateTriggerTags(
   }
 }
 OwnedPtr<Action> PluginDerivedActionFactory::tryMakeAction(const Tag& id, File* file) {
-  return newOwned<PluginDerivedAction>(executable.get(), verb, silent, file);
+  return newOwned<PluginDerivedAction>(executable.get(), verb, silent, file, workers.get());
 }
 
 // =======================================================================================
@@ -388,7 +496,16 @@ void ExecPluginActionFactory::enumerateTriggerTags(
 }
 
 OwnedPtr<Action> ExecPluginActionFactory::tryMakeAction(const Tag& id, File* file) {
-  return newOwned<PluginDerivedAction>(file, "learn", false, (File*)NULL);
+  return newOwned<PluginDerivedAction>(file, "learn", false, (File*)NULL,
+                                       (RuleWorkerPool*)NULL);
+}
+
+void ExecPluginActionFactory::setWorkersEnabled(bool enabled) {
+  workersEnabled = enabled;
+}
+
+void ExecPluginActionFactory::stopWorkers() {
+  RuleWorkerPool::stopAll();
 }
 
 }  // namespace ekam
@@ -26,6 +26,13 @@ public:
   ExecPluginActionFactory();
   ~ExecPluginActionFactory();
 
+  // Rules may ask to be kept running and sent several actions in turn.  If disabled, every
+  // action starts the rule afresh, as for rules that don't ask.
+  static void setWorkersEnabled(bool enabled);
+
+  // Kill the idle workers.  They would otherwise live as long as their rule.
+  static void stopWorkers();
+
   // implements ActionFactory ------------------------------------------------------------
   void enumerateTriggerTags(std::back_insert_iterator<std::vector<Tag> > iter);
   OwnedPtr<Action> tryMakeAction(const Tag& id, File* file);
@@ -0,0 +1,290 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "IntermediateStore.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <memory>
+#include <vector>
+
+#include "base/Debug.h"
+#include "os/ByteStream.h"
+#include "os/OsHandle.h"
+
+namespace ekam {
+
+namespace {
+
+void unlinkIfExists(const std::string& path) {
+  if (unlink(path.c_str()) < 0 && errno != ENOENT) {
+    DEBUG_ERROR << path << ": unlink: " << strerror(errno);
+  }
+}
+
+void copyFile(const std::string& from, const std::string& to) {
+  ByteStream in(from, O_RDONLY);
+  ByteStream out(to, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+  struct stat stats;
+  in.stat(&stats);
+  fchmod(out.getHandle()->get(), stats.st_mode & 07777);
+
+  std::unique_ptr<char[]> buffer(new char[1 << 20]);
+  while (true) {
+    size_t n = in.read(buffer.get(), 1 << 20);
+    if (n == 0) break;
+    out.writeAll(buffer.get(), n);
+  }
+}
+
+// Delete the directories of stores whose Ekam died without cleaning up.  Store directories are
+// named for the owning process and contain only files.
+void removeAbandonedDirectories(const std::string& ramDirectory) {
+  DIR* dir = opendir(ramDirectory.c_str());
+  if (dir == NULL) {
+    return;
+  }
+
+  while (struct dirent* entry = readdir(dir)) {
+    int pid;
+    if (sscanf(entry->d_name, "ekam-%d-", &pid) != 1 || pid == getpid() ||
+        kill(pid, 0) == 0 || errno != ESRCH) {
+      continue;
+    }
+
+    std::string path = ramDirectory + "/" + entry->d_name;
+    DIR* storeDir = opendir(path.c_str());
+    if (storeDir == NULL) {
+      continue;
+    }
+    while (struct dirent* file = readdir(storeDir)) {
+      if (strcmp(file->d_name, ".") != 0 && strcmp(file->d_name, "..") != 0) {
+        unlinkIfExists(path + "/" + file->d_name);
+      }
+    }
+    closedir(storeDir);
+
+    if (rmdir(path.c_str()) == 0) {
+      DEBUG_INFO << "Removed abandoned intermediate store: " << path;
+    }
+  }
+
+  closedir(dir);
+}
+
+std::string basenameOf(const std::string& path) {
+  std::string::size_type slashPos = path.find_last_of('/');
+  return slashPos == std::string::npos ? path : path.substr(slashPos + 1);
+}
+
+}  // namespace
+
+IntermediateStore::IntermediateStore(const std::string& ramDirectory, uint64_t budget,
+                                     const std::vector<std::string>& suffixes)
+    : budget(budget), suffixes(suffixes), nextId(0), nextSequence(1), bytesInMemory(0), spillCount(0),
+      spilledBytes(0) {
+  removeAbandonedDirectories(ramDirectory);
+
+  std::string pattern = ramDirectory + "/ekam-" + std::to_string(getpid()) + "-XXXXXX";
+  std::vector<char> buffer(pattern.begin(), pattern.end());
+  buffer.push_back('\0');
+  if (mkdtemp(buffer.data()) == NULL) {
+    throw OsError(pattern, "mkdtemp", errno);
+  }
+  directory = buffer.data();
+}
+
+IntermediateStore::~IntermediateStore() {
+  for (auto& entry: entries) {
+    if (isStillLinked(entry.first, entry.second)) {
+      unlinkIfExists(entry.first);
+    }
+    unlinkIfExists(entry.second.ramPath);
+  }
+  if (rmdir(directory.c_str()) < 0) {
+    DEBUG_ERROR << directory << ": rmdir: " << strerror(errno);
+  }
+}
+
+void IntermediateStore::place(File* output) {
+  std::string path = output->getOnDisk(File::WRITE)->path();
+  if (!isSelected(path)) {
+    return;
+  }
+
+  auto iter = entries.find(path);
+  if (iter != entries.end()) {
+    // Being rewritten by a re-run of the same action.
+    Entry& entry = iter->second;
+    if (isStillLinked(path, entry)) {
+      if (entry.sequence != 0) {
+        sealedOrder.erase(entry.sequence);
+        bytesInMemory -= entry.size;
+        entry.sequence = 0;
+        entry.size = 0;
+      }
+      return;
+    }
+    forget(path);
+  }
+
+  // Whatever is there -- an old output, or a dangling link left by a previous Ekam that did not
+  // exit cleanly -- is stale.
+  struct stat stats;
+  if (lstat(path.c_str(), &stats) == 0) {
+    if (S_ISDIR(stats.st_mode)) {
+      return;
+    }
+    unlinkIfExists(path);
+  }
+
+  Entry entry;
+  entry.ramPath = directory + "/" + std::to_string(nextId++) + "-" + basenameOf(path);
+  entry.size = 0;
+  entry.sequence = 0;
+  if (symlink(entry.ramPath.c_str(), path.c_str()) < 0) {
+    DEBUG_WARNING << path << ": symlink: " << strerror(errno) << "; writing to disk instead.";
+    return;
+  }
+  entries[path] = entry;
+}
+
+void IntermediateStore::seal(File* output) {
+  std::string path = output->getOnDisk(File::READ)->path();
+
+  auto iter = entries.find(path);
+  if (iter == entries.end()) {
+    return;
+  }
+
+  Entry& entry = iter->second;
+  if (!isStillLinked(path, entry)) {
+    // The action replaced or deleted the link, so the output (if any) is on disk already.
+    forget(path);
+    return;
+  }
+
+  if (entry.sequence != 0) {
+    sealedOrder.erase(entry.sequence);
+    bytesInMemory -= entry.size;
+  }
+
+  struct stat stats;
+  entry.size = stat(entry.ramPath.c_str(), &stats) == 0 ? stats.st_size : 0;
+  entry.sequence = nextSequence++;
+  sealedOrder[entry.sequence] = path;
+  bytesInMemory += entry.size;
+
+  enforceBudget();
+}
+
+void IntermediateStore::materialize(File* output) {
+  std::string path = output->getOnDisk(File::WRITE)->path();
+  if (entries.count(path) > 0) {
+    spill(path);
+  }
+}
+
+void IntermediateStore::dumpStats(FILE* out) {
+  fprintf(out, "%-20s %9zu files %9llu bytes in memory, %llu spilled (%llu bytes)\n",
+          "intermediate store", entries.size(), (unsigned long long)bytesInMemory,
+          (unsigned long long)spillCount, (unsigned long long)spilledBytes);
+}
+
+bool IntermediateStore::isSelected(const std::string& path) {
+  for (const std::string& suffix: suffixes) {
+    if (path.size() >= suffix.size() &&
+        path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool IntermediateStore::isStillLinked(const std::string& path, const Entry& entry) {
+  char target[4096];
+  ssize_t n = readlink(path.c_str(), target, sizeof(target));
+  return n >= 0 && static_cast<size_t>(n) == entry.ramPath.size() &&
+         entry.ramPath.compare(0, n, target, n) == 0;
+}
+
+void IntermediateStore::forget(const std::string& path) {
+  auto iter = entries.find(path);
+  if (iter == entries.end()) {
+    return;
+  }
+
+  Entry& entry = iter->second;
+  if (entry.sequence != 0) {
+    sealedOrder.erase(entry.sequence);
+    bytesInMemory -= entry.size;
+  }
+  unlinkIfExists(entry.ramPath);
+  entries.erase(iter);
+}
+
+void IntermediateStore::spill(const std::string& path) {
+  auto iter = entries.find(path);
+  if (iter == entries.end()) {
+    return;
+  }
+
+  Entry& entry = iter->second;
+  if (isStillLinked(path, entry)) {
+    struct stat stats;
+    if (stat(entry.ramPath.c_str(), &stats) < 0) {
+      // Never written:  the output doesn't exist.
+      unlinkIfExists(path);
+    } else {
+      // Copy next to the link and rename over it, so that the path always refers to a complete
+      // file.
+      std::string temporary = path + ".ekam-spill";
+      try {
+        copyFile(entry.ramPath, temporary);
+        WRAP_SYSCALL(rename, temporary.c_str(), path.c_str());
+      } catch (const OsError& e) {
+        DEBUG_ERROR << "Failed to move " << path << " out of memory: " << e.what();
+        unlinkIfExists(temporary);
+        return;
+      }
+      ++spillCount;
+      spilledBytes += stats.st_size;
+    }
+  }
+
+  forget(path);
+}
+
+void IntermediateStore::enforceBudget() {
+  while (bytesInMemory > budget && !sealedOrder.empty()) {
+    std::string path = sealedOrder.begin()->second;
+    size_t countBefore = sealedOrder.size();
+    spill(path);
+    if (sealedOrder.size() == countBefore) {
+      // Spilling failed; leave the rest for next time rather than spinning.
+      break;
+    }
+  }
+}
+
+}  // namespace ekam
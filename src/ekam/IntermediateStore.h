@@ -0,0 +1,94 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KENTONSCODE_EKAM_INTERMEDIATESTORE_H_
+#define KENTONSCODE_EKAM_INTERMEDIATESTORE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "os/File.h"
+
+namespace ekam {
+
+// Keeps selected action outputs in memory rather than in tmp/.  Each output's path in tmp/ becomes a
+// symlink to a file in a private directory on a RAM-backed filesystem (normally /dev/shm), so
+// that the actions writing and reading it -- and Ekam itself -- still use the same path.
+//
+// Once the outputs of completed actions total more than the budget, the least recently written
+// ones are spilled:  copied to their real place in tmp/, replacing the link.  Outputs are also
+// spilled before being installed, so nothing outside tmp/ ever points into memory.  An action
+// that deletes or replaces its output (as many linkers do) just ends up writing to disk.
+//
+// Outputs still in memory are deleted when the store is destroyed.
+class IntermediateStore {
+public:
+  // Creates a private directory under `ramDirectory`.  Only outputs whose names end with one of
+  // `suffixes` are kept in memory.
+  IntermediateStore(const std::string& ramDirectory, uint64_t budget,
+                    const std::vector<std::string>& suffixes);
+  ~IntermediateStore();
+
+  // Called when an action declares an output, before it is written.  Outputs that weren't
+  // selected are left alone.
+  void place(File* output);
+
+  // Called when the action that wrote the output has finished.  Only finished outputs count
+  // against the budget or are spilled.
+  void seal(File* output);
+
+  // Make sure the output is a real file in tmp/.
+  void materialize(File* output);
+
+  void dumpStats(FILE* out);
+
+private:
+  struct Entry {
+    std::string ramPath;
+    uint64_t size;
+    uint64_t sequence;  // Zero until sealed.
+  };
+
+  std::string directory;
+  uint64_t budget;
+  std::vector<std::string> suffixes;
+  uint64_t nextId;
+  uint64_t nextSequence;
+
+  uint64_t bytesInMemory;
+  uint64_t spillCount;
+  uint64_t spilledBytes;
+
+  // By path in tmp/.
+  std::unordered_map<std::string, Entry> entries;
+
+  // Sealed entries, oldest first.
+  std::map<uint64_t, std::string> sealedOrder;
+
+  bool isSelected(const std::string& path);
+  bool isStillLinked(const std::string& path, const Entry& entry);
+  void forget(const std::string& path);
+  void spill(const std::string& path);
+  void enforceBudget();
+};
+
+}  // namespace ekam
+
+#endif  // KENTONSCODE_EKAM_INTERMEDIATESTORE_H_
@@ -0,0 +1,159 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "IntermediateStore.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+
+#include "os/DiskFile.h"
+
+namespace ekam {
+namespace {
+
+#define ASSERT(EXPRESSION)                                                    \
+  if (!(EXPRESSION)) {                                                        \
+    fprintf(stderr, "%s:%d: FAILED: %s\n", __FILE__, __LINE__, #EXPRESSION);  \
+    exit(1);                                                                  \
+  }
+
+std::string makeTempDir() {
+  char pattern[] = "/tmp/ekam-test-XXXXXX";
+  ASSERT(mkdtemp(pattern) != NULL);
+  return pattern;
+}
+
+void writeFile(const std::string& path, const char* content) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  ASSERT(fd >= 0);
+  ASSERT(write(fd, content, strlen(content)) == (ssize_t)strlen(content));
+  close(fd);
+}
+
+std::string readFile(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  ASSERT(fd >= 0);
+  char buffer[256];
+  ssize_t n = read(fd, buffer, sizeof(buffer));
+  ASSERT(n >= 0);
+  close(fd);
+  return std::string(buffer, n);
+}
+
+bool isLink(const std::string& path) {
+  struct stat stats;
+  return lstat(path.c_str(), &stats) == 0 && S_ISLNK(stats.st_mode);
+}
+
+bool isRegularFile(const std::string& path) {
+  struct stat stats;
+  return lstat(path.c_str(), &stats) == 0 && S_ISREG(stats.st_mode);
+}
+
+size_t countEntries(const std::string& path) {
+  DIR* dir = opendir(path.c_str());
+  ASSERT(dir != NULL);
+  size_t count = 0;
+  while (struct dirent* entry = readdir(dir)) {
+    if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+      ++count;
+    }
+  }
+  closedir(dir);
+  return count;
+}
+
+void testIntermediateStore() {
+  std::string tmpPath = makeTempDir();
+  std::string ramPath = makeTempDir();
+  DiskFile tmp(tmpPath, NULL);
+
+  std::vector<std::string> suffixes;
+  suffixes.push_back(".syms");
+  suffixes.push_back(".deps");
+
+  {
+    // Room for one ten-byte output but not two.
+    IntermediateStore store(ramPath, 15, suffixes);
+    ASSERT(countEntries(ramPath) == 1);
+
+    OwnedPtr<File> syms = tmp.relative("a.o.syms");
+    OwnedPtr<File> deps = tmp.relative("a.o.deps");
+    OwnedPtr<File> object = tmp.relative("a.o");
+    std::string symsPath = tmpPath + "/a.o.syms";
+    std::string depsPath = tmpPath + "/a.o.deps";
+    std::string objectPath = tmpPath + "/a.o";
+
+    // Only selected outputs go to memory.
+    store.place(syms.get());
+    store.place(object.get());
+    ASSERT(isLink(symsPath));
+    ASSERT(!isLink(objectPath));
+    writeFile(symsPath, "0123456789");
+    writeFile(objectPath, "object");
+    store.seal(syms.get());
+    store.seal(object.get());
+    ASSERT(isLink(symsPath));
+    ASSERT(isRegularFile(objectPath));
+
+    // Going over budget spills the oldest output.
+    store.place(deps.get());
+    writeFile(depsPath, "abcdefghij");
+    ASSERT(isLink(depsPath));
+    ASSERT(isLink(symsPath));
+    store.seal(deps.get());
+    ASSERT(isRegularFile(symsPath));
+    ASSERT(readFile(symsPath) == "0123456789");
+    ASSERT(isLink(depsPath));
+    ASSERT(readFile(depsPath) == "abcdefghij");
+
+    // Unsealed outputs don't count against the budget, so a re-run's output stays in memory
+    // until it is done.
+    store.place(syms.get());
+    ASSERT(isLink(symsPath));
+    writeFile(symsPath, "9876543210");
+    ASSERT(isLink(depsPath));
+
+    // Installed outputs are moved to disk.
+    store.materialize(deps.get());
+    ASSERT(isRegularFile(depsPath));
+    ASSERT(readFile(depsPath) == "abcdefghij");
+  }
+
+  // Anything left in memory is deleted along with the store.
+  ASSERT(countEntries(ramPath) == 0);
+  ASSERT(!isRegularFile(tmpPath + "/a.o.syms"));
+
+  unlink((tmpPath + "/a.o.syms").c_str());
+  unlink((tmpPath + "/a.o.deps").c_str());
+  unlink((tmpPath + "/a.o").c_str());
+  rmdir(tmpPath.c_str());
+  rmdir(ramPath.c_str());
+}
+
+}  // namespace
+}  // namespace ekam
+
+int main(int argc, char* argv[]) {
+  ekam::testIntermediateStore();
+  return 0;
+}
@@ -33,10 +33,13 @@ public:
   // implements Task ---------------------------------------------------------------------
   void setState(TaskState state);
   void addOutput(const std::string& text);
+  void setResourceUsage(const ResourceUsage& usage);
 
 private:
   MuxDashboard* mux;
   TaskState state;
+  bool hasResourceUsage;
+  ResourceUsage resourceUsage;
   Silence silence;
   std::string verb;
   std::string noun;
@@ -46,13 +49,15 @@ private:
   WrappedTasksMap wrappedTasks;
 
   static const size_t OUTPUT_BUFER_LIMIT = 4096 - sizeof("\n...(log truncated)...");
+
+  friend class MuxDashboard;
 };
 
 const size_t MuxDashboard::TaskImpl::OUTPUT_BUFER_LIMIT;
 
 MuxDashboard::TaskImpl::TaskImpl(MuxDashboard* mux, const std::string& verb,
                                  const std::string& noun, Silence silence)
-    : mux(mux), state(PENDING), silence(silence), verb(verb), noun(noun) {
+    : mux(mux), state(PENDING), hasResourceUsage(false), silence(silence), verb(verb), noun(noun) {
   mux->tasks.insert(this);
 
   for (std::unordered_set<Dashboard*>::iterator iter = mux->wrappedDashboards.begin();
@@ -69,6 +74,9 @@ void MuxDashboard::TaskImpl::attach(Dashboard* dashboard) {
   if (!outputText.empty()) {
     wrappedTask->addOutput(outputText);
   }
+  if (hasResourceUsage) {
+    wrappedTask->setResourceUsage(resourceUsage);
+  }
   if (state != PENDING) {
     wrappedTask->setState(state);
   }
@@ -87,6 +95,7 @@ void MuxDashboard::TaskImpl::detach(Dashboard* dashboard) {
 void MuxDashboard::TaskImpl::setState(TaskState state) {
   if (state == PENDING || state == RUNNING) {
     outputText.clear();
+    hasResourceUsage = false;
   }
 
   this->state = state;
@@ -110,6 +119,15 @@ void MuxDashboard::TaskImpl::addOutput(const std::string& text) {
   }
 }
 
+void MuxDashboard::TaskImpl::setResourceUsage(const ResourceUsage& usage) {
+  hasResourceUsage = true;
+  resourceUsage = usage;
+
+  for (WrappedTasksMap::Iterator iter(wrappedTasks); iter.next();) {
+    iter.value()->setResourceUsage(usage);
+  }
+}
+
 // =======================================================================================
 
 MuxDashboard::MuxDashboard() {}
@@ -120,6 +138,17 @@ OwnedPtr<Dashboard::Task> MuxDashboard::beginTask(const std::string& verb, const
   return newOwned<TaskImpl>(this, verb, noun, silence);
 }
 
+size_t MuxDashboard::retainedLogBytes() {
+  size_t result = 0;
+  for (TaskImpl* task: tasks) {
+    result += task->outputText.capacity();
+  }
+  for (Dashboard* dashboard: wrappedDashboards) {
+    result += dashboard->retainedLogBytes();
+  }
+  return result;
+}
+
 MuxDashboard::Connector::Connector(MuxDashboard* mux, Dashboard* dashboard)
     : mux(mux), dashboard(dashboard) {
   if (!mux->wrappedDashboards.insert(dashboard).second) {
@@ -40,6 +40,7 @@ public:
 
   // implements Dashboard ----------------------------------------------------------------
   OwnedPtr<Task> beginTask(const std::string& verb, const std::string& noun, Silence silence);
+  size_t retainedLogBytes();
 
 private:
   class TaskImpl;
@@ -37,6 +37,7 @@ public:
   // implements Task ---------------------------------------------------------------------
   void setState(TaskState state);
   void addOutput(const std::string& text);
+  void setResourceUsage(const ResourceUsage& usage);
 
 private:
   int id;
@@ -91,6 +92,22 @@ void ProtoDashboard::TaskImpl::addOutput(const std::string& text) {
   output->write(message.getSegmentsForOutput());
 }
 
+void ProtoDashboard::TaskImpl::setResourceUsage(const ResourceUsage& usage) {
+  capnp::MallocMessageBuilder message;
+  proto::TaskUpdate::Builder update = message.getRoot<proto::TaskUpdate>();
+  update.setId(id);
+  proto::ResourceUsage::Builder usageBuilder = update.initResourceUsage();
+  usageBuilder.setProcessCount(usage.processCount);
+  usageBuilder.setUserMicros(usage.userMicros);
+  usageBuilder.setSystemMicros(usage.systemMicros);
+  usageBuilder.setMaxRssKilobytes(usage.maxRssKilobytes);
+  usageBuilder.setBlockInputs(usage.blockInputs);
+  usageBuilder.setBlockOutputs(usage.blockOutputs);
+  usageBuilder.setVoluntaryContextSwitches(usage.voluntaryContextSwitches);
+  usageBuilder.setInvoluntaryContextSwitches(usage.involuntaryContextSwitches);
+  output->write(message.getSegmentsForOutput());
+}
+
 // =======================================================================================
 
 ProtoDashboard::ProtoDashboard(EventManager* eventManager, OwnedPtr<ByteStream> stream)
@@ -209,6 +226,9 @@ public:
   OwnedPtr<Task> beginTask(const std::string& verb, const std::string& noun, Silence silence) {
     return mux.beginTask(verb, noun, silence);
   }
+  size_t retainedLogBytes() {
+    return mux.retainedLogBytes();
+  }
 
 private:
   EventManager* eventManager;
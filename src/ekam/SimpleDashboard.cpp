@@ -20,7 +20,8 @@ namespace ekam {
 
 class SimpleDashboard::TaskImpl : public Dashboard::Task {
 public:
-  TaskImpl(const std::string& verb, const std::string& noun, Silence silence, FILE* outputStream);
+  TaskImpl(SimpleDashboard* dashboard, const std::string& verb, const std::string& noun,
+           Silence silence);
   ~TaskImpl();
 
   // implements Task ---------------------------------------------------------------------
@@ -28,6 +29,7 @@ public:
   void addOutput(const std::string& text);
 
 private:
+  SimpleDashboard* dashboard;
   TaskState state;
   Silence silence;
   std::string verb;
@@ -36,6 +38,8 @@ private:
   FILE* outputStream;
 
   static const char* const STATE_NAMES[];
+
+  friend class SimpleDashboard;
 };
 
 const char* const SimpleDashboard::TaskImpl::STATE_NAMES[] = {
@@ -47,10 +51,15 @@ const char* const SimpleDashboard::TaskImpl::STATE_NAMES[] = {
   "BLOCKED"
 };
 
-SimpleDashboard::TaskImpl::TaskImpl(const std::string& verb, const std::string& noun,
-                                    Silence silence, FILE* outputStream)
-    : state(PENDING), silence(silence), verb(verb), noun(noun), outputStream(outputStream) {}
-SimpleDashboard::TaskImpl::~TaskImpl() {}
+SimpleDashboard::TaskImpl::TaskImpl(SimpleDashboard* dashboard, const std::string& verb,
+                                    const std::string& noun, Silence silence)
+    : dashboard(dashboard), state(PENDING), silence(silence), verb(verb), noun(noun),
+      outputStream(dashboard->outputStream) {
+  dashboard->tasks.insert(this);
+}
+SimpleDashboard::TaskImpl::~TaskImpl() {
+  dashboard->tasks.erase(this);
+}
 
 void SimpleDashboard::TaskImpl::setState(TaskState state) {
   // If state was previously BLOCKED, and we managed to un-block, then we don't care about the
@@ -91,7 +100,15 @@ SimpleDashboard::~SimpleDashboard() {}
 
 OwnedPtr<Dashboard::Task> SimpleDashboard::beginTask(
     const std::string& verb, const std::string& noun, Silence silence) {
-  return newOwned<TaskImpl>(verb, noun, silence, outputStream);
+  return newOwned<TaskImpl>(this, verb, noun, silence);
+}
+
+size_t SimpleDashboard::retainedLogBytes() {
+  size_t result = 0;
+  for (TaskImpl* task: tasks) {
+    result += task->outputText.capacity();
+  }
+  return result;
 }
 
 }  // namespace ekam
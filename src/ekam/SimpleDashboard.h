@@ -18,6 +18,7 @@
 #define KENTONSCODE_EKAM_SIMPLEDASHBOARD_H_
 
 #include <stdio.h>
+#include <unordered_set>
 
 #include "Dashboard.h"
 
@@ -30,11 +31,13 @@ public:
 
   // implements Dashboard ----------------------------------------------------------------
   OwnedPtr<Task> beginTask(const std::string& verb, const std::string& noun, Silence silence);
+  size_t retainedLogBytes();
 
 private:
   class TaskImpl;
 
   FILE* outputStream;
+  std::unordered_set<TaskImpl*> tasks;
 };
 
 }  // namespace ekam
@@ -26,6 +26,19 @@
 
 namespace ekam {
 
+ResourceUsage toResourceUsage(proto::ResourceUsage::Reader message) {
+  ResourceUsage usage;
+  usage.processCount = message.getProcessCount();
+  usage.userMicros = message.getUserMicros();
+  usage.systemMicros = message.getSystemMicros();
+  usage.maxRssKilobytes = message.getMaxRssKilobytes();
+  usage.blockInputs = message.getBlockInputs();
+  usage.blockOutputs = message.getBlockOutputs();
+  usage.voluntaryContextSwitches = message.getVoluntaryContextSwitches();
+  usage.involuntaryContextSwitches = message.getInvoluntaryContextSwitches();
+  return usage;
+}
+
 void dump(proto::TaskUpdate::Reader message) {
   using std::cerr;
   using std::cout;
@@ -48,6 +61,11 @@ void dump(proto::TaskUpdate::Reader message) {
   }
   cout << '\n';
 
+  if (message.hasResourceUsage()) {
+    ResourceUsage usage = toResourceUsage(message.getResourceUsage());
+    cout << "resources: " << usage.processCount << " processes, " << usage.toString() << '\n';
+  }
+
   if (message.hasLog()) {
     auto log = message.getLog();
     cout << log.cStr();
@@ -130,6 +148,9 @@ int main(int argc, char* argv[]) {
       if (message.hasLog()) {
         task->addOutput(message.getLog());
       }
+      if (message.hasResourceUsage()) {
+        task->setResourceUsage(toResourceUsage(message.getResourceUsage()));
+      }
       if (message.getState() != proto::TaskUpdate::State::UNCHANGED) {
         task->setState(toDashboardState(message.getState()));
       }
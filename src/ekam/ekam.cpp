@@ -15,6 +15,11 @@
 // limitations under the License.
 
 #include <string>
+#include <utility>
+#include <vector>
+#include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
@@ -25,18 +30,31 @@
 #include <signal.h>
 #include <fcntl.h>
 #include <sys/file.h>
+#include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <termios.h>
 
 #include "Driver.h"
+#include "IntermediateStore.h"
 #include "base/Debug.h"
 #include "os/DiskFile.h"
+#ifdef __linux__
+#include "os/EpollEventManager.h"
+#include "os/IoUringEventManager.h"
+#endif
 #include "Action.h"
 #include "SimpleDashboard.h"
 #include "ConsoleDashboard.h"
 #include "CppActionFactory.h"
 #include "ExecPluginActionFactory.h"
+#include "os/Cgroup.h"
+#include "os/Subprocess.h"
 #include "os/OsHandle.h"
+#include "os/HashCache.h"
+#include "os/IoBatch.h"
+#include "os/TreeScanner.h"
+#include "base/IgnoreRules.h"
 
 namespace ekam {
 
@@ -100,7 +118,7 @@ public:
 
 void usage(const char* command, FILE* out) {
   fprintf(out,
-    "usage: %s [-hvc] [-j <jobcount>] [-n [<addr>]:<port>] [-l <count>]\n"
+    "usage: %s [-hvc] [-j <jobcount>] [-n [<addr>]:<port>] [-l <count>] [-m <MB>]\n"
     "\n"
     "Build code with Ekam. See https://github.io/sandstorm-io/ekam for details.\n"
     "\n"
@@ -119,8 +137,22 @@ void usage(const char* command, FILE* out) {
     "                to see more of a particular error log. NOTE: If you just\n"
     "                need a one-off, you can use `ekam-client` rather than\n"
     "                restarting Ekam.\n"
+    "  -m <MB>       Keep up to <MB> megabytes of intermediate outputs in memory\n"
+    "                (in $EKAM_RAM_DIR, default /dev/shm) rather than writing\n"
+    "                them to tmp/. Outputs beyond that, and anything installed,\n"
+    "                are moved to tmp/. Whatever is still in memory is deleted\n"
+    "                when Ekam exits. Only outputs whose names end with one of the\n"
+    "                comma-separated suffixes in $EKAM_RAM_OUTPUTS (default\n"
+    "                \".syms,.deps\") are kept in memory.\n"
     "  -h            See this help\n"
-    "  -v            Show debug logs.\n",
+    "  -v            Show debug logs.\n"
+    "\n"
+    "Files and directories matching the .gitignore-style patterns in\n"
+    "src/.ekamignore are not scanned, watched, or built. Changes to that file\n"
+    "take effect the next time Ekam starts.\n"
+    "\n"
+    "Send SIGUSR1 to a running Ekam to have it write memory usage statistics\n"
+    "to tmp/.ekam-stats.\n",
     command);
 }
 
@@ -146,12 +178,24 @@ public:
     asyncOp.release();
     diskRef = file->getOnDisk(File::READ);
     watcher = eventManager->watchFile(diskRef->path());
+    snapshot = takeSnapshot();
     waitForEvent();
   }
 
   void waitForEvent() {
     asyncOp = eventManager->when(watcher->onChange())(
       [this](EventManager::FileChangeType changeType) {
+        file->invalidateCache();
+        if (changeType == EventManager::FileChangeType::UNKNOWN) {
+          // Events were dropped.  Work out from the file itself whether anything happened.
+          changeType = recheck();
+          if (changeType == EventManager::FileChangeType::UNKNOWN) {
+            waitForEvent();
+            return;
+          }
+        }
+
+        snapshot = takeSnapshot();
         switch (changeType) {
           case EventManager::FileChangeType::MODIFIED:
             modified();
@@ -159,6 +203,8 @@ public:
           case EventManager::FileChangeType::DELETED:
             deleted();
             break;
+          case EventManager::FileChangeType::UNKNOWN:
+            break;
         }
         waitForEvent();
       });
@@ -172,6 +218,11 @@ public:
     return asyncOp == nullptr;
   }
 
+  // See EventManager::FileWatcher::getChangedChildren().
+  bool getChangedChildren(std::vector<std::string>* names) {
+    return watcher->getChangedChildren(names);
+  }
+
   virtual void created() = 0;
   virtual void modified() = 0;
   virtual void deleted() = 0;
@@ -181,6 +232,51 @@ private:
   OwnedPtr<File::DiskRef> diskRef;
   OwnedPtr<EventManager::FileWatcher> watcher;
   Promise<void> asyncOp;
+
+  // What the file looked like when we last reported on it, used to decide what to report when
+  // events have been lost.
+  struct Snapshot {
+    bool exists;
+    dev_t device;
+    ino_t inode;
+    mode_t type;
+    off_t size;
+    struct timespec mtime;
+  };
+  Snapshot snapshot;
+
+  Snapshot takeSnapshot() {
+    Snapshot result;
+    struct stat stats;
+    result.exists = stat(diskRef->path().c_str(), &stats) == 0;
+    if (result.exists) {
+      result.device = stats.st_dev;
+      result.inode = stats.st_ino;
+      result.type = stats.st_mode & S_IFMT;
+      result.size = stats.st_size;
+      result.mtime = stats.st_mtim;
+    }
+    return result;
+  }
+
+  EventManager::FileChangeType recheck() {
+    Snapshot current = takeSnapshot();
+    if (!current.exists || !snapshot.exists || current.device != snapshot.device ||
+        current.inode != snapshot.inode || current.type != snapshot.type) {
+      // Gone, or replaced by a different file.  deleted() sorts out which.
+      return EventManager::FileChangeType::DELETED;
+    } else if (current.size != snapshot.size ||
+               current.mtime.tv_sec != snapshot.mtime.tv_sec ||
+               current.mtime.tv_nsec != snapshot.mtime.tv_nsec) {
+      return EventManager::FileChangeType::MODIFIED;
+    } else if (isDirectory) {
+      // Adding or removing a directory's children updates its mtime, but not necessarily by a
+      // visible amount when it happens within one clock tick.  Re-listing is cheap.
+      return EventManager::FileChangeType::MODIFIED;
+    } else {
+      return EventManager::FileChangeType::UNKNOWN;
+    }
+  }
 };
 
 class FileWatcher : public Watcher {
@@ -222,90 +318,56 @@ public:
 class DirectoryWatcher : public Watcher {
   typedef OwnedPtrMap<File*, Watcher, File::HashFunc, File::EqualFunc> ChildMap;
 public:
-  DirectoryWatcher(OwnedPtr<File> file, EventManager* eventManager, Driver* driver)
-      : Watcher(file.release(), eventManager, driver, true) {}
+  DirectoryWatcher(OwnedPtr<File> file, EventManager* eventManager, Driver* driver,
+                   const IgnoreRules* ignoreRules)
+      : Watcher(file.release(), eventManager, driver, true), ignoreRules(ignoreRules) {}
   ~DirectoryWatcher() {}
 
   // implements FileChangeCallback -------------------------------------------------------
   void created() {
     driver->addSourceFile(file.get());
-    modified();
+    relist();
   }
   void modified() {
-    DEBUG_INFO << "Directory modified: " << file->canonicalName();
-
-    OwnedPtrVector<File> list;
-    try {
-      file->list(list.appender());
-    } catch (OsError& e) {
-      // Probably the directory has been deleted but we weren't yet notified.
-      reallyDeleted();
+    std::vector<std::string> names;
+    if (!getChangedChildren(&names)) {
+      relist();
       return;
     }
 
-    ChildMap newChildren;
+    DEBUG_INFO << "Directory modified: " << file->canonicalName() << " (" << names.size()
+               << " children changed)";
+    for (const std::string& name: names) {
+      if (name[0] == '.') {
+        // list() skips hidden files too.
+        continue;
+      }
 
-    // Build new child list, copying over child watchers where possible.
-    for (int i = 0; i < list.size(); i++) {
-      OwnedPtr<File> childFile = list.release(i);
+      OwnedPtr<File> childFile = file->relative(name);
+      childFile->invalidateCache();
 
       OwnedPtr<Watcher> child;
-      bool childIsDirectory = childFile->isDirectory();
-
-      // When a file is deleted and replaced with a new one of the same type, we run into a lot
-      // of awkward race conditions.  There are three things that can happen in any order:
-      // 1) Notification of file deletion.
-      // 2) Notification of directory change.
-      // 3) New file is created.
-      //
-      // Here is how we handle each possible ordering:
-      // 1, 2, 3)  File will not show up in directory list, so we won't transfer the watcher or
-      //   create a new one.  It will be destroyed.
-      // 1, 3, 2)  child->isDeleted will be true so we'll create a new watcher to replace it.
-      // 2, 1, 3)  Like 1, 2, 3 except we directly call deleted() on the old child watcher from
-      //   this function (see below).  We actually never receive the file deletion event from
-      //   the EventManager in this case.
-      // 2, 3, 1)  Same as 2, 1, 3.
-      // 3, 1, 2)  File watcher notices new file already exists and simply resumes watching.
-      //   Parent watcher thinks nothing happened.
-      // 3, 2, 1)  Same as 3, 1, 2.
-      //
-      // The last two are different if a file was replaced with a directory or vice versa:
-      // 3, 1, 2)  Child watcher notices replacement is a different type and so does not resume
-      //   watching.  The parent notices child->isDeleted is true and replaces it.
-      // 3, 2, 1)  The parent notices that child->isDirectory does not match the type of the new
-      //   file, and so deletes the child watcher explicitly.
-      if (!children.release(childFile.get(), &child) ||
-          child->isDeleted() || child->isDirectory != childIsDirectory) {
-        if (childIsDirectory) {
-          child = newOwned<DirectoryWatcher>(childFile.release(), eventManager, driver);
-        } else {
-          child = newOwned<FileWatcher>(childFile.release(), eventManager, driver);
+      if (!childFile->exists()) {
+        // Deleted or renamed away.
+        if (children.release(childFile.get(), &child) && !child->isDeleted()) {
+          child->reallyDeleted();
         }
-        child->created();
+        continue;
       }
 
-      File* key = child->file.get();  // cannot inline due to undefined evaluation order
-      newChildren.add(key, child.release());
-    }
-
-    // Make sure remaining children have been notified of deletion before we destroy the objects.
-    for (ChildMap::Iterator iter(children); iter.next();) {
-      if (!iter.value()->isDeleted()) {
-        iter.value()->reallyDeleted();
+      child = updateChild(childFile.release());
+      if (child != nullptr) {
+        File* key = child->file.get();  // cannot inline due to undefined evaluation order
+        children.add(key, child.release());
       }
     }
-
-    // Swap in new children.
-    children.swap(&newChildren);
   }
-
   void deleted() {
     if (file->isDirectory()) {
       // A new directory was created in place of the old.  Reset the watch.
       DEBUG_INFO << "Directory replaced: " << file->canonicalName();
       resetWatch();
-      modified();
+      relist();
     } else {
       reallyDeleted();
     }
@@ -327,12 +389,153 @@ public:
     children.clear();
   }
 
+  // Compare the whole directory listing against our children.  Used for the initial scan and
+  // whenever the watcher can't say which children changed.
+  void relist() {
+    DEBUG_INFO << "Directory modified: " << file->canonicalName();
+
+    OwnedPtrVector<File> list;
+    try {
+      file->list(list.appender());
+    } catch (OsError& e) {
+      // Probably the directory has been deleted but we weren't yet notified.
+      reallyDeleted();
+      return;
+    }
+
+    ChildMap newChildren;
+
+    // Build new child list, copying over child watchers where possible.
+    for (int i = 0; i < list.size(); i++) {
+      OwnedPtr<Watcher> child = updateChild(list.release(i));
+      if (child != nullptr) {
+        File* key = child->file.get();  // cannot inline due to undefined evaluation order
+        newChildren.add(key, child.release());
+      }
+    }
+
+    // Make sure remaining children have been notified of deletion before we destroy the objects.
+    for (ChildMap::Iterator iter(children); iter.next();) {
+      if (!iter.value()->isDeleted()) {
+        iter.value()->reallyDeleted();
+      }
+    }
+
+    // Swap in new children.
+    children.swap(&newChildren);
+  }
+
 private:
+  const IgnoreRules* ignoreRules;
   ChildMap children;
+
+  // Takes the watcher for an existing child out of `children`, or creates a new one if there is
+  // none or it no longer fits.  Returns null if the child is ignored.
+  OwnedPtr<Watcher> updateChild(OwnedPtr<File> childFile) {
+    OwnedPtr<Watcher> child;
+    bool childIsDirectory = childFile->isDirectory();
+
+    if (ignoreRules->matches(childFile->canonicalName(), childIsDirectory)) {
+      // Not watched at all.
+      return nullptr;
+    }
+
+    // When a file is deleted and replaced with a new one of the same type, we run into a lot
+    // of awkward race conditions.  There are three things that can happen in any order:
+    // 1) Notification of file deletion.
+    // 2) Notification of directory change.
+    // 3) New file is created.
+    //
+    // Here is how we handle each possible ordering:
+    // 1, 2, 3)  File will not show up in directory list, so we won't transfer the watcher or
+    //   create a new one.  It will be destroyed.
+    // 1, 3, 2)  child->isDeleted will be true so we'll create a new watcher to replace it.
+    // 2, 1, 3)  Like 1, 2, 3 except we directly call deleted() on the old child watcher from
+    //   this function (see below).  We actually never receive the file deletion event from
+    //   the EventManager in this case.
+    // 2, 3, 1)  Same as 2, 1, 3.
+    // 3, 1, 2)  File watcher notices new file already exists and simply resumes watching.
+    //   Parent watcher thinks nothing happened.
+    // 3, 2, 1)  Same as 3, 1, 2.
+    //
+    // The last two are different if a file was replaced with a directory or vice versa:
+    // 3, 1, 2)  Child watcher notices replacement is a different type and so does not resume
+    //   watching.  The parent notices child->isDeleted is true and replaces it.
+    // 3, 2, 1)  The parent notices that child->isDirectory does not match the type of the new
+    //   file, and so deletes the child watcher explicitly.
+    if (!children.release(childFile.get(), &child) ||
+        child->isDeleted() || child->isDirectory != childIsDirectory) {
+      if (childIsDirectory) {
+        child = newOwned<DirectoryWatcher>(childFile.release(), eventManager, driver,
+                                           ignoreRules);
+      } else {
+        child = newOwned<FileWatcher>(childFile.release(), eventManager, driver);
+      }
+      child->created();
+    }
+    return child;
+  }
 };
 
 // =======================================================================================
 
+// Writes memory statistics to tmp/.ekam-stats whenever SIGUSR1 is received.
+class StatsReporter {
+public:
+  StatsReporter(RunnableEventManager* eventManager, Driver* driver, HashCache* hashCache)
+      : eventManager(eventManager), driver(driver), hashCache(hashCache),
+        signalOp(waitForSignal()) {}
+  ~StatsReporter() {}
+
+private:
+  RunnableEventManager* eventManager;
+  Driver* driver;
+  HashCache* hashCache;
+  Promise<void> signalOp;
+
+  Promise<void> waitForSignal() {
+    return eventManager->when(eventManager->onSignal(SIGUSR1))(
+      [this](Void) {
+        report();
+        return waitForSignal();
+      });
+  }
+
+  void report() {
+    // Write to a temporary and rename so that readers never see a partial report.
+    FILE* out = fopen("tmp/.ekam-stats.partial", "w");
+    if (out == NULL) {
+      DEBUG_ERROR << "tmp/.ekam-stats.partial: " << strerror(errno);
+      return;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(out, "%-20s %9ld KiB\n", "max RSS", usage.ru_maxrss);
+
+    driver->dumpStats(out);
+    eventManager->dumpStats(out);
+
+    if (hashCache != NULL) {
+      fprintf(out, "%-20s %9llu hits %9llu misses %9llu racy\n", "hash cache",
+              (unsigned long long)hashCache->getHitCount(),
+              (unsigned long long)hashCache->getMissCount(),
+              (unsigned long long)hashCache->getRacyCount());
+    }
+
+    DiskFile::StatCacheCounters statCache = DiskFile::getStatCacheCounters();
+    fprintf(out, "%-20s %9llu hits %9llu misses %9llu invalidated %9llu stale\n", "stat cache",
+            (unsigned long long)statCache.hits, (unsigned long long)statCache.misses,
+            (unsigned long long)statCache.invalidations,
+            (unsigned long long)statCache.staleEntries);
+
+    fclose(out);
+    if (rename("tmp/.ekam-stats.partial", "tmp/.ekam-stats") < 0) {
+      DEBUG_ERROR << "rename(tmp/.ekam-stats): " << strerror(errno);
+    }
+  }
+};
+
 class EkamLocks final: public Driver::ActivityObserver {
 public:
   EkamLocks(File* tmp)
@@ -411,26 +614,109 @@ private:
 
 // =======================================================================================
 
-void scanSourceTree(File* src, Driver* driver) {
-  OwnedPtrVector<File> fileQueue;
+void collectScannedTree(const TreeScanner::Entry& entry, OwnedPtr<File> file,
+                        OwnedPtrVector<File>* output) {
+  if (entry.error != 0) {
+    DEBUG_ERROR << file->canonicalName() << ": " << strerror(entry.error);
+  }
 
-  {
-    fileQueue.add(src->clone());
+  File* parent = file.get();  // cannot inline due to undefined evaluation order
+  output->add(file.release());
+  for (const TreeScanner::Entry& child: entry.children) {
+    collectScannedTree(child, parent->relative(child.name), output);
   }
+}
 
-  while (!fileQueue.empty()) {
-    OwnedPtr<File> current = fileQueue.releaseBack();
+void scanSourceTree(File* src, Driver* driver, const IgnoreRules* ignoreRules) {
+  if (!src->isDirectory()) {
+    driver->addSourceFile(src);
+    return;
+  }
 
-    if (current->isDirectory()) {
-      OwnedPtrVector<File> list;
-      current->list(list.appender());
-      for (int i = 0; i < list.size(); i++) {
-        fileQueue.add(list.release(i));
-      }
+  // The directory listing happens on a thread pool; only the Driver calls happen here, in
+  // sorted pre-order.
+  TreeScanner scanner(0, ignoreRules);
+  TreeScanner::Entry root = scanner.scan(src->getOnDisk(File::READ)->path());
+  DEBUG_INFO << "Scanned " << scanner.getDirectoryCount() << " directories, "
+             << scanner.getEntryCount() << " entries, ignored "
+             << scanner.getIgnoredCount() << "; " << scanner.getDuplicateCount()
+             << " directories were copies reached through symlinks, "
+             << scanner.getLoopCount() << " symlink loops.";
+
+  OwnedPtrVector<File> files;
+  collectScannedTree(root, src->clone(), &files);
+
+  // Stat and hash the files in batches before the Driver asks for them one by one.
+  std::vector<File*> filePtrs;
+  for (int i = 0; i < files.size(); i++) {
+    filePtrs.push_back(files.get(i));
+  }
+  DiskFile::prefetch(filePtrs);
+
+  for (int i = 0; i < files.size(); i++) {
+    driver->addSourceFile(files.get(i));
+  }
+}
+
+// Parses a comma-separated list of verb=seconds.
+bool parseTimeouts(const std::string& spec, std::vector<std::pair<std::string, int> >* output) {
+  std::string::size_type pos = 0;
+  while (pos < spec.size()) {
+    std::string::size_type end = spec.find_first_of(',', pos);
+    if (end == std::string::npos) {
+      end = spec.size();
+    }
+    std::string item(spec, pos, end - pos);
+    pos = end + 1;
+
+    std::string::size_type equalsPos = item.find_first_of('=');
+    if (equalsPos == std::string::npos || equalsPos == 0) {
+      return false;
     }
+    char* numberEnd;
+    const char* number = item.c_str() + equalsPos + 1;
+    long seconds = strtol(number, &numberEnd, 10);
+    if (*number == '\0' || *numberEnd != '\0' || seconds < 0 || seconds > INT_MAX / 1000) {
+      return false;
+    }
+    output->push_back(std::make_pair(item.substr(0, equalsPos), static_cast<int>(seconds)));
+  }
+  return true;
+}
+
+struct CgroupSetting {
+  std::string verb;
+  std::string name;
+  std::string value;
+};
 
-    driver->addSourceFile(current.get());
+// Parses a comma-separated list of verb:file=value.
+bool parseCgroupSettings(const std::string& spec, std::vector<CgroupSetting>* output) {
+  std::string::size_type pos = 0;
+  while (pos < spec.size()) {
+    std::string::size_type end = spec.find_first_of(',', pos);
+    if (end == std::string::npos) {
+      end = spec.size();
+    }
+    std::string item(spec, pos, end - pos);
+    pos = end + 1;
+
+    std::string::size_type colonPos = item.find_first_of(':');
+    std::string::size_type equalsPos = item.find_first_of('=');
+    if (colonPos == std::string::npos || colonPos == 0 || equalsPos == std::string::npos ||
+        equalsPos < colonPos + 2 || equalsPos + 1 == item.size()) {
+      return false;
+    }
+    CgroupSetting setting;
+    setting.verb = item.substr(0, colonPos);
+    setting.name = item.substr(colonPos + 1, equalsPos - colonPos - 1);
+    setting.value = item.substr(equalsPos + 1);
+    if (setting.name.find('/') != std::string::npos) {
+      return false;
+    }
+    output->push_back(setting);
   }
+  return true;
 }
 
 OwnedPtr<Dashboard> getDashboard(int maxDisplayedLogLines) {
@@ -469,9 +755,10 @@ int main(int argc, char* argv[]) {
   int maxConcurrentActions = 1;
   bool continuous = false;
   std::string networkDashboardAddress;
+  uint64_t intermediateStoreBudget = 0;
 
   while (true) {
-    int opt = getopt(argc, argv, "chvj:n:l:");
+    int opt = getopt(argc, argv, "chvj:n:l:m:");
     if (opt == -1) break;
 
     switch (opt) {
@@ -496,6 +783,19 @@ int main(int argc, char* argv[]) {
       case 'n':
         networkDashboardAddress = optarg;
         break;
+      case 'm': {
+        char* endptr;
+        errno = 0;
+        unsigned long long megabytes = strtoull(optarg, &endptr, 10);
+        if (!isdigit(*optarg) || *endptr != '\0' || errno == ERANGE ||
+            megabytes > (UINT64_MAX >> 20)) {
+          fprintf(stderr, "Expected number of megabytes after -m.\n");
+          usage(command, stderr);
+          return 1;
+        }
+        intermediateStoreBudget = static_cast<uint64_t>(megabytes) << 20;
+        break;
+      }
       case 'l': {
         char* endptr;
         maxDisplayedLogLines = strtoul(optarg, &endptr, 0);
@@ -519,6 +819,89 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
+  // EKAM_STAT_CACHE=off disables caching of file types; =strict double-checks every cache hit
+  // against the disk and logs stale entries.
+  const char* statCacheMode = getenv("EKAM_STAT_CACHE");
+  if (statCacheMode != NULL) {
+    if (strcmp(statCacheMode, "off") == 0) {
+      DiskFile::setStatCacheMode(DiskFile::STAT_CACHE_DISABLED);
+    } else if (strcmp(statCacheMode, "strict") == 0) {
+      DiskFile::setStatCacheMode(DiskFile::STAT_CACHE_STRICT);
+    } else if (strcmp(statCacheMode, "on") != 0) {
+      fprintf(stderr, "EKAM_STAT_CACHE must be \"on\", \"off\" or \"strict\".\n");
+      return 1;
+    }
+  }
+
+  // EKAM_IO_URING=off forces batched file operations to use plain blocking syscalls.
+  const char* ioUring = getenv("EKAM_IO_URING");
+  if (ioUring != NULL && strcmp(ioUring, "off") == 0) {
+    IoBatch::setIoUringEnabled(false);
+  }
+
+  // EKAM_TIMEOUTS limits how long actions may run, in seconds, by verb, e.g. "test=300,*=3600".
+  std::vector<std::pair<std::string, int> > timeouts;
+  const char* timeoutSpec = getenv("EKAM_TIMEOUTS");
+  if (timeoutSpec != NULL && !parseTimeouts(timeoutSpec, &timeouts)) {
+    fprintf(stderr, "EKAM_TIMEOUTS must look like \"test=300,compile=600,*=3600\".\n");
+    return 1;
+  }
+
+  // EKAM_CGROUP=<directory> runs each action in its own cgroup, under a cgroup v2 directory
+  // delegated to us.  EKAM_CGROUP_LIMITS sets the actions' cgroup files by verb, e.g.
+  // "test:memory.max=2G,link:cpu.weight=50,*:pids.max=1000".  EKAM_CGROUP_FREEZE=on freezes the
+  // processes of cancelled and timed-out actions, rather than killing them, so they can be
+  // inspected.
+  const char* cgroupRoot = getenv("EKAM_CGROUP");
+  std::vector<CgroupSetting> cgroupSettings;
+  const char* cgroupLimits = getenv("EKAM_CGROUP_LIMITS");
+  if (cgroupLimits != NULL && !parseCgroupSettings(cgroupLimits, &cgroupSettings)) {
+    fprintf(stderr,
+            "EKAM_CGROUP_LIMITS must look like \"test:memory.max=2G,*:pids.max=1000\".\n");
+    return 1;
+  }
+  const char* cgroupFreeze = getenv("EKAM_CGROUP_FREEZE");
+  bool freezeCancelledActions = cgroupFreeze != NULL && strcmp(cgroupFreeze, "on") == 0;
+
+  // EKAM_RULE_WORKERS=off starts rules afresh for every action even if they can run as workers.
+  const char* ruleWorkers = getenv("EKAM_RULE_WORKERS");
+  if (ruleWorkers != NULL && strcmp(ruleWorkers, "off") == 0) {
+    ExecPluginActionFactory::setWorkersEnabled(false);
+  }
+
+  // EKAM_BUILTIN_COMPILE=on compiles C and C++ in-process rather than with compile.ekam-rule,
+  // which sees the same variable and stands aside.
+  const char* builtinCompile = getenv("EKAM_BUILTIN_COMPILE");
+  bool useBuiltinCompile = builtinCompile != NULL && strcmp(builtinCompile, "on") == 0;
+
+#ifdef __linux__
+  // EKAM_EVENT_LOOP=io_uring runs the event loop on io_uring rather than epoll, where the kernel
+  // is new enough (6.7).
+  bool ioUringEventLoop = false;
+  const char* eventLoop = getenv("EKAM_EVENT_LOOP");
+  if (eventLoop != NULL) {
+    if (strcmp(eventLoop, "io_uring") == 0) {
+      ioUringEventLoop = true;
+    } else if (strcmp(eventLoop, "epoll") != 0) {
+      fprintf(stderr, "EKAM_EVENT_LOOP must be \"epoll\" or \"io_uring\".\n");
+      return 1;
+    }
+  }
+
+  // EKAM_PIDFD=off watches subprocesses through SIGCHLD, as on kernels without pidfds.
+  const char* pidfd = getenv("EKAM_PIDFD");
+  if (pidfd != NULL && strcmp(pidfd, "off") == 0) {
+    EpollEventManager::setPidfdEnabled(false);
+  }
+
+  // EKAM_FANOTIFY=on watches the source tree in continuous mode with fanotify filesystem marks
+  // instead of an inotify watch per directory, where permitted.
+  const char* fanotify = getenv("EKAM_FANOTIFY");
+  if (fanotify != NULL && strcmp(fanotify, "on") == 0) {
+    EpollEventManager::setFanotifyEnabled(true);
+  }
+#endif
+
   DiskFile src("src", NULL);
   DiskFile tmp("tmp", NULL);
   DiskFile bin("bin", NULL);
@@ -543,7 +926,45 @@ int main(int argc, char* argv[]) {
     }
   }
 
-  OwnedPtr<RunnableEventManager> eventManager = newPreferredEventManager();
+  OwnedPtr<HashCache> hashCache;
+  try {
+    hashCache = newOwned<HashCache>("tmp/.ekam-hashcache", DiskFile::CONTENT_HASH_VERSION);
+    DiskFile::setHashCache(hashCache.get());
+  } catch (const OsError& e) {
+    DEBUG_WARNING << "Content hash cache disabled: " << e.what();
+  }
+
+  OwnedPtr<RunnableEventManager> eventManager;
+#if EKAM_HAVE_IO_URING
+  if (ioUringEventLoop) {
+    if (IoUringEventManager::isSupported()) {
+      eventManager = newOwned<IoUringEventManager>();
+    } else {
+      DEBUG_WARNING << "io_uring event loop not supported by this kernel; using epoll.";
+    }
+  }
+#endif
+  if (eventManager == NULL) {
+    eventManager = newPreferredEventManager();
+  }
+
+  OwnedPtr<CgroupTree> cgroupTree;
+  if (cgroupRoot != NULL && !Subprocess::canStartInCgroup()) {
+    // Moving each process after it starts would let whatever it forks first escape the limits.
+    DEBUG_WARNING << "Not running actions in cgroups: neither the C library nor the kernel can "
+                     "start a process in a cgroup (needs glibc 2.41 or Linux 5.7).";
+  } else if (cgroupRoot != NULL) {
+    try {
+      cgroupTree = newOwned<CgroupTree>(cgroupRoot, eventManager.get());
+
+      // A worker outlives the actions it runs, so it can't be in their cgroups.  Start rules
+      // afresh for every action instead, so that each one gets its limits, timeouts and OOM
+      // reports.
+      ExecPluginActionFactory::setWorkersEnabled(false);
+    } catch (const OsError& e) {
+      DEBUG_WARNING << "Not running actions in cgroups: " << e.what();
+    }
+  }
 
   OwnedPtr<Dashboard> dashboard = getDashboard(maxDisplayedLogLines);
   if (!networkDashboardAddress.empty()) {
@@ -554,24 +975,90 @@ int main(int argc, char* argv[]) {
   Driver driver(eventManager.get(), dashboard.get(), &tmp, installDirs, maxConcurrentActions,
                 &locks);
 
+  StatsReporter statsReporter(eventManager.get(), &driver, hashCache.get());
+
+  OwnedPtr<IntermediateStore> intermediateStore;
+  if (intermediateStoreBudget > 0) {
+    const char* ramDir = getenv("EKAM_RAM_DIR");
+    const char* ramOutputs = getenv("EKAM_RAM_OUTPUTS");
+    std::vector<std::string> suffixes;
+    std::string spec = ramOutputs == NULL ? ".syms,.deps" : ramOutputs;
+    for (std::string::size_type pos = 0; pos <= spec.size();) {
+      std::string::size_type end = spec.find_first_of(',', pos);
+      if (end == std::string::npos) {
+        end = spec.size();
+      }
+      if (end > pos) {
+        suffixes.push_back(spec.substr(pos, end - pos));
+      }
+      pos = end + 1;
+    }
+    try {
+      intermediateStore = newOwned<IntermediateStore>(
+          ramDir == NULL ? "/dev/shm" : ramDir, intermediateStoreBudget, suffixes);
+      driver.setIntermediateStore(intermediateStore.get());
+    } catch (const OsError& e) {
+      DEBUG_WARNING << "Keeping intermediate outputs on disk: " << e.what();
+    }
+  }
+
+  for (auto& timeout: timeouts) {
+    driver.setTimeout(timeout.first, timeout.second);
+  }
+
+  if (cgroupTree != NULL) {
+    driver.setCgroupTree(cgroupTree.get());
+    for (auto& setting: cgroupSettings) {
+      driver.setCgroupSetting(setting.verb, setting.name, setting.value);
+    }
+    driver.setFreezeCancelledActions(freezeCancelledActions);
+  }
+
   ExtractTypeActionFactory extractTypeActionFactcory;
   driver.addActionFactory(&extractTypeActionFactcory);
 
   CppActionFactory cppActionFactory;
   driver.addActionFactory(&cppActionFactory);
 
+  CppCompileActionFactory cppCompileActionFactory;
+  if (useBuiltinCompile) {
+    driver.addActionFactory(&cppCompileActionFactory);
+  }
+
   ExecPluginActionFactory execPluginActionFactory;
   driver.addActionFactory(&execPluginActionFactory);
 
+  IgnoreRules ignoreRules;
+  OwnedPtr<File> ignoreFile = src.relative(".ekamignore");
+  if (ignoreFile->isFile()) {
+    ignoreRules.parse(ignoreFile->readAll());
+    DEBUG_INFO << "Loaded " << ignoreRules.size() << " patterns from src/.ekamignore.";
+  }
+
   OwnedPtr<DirectoryWatcher> rootWatcher;
   if (continuous) {
-    rootWatcher = newOwned<DirectoryWatcher>(src.clone(), eventManager.get(), &driver);
-    rootWatcher->modified();
+    rootWatcher = newOwned<DirectoryWatcher>(src.clone(), eventManager.get(), &driver,
+                                             &ignoreRules);
+    rootWatcher->relist();
   } else {
-    scanSourceTree(&src, &driver);
+    scanSourceTree(&src, &driver, &ignoreRules);
   }
   eventManager->loop();
 
+  if (hashCache != NULL) {
+    DEBUG_INFO << "Content hash cache: " << hashCache->getHitCount() << " hits, "
+        << hashCache->getMissCount() << " misses, "
+        << hashCache->getRacyCount() << " too recently modified to cache.";
+  }
+
+  DiskFile::StatCacheCounters statCache = DiskFile::getStatCacheCounters();
+  DEBUG_INFO << "Stat cache: " << statCache.hits << " hits, " << statCache.misses << " misses, "
+      << statCache.invalidations << " invalidations, " << statCache.staleEntries << " stale.";
+
+  // Frozen actions and idle rule workers are our children too; don't wait for them forever.
+  driver.killFrozenActions();
+  ExecPluginActionFactory::stopWorkers();
+
   // For debugging purposes, check for zombie processes.
   int zombieCount = 0;
   while (true) {
@@ -46,6 +46,14 @@ Promise<size_t> ByteStream::readAsync(EventManager* eventManager, void* buffer,
   if (watcher == nullptr) {
     watcher = eventManager->watchFd(handle.get());
   }
+  return watcher->readAsync(buffer, size);
+}
+
+Promise<size_t> ByteStream::readWhenReadable(EventManager* eventManager,
+                                             void* buffer, size_t size) {
+  if (watcher == nullptr) {
+    watcher = eventManager->watchFd(handle.get());
+  }
   return eventManager->when(watcher->onReadable())(
     [this, buffer, size](Void) -> size_t {
       return read(buffer, size);
@@ -98,18 +106,6 @@ OwnedPtr<ByteStream> Pipe::releaseWriteEnd() {
   return result.release();
 }
 
-void Pipe::attachReadEndForExec(int target) {
-  dup2(fds[0], target);
-  closeReadEnd();
-  closeWriteEnd();
-}
-
-void Pipe::attachWriteEndForExec(int target) {
-  dup2(fds[1], target);
-  closeReadEnd();
-  closeWriteEnd();
-}
-
 void Pipe::closeReadEnd() {
   if (fds[0] != -1) {
     if (close(fds[0]) != 0) {
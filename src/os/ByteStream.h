@@ -41,6 +41,9 @@ public:
 
   size_t read(void* buffer, size_t size);
   Promise<size_t> readAsync(EventManager* eventManager, void* buffer, size_t size);
+  // Like readAsync(), but nothing is read from the fd before the call, even by event managers that
+  // otherwise read ahead (io_uring).  Use this when something else will read the fd later.
+  Promise<size_t> readWhenReadable(EventManager* eventManager, void* buffer, size_t size);
   size_t write(const void* buffer, size_t size);
   void writeAll(const void* buffer, size_t size);
   void stat(struct stat* stats);
@@ -59,8 +62,11 @@ public:
 
   OwnedPtr<ByteStream> releaseReadEnd();
   OwnedPtr<ByteStream> releaseWriteEnd();
-  void attachReadEndForExec(int target);
-  void attachWriteEndForExec(int target);
+
+  // The descriptors, for a child to dup2() into place before exec.  The pipe itself is
+  // close-on-exec, so only the copies are inherited.
+  int getReadFd() { return fds[0]; }
+  int getWriteFd() { return fds[1]; }
 
 private:
   int fds[2];
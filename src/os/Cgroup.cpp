@@ -0,0 +1,334 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Cgroup.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "base/Debug.h"
+
+namespace ekam {
+
+namespace {
+
+const char* const CONTROLLERS[] = { "memory", "pids", "cpu" };
+
+bool writeFile(const std::string& path, const std::string& value) {
+  int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  ssize_t n;
+  do {
+    n = write(fd, value.data(), value.size());
+  } while (n < 0 && errno == EINTR);
+  int error = errno;
+  close(fd);
+  errno = error;
+  return n == static_cast<ssize_t>(value.size());
+}
+
+bool readFile(const std::string& path, std::string* output) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  output->clear();
+  char buffer[4096];
+  ssize_t n;
+  while ((n = read(fd, buffer, sizeof(buffer))) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      close(fd);
+      return false;
+    }
+    output->append(buffer, n);
+  }
+  close(fd);
+  return true;
+}
+
+// Reads "<key> <value>" from a flat-keyed file like memory.events.  Zero if missing.
+uint64_t readKey(const std::string& path, const std::string& key) {
+  std::string content;
+  if (!readFile(path, &content)) {
+    return 0;
+  }
+  std::string::size_type pos = 0;
+  while (pos < content.size()) {
+    std::string::size_type end = content.find('\n', pos);
+    if (end == std::string::npos) {
+      end = content.size();
+    }
+    if (content.compare(pos, key.size(), key) == 0 && content[pos + key.size()] == ' ') {
+      return strtoull(content.c_str() + pos + key.size() + 1, NULL, 10);
+    }
+    pos = end + 1;
+  }
+  return 0;
+}
+
+// Whether the space-separated list (e.g. cgroup.controllers) contains the word.
+bool hasWord(const std::string& list, const std::string& word) {
+  std::string::size_type pos = 0;
+  while ((pos = list.find(word, pos)) != std::string::npos) {
+    std::string::size_type end = pos + word.size();
+    if ((pos == 0 || isspace(list[pos - 1])) && (end == list.size() || isspace(list[end]))) {
+      return true;
+    }
+    pos = end;
+  }
+  return false;
+}
+
+// Kills everything in the cgroup, without waiting.  Any victims that are our own children are
+// reaped by whoever started them.
+void killAll(const std::string& path) {
+  // cgroup.kill (Linux 5.14) also catches processes forked while we're killing.
+  if (writeFile(path + "/cgroup.kill", "1")) {
+    return;
+  }
+
+  std::string content;
+  if (readFile(path + "/cgroup.procs", &content)) {
+    const char* pos = content.c_str();
+    char* end;
+    while (pid_t pid = strtol(pos, &end, 10)) {
+      kill(pid, SIGKILL);
+      pos = end;
+    }
+  }
+}
+
+// Removes the cgroup, killing everything in it first if need be.  Returns false if it is still
+// populated:  processes leave the cgroup as they exit, which takes a moment after they are killed.
+// Other errors are logged.
+bool removeCgroup(const std::string& path) {
+  if (rmdir(path.c_str()) == 0 || errno == ENOENT) {
+    return true;
+  } else if (errno == EBUSY) {
+    killAll(path);
+    if (rmdir(path.c_str()) == 0 || errno == ENOENT) {
+      return true;
+    } else if (errno == EBUSY) {
+      return false;
+    }
+  }
+  DEBUG_WARNING << path << ": rmdir: " << strerror(errno);
+  return true;
+}
+
+// Remove the cgroups of Ekams that died without cleaning up.
+void removeAbandonedCgroups(const std::string& root) {
+  DIR* dir = opendir(root.c_str());
+  if (dir == NULL) {
+    return;
+  }
+
+  while (struct dirent* entry = readdir(dir)) {
+    int pid;
+    if (sscanf(entry->d_name, "ekam-%d", &pid) != 1 || pid == getpid() ||
+        kill(pid, 0) == 0 || errno != ESRCH) {
+      continue;
+    }
+
+    std::string path = root + "/" + entry->d_name;
+    DIR* ekamDir = opendir(path.c_str());
+    if (ekamDir == NULL) {
+      continue;
+    }
+    while (struct dirent* child = readdir(ekamDir)) {
+      if (child->d_type == DT_DIR && strcmp(child->d_name, ".") != 0 &&
+          strcmp(child->d_name, "..") != 0) {
+        removeCgroup(path + "/" + child->d_name);
+      }
+    }
+    closedir(ekamDir);
+
+    // If processes were still on their way out, the next Ekam gets another try.
+    if (rmdir(path.c_str()) == 0) {
+      DEBUG_INFO << "Removed abandoned cgroup: " << path;
+    }
+  }
+
+  closedir(dir);
+}
+
+}  // namespace
+
+// Waits for cgroup.events to say the cgroup is no longer populated, then removes it.
+class CgroupTree::Removal {
+public:
+  Removal(EventManager* eventManager, const std::string& path)
+      : eventManager(eventManager), path(path),
+        watcher(eventManager->watchFile(path + "/cgroup.events")), done(false) {
+    waitOp = waitUntilEmpty();
+  }
+  ~Removal() {}
+
+  const std::string& getPath() { return path; }
+  bool isDone() { return done; }
+
+private:
+  EventManager* eventManager;
+  std::string path;
+  OwnedPtr<EventManager::FileWatcher> watcher;
+  Promise<void> waitOp;
+  bool done;
+
+  Promise<void> waitUntilEmpty() {
+    // The watch was set up first, so if the last process exits after we look, we still hear.
+    if (readKey(path + "/cgroup.events", "populated") == 0) {
+      watcher.clear();
+      if (removeCgroup(path)) {
+        DEBUG_INFO << "Removed cgroup once its processes exited: " << path;
+      }
+      done = true;
+      return newFulfilledPromise();
+    }
+
+    return eventManager->when(watcher->onChange())(
+      [this](EventManager::FileChangeType) -> Promise<void> {
+        return waitUntilEmpty();
+      });
+  }
+};
+
+CgroupTree::CgroupTree(const std::string& root, EventManager* eventManager)
+    : eventManager(eventManager), nextId(0) {
+  std::string available;
+  if (!readFile(root + "/cgroup.controllers", &available)) {
+    throw OsError(root + "/cgroup.controllers", "open", errno);
+  }
+
+  removeAbandonedCgroups(root);
+
+  directory = root + "/ekam-" + std::to_string(getpid());
+  WRAP_SYSCALL(mkdir, directory.c_str(), 0755);
+  std::string mainPath = directory + "/main";
+  WRAP_SYSCALL(mkdir, mainPath.c_str(), 0755);
+
+  std::string procsPath = mainPath + "/cgroup.procs";
+  OsHandle mainProcs(procsPath, WRAP_SYSCALL(open, procsPath.c_str(), O_WRONLY | O_CLOEXEC));
+  WRAP_SYSCALL(write, mainProcs, "0", 1);
+
+  // Now that Ekam has left it, the root can hand controllers down to our cgroup, and our cgroup
+  // to the actions' cgroups.
+  for (const char* controller: CONTROLLERS) {
+    std::string enable = std::string("+") + controller;
+    if (!hasWord(available, controller)) {
+      DEBUG_WARNING << root << ": cgroup controller not available: " << controller;
+    } else if (!writeFile(root + "/cgroup.subtree_control", enable) ||
+               !writeFile(directory + "/cgroup.subtree_control", enable)) {
+      DEBUG_WARNING << directory << ": can't enable cgroup controller " << controller << ": "
+                    << strerror(errno);
+    }
+  }
+}
+
+CgroupTree::~CgroupTree() {
+  for (int i = 0; i < removals.size(); i++) {
+    if (!removals.get(i)->isDone()) {
+      DEBUG_INFO << "Processes haven't left " << removals.get(i)->getPath()
+                 << "; the next Ekam will remove it.";
+    }
+  }
+}
+
+void CgroupTree::remove(const std::string& path) {
+  for (int i = removals.size() - 1; i >= 0; i--) {
+    if (removals.get(i)->isDone()) {
+      removals.releaseAndShift(i);
+    }
+  }
+
+  if (!removeCgroup(path)) {
+    removals.add(newOwned<Removal>(eventManager, path));
+  }
+}
+
+OwnedPtr<Cgroup> CgroupTree::newCgroup(
+    const std::vector<std::pair<std::string, std::string> >& settings) {
+  std::string path = directory + "/action-" + std::to_string(nextId++);
+  WRAP_SYSCALL(mkdir, path.c_str(), 0755);
+  OwnedPtr<Cgroup> result;
+  try {
+    result = newOwned<Cgroup>(this, path);
+  } catch (...) {
+    rmdir(path.c_str());
+    throw;
+  }
+
+  for (auto& setting: settings) {
+    if (!writeFile(path + "/" + setting.first, setting.second) &&
+        warnedSettings.insert(setting.first).second) {
+      DEBUG_WARNING << "Can't set " << setting.first << " to " << setting.second
+                    << " in action cgroups: " << strerror(errno);
+    }
+  }
+  return result.release();
+}
+
+// =======================================================================================
+
+Cgroup::Cgroup(CgroupTree* tree, const std::string& path)
+    : tree(tree), path(path),
+      directory(path, WRAP_SYSCALL(open, path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)),
+      frozen(false) {}
+
+Cgroup::~Cgroup() {
+  tree->remove(path);
+}
+
+void Cgroup::freeze() {
+  if (writeFile(path + "/cgroup.freeze", "1")) {
+    frozen = true;
+  } else {
+    DEBUG_WARNING << path << ": can't freeze: " << strerror(errno);
+  }
+}
+
+uint64_t Cgroup::getOomKillCount() {
+  return readKey(path + "/memory.events", "oom_kill");
+}
+
+uint64_t Cgroup::getPeakMemory() {
+  // memory.peak is Linux 5.19.
+  return strtoull(read("memory.peak").c_str(), NULL, 10);
+}
+
+std::string Cgroup::read(const std::string& name) {
+  std::string content;
+  if (!readFile(path + "/" + name, &content)) {
+    return "";
+  }
+  if (!content.empty() && content[content.size() - 1] == '\n') {
+    content.resize(content.size() - 1);
+  }
+  return content;
+}
+
+}  // namespace ekam
@@ -0,0 +1,105 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KENTONSCODE_OS_CGROUP_H_
+#define KENTONSCODE_OS_CGROUP_H_
+
+#include <stdint.h>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/OwnedPtr.h"
+#include "EventManager.h"
+#include "OsHandle.h"
+
+namespace ekam {
+
+class Cgroup;
+
+// The part of the cgroup v2 hierarchy that Ekam manages, under a directory delegated to the user
+// running it (e.g. by `systemd-run --user -p Delegate=yes`).  Ekam's own cgroup is
+// <root>/ekam-<pid>.  Ekam itself moves into its "main" child, because cgroup v2 only allows
+// processes in the leaves of a tree that has controllers enabled.  Each action gets a sibling of
+// "main".
+//
+// The directories of Ekams that died are removed the next time one starts.  Ekam can't remove
+// its own cgroup while it is still inside it.
+class CgroupTree {
+public:
+  // Throws OsError if `root` is not a cgroup v2 directory that we can create cgroups in.
+  // Controllers (memory, pids, cpu) that can't be enabled are logged; limits on them won't apply.
+  // `eventManager` is used to wait for killed processes to leave cgroups before removing them.
+  CgroupTree(const std::string& root, EventManager* eventManager);
+  ~CgroupTree();
+
+  // Creates a cgroup and writes each (interface file, value) pair to it, e.g.
+  // ("memory.max", "2G").  Settings that the kernel rejects are logged, once per file, and
+  // skipped.
+  OwnedPtr<Cgroup> newCgroup(const std::vector<std::pair<std::string, std::string> >& settings);
+
+private:
+  class Removal;
+
+  EventManager* eventManager;
+  std::string directory;
+  uint64_t nextId;
+  std::set<std::string> warnedSettings;
+
+  // Cgroups whose processes have been killed but haven't all exited yet.  Those left when the
+  // tree is destroyed are removed the next time an Ekam starts.
+  OwnedPtrVector<Removal> removals;
+
+  // Kill everything in the cgroup and remove it, now or once the processes are gone.
+  void remove(const std::string& path);
+
+  friend class Cgroup;
+};
+
+// One action's cgroup.  Created by CgroupTree::newCgroup().
+class Cgroup {
+public:
+  Cgroup(CgroupTree* tree, const std::string& path);
+  // Kills anything still in the cgroup and removes it, without waiting for the processes to exit.
+  ~Cgroup();
+
+  const std::string& getPath() { return path; }
+  int getDirectoryFd() { return directory.get(); }
+
+  // Stop everything in the cgroup where it stands.  Frozen processes can still be killed.
+  void freeze();
+  bool isFrozen() { return frozen; }
+
+  // Number of processes the kernel killed for exceeding memory.max.
+  uint64_t getOomKillCount();
+
+  // Peak memory use of the cgroup in bytes, or zero if the kernel doesn't track it.
+  uint64_t getPeakMemory();
+
+  // Contents of an interface file, without the trailing newline, or "" if it can't be read.
+  std::string read(const std::string& name);
+
+private:
+  CgroupTree* tree;
+  std::string path;
+  OsHandle directory;
+  bool frozen;
+};
+
+}  // namespace ekam
+
+#endif  // KENTONSCODE_OS_CGROUP_H_
@@ -0,0 +1,198 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Needs a cgroup v2 directory we can create cgroups in:  $EKAM_TEST_CGROUP, or else the one we
+// are running in.  Skips otherwise.  Like Ekam, moves itself into the tree's "main" cgroup.
+
+#include "Cgroup.h"
+#include "EpollEventManager.h"
+#include "Subprocess.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+namespace ekam {
+namespace {
+
+#define ASSERT(EXPRESSION)                                                    \
+  if (!(EXPRESSION)) {                                                        \
+    fprintf(stderr, "%s:%d: FAILED: %s\n", __FILE__, __LINE__, #EXPRESSION);  \
+    exit(1);                                                                  \
+  }
+
+// Our own cgroup v2 directory, or "" if we're not in one.
+// Reads everything from the stream into `text`.
+class Slurper {
+public:
+  Slurper(EventManager* eventManager, OwnedPtr<ByteStream> stream)
+      : eventManager(eventManager), stream(stream.release()) {
+    asyncOp = readMore();
+  }
+
+  std::string text;
+
+private:
+  EventManager* eventManager;
+  OwnedPtr<ByteStream> stream;
+  char buffer[256];
+  Promise<void> asyncOp;
+
+  Promise<void> readMore() {
+    return eventManager->when(stream->readAsync(eventManager, buffer, sizeof(buffer)))(
+      [this](size_t size) -> Promise<void> {
+        if (size == 0) {
+          return newFulfilledPromise();
+        }
+        text.append(buffer, size);
+        return readMore();
+      });
+  }
+};
+
+// Runs a command in the cgroup and returns its exit code and output.
+int runInCgroup(RunnableEventManager* eventManager, Cgroup* cgroup,
+                const std::string& executable, const std::string& argument,
+                std::string* output) {
+  Subprocess subprocess;
+  subprocess.setCgroup(cgroup);
+  subprocess.addArgument(executable);
+  subprocess.addArgument(argument);
+  Slurper slurper(eventManager, subprocess.captureStdoutAndStderr());
+  int exitCode = -1;
+  Promise<void> exited = eventManager->when(subprocess.start(eventManager))(
+    [&](ProcessExitCode code) { exitCode = code.getExitCode(); });
+  eventManager->loop();
+  *output = slurper.text;
+  return exitCode;
+}
+
+std::string findOwnCgroup() {
+  std::string mountPoint;
+  FILE* mounts = fopen("/proc/self/mounts", "r");
+  if (mounts == NULL) {
+    return "";
+  }
+  char device[256], path[1024], type[64];
+  while (fscanf(mounts, "%255s %1023s %63s %*[^\n]", device, path, type) == 3) {
+    if (strcmp(type, "cgroup2") == 0) {
+      mountPoint = path;
+      break;
+    }
+  }
+  fclose(mounts);
+
+  std::string relativePath;
+  FILE* cgroups = fopen("/proc/self/cgroup", "r");
+  if (cgroups == NULL) {
+    return "";
+  }
+  char line[1024];
+  while (fgets(line, sizeof(line), cgroups) != NULL) {
+    if (strncmp(line, "0::", 3) == 0) {
+      relativePath.assign(line + 3, strcspn(line + 3, "\n"));
+    }
+  }
+  fclose(cgroups);
+
+  if (mountPoint.empty() || relativePath.empty()) {
+    return "";
+  }
+  return mountPoint + relativePath;
+}
+
+void testCgroups(const std::string& root) {
+  if (!Subprocess::canStartInCgroup()) {
+    fprintf(stderr, "Can't start processes in cgroups here; skipping.\n");
+    return;
+  }
+
+  EpollEventManager eventManager;
+
+  OwnedPtr<CgroupTree> tree;
+  try {
+    tree = newOwned<CgroupTree>(root, &eventManager);
+  } catch (const OsError& e) {
+    fprintf(stderr, "Can't create cgroups under %s; skipping: %s\n", root.c_str(), e.what());
+    return;
+  }
+
+  std::vector<std::pair<std::string, std::string> > settings;
+  settings.push_back(std::make_pair("pids.max", "50"));
+  settings.push_back(std::make_pair("no.such.setting", "1"));
+  OwnedPtr<Cgroup> cgroup = tree->newCgroup(settings);
+  std::string path = cgroup->getPath();
+  ASSERT(access(path.c_str(), F_OK) == 0);
+
+  // Limits only apply where the controller could be enabled; the bogus setting is just logged.
+  std::string controllers = cgroup->read("cgroup.controllers");
+  if (controllers.find("pids") != std::string::npos) {
+    ASSERT(cgroup->read("pids.max") == "50");
+  } else {
+    fprintf(stderr, "pids controller not enabled; not checking limits.\n");
+  }
+
+  // The process is in the cgroup from the start, not moved there later, so anything it forks is
+  // too.  Everything else about starting it is as usual.
+  std::string output;
+  ASSERT(runInCgroup(&eventManager, cgroup.get(), "cat", "/proc/self/cgroup", &output) == 0);
+  std::string name = path.substr(path.find_last_of('/'));
+  ASSERT(output.find(name + "\n") != std::string::npos);
+  ASSERT(runInCgroup(&eventManager, cgroup.get(), "cat", "/proc/self/status", &output) == 0);
+  ASSERT(output.find("\nSigBlk:\t0000000000000000\n") != std::string::npos);
+  ASSERT(runInCgroup(&eventManager, cgroup.get(), "./no-such-program", "", &output) != 0);
+  ASSERT(output.find("No such file or directory") != std::string::npos);
+
+  // Leave a process behind in the cgroup.
+  {
+    Subprocess subprocess;
+    subprocess.setCgroup(cgroup.get());
+    subprocess.addArgument("sh");
+    subprocess.addArgument("-c");
+    subprocess.addArgument("sleep 60 >/dev/null 2>&1 & exit 0");
+    int exitCode = -1;
+    Promise<void> exited = eventManager.when(subprocess.start(&eventManager))(
+      [&](ProcessExitCode code) { exitCode = code.getExitCode(); });
+    eventManager.loop();
+    ASSERT(exitCode == 0);
+  }
+  ASSERT(atoi(cgroup->read("cgroup.procs").c_str()) > 0);
+
+  cgroup->freeze();
+  ASSERT(cgroup->isFrozen());
+
+  // Destroying the cgroup kills the process without waiting for it.  The cgroup is removed once
+  // the process is gone, after which nothing is left for the loop to do.
+  cgroup.clear();
+  eventManager.loop();
+  ASSERT(access(path.c_str(), F_OK) != 0 && errno == ENOENT);
+}
+
+}  // namespace
+}  // namespace ekam
+
+int main(int argc, char* argv[]) {
+  const char* root = getenv("EKAM_TEST_CGROUP");
+  std::string ownCgroup = root == NULL ? ekam::findOwnCgroup() : root;
+  if (ownCgroup.empty()) {
+    fprintf(stderr, "Not in a cgroup v2 hierarchy; skipping.\n");
+    return 0;
+  }
+  ekam::testCgroups(ownCgroup);
+  return 0;
+}
@@ -25,11 +25,20 @@
 #include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <map>
+#include <set>
 #include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
 
 #include "base/Debug.h"
 #include "os/OsHandle.h"
 #include "os/ByteStream.h"
+#include "os/HashCache.h"
+#include "os/IoBatch.h"
 #include "base/Hash.h"
 
 namespace ekam {
@@ -55,7 +64,7 @@ public:
     }
   }
 
-  bool next(std::string* output) {
+  bool next(std::string* output, unsigned char* type) {
     errno = 0;
     struct dirent *entryPointer = readdir(dir);
     if (errno != 0) {
@@ -66,6 +75,7 @@ public:
       return false;
     } else {
       *output = entryPointer->d_name;
+      *type = entryPointer->d_type;
       return true;
     }
   }
@@ -90,66 +100,465 @@ bool statIfExists(const std::string& path, struct stat* output) {
   }
 }
 
-}  // anonymous namespace
+HashCache* hashCache = NULL;
 
-DiskFile::DiskFile(const std::string& path, File* parent) : path(path) {
-  if (parent != NULL) {
-    this->parentRef = parent->clone();
+// What the stat cache knows about a path.
+enum class PathType : uint8_t {
+  UNKNOWN,
+  MISSING,
+  FILE,
+  DIRECTORY,
+  OTHER  // Exists, but is neither a regular file nor a directory.
+};
+
+const char* pathTypeName(PathType type) {
+  switch (type) {
+    case PathType::UNKNOWN: return "unknown";
+    case PathType::MISSING: return "missing";
+    case PathType::FILE: return "file";
+    case PathType::DIRECTORY: return "directory";
+    case PathType::OTHER: return "other";
   }
+  return "?";
 }
-DiskFile::~DiskFile() {}
 
-std::string DiskFile::basename() {
-  if (path.empty()) {
-    return ".";
+PathType modePathType(mode_t mode) {
+  if (S_ISREG(mode)) {
+    return PathType::FILE;
+  } else if (S_ISDIR(mode)) {
+    return PathType::DIRECTORY;
+  } else {
+    return PathType::OTHER;
   }
+}
 
-  std::string::size_type slashPos = path.find_last_of('/');
-  if (slashPos == std::string::npos) {
-    return path;
+PathType statPathType(const std::string& path) {
+  struct stat stats;
+  if (!statIfExists(path, &stats)) {
+    return PathType::MISSING;
   } else {
-    return path.substr(slashPos + 1);
+    return modePathType(stats.st_mode);
   }
 }
 
-std::string DiskFile::canonicalName() {
-  if (parentRef == NULL) {
-    return ".";
+// Symlinks are followed by stat(), so only d_types that can't be links are trusted.
+PathType direntPathType(unsigned char type) {
+  switch (type) {
+    case DT_REG: return PathType::FILE;
+    case DT_DIR: return PathType::DIRECTORY;
+    case DT_LNK: return PathType::UNKNOWN;
+    case DT_UNKNOWN: return PathType::UNKNOWN;
+    default: return PathType::OTHER;
   }
+}
 
-  std::string result = parentRef->canonicalName();
-  if (result == ".") {
-    result.clear();
-  } else {
-    result.push_back('/');
+DiskFile::StatCacheMode statCacheMode = DiskFile::STAT_CACHE_ENABLED;
+DiskFile::StatCacheCounters statCacheCounters = { 0, 0, 0, 0 };
+
+// Files at least this big are hashed as a tree of independently-hashed chunks so that the chunks
+// can be read and hashed in parallel.  Linked binaries with debug info easily reach hundreds of
+// megabytes, and hashing those on a single thread stalls the event loop for seconds.
+const uint64_t TREE_HASH_MIN_SIZE = 64 << 20;
+const uint64_t TREE_HASH_CHUNK_SIZE = 16 << 20;
+
+// Files bigger than this are read through a heap buffer rather than the stack.
+const size_t SMALL_FILE_SIZE = 64 << 10;
+const size_t LARGE_READ_SIZE = 1 << 20;
+
+void adviseSequential(int fd) {
+#ifdef POSIX_FADV_SEQUENTIAL
+  // Purely advisory; failure is harmless.
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+// Plain SHA-256 of the file content.
+Hash linearHash(ByteStream* fd, uint64_t size) {
+  Hash::Builder hasher;
+  char stackBuffer[8192];
+  std::unique_ptr<char[]> heapBuffer;
+  char* buffer = stackBuffer;
+  size_t bufferSize = sizeof(stackBuffer);
+
+  if (size > SMALL_FILE_SIZE) {
+    heapBuffer.reset(new char[LARGE_READ_SIZE]);
+    buffer = heapBuffer.get();
+    bufferSize = LARGE_READ_SIZE;
+    adviseSequential(fd->getHandle()->get());
   }
-  result.append(basename());
 
-  return result;
+  while (true) {
+    size_t n = fd->read(buffer, bufferSize);
+    if (n == 0) {
+      return hasher.build();
+    }
+
+    hasher.add(buffer, n);
+  }
+}
+
+// Hash the given range of the file into *output.  Returns zero on success or an errno.
+int hashChunk(int fd, uint64_t offset, uint64_t size, char* buffer, Hash* output) {
+  Hash::Builder hasher;
+  while (size > 0) {
+    ssize_t n = pread(fd, buffer, std::min<uint64_t>(size, LARGE_READ_SIZE), offset);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return errno;
+    } else if (n == 0) {
+      // File was truncated under us.  The hash will be wrong, but so would any hash of a file
+      // that is changing; the modification will be picked up by the watcher.
+      break;
+    }
+    hasher.add(buffer, n);
+    offset += n;
+    size -= n;
+  }
+  *output = hasher.build();
+  return 0;
+}
+
+// Tree digest:  SHA-256 over a format tag, the file size, and the SHA-256 of each
+// TREE_HASH_CHUNK_SIZE chunk in order.  The result does not depend on the number of threads.
+Hash treeHash(const std::string& path, int fd, uint64_t size) {
+  adviseSequential(fd);
+
+  uint64_t chunkCount = (size + TREE_HASH_CHUNK_SIZE - 1) / TREE_HASH_CHUNK_SIZE;
+  std::vector<Hash> chunkHashes(chunkCount);
+  std::atomic<uint64_t> nextChunk(0);
+  std::atomic<int> error(0);
+
+  auto worker = [&]() {
+    std::unique_ptr<char[]> buffer(new char[LARGE_READ_SIZE]);
+    while (error.load() == 0) {
+      uint64_t i = nextChunk++;
+      if (i >= chunkCount) break;
+      uint64_t offset = i * TREE_HASH_CHUNK_SIZE;
+      int result = hashChunk(fd, offset, std::min(TREE_HASH_CHUNK_SIZE, size - offset),
+                             buffer.get(), &chunkHashes[i]);
+      if (result != 0) {
+        error = result;
+      }
+    }
+  };
+
+  uint64_t threadCount = std::min<uint64_t>(std::max(std::thread::hardware_concurrency(), 1u),
+                                            chunkCount);
+  std::vector<std::thread> threads;
+  for (uint64_t i = 1; i < threadCount; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread: threads) {
+    thread.join();
+  }
+
+  if (error != 0) {
+    throw OsError(path, "pread", error);
+  }
+
+  Hash::Builder hasher;
+  hasher.add("ekam-tree-v1");
+  unsigned char sizeBytes[8];
+  for (int i = 0; i < 8; i++) {
+    sizeBytes[i] = size >> (i * 8);
+  }
+  hasher.add(sizeBytes, sizeof(sizeBytes));
+  for (Hash& chunkHash: chunkHashes) {
+    hasher.add(chunkHash.bytes(), Hash::SIZE);
+  }
+  return hasher.build();
+}
+
+// contentHash() without the prefetched result.
+Hash hashFile(const std::string& path) {
+  try {
+    ByteStream fd(path, O_RDONLY);
+
+    // Stat before reading so that a concurrent modification can only make the cache entry stale,
+    // never wrong.
+    struct stat stats;
+    fd.stat(&stats);
+    if (S_ISDIR(stats.st_mode)) {
+      return Hash::NULL_HASH;
+    }
+
+    Hash result;
+    if (hashCache != NULL && hashCache->lookup(stats, &result)) {
+      return result;
+    }
+
+    uint64_t size = stats.st_size;
+    if (size >= TREE_HASH_MIN_SIZE) {
+      result = treeHash(path, fd.getHandle()->get(), size);
+    } else {
+      result = linearHash(&fd, size);
+    }
+
+    if (hashCache != NULL) {
+      hashCache->store(stats, result);
+    }
+    return result;
+  } catch (const OsError& e) {
+    if (e.getErrorNumber() == ENOENT || e.getErrorNumber() == EACCES ||
+        e.getErrorNumber() == EISDIR) {
+      return Hash::NULL_HASH;
+    }
+    throw;
+  }
+}
+
+}  // anonymous namespace
+
+const uint32_t DiskFile::CONTENT_HASH_VERSION;
+
+void DiskFile::setHashCache(HashCache* cache) {
+  hashCache = cache;
+}
+
+void DiskFile::setStatCacheMode(StatCacheMode mode) {
+  statCacheMode = mode;
+}
+
+DiskFile::StatCacheCounters DiskFile::getStatCacheCounters() {
+  return statCacheCounters;
+}
+
+// =======================================================================================
+
+// A path on disk, shared by every DiskFile referring to it.  Nodes are interned:  there is at
+// most one node per (parent, basename), so cloning a DiskFile or walking to a child that is
+// already known just bumps a refcount, and the canonical name is computed only once.
+class DiskFile::PathNode {
+public:
+  // Get the (interned) node for the given path.  Returns a new reference.
+  static PathNode* get(PathNode* parent, const std::string& path) {
+    std::unordered_map<std::string, PathNode*>* map = parent == NULL ? roots() : &parent->children;
+    std::string name = basenameOf(path);
+    auto iter = map->find(name);
+    if (iter != map->end() && iter->second->path == path) {
+      iter->second->ref();
+      return iter->second;
+    }
+
+    PathNode* result = new PathNode(parent, path, name);
+    if (iter == map->end()) {
+      // Paths normally nest, so a collision on the basename only happens if someone constructed
+      // a DiskFile with an unusual path.  That node just doesn't get interned.
+      map->insert(std::make_pair(name, result));
+      result->interned = true;
+    }
+    return result;
+  }
+
+  void ref() {
+    ++refcount;
+  }
+
+  PathType getType() {
+    if (statCacheMode == STAT_CACHE_DISABLED || !interned) {
+      ++statCacheCounters.misses;
+      return statPathType(path);
+    }
+
+    if (type == PathType::UNKNOWN) {
+      ++statCacheCounters.misses;
+      type = statPathType(path);
+      return type;
+    }
+
+    ++statCacheCounters.hits;
+    if (statCacheMode == STAT_CACHE_STRICT) {
+      PathType actual = statPathType(path);
+      if (actual != type) {
+        ++statCacheCounters.staleEntries;
+        DEBUG_ERROR << "Stat cache is stale for " << path << ": cached "
+                    << pathTypeName(type) << ", actually " << pathTypeName(actual);
+        type = actual;
+      }
+    }
+    return type;
+  }
+
+  // Record a type learned without stat()ing, e.g. from a successful mutation.
+  void setType(PathType newType) {
+    if (interned) {
+      type = newType;
+    }
+  }
+
+  void invalidate() {
+    if (type != PathType::UNKNOWN) {
+      ++statCacheCounters.invalidations;
+      type = PathType::UNKNOWN;
+    }
+    hasPrefetchedHash = false;
+  }
+
+  // A content hash computed by DiskFile::prefetch(), good for one contentHash() call.
+  void setPrefetchedHash(const Hash& hash) {
+    if (interned) {
+      prefetchedHash = hash;
+      hasPrefetchedHash = true;
+    }
+  }
+
+  bool takePrefetchedHash(Hash* output) {
+    if (hasPrefetchedHash) {
+      hasPrefetchedHash = false;
+      *output = prefetchedHash;
+      return true;
+    }
+    return false;
+  }
+
+  // Called after listing this directory:  `seen` maps every name in the listing (including
+  // hidden ones) to its d_type.  Live children not in the listing are now known to be missing.
+  void updateChildren(const std::unordered_map<std::string, unsigned char>& seen) {
+    std::string prefix = path.empty() ? std::string() : path + "/";
+    for (auto& child: children) {
+      if (child.second->path != prefix + child.first) {
+        continue;
+      }
+      auto iter = seen.find(child.first);
+      if (iter == seen.end()) {
+        child.second->setType(PathType::MISSING);
+      } else {
+        child.second->setType(direntPathType(iter->second));
+      }
+    }
+  }
+
+  void unref() {
+    if (--refcount == 0) {
+      if (interned) {
+        (parent == NULL ? roots() : &parent->children)->erase(basename);
+      }
+      if (parent != NULL) {
+        parent->unref();
+      }
+      delete this;
+    }
+  }
+
+  PathNode* const parent;  // Holds a reference.
+  const std::string path;
+  const std::string basename;
+  const std::string canonicalName;
+  const size_t identityHash;
+
+private:
+  int refcount;
+  bool interned;
+
+  // Only interned nodes cache their type, since invalidating a node would not reach a
+  // non-interned duplicate for the same path.
+  PathType type;
+
+  // Cleared along with `type`.
+  bool hasPrefetchedHash;
+  Hash prefetchedHash;
+
+  // Children currently alive, by basename.  Children hold references to their parents, not the
+  // other way around, so a child removes itself from this map when it dies.
+  std::unordered_map<std::string, PathNode*> children;
+
+  PathNode(PathNode* parent, const std::string& path, const std::string& basename)
+      : parent(parent), path(path), basename(basename),
+        canonicalName(makeCanonicalName(parent, basename)),
+        identityHash(std::hash<std::string>()(path)),
+        refcount(1), interned(false), type(PathType::UNKNOWN), hasPrefetchedHash(false) {
+    if (parent != NULL) {
+      parent->ref();
+    }
+  }
+
+  ~PathNode() {
+    if (!children.empty()) {
+      DEBUG_ERROR << "PathNode destroyed while children still alive: " << path;
+    }
+  }
+
+  static std::unordered_map<std::string, PathNode*>* roots() {
+    static std::unordered_map<std::string, PathNode*> result;
+    return &result;
+  }
+
+  static std::string basenameOf(const std::string& path) {
+    if (path.empty()) {
+      return ".";
+    }
+
+    std::string::size_type slashPos = path.find_last_of('/');
+    if (slashPos == std::string::npos) {
+      return path;
+    } else {
+      return path.substr(slashPos + 1);
+    }
+  }
+
+  static std::string makeCanonicalName(PathNode* parent, const std::string& basename) {
+    if (parent == NULL) {
+      return ".";
+    } else if (parent->canonicalName == ".") {
+      return basename;
+    } else {
+      return parent->canonicalName + "/" + basename;
+    }
+  }
+};
+
+DiskFile::DiskFile(const std::string& path, File* parent) {
+  PathNode* parentNode = NULL;
+  if (parent != NULL) {
+    DiskFile* diskParent = dynamic_cast<DiskFile*>(parent);
+    if (diskParent == NULL) {
+      throw std::invalid_argument("Parent of disk file must be a disk file: " + path);
+    }
+    parentNode = diskParent->node;
+  }
+  node = PathNode::get(parentNode, path);
+}
+
+DiskFile::DiskFile(PathNode* node) : node(node) {
+  node->ref();
+}
+
+DiskFile::~DiskFile() {
+  node->unref();
+}
+
+std::string DiskFile::basename() {
+  return node->basename;
+}
+
+std::string DiskFile::canonicalName() {
+  return node->canonicalName;
 }
 
 OwnedPtr<File> DiskFile::clone() {
-  return newOwned<DiskFile>(path, parentRef.get());
+  return newOwned<DiskFile>(node);
 }
 
 bool DiskFile::hasParent() {
-  return parentRef != NULL;
+  return node->parent != NULL;
 }
 
 OwnedPtr<File> DiskFile::parent() {
-  if (parentRef == NULL) {
+  if (node->parent == NULL) {
     throw std::runtime_error("Tried to get parent of top-level directory: " + canonicalName());
   }
-  return parentRef->clone();
+  return newOwned<DiskFile>(node->parent);
 }
 
 bool DiskFile::equals(File* other) {
   DiskFile* otherDiskFile = dynamic_cast<DiskFile*>(other);
-  return otherDiskFile != NULL && otherDiskFile->path == path;
+  return otherDiskFile != NULL &&
+      (otherDiskFile->node == node || otherDiskFile->node->path == node->path);
 }
 
 size_t DiskFile::identityHash() {
-  return std::hash<std::string>()(path);
+  return node->identityHash;
 }
 
 class DiskFile::DiskRefImpl : public File::DiskRef {
@@ -165,51 +574,154 @@ private:
 };
 
 OwnedPtr<File::DiskRef> DiskFile::getOnDisk(Usage usage) {
-  return newOwned<DiskRefImpl>(path);
+  if (usage != READ) {
+    // The caller is about to modify the file by other means.
+    node->invalidate();
+  }
+  return newOwned<DiskRefImpl>(node->path);
 }
 
 bool DiskFile::exists() {
-  struct stat stats;
-  return statIfExists(path.c_str(), &stats) && (S_ISREG(stats.st_mode) || S_ISDIR(stats.st_mode));
+  PathType type = node->getType();
+  return type == PathType::FILE || type == PathType::DIRECTORY;
 }
 
 bool DiskFile::isFile() {
-  struct stat stats;
-  return statIfExists(path.c_str(), &stats) && S_ISREG(stats.st_mode);
+  return node->getType() == PathType::FILE;
 }
 
 bool DiskFile::isDirectory() {
-  struct stat stats;
-  return statIfExists(path.c_str(), &stats) && S_ISDIR(stats.st_mode);
+  return node->getType() == PathType::DIRECTORY;
+}
+
+void DiskFile::invalidateCache() {
+  node->invalidate();
 }
 
 // File only.
 Hash DiskFile::contentHash() {
-  try {
-    Hash::Builder hasher;
-    ByteStream fd(path, O_RDONLY);
+  Hash prefetched;
+  if (node->takePrefetchedHash(&prefetched)) {
+    if (statCacheMode == STAT_CACHE_STRICT) {
+      Hash actual = hashFile(node->path);
+      if (actual != prefetched) {
+        ++statCacheCounters.staleEntries;
+        DEBUG_ERROR << "Prefetched content hash is stale for " << node->path;
+      }
+      return actual;
+    }
+    return prefetched;
+  }
 
-    char buffer[8192];
+  return hashFile(node->path);
+}
 
-    while (true) {
-      size_t n = fd.read(buffer, sizeof(buffer));
-      if (n == 0) {
-        return hasher.build();
+void DiskFile::prefetch(const std::vector<File*>& files) {
+  // Bounds the memory used for file content.
+  const size_t BATCH_SIZE = 256;
+
+  std::vector<PathNode*> nodes;
+  for (File* file: files) {
+    DiskFile* diskFile = dynamic_cast<DiskFile*>(file);
+    if (diskFile != NULL) {
+      nodes.push_back(diskFile->node);
+    }
+  }
+
+  // The same file is often found under several names, through symlinked directories.  Read and
+  // hash each (device, inode) only once.
+  typedef std::pair<dev_t, ino_t> FileId;
+  struct KnownHash {
+    struct stat stats;
+    Hash hash;
+  };
+  std::map<FileId, KnownHash> knownHashes;
+  auto sameVersion = [](const struct stat& a, const struct stat& b) {
+    return a.st_size == b.st_size && a.st_mtim.tv_sec == b.st_mtim.tv_sec &&
+           a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+  };
+
+  for (size_t begin = 0; begin < nodes.size(); begin += BATCH_SIZE) {
+    size_t count = std::min(BATCH_SIZE, nodes.size() - begin);
+    PathNode** batchNodes = &nodes[begin];
+
+    std::vector<struct stat> stats(count);
+    std::vector<int> errors(count);
+    IoBatch statBatch;
+    for (size_t i = 0; i < count; i++) {
+      statBatch.stat(batchNodes[i]->path, &stats[i], &errors[i]);
+    }
+    statBatch.run();
+
+    std::vector<size_t> toRead;
+    std::set<FileId> toReadIds;
+    std::vector<size_t> sameAsRead;  // Nodes whose file is already in toRead.
+    for (size_t i = 0; i < count; i++) {
+      PathNode* node = batchNodes[i];
+      if (errors[i] == ENOENT) {
+        node->setType(PathType::MISSING);
+        node->setPrefetchedHash(Hash::NULL_HASH);
+      } else if (errors[i] == EACCES) {
+        node->setPrefetchedHash(Hash::NULL_HASH);
+      } else if (errors[i] == 0) {
+        PathType type = modePathType(stats[i].st_mode);
+        node->setType(type);
+
+        FileId id(stats[i].st_dev, stats[i].st_ino);
+        auto known = knownHashes.find(id);
+
+        Hash hash;
+        if (type == PathType::DIRECTORY) {
+          node->setPrefetchedHash(Hash::NULL_HASH);
+        } else if (type != PathType::FILE) {
+          // Reading a FIFO or device could block; leave it to contentHash().
+        } else if (known != knownHashes.end() && sameVersion(known->second.stats, stats[i])) {
+          node->setPrefetchedHash(known->second.hash);
+        } else if (toReadIds.count(id) > 0) {
+          sameAsRead.push_back(i);
+        } else if (hashCache != NULL && hashCache->lookup(stats[i], &hash)) {
+          node->setPrefetchedHash(hash);
+          knownHashes[id] = KnownHash { stats[i], hash };
+        } else if (static_cast<uint64_t>(stats[i].st_size) <= SMALL_FILE_SIZE) {
+          toReadIds.insert(id);
+          toRead.push_back(i);
+        }
       }
+    }
 
-      hasher.add(buffer, n);
+    std::vector<std::string> contents(toRead.size());
+    std::vector<struct stat> readStats(toRead.size());
+    std::vector<int> readErrors(toRead.size());
+    IoBatch readBatch;
+    for (size_t j = 0; j < toRead.size(); j++) {
+      readBatch.readFile(batchNodes[toRead[j]]->path, SMALL_FILE_SIZE,
+                         &contents[j], &readStats[j], &readErrors[j]);
     }
-  } catch (const OsError& e) {
-    if (e.getErrorNumber() == ENOENT || e.getErrorNumber() == EACCES ||
-        e.getErrorNumber() == EISDIR) {
-      return Hash::NULL_HASH;
+    readBatch.run();
+
+    for (size_t j = 0; j < toRead.size(); j++) {
+      // Anything odd, e.g. the file having grown or been replaced, is left to contentHash().
+      if (readErrors[j] == 0 && S_ISREG(readStats[j].st_mode)) {
+        Hash hash = Hash::of(contents[j]);
+        if (hashCache != NULL) {
+          hashCache->store(readStats[j], hash);
+        }
+        batchNodes[toRead[j]]->setPrefetchedHash(hash);
+        knownHashes[FileId(readStats[j].st_dev, readStats[j].st_ino)] =
+            KnownHash { readStats[j], hash };
+      }
+    }
+    for (size_t i: sameAsRead) {
+      auto known = knownHashes.find(FileId(stats[i].st_dev, stats[i].st_ino));
+      if (known != knownHashes.end() && sameVersion(known->second.stats, stats[i])) {
+        batchNodes[i]->setPrefetchedHash(known->second.hash);
+      }
     }
-    throw;
   }
 }
 
 std::string DiskFile::readAll() {
-  ByteStream fd(path, O_RDONLY);
+  ByteStream fd(node->path, O_RDONLY);
 
   struct stat stats;
   fd.stat(&stats);
@@ -236,7 +748,9 @@ std::string DiskFile::readAll() {
 }
 
 void DiskFile::writeAll(const std::string& content) {
-  ByteStream fd(path, O_WRONLY | O_TRUNC | O_CREAT);
+  node->invalidate();
+  ByteStream fd(node->path, O_WRONLY | O_TRUNC | O_CREAT);
+  node->setType(PathType::FILE);
 
   std::string::size_type pos = 0;
   while (pos < content.size()) {
@@ -245,7 +759,9 @@ void DiskFile::writeAll(const std::string& content) {
 }
 
 void DiskFile::writeAll(const void* data, int size) {
-  ByteStream fd(path, O_WRONLY | O_TRUNC | O_CREAT);
+  node->invalidate();
+  ByteStream fd(node->path, O_WRONLY | O_TRUNC | O_CREAT);
+  node->setType(PathType::FILE);
 
   const char* pos = reinterpret_cast<const char*>(data);
   while (size > 0) {
@@ -258,19 +774,43 @@ void DiskFile::writeAll(const void* data, int size) {
 // Directory only.
 void DiskFile::list(OwnedPtrVector<File>::Appender output) {
   std::string prefix;
-  if (!path.empty()) {
-    prefix = path + "/";
+  if (!node->path.empty()) {
+    prefix = node->path + "/";
   }
 
-  DirectoryReader reader(path);
-  std::string filename;
-  while (reader.next(&filename)) {
-    if (filename.empty()) {
-      DEBUG_ERROR << "DirectoryReader returned empty file name.";
-    } else if (filename[0] != '.') {  // skip hidden files
-      output.add(newOwned<DiskFile>(prefix + filename, this));
+  std::unordered_map<std::string, unsigned char> seen;
+
+  {
+    DirectoryReader reader(node->path);
+    std::string filename;
+    unsigned char type;
+    while (reader.next(&filename, &type)) {
+      if (filename.empty()) {
+        DEBUG_ERROR << "DirectoryReader returned empty file name.";
+      } else if (filename != "." && filename != "..") {
+        seen[filename] = type;
+      }
     }
   }
+
+  // The listing is fresher than anything cached for the children, including the ones created
+  // below.
+  std::vector<std::string> names;
+  for (auto& entry: seen) {
+    if (entry.first[0] != '.') {  // skip hidden files
+      names.push_back(entry.first);
+    }
+  }
+  std::sort(names.begin(), names.end());
+
+  OwnedPtrVector<File> children;
+  for (const std::string& name: names) {
+    children.add(newOwned<DiskFile>(prefix + name, this));
+  }
+  node->updateChildren(seen);
+  for (int i = 0; i < children.size(); i++) {
+    output.add(children.release(i));
+  }
 }
 
 OwnedPtr<File> DiskFile::relative(const std::string& path) {
@@ -288,10 +828,10 @@ OwnedPtr<File> DiskFile::relative(const std::string& path) {
       return clone();
     } else if (path == "..") {
       return parent();
-    } else if (this->path.empty()) {
+    } else if (node->path.empty()) {
       return newOwned<DiskFile>(path, this);
     } else {
-      return newOwned<DiskFile>(this->path + "/" + path, this);
+      return newOwned<DiskFile>(node->path + "/" + path, this);
     }
 
   } else {
@@ -308,17 +848,13 @@ OwnedPtr<File> DiskFile::relative(const std::string& path) {
       if (first_part == ".") {
         return relative(rest);
       } else if (first_part == "..") {
-        if (parentRef == NULL) {
-          throw std::runtime_error(
-              "Tried to get parent of top-level directory: " + canonicalName());
-        }
-        return parentRef->relative(rest);
+        return parent()->relative(rest);
       } else {
         OwnedPtr<File> temp;
-        if (this->path.empty()) {
+        if (node->path.empty()) {
           temp = newOwned<DiskFile>(first_part, this);
         } else {
-          temp = newOwned<DiskFile>(this->path + "/" + first_part, this);
+          temp = newOwned<DiskFile>(node->path + "/" + first_part, this);
         }
         return temp->relative(rest);
       }
@@ -327,11 +863,13 @@ OwnedPtr<File> DiskFile::relative(const std::string& path) {
 }
 
 void DiskFile::createDirectory() {
+  node->invalidate();
   while (true) {
-    if (mkdir(path.c_str(), 0777) == 0) {
+    if (mkdir(node->path.c_str(), 0777) == 0) {
+      node->setType(PathType::DIRECTORY);
       return;
     } else if (errno != EINTR) {
-      throw OsError(path, "mkdir", errno);
+      throw OsError(node->path, "mkdir", errno);
     }
   }
 }
@@ -339,14 +877,17 @@ void DiskFile::createDirectory() {
 void DiskFile::link(File* target) {
   DiskFile* diskTarget = dynamic_cast<DiskFile*>(target);
   if (diskTarget == NULL) {
-    throw new std::invalid_argument("Cannot link disk file to non-disk file: " + path);
+    throw new std::invalid_argument("Cannot link disk file to non-disk file: " + node->path);
   }
 
-  WRAP_SYSCALL(link, diskTarget->path.c_str(), path.c_str());
+  node->invalidate();
+  WRAP_SYSCALL(link, diskTarget->node->path.c_str(), node->path.c_str());
 }
 
 void DiskFile::unlink() {
-  WRAP_SYSCALL(unlink, path.c_str());
+  node->invalidate();
+  WRAP_SYSCALL(unlink, node->path.c_str());
+  node->setType(PathType::MISSING);
 }
 
 }  // namespace ekam
@@ -19,14 +19,49 @@
 
 #include "File.h"
 #include <string>
+#include <vector>
+#include <stdint.h>
 
 namespace ekam {
 
+class HashCache;
+
 class DiskFile: public File {
 public:
   DiskFile(const std::string& path, File* parent);
   ~DiskFile();
 
+  // Identifies the algorithm used by contentHash().  Bump this whenever it changes so that
+  // persisted hashes are invalidated.
+  static const uint32_t CONTENT_HASH_VERSION = 2;
+
+  // Use the given cache (which must outlive all calls to contentHash()) to avoid re-reading
+  // unchanged files.  Pass NULL to disable.
+  static void setHashCache(HashCache* cache);
+
+  // exists(), isFile() and isDirectory() remember the type of each path until it is invalidated
+  // by invalidateCache(), by a mutation made through a DiskFile, or by a list() of its parent.
+  // STRICT still consults the cache but also stat()s every time, reporting stale entries.
+  enum StatCacheMode {
+    STAT_CACHE_DISABLED,
+    STAT_CACHE_ENABLED,
+    STAT_CACHE_STRICT
+  };
+  static void setStatCacheMode(StatCacheMode mode);
+
+  struct StatCacheCounters {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t invalidations;
+    uint64_t staleEntries;  // Only detected in STRICT mode.
+  };
+  static StatCacheCounters getStatCacheCounters();
+
+  // Learn the types and content hashes of many files at once through an IoBatch, so that the
+  // next exists(), isFile(), isDirectory() and contentHash() on each need no I/O.  Small files
+  // that the hash cache doesn't know are read and hashed here.  Non-DiskFiles are ignored.
+  static void prefetch(const std::vector<File*>& files);
+
   // implements File ---------------------------------------------------------------------
   std::string basename();
   std::string canonicalName();
@@ -42,6 +77,7 @@ public:
   bool exists();
   bool isFile();
   bool isDirectory();
+  void invalidateCache();
 
   // File only.
   Hash contentHash();
@@ -60,9 +96,15 @@ public:
 
 private:
   class DiskRefImpl;
+  class PathNode;
+
+  // Shared with all other DiskFiles for the same path.  Holds a reference.
+  PathNode* node;
+
+  explicit DiskFile(PathNode* node);
 
-  std::string path;
-  OwnedPtr<File> parentRef;
+  template <typename U, typename... Params>
+  friend OwnedPtr<U> newOwned(Params&&... params);
 };
 
 }  // namespace ekam
@@ -20,27 +20,42 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
 #include <sys/time.h>
 #include <sys/epoll.h>
 #include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <sys/inotify.h>
+#include <sys/fanotify.h>
+#include <sys/vfs.h>
 #include <sys/stat.h>
 #include <algorithm>
+#include <set>
 #include <stdexcept>
 #include <assert.h>
 #include <poll.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <limits.h>
+#include <vector>
 
 #include "base/Debug.h"
 #include "base/Table.h"
+#include "Pidfd.h"
 
 namespace ekam {
 
 namespace {
 
+uint64_t monotonicNow() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
 std::string epollEventsToString(uint32_t events) {
   std::string result;
   if (events == 0) {
@@ -102,9 +117,10 @@ bool isDirectory(const std::string& path) {
 
 }  // namespace
 
-EpollEventManager::Epoller::Epoller()
+EpollEventManager::Epoller::Epoller(int maxEventsPerWait)
     : epollHandle("epoll", WRAP_SYSCALL(epoll_create1, (int)EPOLL_CLOEXEC)),
-      watchCount(0) {}
+      watchCount(0), readyEvents(std::max(1, maxEventsPerWait)), readyCount(0),
+      nextReadyEvent(0), readyTime(0), waitCount(0), eventCount(0) {}
 
 EpollEventManager::Epoller::~Epoller() {
   if (watchCount > 0) {
@@ -114,15 +130,15 @@ EpollEventManager::Epoller::~Epoller() {
 
 EpollEventManager::Epoller::Watch::Watch(Epoller* epoller, OsHandle* handle,
                                          uint32_t events, IoHandler* handler)
-    : epoller(epoller), events(0), registeredEvents(0), fd(handle->get()), name(handle->getName()),
-      handler(handler) {
+    : epoller(epoller), events(0), registeredEvents(0), passive(false), fd(handle->get()),
+      name(handle->getName()), handler(handler) {
   addEvents(events);
 }
 
 EpollEventManager::Epoller::Watch::Watch(Epoller* epoller, int fd,
                                          uint32_t events, IoHandler* handler)
-    : epoller(epoller), events(0), registeredEvents(0), fd(fd), name(toString(fd)),
-      handler(handler) {
+    : epoller(epoller), events(0), registeredEvents(0), passive(false), fd(fd),
+      name(toString(fd)), handler(handler) {
   addEvents(events);
 }
 
@@ -132,6 +148,7 @@ EpollEventManager::Epoller::Watch::~Watch() {
   if (epoller->watchesNeedingUpdate.erase(this) > 0) {
     updateRegistration();
   }
+  epoller->forgetReadyEvents(this);
 }
 
 void EpollEventManager::Epoller::Watch::addEvents(uint32_t eventsToAdd) {
@@ -164,6 +181,13 @@ void EpollEventManager::Epoller::Watch::removeEvents(uint32_t eventsToRemove) {
   }
 }
 
+void EpollEventManager::Epoller::Watch::setPassive() {
+  if (events != 0 || registeredEvents != 0) {
+    throw std::logic_error("Watch::setPassive() called after events were added.");
+  }
+  passive = true;
+}
+
 void EpollEventManager::Epoller::Watch::updateRegistration() {
   if (registeredEvents == events) {
     DEBUG_ERROR << "Watch does not need updating.";
@@ -173,10 +197,10 @@ void EpollEventManager::Epoller::Watch::updateRegistration() {
 
   int op = EPOLL_CTL_MOD;
   if (registeredEvents == 0) {
-    ++epoller->watchCount;
+    if (!passive) ++epoller->watchCount;
     op = EPOLL_CTL_ADD;
   } else if (events == 0) {
-    --epoller->watchCount;
+    if (!passive) --epoller->watchCount;
     op = EPOLL_CTL_DEL;
   }
   registeredEvents = events;
@@ -187,33 +211,79 @@ void EpollEventManager::Epoller::Watch::updateRegistration() {
   WRAP_SYSCALL(epoll_ctl, epoller->epollHandle, op, fd, &event);
 }
 
-bool EpollEventManager::Epoller::handleEvent() {
-  // Run pending updates.
+void EpollEventManager::Epoller::forgetReadyEvents(Watch* watch) {
+  for (int i = nextReadyEvent; i < readyCount; i++) {
+    if (readyEvents[i].data.ptr == watch) {
+      readyEvents[i].data.ptr = nullptr;
+    }
+  }
+}
+
+bool EpollEventManager::Epoller::handleEvents(bool block) {
+  // If a handler threw, finish the events left over from last time before waiting again.
+  if (nextReadyEvent >= readyCount) {
+    if (!updateRegistrations()) {
+      if (block) {
+        DEBUG_INFO << "No more events.";
+      }
+      return false;
+    }
+
+    DEBUG_INFO << "Waiting for " << watchCount << " events...";
+    nextReadyEvent = 0;
+    readyCount = 0;
+    readyCount = WRAP_SYSCALL(epoll_wait, epollHandle, readyEvents.data(), readyEvents.size(),
+                              block ? -1 : 0);
+    readyTime = monotonicNow();
+    ++waitCount;
+    if (readyCount == 0 && block) {
+      throw std::logic_error("epoll_wait() returned zero despite infinite timeout.");
+    }
+  }
+
+  dispatchReadyEvents();
+  return true;
+}
+
+bool EpollEventManager::Epoller::updateRegistrations() {
   for (Watch* watch : watchesNeedingUpdate) {
     watch->updateRegistration();
   }
   watchesNeedingUpdate.clear();
+  return watchCount > 0;
+}
 
-  if (watchCount == 0) {
-    DEBUG_INFO << "No more events.";
-    return false;
+void EpollEventManager::Epoller::handleReadyEvents() {
+  if (nextReadyEvent >= readyCount) {
+    updateRegistrations();
+    nextReadyEvent = 0;
+    readyCount = 0;
+    readyCount = WRAP_SYSCALL(epoll_wait, epollHandle, readyEvents.data(), readyEvents.size(), 0);
+    readyTime = monotonicNow();
+    ++waitCount;
   }
 
-  DEBUG_INFO << "Waiting for " << watchCount << " events...";
-  struct epoll_event event;
-  int result = WRAP_SYSCALL(epoll_wait, epollHandle, &event, 1, -1);
-  if (result == 0) {
-    throw std::logic_error("epoll_wait() returned zero despite infinite timeout.");
-  } else if (result > 1) {
-    throw std::logic_error("epoll_wait() returned more than one event when only one requested.");
-  }
+  dispatchReadyEvents();
+}
 
-  Watch* watch = reinterpret_cast<Watch*>(event.data.ptr);
-  DEBUG_INFO << "epoll event: " << watch->name << ":" << epollEventsToString(event.events);
+void EpollEventManager::Epoller::dispatchReadyEvents() {
+  while (nextReadyEvent < readyCount) {
+    struct epoll_event& event = readyEvents[nextReadyEvent++];
+    Watch* watch = reinterpret_cast<Watch*>(event.data.ptr);
+    if (watch == nullptr || watch->events == 0) {
+      // Destroyed by an earlier handler, or no longer interested.
+      continue;
+    }
 
-  watch->handler->handle(event.events);
+    DEBUG_INFO << "epoll event: " << watch->name << ":" << epollEventsToString(event.events);
+    ++eventCount;
 
-  return true;
+    // The event was ready at least since epoll_wait() returned; earlier handlers made it wait.
+    uint64_t start = monotonicNow();
+    eventLatency.add((start - readyTime) / 1000);
+    watch->handler->handle(event.events);
+    eventHandlerTime.add((monotonicNow() - start) / 1000);
+  }
 }
 
 // =============================================================================
@@ -229,10 +299,38 @@ sigset_t getHandledSignals() {
 
 const sigset_t HANDLED_SIGNALS = getHandledSignals();
 
+bool pidfdEnabled = true;
+
+ProcessExitCode decodeWaitStatus(int waitStatus) {
+  if (WIFEXITED(waitStatus)) {
+    return ProcessExitCode(WEXITSTATUS(waitStatus));
+  } else if (WIFSIGNALED(waitStatus)) {
+    return ProcessExitCode(ProcessExitCode::SIGNALED, WTERMSIG(waitStatus));
+  } else {
+    DEBUG_ERROR << "Didn't understand process exit status.";
+    return ProcessExitCode(-1);
+  }
+}
+
+sigset_t emptySignalSet() {
+  sigset_t result;
+  sigemptyset(&result);
+  return result;
+}
+
 }  // namespace
 
+bool EpollEventManager::isPidfdSupported() {
+  return Pidfd::isSupported();
+}
+
+void EpollEventManager::setPidfdEnabled(bool enabled) {
+  pidfdEnabled = enabled;
+}
+
 EpollEventManager::SignalHandler::SignalHandler(Epoller* epoller)
-    : signalStream(WRAP_SYSCALL(signalfd, -1, &HANDLED_SIGNALS, SFD_NONBLOCK | SFD_CLOEXEC),
+    : epoller(epoller), usePidfd(pidfdEnabled && isPidfdSupported()),
+      signalStream(WRAP_SYSCALL(signalfd, -1, &HANDLED_SIGNALS, SFD_NONBLOCK | SFD_CLOEXEC),
                    "signalfd"),
       watch(epoller, signalStream.getHandle(), 0, this) {
   sigprocmask(SIG_BLOCK, &HANDLED_SIGNALS, NULL);
@@ -270,6 +368,182 @@ void EpollEventManager::SignalHandler::maybeStopExpecting() {
 
 // =======================================================================================
 
+class EpollEventManager::UserSignalHandler::SignalFulfiller : public PromiseFulfiller<void> {
+public:
+  SignalFulfiller(Callback* callback, UserSignalHandler* signalHandler, int signum)
+      : callback(callback), signalHandler(signalHandler), signum(signum) {
+    signalHandler->fulfillers.insert(std::make_pair(signum, this));
+  }
+  ~SignalFulfiller() {
+    if (signalHandler != nullptr) {
+      auto range = signalHandler->fulfillers.equal_range(signum);
+      for (auto iter = range.first; iter != range.second; ++iter) {
+        if (iter->second == this) {
+          signalHandler->fulfillers.erase(iter);
+          break;
+        }
+      }
+    }
+  }
+
+  void fulfill() {
+    signalHandler = nullptr;
+    callback->fulfill();
+  }
+
+private:
+  Callback* callback;
+  UserSignalHandler* signalHandler;
+  int signum;
+};
+
+EpollEventManager::UserSignalHandler::UserSignalHandler(Epoller* epoller)
+    : signals(emptySignalSet()),
+      signalStream(WRAP_SYSCALL(signalfd, -1, &signals, SFD_NONBLOCK | SFD_CLOEXEC),
+                   "signalfd(user)"),
+      watch(epoller, signalStream.getHandle(), 0, this) {
+  watch.setPassive();
+  watch.addEvents(EPOLLIN);
+}
+
+EpollEventManager::UserSignalHandler::~UserSignalHandler() {
+  if (!fulfillers.empty()) {
+    DEBUG_ERROR << "UserSignalHandler destroyed while promises were waiting on it.";
+  }
+  sigprocmask(SIG_UNBLOCK, &signals, NULL);
+}
+
+Promise<void> EpollEventManager::UserSignalHandler::onSignal(int signum) {
+  if (!sigismember(&signals, signum)) {
+    sigaddset(&signals, signum);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+    WRAP_SYSCALL(signalfd, signalStream.getHandle()->get(), &signals, 0);
+  }
+  return newPromise<SignalFulfiller>(this, signum);
+}
+
+void EpollEventManager::UserSignalHandler::handle(uint32_t events) {
+  struct signalfd_siginfo signalEvent;
+  if (signalStream.read(&signalEvent, sizeof(signalEvent)) != sizeof(signalEvent)) {
+    DEBUG_ERROR << "read(signalfd) returned wrong size.";
+    return;
+  }
+
+  DEBUG_INFO << "Received signal " << signalEvent.ssi_signo << " on signalfd.";
+
+  // Detach all waiting fulfillers before calling any of them, since callbacks may wait again.
+  std::vector<SignalFulfiller*> toFulfill;
+  auto range = fulfillers.equal_range(signalEvent.ssi_signo);
+  for (auto iter = range.first; iter != range.second; ++iter) {
+    toFulfill.push_back(iter->second);
+  }
+  fulfillers.erase(range.first, range.second);
+
+  for (SignalFulfiller* fulfiller: toFulfill) {
+    fulfiller->fulfill();
+  }
+}
+
+Promise<void> EpollEventManager::onSignal(int signum) {
+  return userSignalHandler.onSignal(signum);
+}
+
+// =======================================================================================
+
+class EpollEventManager::TimerHandler::TimerFulfiller : public PromiseFulfiller<void> {
+public:
+  TimerFulfiller(Callback* callback, TimerHandler* timerHandler, uint64_t deadline)
+      : callback(callback), timerHandler(timerHandler) {
+    iter = timerHandler->timers.insert(std::make_pair(deadline, this));
+    if (deadline < timerHandler->armedDeadline) {
+      timerHandler->rearm();
+    }
+  }
+  ~TimerFulfiller() {
+    if (timerHandler != nullptr) {
+      // Leave the timerfd armed; if it fires early, handle() just re-arms it.
+      timerHandler->timers.erase(iter);
+      if (timerHandler->timers.empty()) {
+        timerHandler->rearm();
+      }
+    }
+  }
+
+  void fulfill() {
+    timerHandler = nullptr;
+    callback->fulfill();
+  }
+
+private:
+  Callback* callback;
+  TimerHandler* timerHandler;
+  TimerMap::iterator iter;
+};
+
+EpollEventManager::TimerHandler::TimerHandler(Epoller* epoller)
+    : timerStream(WRAP_SYSCALL(timerfd_create, CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC),
+                  "timerfd"),
+      watch(epoller, timerStream.getHandle(), 0, this),
+      armedDeadline(UINT64_MAX) {}
+
+EpollEventManager::TimerHandler::~TimerHandler() {
+  if (!timers.empty()) {
+    DEBUG_ERROR << "TimerHandler destroyed while promises were waiting on it.";
+  }
+}
+
+Promise<void> EpollEventManager::TimerHandler::afterDelay(uint64_t milliseconds) {
+  return newPromise<TimerFulfiller>(this, monotonicNow() + milliseconds * 1000000);
+}
+
+void EpollEventManager::TimerHandler::rearm() {
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+
+  if (timers.empty()) {
+    // Disarm, and stop keeping the loop alive.
+    armedDeadline = UINT64_MAX;
+    watch.removeEvents(EPOLLIN);
+  } else {
+    armedDeadline = timers.begin()->first;
+    spec.it_value.tv_sec = armedDeadline / 1000000000;
+    spec.it_value.tv_nsec = armedDeadline % 1000000000;
+    watch.addEvents(EPOLLIN);
+  }
+
+  struct itimerspec oldSpec;
+  WRAP_SYSCALL(timerfd_settime, timerStream.getHandle()->get(), TFD_TIMER_ABSTIME, &spec,
+               &oldSpec);
+}
+
+void EpollEventManager::TimerHandler::handle(uint32_t events) {
+  uint64_t expirations;
+  if (read(timerStream.getHandle()->get(), &expirations, sizeof(expirations)) < 0 &&
+      errno != EAGAIN) {
+    DEBUG_ERROR << "read(timerfd): " << strerror(errno);
+  }
+
+  // Detach all expired fulfillers before calling any of them, since callbacks may add timers.
+  uint64_t now = monotonicNow();
+  std::vector<TimerFulfiller*> toFulfill;
+  TimerMap::iterator end = timers.upper_bound(now);
+  for (TimerMap::iterator iter = timers.begin(); iter != end; ++iter) {
+    toFulfill.push_back(iter->second);
+  }
+  timers.erase(timers.begin(), end);
+  rearm();
+
+  for (TimerFulfiller* fulfiller: toFulfill) {
+    fulfiller->fulfill();
+  }
+}
+
+Promise<void> EpollEventManager::afterDelay(uint64_t milliseconds) {
+  return timerHandler.afterDelay(milliseconds);
+}
+
+// =======================================================================================
+
 class EpollEventManager::AsyncCallbackHandler : public PendingRunnable {
 public:
   AsyncCallbackHandler(EpollEventManager* eventManager, OwnedPtr<Runnable> runnable)
@@ -311,40 +585,69 @@ class EpollEventManager::SignalHandler::ProcessExitHandler
 public:
   ProcessExitHandler(Callback* callback, SignalHandler* signalHandler, pid_t pid)
       : callback(callback), signalHandler(signalHandler), pid(pid) {
-    if (!signalHandler->processExitHandlerMap.insert(
-        std::make_pair(pid, this)).second) {
-      throw std::runtime_error("Already waiting on this process.");
+    if (signalHandler->usePidfd) {
+      pidfd = newOwned<Pidfd>(pid);
+      pidfdHandler = newOwned<PidfdHandler>(this);
+      pidfdWatch = newOwned<Epoller::Watch>(signalHandler->epoller, pidfd->getHandle(), EPOLLIN,
+                                            pidfdHandler.get());
+    } else {
+      if (!signalHandler->processExitHandlerMap.insert(
+          std::make_pair(pid, this)).second) {
+        throw std::runtime_error("Already waiting on this process.");
+      }
+      signalHandler->watch.addEvents(EPOLLIN);
     }
-    signalHandler->watch.addEvents(EPOLLIN);
   }
   ~ProcessExitHandler() {
-    if (pid != -1) {
+    if (pid != -1 && pidfd == nullptr) {
       signalHandler->processExitHandlerMap.erase(pid);
       signalHandler->maybeStopExpecting();
     }
   }
 
-  void handle(int waitStatus) {
+  // Called by SignalHandler in SIGCHLD mode, once the process has been reaped.
+  void handle(int waitStatus, const struct rusage& usage) {
     DEBUG_INFO << "Process " << pid << " exited with status: " << waitStatus;
 
     signalHandler->processExitHandlerMap.erase(pid);
     signalHandler->maybeStopExpecting();
     pid = -1;
 
-    if (WIFEXITED(waitStatus)) {
-      callback->fulfill(ProcessExitCode(WEXITSTATUS(waitStatus)));
-    } else if (WIFSIGNALED(waitStatus)) {
-      callback->fulfill(ProcessExitCode(ProcessExitCode::SIGNALED, WTERMSIG(waitStatus)));
-    } else {
-      DEBUG_ERROR << "Didn't understand process exit status.";
-      callback->fulfill(ProcessExitCode(-1));
-    }
+    ProcessExitCode exitCode = decodeWaitStatus(waitStatus);
+    exitCode.setResourceUsage(usage);
+    callback->fulfill(exitCode);
   }
 
 private:
+  class PidfdHandler: public IoHandler {
+  public:
+    explicit PidfdHandler(ProcessExitHandler* owner): owner(owner) {}
+    void handle(uint32_t events) { owner->reap(); }
+
+  private:
+    ProcessExitHandler* owner;
+  };
+
   Callback* callback;
   SignalHandler* signalHandler;
   pid_t pid;
+
+  // pidfd mode only.  The watch must be destroyed before the handle.
+  OwnedPtr<Pidfd> pidfd;
+  OwnedPtr<PidfdHandler> pidfdHandler;
+  OwnedPtr<Epoller::Watch> pidfdWatch;
+
+  // Called in pidfd mode when the pidfd is readable.
+  void reap() {
+    ProcessExitCode exitCode;
+    if (!pidfd->tryReap(&exitCode)) {
+      return;
+    }
+
+    pidfdWatch->removeEvents(EPOLLIN);
+    pid = -1;
+    callback->fulfill(exitCode);
+  }
 };
 
 void EpollEventManager::SignalHandler::handleProcessExit() {
@@ -355,11 +658,12 @@ void EpollEventManager::SignalHandler::handleProcessExit() {
   // children.  Signals suck so much.
   while (true) {
     int waitStatus;
-    pid_t pid = waitpid(-1, &waitStatus, WNOHANG);
+    struct rusage usage;
+    pid_t pid = wait4(-1, &waitStatus, WNOHANG, &usage);
     if (pid < 0) {
       // ECHILD indicates there are no child processes.  Anything else is a real error.
       if (errno != ECHILD) {
-        DEBUG_ERROR << "waitpid: " << strerror(errno);
+        DEBUG_ERROR << "wait4: " << strerror(errno);
       }
       break;
     } else if (pid == 0) {
@@ -381,7 +685,7 @@ void EpollEventManager::SignalHandler::handleProcessExit() {
       return;
     }
 
-    iter->second->handle(waitStatus);
+    iter->second->handle(waitStatus, usage);
   }
 }
 
@@ -397,8 +701,8 @@ Promise<ProcessExitCode> EpollEventManager::onProcessExit(pid_t pid) {
 
 class EpollEventManager::IoWatcherImpl: public IoWatcher, public IoHandler {
 public:
-  IoWatcherImpl(Epoller* epoller, int fd)
-      : watch(epoller, fd, 0, this),
+  IoWatcherImpl(EpollEventManager* eventManager, int fd)
+      : eventManager(eventManager), fd(fd), watch(&eventManager->epoller, fd, 0, this),
         readFulfiller(nullptr), writeFulfiller(nullptr) {}
 
   ~IoWatcherImpl() {
@@ -426,6 +730,14 @@ public:
     return newPromise<Fulfiller>(&watch, EPOLLOUT, &writeFulfiller);
   }
 
+  Promise<size_t> readAsync(void* buffer, size_t size) {
+    int fd = this->fd;
+    return eventManager->when(onReadable())(
+      [fd, buffer, size](Void) -> size_t {
+        return WRAP_SYSCALL(read, fd, buffer, size);
+      });
+  }
+
   // implements IoHandler --------------------------------------------------------------
   void handle(uint32_t events) {
     if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
@@ -480,17 +792,164 @@ private:
     Fulfiller** ptr;
   };
 
+  EpollEventManager* eventManager;
+  int fd;
   Epoller::Watch watch;
   Fulfiller* readFulfiller;
   Fulfiller* writeFulfiller;
 };
 
 OwnedPtr<EventManager::IoWatcher> EpollEventManager::watchFd(int fd) {
-  return newOwned<IoWatcherImpl>(&epoller, fd);
+  return newOwned<IoWatcherImpl>(this, fd);
 }
 
 // =======================================================================================
 
+namespace {
+
+bool fanotifyEnabled = false;
+
+const uint64_t FANOTIFY_EVENTS =
+    FAN_ATTRIB | FAN_CLOSE_WRITE | FAN_CREATE | FAN_DELETE | FAN_DELETE_SELF | FAN_MODIFY |
+    FAN_MOVE_SELF | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_ONDIR;
+
+// Identifies a directory in fanotify events:  the filesystem ID plus the file handle.
+std::string fanotifyKey(const void* fsid, int handleType, const void* handle, size_t handleSize) {
+  std::string result(reinterpret_cast<const char*>(fsid), sizeof(fsid_t));
+  result.append(reinterpret_cast<const char*>(&handleType), sizeof(handleType));
+  result.append(reinterpret_cast<const char*>(handle), handleSize);
+  return result;
+}
+
+uint32_t fanotifyToInotifyMask(uint64_t mask, bool isSelf) {
+  static const struct { uint64_t fanotify; uint32_t inotify; } FLAGS[] = {
+    { FAN_ATTRIB, IN_ATTRIB },
+    { FAN_CLOSE_WRITE, IN_CLOSE_WRITE },
+    { FAN_CREATE, IN_CREATE },
+    { FAN_DELETE, IN_DELETE },
+    { FAN_MODIFY, IN_MODIFY },
+    { FAN_MOVED_FROM, IN_MOVED_FROM },
+    { FAN_MOVED_TO, IN_MOVED_TO },
+    { FAN_DELETE_SELF, IN_DELETE_SELF },
+    { FAN_MOVE_SELF, IN_MOVE_SELF },
+  };
+
+  uint32_t result = 0;
+  for (auto& flag: FLAGS) {
+    if (mask & flag.fanotify) {
+      result |= flag.inotify;
+    }
+  }
+  if (!isSelf) {
+    // A file deleting or moving itself, reported against its directory.  The entry events
+    // (IN_DELETE, IN_MOVED_FROM) already cover it; don't let it look like the directory went away.
+    result &= ~(IN_DELETE_SELF | IN_MOVE_SELF);
+  }
+  return result;
+}
+
+}  // namespace
+
+void EpollEventManager::setFanotifyEnabled(bool enabled) {
+  fanotifyEnabled = enabled;
+}
+
+// One fanotify group with a mark on each filesystem holding a watched directory.  Events name the
+// directory by file handle, so each WatchedDirectory is registered under its directory's handle;
+// events in directories nobody is watching are dropped.
+class EpollEventManager::InotifyHandler::Fanotify : public IoHandler {
+public:
+  Fanotify(InotifyHandler* inotifyHandler, Epoller* epoller, int fd)
+      : inotifyHandler(inotifyHandler), stream(fd, "fanotify"),
+        watch(epoller, stream.getHandle(), 0, this) {}
+  ~Fanotify() {}
+
+  // Returns null if fanotify can't be used at all.
+  static OwnedPtr<Fanotify> create(InotifyHandler* inotifyHandler, Epoller* epoller) {
+    int fd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_CLOEXEC | FAN_NONBLOCK,
+                           O_RDONLY);
+    if (fd < 0) {
+      DEBUG_WARNING << "fanotify_init: " << strerror(errno) << "; using inotify.";
+      return nullptr;
+    }
+    return newOwned<Fanotify>(inotifyHandler, epoller, fd);
+  }
+
+  // Report events in the directory at `path` to `directory`, setting *key to what identifies it.
+  // Returns false if the directory can't be watched through fanotify.
+  bool add(const std::string& path, WatchedDirectory* directory, std::string* key) {
+    struct statfs filesystem;
+    if (statfs(path.c_str(), &filesystem) < 0) {
+      return false;
+    }
+    std::string fsid(reinterpret_cast<const char*>(&filesystem.f_fsid), sizeof(fsid_t));
+
+    if (markedFilesystems.count(fsid) == 0) {
+      if (unmarkableFilesystems.count(fsid) > 0) {
+        return false;
+      }
+      if (fanotify_mark(stream.getHandle()->get(), FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+                        FANOTIFY_EVENTS, AT_FDCWD, path.c_str()) < 0) {
+        DEBUG_WARNING << "fanotify can't watch the filesystem containing " << path << ": "
+                      << strerror(errno) << "; using inotify there.";
+        unmarkableFilesystems.insert(fsid);
+        return false;
+      }
+      DEBUG_INFO << "fanotify marked the filesystem containing " << path;
+      markedFilesystems.insert(fsid);
+    }
+
+    union {
+      struct file_handle handle;
+      char space[sizeof(struct file_handle) + MAX_HANDLE_SZ];
+    } handle;
+    handle.handle.handle_bytes = MAX_HANDLE_SZ;
+    int mountId;
+    if (name_to_handle_at(AT_FDCWD, path.c_str(), &handle.handle, &mountId,
+                          AT_SYMLINK_FOLLOW) < 0) {
+      DEBUG_WARNING << "name_to_handle_at(" << path << "): " << strerror(errno);
+      return false;
+    }
+
+    *key = fanotifyKey(&filesystem.f_fsid, handle.handle.handle_type, handle.handle.f_handle,
+                       handle.handle.handle_bytes);
+    directories.insert(std::make_pair(*key, directory));
+    watch.addEvents(EPOLLIN);
+    return true;
+  }
+
+  void remove(const std::string& key, WatchedDirectory* directory) {
+    auto range = directories.equal_range(key);
+    for (auto iter = range.first; iter != range.second; ++iter) {
+      if (iter->second == directory) {
+        directories.erase(iter);
+        break;
+      }
+    }
+    if (directories.empty()) {
+      watch.removeEvents(EPOLLIN);
+    }
+  }
+
+  // implements IoHandler --------------------------------------------------------------
+  void handle(uint32_t epollEvents);
+
+private:
+  InotifyHandler* inotifyHandler;
+  ByteStream stream;
+  Epoller::Watch watch;
+
+  std::unordered_set<std::string> markedFilesystems;
+  std::unordered_set<std::string> unmarkableFilesystems;
+
+  // Several WatchedDirectories share a key when their paths name the same directory.
+  std::unordered_multimap<std::string, WatchedDirectory*> directories;
+
+  void dispatch(const std::string& key, uint32_t mask, const std::string& basename);
+};
+
+// =======================================================================================
+
 class EpollEventManager::InotifyHandler::WatchedDirectory {
   class CallbackTable : public Table<IndexedColumn<std::string>,
                                      UniqueColumn<FileWatcherImpl*> > {
@@ -501,14 +960,20 @@ class EpollEventManager::InotifyHandler::WatchedDirectory {
 
 public:
   WatchedDirectory(InotifyHandler* inotifyHandler, const std::string& path)
-      : inotifyHandler(inotifyHandler), path(path) {
-    wd = WRAP_SYSCALL(inotify_add_watch, *inotifyHandler->inotifyStream.getHandle(), path.c_str(),
-                      IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_DELETE_SELF |
-                      IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO);
-    DEBUG_INFO << "inotify_add_watch(" << path << ") [" << wd << "]";
-    inotifyHandler->watchMap[wd] = this;
+      : inotifyHandler(inotifyHandler), wd(-1), path(path) {
+    if (inotifyHandler->fanotify != nullptr &&
+        inotifyHandler->fanotify->add(path, this, &fanotifyKey)) {
+      DEBUG_INFO << "fanotify watching " << path;
+    } else {
+      wd = WRAP_SYSCALL(inotify_add_watch, *inotifyHandler->inotifyStream.getHandle(),
+                        path.c_str(),
+                        IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_DELETE_SELF |
+                        IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO);
+      DEBUG_INFO << "inotify_add_watch(" << path << ") [" << wd << "]";
+      inotifyHandler->watchMap.insert(std::make_pair(wd, this));
+      inotifyHandler->watch.addEvents(EPOLLIN);
+    }
     inotifyHandler->watchByNameMap[path] = this;
-    inotifyHandler->watch.addEvents(EPOLLIN);
   }
 
   ~WatchedDirectory() {
@@ -518,15 +983,18 @@ public:
       DEBUG_ERROR << "Deleting WatchedDirectory before all FileWatcherImpls were removed.";
     }
 
-    if (wd >= 0) {
-      DEBUG_INFO << "inotify_rm_watch(" << path << ") [" << wd << "]";
+    int oldWd = wd;
+    invalidate();
 
-      if (WRAP_SYSCALL(inotify_rm_watch, *inotifyHandler->inotifyStream.getHandle(), wd) < 0) {
+    // inotify_add_watch() returns the existing descriptor when the same directory is watched
+    // again under another name, so only remove it once nobody else is using it.
+    if (oldWd >= 0 && inotifyHandler->watchMap.count(oldWd) == 0) {
+      DEBUG_INFO << "inotify_rm_watch(" << path << ") [" << oldWd << "]";
+
+      if (WRAP_SYSCALL(inotify_rm_watch, *inotifyHandler->inotifyStream.getHandle(), oldWd) < 0) {
         DEBUG_ERROR << "inotify_rm_watch(" << path << "): " << strerror(errno);
       }
     }
-
-    invalidate();
   }
 
   void addWatch(const std::string& basename, FileWatcherImpl* op) {
@@ -544,17 +1012,31 @@ public:
 
   void invalidate() {
     if (wd >= 0) {
-      inotifyHandler->watchMap.erase(wd);
+      auto range = inotifyHandler->watchMap.equal_range(wd);
+      for (auto iter = range.first; iter != range.second; ++iter) {
+        if (iter->second == this) {
+          inotifyHandler->watchMap.erase(iter);
+          break;
+        }
+      }
       inotifyHandler->watchByNameMap.erase(path);
       wd = -1;
+    } else if (!fanotifyKey.empty()) {
+      inotifyHandler->fanotify->remove(fanotifyKey, this);
+      inotifyHandler->watchByNameMap.erase(path);
+      fanotifyKey.clear();
     }
   }
 
-  void handle(struct inotify_event* event);
+  // `mask` is made of inotify's IN_* flags, whichever API the event came from.
+  void handle(uint32_t mask, const std::string& basename);
+
+  void flagAllAsUnknown();
 
 private:
   InotifyHandler* inotifyHandler;
-  int wd;
+  int wd;                   // If watched with inotify.
+  std::string fanotifyKey;  // If watched with fanotify.
   std::string path;
 
   CallbackTable callbackTable;
@@ -582,7 +1064,8 @@ private:
 class EpollEventManager::InotifyHandler::FileWatcherImpl: public FileWatcher {
 public:
   FileWatcherImpl(InotifyHandler* inotifyHandler, const std::string& filename)
-      : watchedDirectory(nullptr), modified(false), deleted(false), fulfiller(nullptr) {
+      : watchedDirectory(nullptr), modified(false), deleted(false), unknown(false),
+        relistNeeded(false), fulfiller(nullptr) {
     // Split directory and basename.
     std::string directory;
     std::string basename;
@@ -632,6 +1115,25 @@ public:
     maybeFulfill();
   }
 
+  void flagAsUnknown() {
+    unknown = true;
+    relistNeeded = true;
+    maybeFulfill();
+  }
+
+  // A child of the watched directory was created, deleted or renamed.
+  void flagChildAsChanged(const std::string& name) {
+    if (!relistNeeded) {
+      if (changedChildren.size() >= MAX_CHANGED_CHILDREN) {
+        relistNeeded = true;
+        changedChildren.clear();
+      } else {
+        changedChildren.insert(name);
+      }
+    }
+    flagAsModified();
+  }
+
   // implements FileWatcher --------------------------------------------------------------
   Promise<FileChangeType> onChange() {
     if (fulfiller != nullptr) {
@@ -642,6 +1144,16 @@ public:
     return result;
   }
 
+  bool getChangedChildren(std::vector<std::string>* names) {
+    bool result = !relistNeeded;
+    if (result) {
+      names->assign(changedChildren.begin(), changedChildren.end());
+    }
+    changedChildren.clear();
+    relistNeeded = false;
+    return result;
+  }
+
 private:
   class Fulfiller: public PromiseFulfiller<FileChangeType> {
   public:
@@ -676,9 +1188,15 @@ private:
     Fulfiller** ptr;
   };
 
+  // Past this many changed children, re-listing the directory is about as cheap.
+  static const size_t MAX_CHANGED_CHILDREN = 256;
+
   WatchedDirectory* watchedDirectory;
   bool modified;
   bool deleted;
+  bool unknown;
+  std::set<std::string> changedChildren;
+  bool relistNeeded;
   Fulfiller* fulfiller;
 
   void maybeFulfill() {
@@ -687,36 +1205,111 @@ private:
         fulfiller->fulfill(FileChangeType::DELETED);
       } else if (modified) {
         fulfiller->fulfill(FileChangeType::MODIFIED);
+      } else if (unknown) {
+        fulfiller->fulfill(FileChangeType::UNKNOWN);
       }
       deleted = false;
       modified = false;
+      unknown = false;
     }
   }
 };
 
-EpollEventManager::InotifyHandler::InotifyHandler(Epoller* epoller)
-    : inotifyStream(WRAP_SYSCALL(inotify_init1, IN_NONBLOCK | IN_CLOEXEC), "inotify"),
-      watch(epoller, inotifyStream.getHandle(), 0, this) {}
+// =======================================================================================
 
-EpollEventManager::InotifyHandler::~InotifyHandler() {}
+void EpollEventManager::InotifyHandler::Fanotify::handle(uint32_t epollEvents) {
+  alignas(struct fanotify_event_metadata) char buffer[65536];
+  ssize_t remaining = stream.read(buffer, sizeof(buffer));
 
-void EpollEventManager::InotifyHandler::WatchedDirectory::handle(struct inotify_event* event) {
-  std::string basename;
+  for (struct fanotify_event_metadata* event =
+           reinterpret_cast<struct fanotify_event_metadata*>(buffer);
+       FAN_EVENT_OK(event, remaining); event = FAN_EVENT_NEXT(event, remaining)) {
+    if (event->vers != FANOTIFY_METADATA_VERSION) {
+      DEBUG_ERROR << "fanotify event has unexpected version " << (int)event->vers;
+      break;
+    }
+    if (event->fd >= 0) {
+      // Only reported without FAN_REPORT_*FID, but don't leak it.
+      close(event->fd);
+    }
+    if (event->mask & FAN_Q_OVERFLOW) {
+      DEBUG_WARNING << "fanotify queue overflowed; rechecking all watched files.";
+      inotifyHandler->handleOverflow();
+      continue;
+    }
+
+    // Each event carries one or more records naming what it happened to.
+    char* pos = reinterpret_cast<char*>(event) + event->metadata_len;
+    char* end = reinterpret_cast<char*>(event) + event->event_len;
+    while (end - pos >= (ssize_t)sizeof(struct fanotify_event_info_header)) {
+      struct fanotify_event_info_header* header =
+          reinterpret_cast<struct fanotify_event_info_header*>(pos);
+      if (header->len == 0 || header->len > end - pos) {
+        DEBUG_ERROR << "fanotify event has a malformed info record.";
+        break;
+      }
+
+      if (header->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME ||
+          header->info_type == FAN_EVENT_INFO_TYPE_DFID ||
+          header->info_type == FAN_EVENT_INFO_TYPE_FID) {
+        struct fanotify_event_info_fid* info =
+            reinterpret_cast<struct fanotify_event_info_fid*>(pos);
+        struct file_handle* handle = reinterpret_cast<struct file_handle*>(info->handle);
+        std::string basename;
+        if (header->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME) {
+          basename = reinterpret_cast<const char*>(handle->f_handle + handle->handle_bytes);
+          if (basename == ".") {
+            // The event happened to the directory itself, as inotify would report it.
+            basename.clear();
+          }
+        }
+        dispatch(fanotifyKey(&info->fsid, handle->handle_type, handle->f_handle,
+                             handle->handle_bytes),
+                 fanotifyToInotifyMask(event->mask, basename.empty()), basename);
+      }
+
+      pos += header->len;
+    }
+  }
+}
+
+void EpollEventManager::InotifyHandler::Fanotify::dispatch(
+    const std::string& key, uint32_t mask, const std::string& basename) {
+  // Handling the event may invalidate the WatchedDirectory, removing it from the map.
+  std::vector<WatchedDirectory*> targets;
+  auto range = directories.equal_range(key);
+  for (auto iter = range.first; iter != range.second; ++iter) {
+    targets.push_back(iter->second);
+  }
+  for (WatchedDirectory* target: targets) {
+    target->handle(mask, basename);
+  }
+}
+
+// =======================================================================================
 
-  if (event->len > 0) {
-    basename = event->name;
+EpollEventManager::InotifyHandler::InotifyHandler(Epoller* epoller)
+    : inotifyStream(WRAP_SYSCALL(inotify_init1, IN_NONBLOCK | IN_CLOEXEC), "inotify"),
+      watch(epoller, inotifyStream.getHandle(), 0, this) {
+  if (fanotifyEnabled) {
+    fanotify = Fanotify::create(this, epoller);
   }
+}
+
+EpollEventManager::InotifyHandler::~InotifyHandler() {}
 
+void EpollEventManager::InotifyHandler::WatchedDirectory::handle(
+    uint32_t mask, const std::string& basename) {
   DEBUG_INFO << "inotify event on: " << path << "\n  basename: " << basename << "\n  flags:"
-             << ((event->mask & IN_ATTRIB     ) ? " IN_ATTRIB"      : "")
-             << ((event->mask & IN_CLOSE_WRITE) ? " IN_CLOSE_WRITE" : "")
-             << ((event->mask & IN_CREATE     ) ? " IN_CREATE"      : "")
-             << ((event->mask & IN_DELETE     ) ? " IN_DELETE"      : "")
-             << ((event->mask & IN_DELETE_SELF) ? " IN_DELETE_SELF" : "")
-             << ((event->mask & IN_MODIFY     ) ? " IN_MODIFY"      : "")
-             << ((event->mask & IN_MOVE_SELF  ) ? " IN_MOVE_SELF"   : "")
-             << ((event->mask & IN_MOVED_FROM ) ? " IN_MOVED_FROM"  : "")
-             << ((event->mask & IN_MOVED_TO   ) ? " IN_MOVED_TO"    : "");
+             << ((mask & IN_ATTRIB     ) ? " IN_ATTRIB"      : "")
+             << ((mask & IN_CLOSE_WRITE) ? " IN_CLOSE_WRITE" : "")
+             << ((mask & IN_CREATE     ) ? " IN_CREATE"      : "")
+             << ((mask & IN_DELETE     ) ? " IN_DELETE"      : "")
+             << ((mask & IN_DELETE_SELF) ? " IN_DELETE_SELF" : "")
+             << ((mask & IN_MODIFY     ) ? " IN_MODIFY"      : "")
+             << ((mask & IN_MOVE_SELF  ) ? " IN_MOVE_SELF"   : "")
+             << ((mask & IN_MOVED_FROM ) ? " IN_MOVED_FROM"  : "")
+             << ((mask & IN_MOVED_TO   ) ? " IN_MOVED_TO"    : "");
 
   // Some events implicitly remove the watch descriptor (because the watched directory no longer
   // exists).  Such descriptors are now invalid and may be reused the next time
@@ -730,15 +1323,15 @@ void EpollEventManager::InotifyHandler::WatchedDirectory::handle(struct inotify_
   // case *does* implicitly remove the watch descriptor (which I know because the next call
   // to inotify_add_watch() typically reuses it).  This appears to be a bug in Linux (observed
   // in 2.6.35-22-generic).  Will file a bug report if I get time to write a demo program.
-  if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
-    DEBUG_INFO << "Watch descriptor implicitly removed: " << event->wd;
+  if (mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+    DEBUG_INFO << "Watch implicitly removed: " << path;
     invalidate();
   }
 
   for (CallbackTable::SearchIterator<CallbackTable::BASENAME> iter(callbackTable, basename);
        iter.next();) {
     FileWatcherImpl* op = iter.cell<CallbackTable::WATCH_OP>();
-    if (event->mask & (IN_DELETE | IN_DELETE_SELF | IN_MOVED_FROM | IN_MOVE_SELF)) {
+    if (mask & (IN_DELETE | IN_DELETE_SELF | IN_MOVED_FROM | IN_MOVE_SELF)) {
       op->flagAsDeleted();
     } else {
       op->flagAsModified();
@@ -746,17 +1339,23 @@ void EpollEventManager::InotifyHandler::WatchedDirectory::handle(struct inotify_
   }
 
   // If this event is indicating creation or deletion of a file in the directory, then call the
-  // directory's modified() callback as well.
+  // directory's modified() callback as well, telling it which child changed.
   if (!basename.empty() &&
-      (event->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))) {
+      (mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))) {
     for (CallbackTable::SearchIterator<CallbackTable::BASENAME> iter(callbackTable, "");
          iter.next();) {
       FileWatcherImpl* op = iter.cell<CallbackTable::WATCH_OP>();
-      op->flagAsModified();
+      op->flagChildAsChanged(basename);
     }
   }
 }
 
+void EpollEventManager::InotifyHandler::WatchedDirectory::flagAllAsUnknown() {
+  for (CallbackTable::RowIterator iter(callbackTable); iter.next();) {
+    iter.cell<CallbackTable::WATCH_OP>()->flagAsUnknown();
+  }
+}
+
 void EpollEventManager::InotifyHandler::handle(uint32_t epollEvents) {
   char buffer[sizeof(struct inotify_event) + PATH_MAX];
 
@@ -807,19 +1406,39 @@ void EpollEventManager::InotifyHandler::handle(uint32_t epollEvents) {
                << ((event->mask & IN_MOVE_SELF  ) ? " IN_MOVE_SELF"   : "")
                << ((event->mask & IN_MOVED_FROM ) ? " IN_MOVED_FROM"  : "")
                << ((event->mask & IN_MOVED_TO   ) ? " IN_MOVED_TO"    : "")
-               << ((event->mask & IN_IGNORED    ) ? " IN_IGNORED"     : "");
+               << ((event->mask & IN_IGNORED    ) ? " IN_IGNORED"     : "")
+               << ((event->mask & IN_Q_OVERFLOW ) ? " IN_Q_OVERFLOW"  : "");
 
-    WatchMap::iterator iter = watchMap.find(event->wd);
-    if (iter == watchMap.end()) {
+    if (event->mask & IN_Q_OVERFLOW) {
+      DEBUG_WARNING << "inotify queue overflowed; rechecking all watched files.";
+      handleOverflow();
+      continue;
+    }
+
+    // Handling the event may invalidate the WatchedDirectory, removing it from the map.
+    std::vector<WatchedDirectory*> targets;
+    auto range = watchMap.equal_range(event->wd);
+    for (auto iter = range.first; iter != range.second; ++iter) {
+      targets.push_back(iter->second);
+    }
+    if (targets.empty()) {
       if (event->mask != IN_IGNORED) {
         DEBUG_ERROR << "inotify event had unknown watch descriptor? " << event->wd;
       }
-    } else {
-      iter->second->handle(event);
+    }
+    for (WatchedDirectory* target: targets) {
+      target->handle(event->mask, event->len > 0 ? event->name : "");
     }
   }
 }
 
+void EpollEventManager::InotifyHandler::handleOverflow() {
+  for (OwnedPtrMap<WatchedDirectory*, WatchedDirectory>::Iterator iter(ownedWatchDirectories);
+       iter.next();) {
+    iter.value()->flagAllAsUnknown();
+  }
+}
+
 OwnedPtr<EventManager::FileWatcher> EpollEventManager::InotifyHandler::watchFile(
     const std::string& filename) {
   return newOwned<FileWatcherImpl>(this, filename);
@@ -831,25 +1450,68 @@ OwnedPtr<EventManager::FileWatcher> EpollEventManager::watchFile(const std::stri
 
 // =======================================================================================
 
-EpollEventManager::EpollEventManager()
-  : signalHandler(&epoller), inotifyHandler(&epoller) {}
+EpollEventManager::EpollEventManager(int maxEventsPerWait)
+  : epoller(maxEventsPerWait), signalHandler(&epoller), userSignalHandler(&epoller),
+    timerHandler(&epoller), inotifyHandler(&epoller), callbackCount(0),
+    budgetExhaustedCount(0) {}
 EpollEventManager::~EpollEventManager() {}
 
+EpollEventManager::LoopStats EpollEventManager::getLoopStats() const {
+  LoopStats result;
+  result.waits = epoller.getWaitCount();
+  result.events = epoller.getEventCount();
+  result.callbacks = callbackCount;
+  result.budgetExhausted = budgetExhaustedCount;
+  return result;
+}
+
+void EpollEventManager::dumpStats(FILE* out) {
+  LoopStats stats = getLoopStats();
+  fprintf(out, "%-20s %9llu waits %9llu events %9llu callbacks %9llu over budget\n",
+          "event loop", (unsigned long long)stats.waits, (unsigned long long)stats.events,
+          (unsigned long long)stats.callbacks, (unsigned long long)stats.budgetExhausted);
+  callbackTime.dump(out, "callback time", "us");
+  callbackQueueDepth.dump(out, "callback queue", "");
+  epoller.getEventHandlerTime().dump(out, "I/O handler time", "us");
+  epoller.getEventLatency().dump(out, "I/O latency", "us");
+}
+
 void EpollEventManager::loop() {
   while (handleEvent()) {}
 }
 
+int EpollEventManager::getPollFd() {
+  return epoller.getFd();
+}
+
+bool EpollEventManager::prepareToWait() {
+  return epoller.updateRegistrations();
+}
+
+void EpollEventManager::pollIo() {
+  epoller.handleReadyEvents();
+}
+
 bool EpollEventManager::handleEvent() {
-  // Run any async callbacks first.
-  // TODO:  Avoid starvation of I/O?  Probably doesn't matter.
-  if (!asyncCallbacks.empty()) {
+  // Run async callbacks first, but only up to the budget:  callbacks tend to queue more
+  // callbacks, and I/O shouldn't have to wait for all of them.
+  callbackQueueDepth.add(asyncCallbacks.size());
+  for (int i = 0; i < ASYNC_CALLBACK_BUDGET && !asyncCallbacks.empty(); i++) {
     AsyncCallbackHandler* handler = asyncCallbacks.front();
     asyncCallbacks.pop_front();
+    ++callbackCount;
+    uint64_t start = monotonicNow();
     handler->run();
+    callbackTime.add((monotonicNow() - start) / 1000);
+  }
+
+  if (!asyncCallbacks.empty()) {
+    ++budgetExhaustedCount;
+    epoller.handleEvents(false);
     return true;
   }
 
-  return epoller.handleEvent();
+  return epoller.handleEvents(true);
 }
 
 // =======================================================================================
@@ -18,14 +18,19 @@
 #define KENTONSCODE_OS_EPOLLEVENTMANAGER_H_
 
 #include <sys/types.h>
+#include <sys/epoll.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <signal.h>
 #include <deque>
+#include <map>
 #include <set>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "EventManager.h"
+#include "base/Histogram.h"
 #include "base/OwnedPtr.h"
 #include "OsHandle.h"
 #include "ByteStream.h"
@@ -36,17 +41,57 @@ namespace ekam {
 
 class EpollEventManager : public RunnableEventManager {
 public:
-  EpollEventManager();
+  // Each turn of the loop runs up to ASYNC_CALLBACK_BUDGET queued callbacks and then handles all
+  // the I/O events returned by one epoll_wait() of up to `maxEventsPerWait` events.  If callbacks
+  // are still queued, that epoll_wait() doesn't block.
+  static const int DEFAULT_MAX_EVENTS_PER_WAIT = 64;
+  static const int ASYNC_CALLBACK_BUDGET = 64;
+
+  explicit EpollEventManager(int maxEventsPerWait = DEFAULT_MAX_EVENTS_PER_WAIT);
   ~EpollEventManager();
 
+  // Process exits are normally watched through a pidfd per process, so that only processes passed
+  // to onProcessExit() are reaped.  Kernels without pidfd_open() (before 5.3) fall back to
+  // SIGCHLD and reaping every child.  setPidfdEnabled(false) forces the fallback; it only affects
+  // event managers created afterwards.
+  static bool isPidfdSupported();
+  static void setPidfdEnabled(bool enabled);
+
+  // Optionally, directories are watched through fanotify rather than inotify:  one mark per
+  // filesystem covers every directory on it, so there is no per-directory watch to count against
+  // max_user_watches.  Marking a whole filesystem requires CAP_SYS_ADMIN; directories on
+  // filesystems that can't be marked, or all of them if fanotify is unavailable, use inotify.
+  // Only affects event managers created afterwards.
+  static void setFanotifyEnabled(bool enabled);
+
+  struct LoopStats {
+    uint64_t waits;              // epoll_wait() calls.
+    uint64_t events;             // I/O events handled.
+    uint64_t callbacks;          // Queued callbacks run.
+    uint64_t budgetExhausted;    // Turns which left callbacks queued in order to check for I/O.
+  };
+  LoopStats getLoopStats() const;
+
+  // For running this event manager's watches from inside another event loop, which then never
+  // calls loop():  IoUringEventManager uses it for watchFile() and onSignal().  The fd returned by
+  // getPollFd() polls readable when pollIo() has I/O to handle.  prepareToWait() must be called
+  // before the other loop blocks, and returns whether anything being watched should keep that
+  // loop running.  Callbacks queued with runLater() are not run this way.
+  int getPollFd();
+  bool prepareToWait();
+  void pollIo();
+
   // implements RunnableEventManager -----------------------------------------------------
   void loop();
+  Promise<void> onSignal(int signum);
+  void dumpStats(FILE* out);
 
   // implements Executor -----------------------------------------------------------------
   OwnedPtr<PendingRunnable> runLater(OwnedPtr<Runnable> runnable);
 
   // implements EventManager -------------------------------------------------------------
   Promise<ProcessExitCode> onProcessExit(pid_t pid);
+  Promise<void> afterDelay(uint64_t milliseconds);
   OwnedPtr<IoWatcher> watchFd(int fd);
   OwnedPtr<FileWatcher> watchFile(const std::string& filename);
 
@@ -63,10 +108,28 @@ private:
 
   class Epoller {
   public:
-    Epoller();
+    explicit Epoller(int maxEventsPerWait);
     ~Epoller();
 
-    bool handleEvent();
+    // Wait for I/O -- or if `block` is false, just check -- and handle every event returned.
+    // Returns false if nothing is being waited for.
+    bool handleEvents(bool block);
+
+    inline uint64_t getWaitCount() const { return waitCount; }
+    inline uint64_t getEventCount() const { return eventCount; }
+
+    // Microseconds each event's handler took, and each event waited after epoll_wait() returned
+    // it, i.e. how long handlers for other events held it up.
+    inline const Histogram& getEventHandlerTime() const { return eventHandlerTime; }
+    inline const Histogram& getEventLatency() const { return eventLatency; }
+
+    // Apply changes to watches, and return whether any watch keeps the loop running.
+    bool updateRegistrations();
+
+    // Handle whatever I/O is ready, without blocking.  Passive watches count too.
+    void handleReadyEvents();
+
+    inline int getFd() const { return epollHandle.get(); }
 
     class Watch {
     public:
@@ -78,12 +141,17 @@ private:
       void addEvents(uint32_t eventsToAdd);
       void removeEvents(uint32_t eventsToRemove);
 
+      // A passive watch delivers events like any other, but does not by itself keep the event
+      // loop running.  Must be called before any events are added.
+      void setPassive();
+
     private:
       friend class Epoller;
 
       Epoller* epoller;
       uint32_t events;
       uint32_t registeredEvents;
+      bool passive;
       int fd;
       std::string name;
       IoHandler* handler;
@@ -96,11 +164,26 @@ private:
     int watchCount;
 
     std::unordered_set<Watch*> watchesNeedingUpdate;
+
+    // Results of the last epoll_wait().  Handling one event can destroy the Watch of another,
+    // in which case the Watch clears its entries.
+    std::vector<struct epoll_event> readyEvents;
+    int readyCount;
+    int nextReadyEvent;
+    uint64_t readyTime;  // When epoll_wait() returned them, in monotonic nanoseconds.
+
+    uint64_t waitCount;
+    uint64_t eventCount;
+    Histogram eventHandlerTime;
+    Histogram eventLatency;
+
+    void forgetReadyEvents(Watch* watch);
+    void dispatchReadyEvents();
   };
 
   class SignalHandler : public IoHandler {
   public:
-    SignalHandler(Epoller* epoller);
+    explicit SignalHandler(Epoller* epoller);
     ~SignalHandler();
 
     Promise<ProcessExitCode> onProcessExit(pid_t pid);
@@ -111,14 +194,64 @@ private:
   private:
     class ProcessExitHandler;
 
+    Epoller* epoller;
+    bool usePidfd;
     ByteStream signalStream;
     Epoller::Watch watch;
+
+    // Only processes watched through SIGCHLD.
     std::unordered_map<pid_t, ProcessExitHandler*> processExitHandlerMap;
 
     void handleProcessExit();
     void maybeStopExpecting();
   };
 
+  // Handles signals requested through onSignal().  Separate from SignalHandler so that its
+  // watch can be passive.
+  class UserSignalHandler : public IoHandler {
+  public:
+    UserSignalHandler(Epoller* epoller);
+    ~UserSignalHandler();
+
+    Promise<void> onSignal(int signum);
+
+    // implements IoHandler --------------------------------------------------------------
+    void handle(uint32_t events);
+
+  private:
+    class SignalFulfiller;
+
+    sigset_t signals;
+    ByteStream signalStream;
+    Epoller::Watch watch;
+    std::unordered_multimap<int, SignalFulfiller*> fulfillers;
+  };
+
+  // All timers share one timerfd, armed for the earliest deadline.
+  class TimerHandler : public IoHandler {
+  public:
+    TimerHandler(Epoller* epoller);
+    ~TimerHandler();
+
+    Promise<void> afterDelay(uint64_t milliseconds);
+
+    // implements IoHandler --------------------------------------------------------------
+    void handle(uint32_t events);
+
+  private:
+    class TimerFulfiller;
+
+    ByteStream timerStream;
+    Epoller::Watch watch;
+
+    // By deadline, in nanoseconds on CLOCK_MONOTONIC.
+    typedef std::multimap<uint64_t, TimerFulfiller*> TimerMap;
+    TimerMap timers;
+    uint64_t armedDeadline;
+
+    void rearm();
+  };
+
   class InotifyHandler : public IoHandler {
   public:
     InotifyHandler(Epoller* epoller);
@@ -132,12 +265,21 @@ private:
   private:
     class WatchedDirectory;
     class FileWatcherImpl;
+    class Fanotify;
+
+    // Events were lost; tell every watcher that its file may have changed.
+    void handleOverflow();
 
     ByteStream inotifyStream;
     Epoller::Watch watch;
 
+    // Null unless fanotify is enabled and available.
+    OwnedPtr<Fanotify> fanotify;
+
     OwnedPtrMap<WatchedDirectory*, WatchedDirectory> ownedWatchDirectories;
-    typedef std::unordered_map<int, WatchedDirectory*> WatchMap;
+    // Several WatchedDirectories share one watch descriptor when their paths name the same
+    // directory, e.g. through symlinks.
+    typedef std::unordered_multimap<int, WatchedDirectory*> WatchMap;
     WatchMap watchMap;
     typedef std::unordered_map<std::string, WatchedDirectory*> WatchByNameMap;
     WatchByNameMap watchByNameMap;
@@ -145,9 +287,15 @@ private:
 
   Epoller epoller;
   SignalHandler signalHandler;
+  UserSignalHandler userSignalHandler;
+  TimerHandler timerHandler;
   InotifyHandler inotifyHandler;
 
   std::deque<AsyncCallbackHandler*> asyncCallbacks;
+  uint64_t callbackCount;
+  uint64_t budgetExhaustedCount;
+  Histogram callbackTime;        // Microseconds per runLater() callback.
+  Histogram callbackQueueDepth;  // Callbacks queued at the start of each turn.
 
   bool handleEvent();
 };
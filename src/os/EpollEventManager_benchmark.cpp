@@ -0,0 +1,197 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Stresses the event loop the way a wide build does:  many subprocesses each writing short lines
+// to three pipes (standing in for stdout, stderr and the rule protocol pipe).  The same run is
+// repeated with one event per epoll_wait() -- the old behavior -- with batches, and on io_uring
+// where the kernel supports it.
+//
+// usage:  EpollEventManager_benchmark [-p <processes>] [-n <lines per pipe>]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "EpollEventManager.h"
+#include "IoUringEventManager.h"
+#include "ByteStream.h"
+
+namespace ekam {
+namespace {
+
+const int PIPES_PER_PROCESS = 3;
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+class Reader {
+public:
+  Reader(OwnedPtr<ByteStream> stream, uint64_t* byteCount, uint64_t* readCount)
+      : stream(stream.release()), byteCount(byteCount), readCount(readCount) {}
+
+  Promise<void> run(EventManager* eventManager) {
+    return eventManager->when(stream->readAsync(eventManager, buffer, sizeof(buffer)))(
+      [=](size_t size) -> Promise<void> {
+        ++*readCount;
+        if (size == 0) {
+          return newFulfilledPromise();
+        }
+        *byteCount += size;
+        return run(eventManager);
+      });
+  }
+
+private:
+  OwnedPtr<ByteStream> stream;
+  uint64_t* byteCount;
+  uint64_t* readCount;
+  char buffer[4096];
+};
+
+void writeLines(int fds[], int lines) {
+  char line[80];
+  for (int i = 0; i < lines; i++) {
+    for (int j = 0; j < PIPES_PER_PROCESS; j++) {
+      int size = snprintf(line, sizeof(line), "pipe %d line %d: some compiler chatter\n", j, i);
+      if (write(fds[j], line, size) != size) {
+        _exit(1);
+      }
+    }
+  }
+  _exit(0);
+}
+
+// Number of times the loop entered the kernel to wait, and how much it got each time.
+void getWaitStats(EpollEventManager* eventManager, uint64_t* waits, uint64_t* events) {
+  EpollEventManager::LoopStats stats = eventManager->getLoopStats();
+  *waits = stats.waits;
+  *events = stats.events;
+}
+
+#if EKAM_HAVE_IO_URING
+void getWaitStats(IoUringEventManager* eventManager, uint64_t* waits, uint64_t* events) {
+  IoUringEventManager::LoopStats stats = eventManager->getLoopStats();
+  *waits = stats.enters;
+  *events = stats.completions;
+}
+#endif
+
+template <typename EventManagerType>
+void run(const char* title, EventManagerType& eventManager, int processes, int lines,
+         bool countReads) {
+  uint64_t byteCount = 0;
+  uint64_t readCount = 0;
+  OwnedPtrVector<Reader> readers;
+  std::vector<Promise<void> > reads;
+  std::vector<Promise<void> > exits;
+
+  double start = now();
+
+  for (int i = 0; i < processes; i++) {
+    OwnedPtrVector<Pipe> pipes;
+    for (int j = 0; j < PIPES_PER_PROCESS; j++) {
+      pipes.add(newOwned<Pipe>());
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      exit(1);
+    } else if (pid == 0) {
+      int fds[PIPES_PER_PROCESS];
+      for (int j = 0; j < PIPES_PER_PROCESS; j++) {
+        fds[j] = dup(pipes.get(j)->releaseWriteEnd()->getHandle()->get());
+      }
+      writeLines(fds, lines);
+    }
+
+    exits.push_back(eventManager.when(eventManager.onProcessExit(pid))(
+      [](ProcessExitCode exitCode) {
+        if (exitCode.wasSignaled() || exitCode.getExitCode() != 0) {
+          fprintf(stderr, "child failed\n");
+        }
+      }));
+
+    for (int j = 0; j < PIPES_PER_PROCESS; j++) {
+      auto reader = newOwned<Reader>(pipes.get(j)->releaseReadEnd(), &byteCount, &readCount);
+      reads.push_back(reader->run(&eventManager));
+      readers.add(reader.release());
+    }
+  }
+
+  eventManager.loop();
+  double time = now() - start;
+
+  uint64_t waits, events;
+  getWaitStats(&eventManager, &waits, &events);
+  // With io_uring, reads are done by the kernel rather than by separate syscalls.
+  uint64_t syscalls = waits + (countReads ? readCount : 0);
+  printf("%-24s %7.3fs  %8.2f MB/s  %9llu waits  %6.2f events/wait  %9.0f syscalls/s\n",
+         title, time, byteCount / time / 1e6, (unsigned long long)waits,
+         waits == 0 ? 0.0 : (double)events / waits, syscalls / time);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int processes = 64;
+  int lines = 2000;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "p:n:")) != -1) {
+    switch (opt) {
+      case 'p':
+        processes = atoi(optarg);
+        break;
+      case 'n':
+        lines = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-p <processes>] [-n <lines per pipe>]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  printf("%d processes, %d pipes each, %d lines per pipe\n", processes, PIPES_PER_PROCESS, lines);
+
+  {
+    EpollEventManager eventManager(1);
+    run("one event per wait", eventManager, processes, lines, true);
+  }
+  {
+    EpollEventManager eventManager;
+    run("batched", eventManager, processes, lines, true);
+  }
+#if EKAM_HAVE_IO_URING
+  if (IoUringEventManager::isSupported()) {
+    IoUringEventManager eventManager;
+    run("io_uring", eventManager, processes, lines, false);
+  }
+#endif
+  return 0;
+}
+
+}  // namespace ekam
+
+int main(int argc, char* argv[]) {
+  return ekam::main(argc, argv);
+}
@@ -80,11 +80,22 @@ OwnedPtr<PendingRunnable> EventGroup::runLater(OwnedPtr<Runnable> runnable) {
 Promise<ProcessExitCode> EventGroup::onProcessExit(pid_t pid) {
   Promise<ProcessExitCode> innerPromise = inner->onProcessExit(pid);
   return when(innerPromise, newPendingEvent())(
-    [](ProcessExitCode exitCode, OwnedPtr<PendingEvent>) -> ProcessExitCode {
+    [this](ProcessExitCode exitCode, OwnedPtr<PendingEvent>) -> ProcessExitCode {
+      if (const struct rusage* usage = exitCode.getResourceUsage()) {
+        resourceUsage.add(*usage);
+      }
       return exitCode;
     });
 }
 
+Promise<void> EventGroup::afterDelay(uint64_t milliseconds) {
+  Promise<void> innerPromise = inner->afterDelay(milliseconds);
+  return when(innerPromise, newPendingEvent())(
+    [](Void, OwnedPtr<PendingEvent>) {
+      // Let PendingEvent die.
+    });
+}
+
 class EventGroup::IoWatcherWrapper: public EventManager::IoWatcher {
 public:
   IoWatcherWrapper(EventGroup* group, OwnedPtr<IoWatcher> inner)
@@ -106,6 +117,14 @@ public:
         // Let PendingEvent die.
       });
   }
+  Promise<size_t> readAsync(void* buffer, size_t size) {
+    Promise<size_t> innerPromise = inner->readAsync(buffer, size);
+    return group->when(innerPromise, group->newPendingEvent())(
+      [](size_t bytesRead, OwnedPtr<PendingEvent>) -> size_t {
+        // Let PendingEvent die.
+        return bytesRead;
+      });
+  }
 
 private:
   EventGroup* group;
@@ -132,6 +151,10 @@ public:
       });
   }
 
+  bool getChangedChildren(std::vector<std::string>* names) {
+    return inner->getChangedChildren(names);
+  }
+
 private:
   EventGroup* group;
   OwnedPtr<FileWatcher> inner;
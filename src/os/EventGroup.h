@@ -20,6 +20,7 @@
 #include <unordered_set>
 
 #include "EventManager.h"
+#include "ResourceUsage.h"
 
 namespace ekam {
 
@@ -47,11 +48,17 @@ public:
   EventGroup(EventManager* inner, ExceptionHandler* exceptionHandler);
   ~EventGroup();
 
+  // Resources used by the processes whose exits were waited for through this group, since
+  // construction or the last resetResourceUsage().
+  const ResourceUsage& getResourceUsage() { return resourceUsage; }
+  void resetResourceUsage() { resourceUsage = ResourceUsage(); }
+
   // implements Executor -----------------------------------------------------------------
   OwnedPtr<PendingRunnable> runLater(OwnedPtr<Runnable> runnable);
 
   // implements EventManager -------------------------------------------------------------
   Promise<ProcessExitCode> onProcessExit(pid_t pid);
+  Promise<void> afterDelay(uint64_t milliseconds);
   OwnedPtr<IoWatcher> watchFd(int fd);
   OwnedPtr<FileWatcher> watchFile(const std::string& filename);
 
@@ -66,6 +73,7 @@ private:
   ExceptionHandler* exceptionHandler;
   int eventCount;
   Promise<void> pendingNoMoreEvents;
+  ResourceUsage resourceUsage;
 
   OwnedPtr<PendingEvent> newPendingEvent();
   void callNoMoreEventsLater();
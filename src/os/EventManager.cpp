@@ -25,8 +25,14 @@ namespace ekam {
 EventManager::~EventManager() noexcept(false) {}
 EventManager::IoWatcher::~IoWatcher() noexcept(false) {}
 EventManager::FileWatcher::~FileWatcher() {}
+
+bool EventManager::FileWatcher::getChangedChildren(std::vector<std::string>* names) {
+  return false;
+}
 RunnableEventManager::~RunnableEventManager() noexcept(false) {}
 
+void RunnableEventManager::dumpStats(FILE* out) {}
+
 void ProcessExitCode::throwError() {
   if (signaled) {
     throw std::logic_error("Process was signaled: " + toString(exitCodeOrSignal));
@@ -18,8 +18,12 @@
 #define KENTONSCODE_OS_EVENTMANAGER_H_
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <sys/types.h>
+#include <sys/resource.h>
 #include <string>
+#include <vector>
 #include "base/OwnedPtr.h"
 #include "base/Promise.h"
 
@@ -27,12 +31,12 @@ namespace ekam {
 
 class ProcessExitCode {
 public:
-  ProcessExitCode(): signaled(false), exitCodeOrSignal(0) {}
+  ProcessExitCode(): signaled(false), exitCodeOrSignal(0), hasUsage(false) {}
   ProcessExitCode(int exitCode)
-      : signaled(false), exitCodeOrSignal(exitCode) {}
+      : signaled(false), exitCodeOrSignal(exitCode), hasUsage(false) {}
   enum Signaled { SIGNALED };
   ProcessExitCode(Signaled, int signalNumber)
-      : signaled(true), exitCodeOrSignal(signalNumber) {}
+      : signaled(true), exitCodeOrSignal(signalNumber), hasUsage(false) {}
 
   bool wasSignaled() {
     return signaled;
@@ -52,9 +56,22 @@ public:
     return exitCodeOrSignal;
   }
 
+  // Resources used by the process (and any descendants it waited for), if the event manager
+  // collected them when reaping it.  NULL otherwise.
+  const struct rusage* getResourceUsage() const {
+    return hasUsage ? &usage : NULL;
+  }
+
+  void setResourceUsage(const struct rusage& usage) {
+    this->usage = usage;
+    hasUsage = true;
+  }
+
 private:
   bool signaled;
   int exitCodeOrSignal;
+  bool hasUsage;
+  struct rusage usage;
 
   void throwError();
 };
@@ -66,6 +83,10 @@ public:
   // Fulfills the promise when the process exits.
   virtual Promise<ProcessExitCode> onProcessExit(pid_t pid) = 0;
 
+  // Fulfills the promise once the given number of milliseconds have passed.  Releasing the
+  // promise first cancels the timer.
+  virtual Promise<void> afterDelay(uint64_t milliseconds) = 0;
+
   class IoWatcher {
   public:
     virtual ~IoWatcher() noexcept(false);
@@ -74,6 +95,12 @@ public:
     virtual Promise<void> onReadable() = 0;
     // Fulfills the promise when the file descriptor is writable.
     virtual Promise<void> onWritable() = 0;
+
+    // Reads up to `size` bytes once the file descriptor is readable, fulfilling the promise with
+    // the number of bytes read, or zero at EOF.  `buffer` must remain valid until the promise is
+    // fulfilled or released.  Some event managers read ahead, so once this has been used, all
+    // reads from the fd must go through it.
+    virtual Promise<size_t> readAsync(void* buffer, size_t size) = 0;
   };
 
   // Watch the file descriptor for readability and writability.
@@ -81,7 +108,11 @@ public:
 
   enum class FileChangeType {
     MODIFIED,
-    DELETED
+    DELETED,
+
+    // Events were lost (e.g. the kernel's queue overflowed), so the file may or may not have
+    // changed.  The watcher must check for itself.
+    UNKNOWN
   };
 
   class FileWatcher {
@@ -89,6 +120,12 @@ public:
     virtual ~FileWatcher();
 
     virtual Promise<FileChangeType> onChange() = 0;
+
+    // For a watched directory:  fills in the names of children created, deleted or renamed since
+    // the last call, so that only those need to be looked at.  Returns false if the directory
+    // must be re-listed instead, e.g. because events were lost or there were too many.  The
+    // default implementation always returns false.
+    virtual bool getChangedChildren(std::vector<std::string>* names);
   };
 
   // Watch a file (on disk) for changes or deletion.
@@ -100,6 +137,14 @@ public:
   virtual ~RunnableEventManager() noexcept(false);
 
   virtual void loop() = 0;
+
+  // Fulfills the promise the next time the process receives the given signal.  Once requested,
+  // the signal stays blocked for the life of the event manager.  Waiting for a signal does not by
+  // itself keep loop() running.
+  virtual Promise<void> onSignal(int signum) = 0;
+
+  // Write statistics about the event loop, one line per topic.  Does nothing by default.
+  virtual void dumpStats(FILE* out);
 };
 
 OwnedPtr<RunnableEventManager> newPreferredEventManager();
@@ -0,0 +1,360 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "EpollEventManager.h"
+#include "IoUringEventManager.h"
+#include "ByteStream.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/fanotify.h>
+#include <string>
+#include <vector>
+
+namespace ekam {
+namespace {
+
+#define ASSERT(EXPRESSION)                                                    \
+  if (!(EXPRESSION)) {                                                        \
+    fprintf(stderr, "%s:%d: FAILED: %s\n", __FILE__, __LINE__, #EXPRESSION);  \
+    exit(1);                                                                  \
+  }
+
+typedef EventManager::FileChangeType FileChangeType;
+
+std::string makeTempDir() {
+  char pattern[] = "/tmp/ekam-test-XXXXXX";
+  ASSERT(mkdtemp(pattern) != NULL);
+  return pattern;
+}
+
+void writeFile(const std::string& path, const char* content) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  ASSERT(fd >= 0);
+  ASSERT(write(fd, content, strlen(content)) == (ssize_t)strlen(content));
+  close(fd);
+}
+
+// Waits for one change to the file, then stops watching so that the loop exits.
+class ChangeRecorder {
+public:
+  ChangeRecorder(EventManager* eventManager, const std::string& path)
+      : watcher(eventManager->watchFile(path)), changed(false), knowsChildren(false) {
+    asyncOp = eventManager->when(watcher->onChange())(
+      [this](FileChangeType type) {
+        changed = true;
+        changeType = type;
+        knowsChildren = watcher->getChangedChildren(&changedChildren);
+        watcher.clear();
+      });
+  }
+
+  OwnedPtr<EventManager::FileWatcher> watcher;
+  Promise<void> asyncOp;
+  bool changed;
+  FileChangeType changeType;
+  bool knowsChildren;
+  std::vector<std::string> changedChildren;
+};
+
+// Each test runs against every backend.
+typedef OwnedPtr<RunnableEventManager> (*EventManagerFactory)();
+
+void testModified(EventManagerFactory factory) {
+  std::string dir = makeTempDir();
+  std::string path = dir + "/file";
+  writeFile(path, "foo");
+
+  OwnedPtr<RunnableEventManager> eventManagerPtr = factory();
+  RunnableEventManager& eventManager = *eventManagerPtr;
+  ChangeRecorder recorder(&eventManager, path);
+  writeFile(path, "bar");
+  eventManager.loop();
+
+  ASSERT(recorder.changed);
+  ASSERT(recorder.changeType == FileChangeType::MODIFIED);
+
+  unlink(path.c_str());
+  rmdir(dir.c_str());
+}
+
+void testChangedChildren(EventManagerFactory factory) {
+  std::string dir = makeTempDir();
+  std::string path = dir + "/new";
+
+  OwnedPtr<RunnableEventManager> eventManagerPtr = factory();
+  RunnableEventManager& eventManager = *eventManagerPtr;
+  ChangeRecorder recorder(&eventManager, dir);
+  writeFile(path, "foo");
+  eventManager.loop();
+
+  ASSERT(recorder.changed);
+  ASSERT(recorder.changeType == FileChangeType::MODIFIED);
+  ASSERT(recorder.knowsChildren);
+  ASSERT(recorder.changedChildren.size() == 1);
+  ASSERT(recorder.changedChildren[0] == "new");
+
+  unlink(path.c_str());
+  rmdir(dir.c_str());
+}
+
+void testDirectoryDeleted(EventManagerFactory factory) {
+  std::string dir = makeTempDir();
+
+  OwnedPtr<RunnableEventManager> eventManagerPtr = factory();
+  RunnableEventManager& eventManager = *eventManagerPtr;
+  ChangeRecorder recorder(&eventManager, dir);
+  ASSERT(rmdir(dir.c_str()) == 0);
+  eventManager.loop();
+
+  ASSERT(recorder.changed);
+  ASSERT(recorder.changeType == FileChangeType::DELETED);
+}
+
+void testDirectoryMoved(EventManagerFactory factory) {
+  std::string dir = makeTempDir();
+  std::string newDir = dir + "-moved";
+
+  OwnedPtr<RunnableEventManager> eventManagerPtr = factory();
+  RunnableEventManager& eventManager = *eventManagerPtr;
+  ChangeRecorder recorder(&eventManager, dir);
+  ASSERT(rename(dir.c_str(), newDir.c_str()) == 0);
+  eventManager.loop();
+
+  ASSERT(recorder.changed);
+  ASSERT(recorder.changeType == FileChangeType::DELETED);
+
+  rmdir(newDir.c_str());
+}
+
+void testOverflow(EventManagerFactory factory) {
+  std::string dir = makeTempDir();
+  std::string path = dir + "/file";
+  writeFile(path, "foo");
+
+  int maxQueuedEvents = 16384;
+  FILE* limit = fopen("/proc/sys/fs/inotify/max_queued_events", "r");
+  if (limit != NULL) {
+    ASSERT(fscanf(limit, "%d", &maxQueuedEvents) == 1);
+    fclose(limit);
+  }
+  // fanotify's queue has a fixed size.
+  const int FANOTIFY_MAX_QUEUED_EVENTS = 16384;
+  if (maxQueuedEvents < FANOTIFY_MAX_QUEUED_EVENTS) {
+    maxQueuedEvents = FANOTIFY_MAX_QUEUED_EVENTS;
+  }
+
+  OwnedPtr<RunnableEventManager> eventManagerPtr = factory();
+  RunnableEventManager& eventManager = *eventManagerPtr;
+  ChangeRecorder dirRecorder(&eventManager, dir);
+  ChangeRecorder fileRecorder(&eventManager, path);
+
+  // Each file generates at least one event, even where the kernel merges its create and delete.
+  // None are read until the loop runs, so the queue overflows.
+  for (int i = 0; i < maxQueuedEvents + 100; i++) {
+    std::string churn = dir + "/churn" + std::to_string(i);
+    writeFile(churn, "");
+    unlink(churn.c_str());
+  }
+  eventManager.loop();
+
+  // The directory saw real events before the overflow.  The file saw none, so it can't be told
+  // what happened, only that something might have.
+  ASSERT(dirRecorder.changed);
+  ASSERT(fileRecorder.changed);
+  ASSERT(fileRecorder.changeType == FileChangeType::UNKNOWN);
+  ASSERT(!fileRecorder.knowsChildren);
+
+  unlink(path.c_str());
+  rmdir(dir.c_str());
+}
+
+void testTimers(EventManagerFactory factory) {
+  OwnedPtr<RunnableEventManager> eventManagerPtr = factory();
+  RunnableEventManager& eventManager = *eventManagerPtr;
+  std::string order;
+
+  Promise<void> slow = eventManager.when(eventManager.afterDelay(30))(
+    [&](Void) { order += "slow "; });
+  Promise<void> fast = eventManager.when(eventManager.afterDelay(10))(
+    [&](Void) { order += "fast "; });
+  Promise<void> canceled = eventManager.when(eventManager.afterDelay(20))(
+    [&](Void) { order += "canceled "; });
+  canceled.release();
+
+  // A timer set from a timer callback.
+  Promise<void> chained;
+  Promise<void> first = eventManager.when(eventManager.afterDelay(0))(
+    [&](Void) {
+      order += "first ";
+      chained = eventManager.when(eventManager.afterDelay(40))(
+        [&](Void) { order += "chained"; });
+    });
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  eventManager.loop();
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  ASSERT(order == "first fast slow chained");
+  ASSERT((end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000 >= 40);
+}
+
+// Reads everything from the stream into `text`.
+class Slurper {
+public:
+  Slurper(EventManager* eventManager, OwnedPtr<ByteStream> stream)
+      : eventManager(eventManager), stream(stream.release()) {
+    asyncOp = readMore();
+  }
+
+  std::string text;
+
+private:
+  EventManager* eventManager;
+  OwnedPtr<ByteStream> stream;
+  char buffer[7];
+  Promise<void> asyncOp;
+
+  Promise<void> readMore() {
+    return eventManager->when(stream->readAsync(eventManager, buffer, sizeof(buffer)))(
+      [this](size_t size) -> Promise<void> {
+        if (size == 0) {
+          return newFulfilledPromise();
+        }
+        text.append(buffer, size);
+        return readMore();
+      });
+  }
+};
+
+void testReadAsync(EventManagerFactory factory) {
+  OwnedPtr<RunnableEventManager> eventManagerPtr = factory();
+  RunnableEventManager& eventManager = *eventManagerPtr;
+
+  Pipe pipe;
+  OwnedPtr<ByteStream> writeEnd = pipe.releaseWriteEnd();
+  writeEnd->writeAll("written before reading, ", 24);
+
+  Slurper slurper(&eventManager, pipe.releaseReadEnd());
+
+  // Writes the rest from a callback, then closes the pipe.
+  OwnedPtr<PendingRunnable> writeLater = eventManager.runLater(newLambdaRunnable([&]() {
+    writeEnd->writeAll("and after.", 10);
+    writeEnd.clear();
+  }));
+
+  eventManager.loop();
+  ASSERT(slurper.text == "written before reading, and after.");
+}
+
+void testReadCanceled(EventManagerFactory factory) {
+  OwnedPtr<RunnableEventManager> eventManagerPtr = factory();
+  RunnableEventManager& eventManager = *eventManagerPtr;
+
+  // Nothing is ever written, so the loop only exits if releasing the read cancels it.
+  Pipe pipe;
+  OwnedPtr<ByteStream> readEnd = pipe.releaseReadEnd();
+  char buffer[16];
+  bool called = false;
+  Promise<void> read = eventManager.when(readEnd->readAsync(&eventManager, buffer, sizeof(buffer)))(
+    [&](size_t) { called = true; });
+  OwnedPtr<PendingRunnable> cancelLater = eventManager.runLater(newLambdaRunnable([&]() {
+    read.release();
+  }));
+
+  eventManager.loop();
+  ASSERT(!called);
+}
+
+void testProcessExit(EventManagerFactory factory) {
+  OwnedPtr<RunnableEventManager> eventManagerPtr = factory();
+  RunnableEventManager& eventManager = *eventManagerPtr;
+
+  pid_t pid = fork();
+  ASSERT(pid >= 0);
+  if (pid == 0) {
+    _exit(7);
+  }
+
+  int exitCode = -1;
+  Promise<void> exited = eventManager.when(eventManager.onProcessExit(pid))(
+    [&](ProcessExitCode code) { exitCode = code.getExitCode(); });
+  eventManager.loop();
+  ASSERT(exitCode == 7);
+}
+
+OwnedPtr<RunnableEventManager> newEpollEventManager() {
+  return newOwned<EpollEventManager>();
+}
+
+// Watches through fanotify, where the kernel lets us.
+OwnedPtr<RunnableEventManager> newFanotifyEventManager() {
+  EpollEventManager::setFanotifyEnabled(true);
+  OwnedPtr<RunnableEventManager> result = newOwned<EpollEventManager>();
+  EpollEventManager::setFanotifyEnabled(false);
+  return result;
+}
+
+bool isFanotifySupported() {
+  int fd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  close(fd);
+  return true;
+}
+
+#if EKAM_HAVE_IO_URING
+OwnedPtr<RunnableEventManager> newIoUringEventManager() {
+  return newOwned<IoUringEventManager>();
+}
+#endif
+
+void testAll(EventManagerFactory factory) {
+  testModified(factory);
+  testChangedChildren(factory);
+  testDirectoryDeleted(factory);
+  testDirectoryMoved(factory);
+  testOverflow(factory);
+  testTimers(factory);
+  testReadAsync(factory);
+  testReadCanceled(factory);
+  testProcessExit(factory);
+}
+
+}  // namespace
+}  // namespace ekam
+
+int main(int argc, char* argv[]) {
+  ekam::testAll(ekam::newEpollEventManager);
+  if (ekam::isFanotifySupported()) {
+    ekam::testAll(ekam::newFanotifyEventManager);
+  } else {
+    fprintf(stderr, "fanotify not permitted; skipping.\n");
+  }
+#if EKAM_HAVE_IO_URING
+  if (ekam::IoUringEventManager::isSupported()) {
+    ekam::testAll(ekam::newIoUringEventManager);
+  } else {
+    fprintf(stderr, "io_uring event loop not supported; skipping.\n");
+  }
+#endif
+  return 0;
+}
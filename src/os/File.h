@@ -70,6 +70,10 @@ public:
   virtual bool isFile() = 0;
   virtual bool isDirectory() = 0;
 
+  // Implementations may cache the answers to the above.  Call this when the file may have been
+  // created, deleted or replaced behind the File's back, e.g. by a subprocess.
+  virtual void invalidateCache() = 0;
+
   // File only.
   virtual Hash contentHash() = 0;
   virtual std::string readAll() = 0;
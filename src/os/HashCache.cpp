@@ -0,0 +1,253 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "HashCache.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <vector>
+
+#include "base/Debug.h"
+
+namespace ekam {
+
+namespace {
+
+const uint64_t MAGIC = 0x6568636d616b65ull;  // "ekamche"
+const uint32_t FILE_VERSION = 1;
+
+// Past this many entries we start over rather than growing.  Every rebuilt output gets a new
+// inode, so without a bound the table would grow forever.
+const uint64_t MAX_CAPACITY = 1 << 18;
+
+int64_t toNanos(const struct timespec& time) {
+  return static_cast<int64_t>(time.tv_sec) * 1000000000ll + time.tv_nsec;
+}
+
+#ifdef __APPLE__
+int64_t mtimeNanos(const struct stat& stats) { return toNanos(stats.st_mtimespec); }
+int64_t ctimeNanos(const struct stat& stats) { return toNanos(stats.st_ctimespec); }
+#else
+int64_t mtimeNanos(const struct stat& stats) { return toNanos(stats.st_mtim); }
+int64_t ctimeNanos(const struct stat& stats) { return toNanos(stats.st_ctim); }
+#endif
+
+uint64_t fnv1a(const void* data, size_t size) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+  uint64_t result = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < size; i++) {
+    result ^= bytes[i];
+    result *= 0x100000001b3ull;
+  }
+  return result;
+}
+
+uint64_t mixKey(uint64_t dev, uint64_t ino) {
+  uint64_t result = ino * 0x9e3779b97f4a7c15ull ^ dev;
+  result ^= result >> 29;
+  result *= 0xbf58476d1ce4e5b9ull;
+  result ^= result >> 32;
+  return result;
+}
+
+}  // anonymous namespace
+
+struct HashCache::Header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t hashFormat;
+  uint64_t capacity;  // always a power of two
+  uint64_t count;
+};
+
+struct HashCache::Entry {
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t size;
+  int64_t mtimeNs;
+  int64_t ctimeNs;
+  unsigned char hash[Hash::SIZE];
+
+  // Checksum of all of the above, so that a torn write (e.g. from a crash) reads as a miss.
+  // Zero means the slot is empty.
+  uint64_t check;
+
+  uint64_t computeCheck() const {
+    return fnv1a(this, offsetof(Entry, check)) | 1;
+  }
+};
+
+HashCache::HashCache(const std::string& path, uint32_t hashFormat)
+    : path(path), hashFormat(hashFormat),
+      handle(path, WRAP_SYSCALL(open, path.c_str(), O_RDWR | O_CREAT, 0666)),
+      mapping(NULL), mappingSize(0), hitCount(0), missCount(0), racyCount(0) {
+  struct stat stats;
+  WRAP_SYSCALL(fstat, handle, &stats);
+
+  if (static_cast<size_t>(stats.st_size) >= sizeof(Header)) {
+    map(stats.st_size);
+    Header* h = header();
+    if (h->magic == MAGIC && h->version == FILE_VERSION && h->hashFormat == hashFormat &&
+        h->capacity > 0 && (h->capacity & (h->capacity - 1)) == 0 &&
+        mappingSize == sizeof(Header) + h->capacity * sizeof(Entry)) {
+      DEBUG_INFO << path << ": loaded " << h->count << " cached hashes.";
+      return;
+    }
+    DEBUG_INFO << path << ": discarding incompatible hash cache.";
+    unmap();
+  }
+
+  reset(INITIAL_CAPACITY);
+}
+
+HashCache::~HashCache() {
+  unmap();
+}
+
+HashCache::Header* HashCache::header() {
+  return reinterpret_cast<Header*>(mapping);
+}
+
+HashCache::Entry* HashCache::entries() {
+  return reinterpret_cast<Entry*>(reinterpret_cast<char*>(mapping) + sizeof(Header));
+}
+
+void HashCache::map(size_t size) {
+  void* result = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, handle.get(), 0);
+  if (result == MAP_FAILED) {
+    throw OsError(path, "mmap", errno);
+  }
+  mapping = result;
+  mappingSize = size;
+}
+
+void HashCache::unmap() {
+  if (mapping != NULL) {
+    if (munmap(mapping, mappingSize) < 0) {
+      DEBUG_ERROR << path << ": munmap: " << strerror(errno);
+    }
+    mapping = NULL;
+    mappingSize = 0;
+  }
+}
+
+void HashCache::reset(uint64_t capacity) {
+  unmap();
+
+  size_t size = sizeof(Header) + capacity * sizeof(Entry);
+  // Truncating to zero first guarantees that the new table reads as all-empty.
+  WRAP_SYSCALL(ftruncate, handle, 0);
+  WRAP_SYSCALL(ftruncate, handle, size);
+  map(size);
+
+  Header* h = header();
+  h->magic = MAGIC;
+  h->version = FILE_VERSION;
+  h->hashFormat = hashFormat;
+  h->capacity = capacity;
+  h->count = 0;
+}
+
+void HashCache::grow() {
+  uint64_t oldCapacity = header()->capacity;
+  if (oldCapacity * 2 > MAX_CAPACITY) {
+    DEBUG_INFO << path << ": hash cache full; starting over.";
+    reset(INITIAL_CAPACITY);
+    return;
+  }
+
+  std::vector<Entry> saved;
+  saved.reserve(header()->count);
+  Entry* oldEntries = entries();
+  for (uint64_t i = 0; i < oldCapacity; i++) {
+    if (oldEntries[i].check != 0) {
+      saved.push_back(oldEntries[i]);
+    }
+  }
+
+  reset(oldCapacity * 2);
+
+  for (const Entry& entry: saved) {
+    Entry* slot = findSlot(entry.dev, entry.ino);
+    *slot = entry;
+    ++header()->count;
+  }
+}
+
+HashCache::Entry* HashCache::findSlot(uint64_t dev, uint64_t ino) {
+  uint64_t mask = header()->capacity - 1;
+  Entry* table = entries();
+  for (uint64_t i = mixKey(dev, ino) & mask;; i = (i + 1) & mask) {
+    Entry* entry = table + i;
+    if (entry->check == 0 || (entry->dev == dev && entry->ino == ino)) {
+      return entry;
+    }
+  }
+}
+
+bool HashCache::lookup(const struct stat& stats, Hash* output) {
+  Entry* entry = findSlot(stats.st_dev, stats.st_ino);
+  if (entry->check != 0 &&
+      entry->size == static_cast<uint64_t>(stats.st_size) &&
+      entry->mtimeNs == mtimeNanos(stats) &&
+      entry->ctimeNs == ctimeNanos(stats) &&
+      entry->check == entry->computeCheck()) {
+    *output = Hash::fromBytes(entry->hash);
+    ++hitCount;
+    return true;
+  }
+
+  ++missCount;
+  return false;
+}
+
+void HashCache::store(const struct stat& stats, const Hash& hash) {
+  int64_t mtime = mtimeNanos(stats);
+  int64_t ctime = ctimeNanos(stats);
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  if (toNanos(now) - std::max(mtime, ctime) < RACY_WINDOW_NS) {
+    // The file could change again within the timestamp granularity without us noticing.
+    ++racyCount;
+    return;
+  }
+
+  Entry* entry = findSlot(stats.st_dev, stats.st_ino);
+  if (entry->check == 0) {
+    if ((header()->count + 1) * 2 > header()->capacity) {
+      grow();
+      entry = findSlot(stats.st_dev, stats.st_ino);
+    }
+    ++header()->count;
+  }
+
+  entry->dev = stats.st_dev;
+  entry->ino = stats.st_ino;
+  entry->size = stats.st_size;
+  entry->mtimeNs = mtime;
+  entry->ctimeNs = ctime;
+  memcpy(entry->hash, hash.bytes(), Hash::SIZE);
+  entry->check = entry->computeCheck();
+}
+
+}  // namespace ekam
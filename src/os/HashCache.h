@@ -0,0 +1,85 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KENTONSCODE_OS_HASHCACHE_H_
+#define KENTONSCODE_OS_HASHCACHE_H_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <string>
+
+#include "base/Hash.h"
+#include "OsHandle.h"
+
+namespace ekam {
+
+// A persistent cache of file content hashes, keyed on (device, inode) and validated against the
+// file's size, mtime and ctime.  The table lives in a memory-mapped file (normally
+// tmp/.ekam-hashcache) so that it survives restarts; unchanged files never have to be re-read.
+//
+// Timestamps are only as good as the filesystem's granularity, so a file that was modified
+// shortly before it was hashed could be modified again without its stats changing.  Such "racy"
+// hashes are never stored; the file will simply be hashed again next time.
+class HashCache {
+public:
+  // `hashFormat` identifies the algorithm used to compute the hashes.  If it doesn't match the
+  // one recorded in the file, the cache is discarded.
+  HashCache(const std::string& path, uint32_t hashFormat);
+  ~HashCache();
+
+  // If the cache has a trustworthy hash for a file with the given stats, sets *output and returns
+  // true.
+  bool lookup(const struct stat& stats, Hash* output);
+
+  // Record the hash of a file, given the stats observed *before* its content was read.
+  void store(const struct stat& stats, const Hash& hash);
+
+  inline uint64_t getHitCount() const { return hitCount; }
+  inline uint64_t getMissCount() const { return missCount; }
+  inline uint64_t getRacyCount() const { return racyCount; }
+
+private:
+  struct Header;
+  struct Entry;
+
+  std::string path;
+  uint32_t hashFormat;
+  OsHandle handle;
+  void* mapping;
+  size_t mappingSize;
+
+  uint64_t hitCount;
+  uint64_t missCount;
+  uint64_t racyCount;
+
+  // Don't trust timestamps this close to the time at which the content was read.
+  static const int64_t RACY_WINDOW_NS = 2000000000ll;
+  static const uint64_t INITIAL_CAPACITY = 4096;
+
+  Header* header();
+  Entry* entries();
+
+  void map(size_t size);
+  void unmap();
+  void reset(uint64_t capacity);
+  void grow();
+  Entry* findSlot(uint64_t dev, uint64_t ino);
+};
+
+}  // namespace ekam
+
+#endif  // KENTONSCODE_OS_HASHCACHE_H_
@@ -0,0 +1,133 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "HashCache.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+
+namespace ekam {
+namespace {
+
+#define ASSERT(EXPRESSION)                                                    \
+  if (!(EXPRESSION)) {                                                        \
+    fprintf(stderr, "%s:%d: FAILED: %s\n", __FILE__, __LINE__, #EXPRESSION);  \
+    exit(1);                                                                  \
+  }
+
+const uint32_t FORMAT = 7;
+
+std::string makeTempDir() {
+  char pattern[] = "/tmp/ekam-test-XXXXXX";
+  ASSERT(mkdtemp(pattern) != NULL);
+  return pattern;
+}
+
+void writeFile(const std::string& path, const char* content) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  ASSERT(fd >= 0);
+  ASSERT(write(fd, content, strlen(content)) == (ssize_t)strlen(content));
+  close(fd);
+}
+
+struct stat statFile(const std::string& path) {
+  struct stat stats;
+  ASSERT(stat(path.c_str(), &stats) == 0);
+  return stats;
+}
+
+void testHashCache() {
+  std::string dir = makeTempDir();
+  std::string cachePath = dir + "/hashcache";
+  std::string a = dir + "/a", b = dir + "/b", c = dir + "/c";
+  writeFile(a, "foo");
+  writeFile(b, "bar");
+  writeFile(c, "baz");
+
+  // Hashes of files changed within the last couple of seconds are never stored.
+  {
+    HashCache cache(cachePath, FORMAT);
+    Hash hash;
+    cache.store(statFile(a), Hash::of("foo"));
+    ASSERT(cache.getRacyCount() == 1);
+    ASSERT(!cache.lookup(statFile(a), &hash));
+  }
+
+  sleep(3);
+
+  {
+    HashCache cache(cachePath, FORMAT);
+    cache.store(statFile(a), Hash::of("foo"));
+    cache.store(statFile(b), Hash::of("bar"));
+    cache.store(statFile(c), Hash::of("baz"));
+    ASSERT(cache.getRacyCount() == 0);
+
+    Hash hash;
+    ASSERT(cache.lookup(statFile(a), &hash));
+    ASSERT(hash == Hash::of("foo"));
+    ASSERT(cache.getHitCount() == 1);
+  }
+
+  // Modify b's mtime and c's size.  Each changes the ctime as well, which is now too recent to
+  // store again.
+  struct timespec times[2];
+  times[0].tv_sec = times[1].tv_sec = 1000000000;
+  times[0].tv_nsec = times[1].tv_nsec = 0;
+  ASSERT(utimensat(AT_FDCWD, b.c_str(), times, 0) == 0);
+  ASSERT(truncate(c.c_str(), 1) == 0);
+
+  // The cache persists; changed files miss.
+  {
+    HashCache cache(cachePath, FORMAT);
+    Hash hash;
+    ASSERT(cache.lookup(statFile(a), &hash));
+    ASSERT(hash == Hash::of("foo"));
+    ASSERT(!cache.lookup(statFile(b), &hash));
+    ASSERT(!cache.lookup(statFile(c), &hash));
+    ASSERT(cache.getHitCount() == 1);
+    ASSERT(cache.getMissCount() == 2);
+  }
+
+  // A cache written with another hash format is discarded.
+  {
+    HashCache cache(cachePath, FORMAT + 1);
+    Hash hash;
+    ASSERT(!cache.lookup(statFile(a), &hash));
+  }
+  {
+    HashCache cache(cachePath, FORMAT);
+    Hash hash;
+    ASSERT(!cache.lookup(statFile(a), &hash));
+  }
+
+  unlink(a.c_str());
+  unlink(b.c_str());
+  unlink(c.c_str());
+  unlink(cachePath.c_str());
+  rmdir(dir.c_str());
+}
+
+}  // namespace
+}  // namespace ekam
+
+int main(int argc, char* argv[]) {
+  ekam::testHashCache();
+  return 0;
+}
@@ -0,0 +1,300 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "IoBatch.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <memory>
+
+#include "base/Debug.h"
+#include "IoUring.h"
+#include "OsHandle.h"
+
+namespace ekam {
+
+namespace {
+
+bool ioUringEnabled = true;
+
+void closeIgnoringErrors(int fd) {
+  // The fd is released even if close() reports EINTR, so it must not be retried.
+  close(fd);
+}
+
+#if EKAM_HAVE_IO_URING
+
+const unsigned RING_ENTRIES = 256;
+
+// One ring, created on first use and shared by all batches.  Like the rest of the os layer,
+// only used from the event loop thread.
+IoUring* getRing() {
+  static std::unique_ptr<IoUring> ring;
+  static bool initialized = false;
+
+  if (!initialized) {
+    initialized = true;
+    try {
+      ring.reset(new IoUring(RING_ENTRIES));
+      // Operations we need were added to io_uring over several kernel versions.
+      for (int op: { IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE }) {
+        if (!ring->isSupported(op)) {
+          throw OsError("", "io_uring opcode probe", EOPNOTSUPP);
+        }
+      }
+    } catch (const OsError& e) {
+      ring.reset();
+      DEBUG_INFO << "io_uring not available, using blocking I/O: " << e.what();
+    }
+  }
+  return ring.get();
+}
+
+void fromStatx(const struct statx& in, struct stat* out) {
+  memset(out, 0, sizeof(*out));
+  out->st_dev = makedev(in.stx_dev_major, in.stx_dev_minor);
+  out->st_ino = in.stx_ino;
+  out->st_mode = in.stx_mode;
+  out->st_nlink = in.stx_nlink;
+  out->st_uid = in.stx_uid;
+  out->st_gid = in.stx_gid;
+  out->st_rdev = makedev(in.stx_rdev_major, in.stx_rdev_minor);
+  out->st_size = in.stx_size;
+  out->st_blksize = in.stx_blksize;
+  out->st_blocks = in.stx_blocks;
+  out->st_atim.tv_sec = in.stx_atime.tv_sec;
+  out->st_atim.tv_nsec = in.stx_atime.tv_nsec;
+  out->st_mtim.tv_sec = in.stx_mtime.tv_sec;
+  out->st_mtim.tv_nsec = in.stx_mtime.tv_nsec;
+  out->st_ctim.tv_sec = in.stx_ctime.tv_sec;
+  out->st_ctim.tv_nsec = in.stx_ctime.tv_nsec;
+}
+
+void prepareStatx(struct io_uring_sqe* sqe, int dirfd, const char* path, int flags,
+                  struct statx* output) {
+  sqe->opcode = IORING_OP_STATX;
+  sqe->fd = dirfd;
+  sqe->addr = reinterpret_cast<uintptr_t>(path);
+  sqe->len = STATX_BASIC_STATS;
+  sqe->off = reinterpret_cast<uintptr_t>(output);
+  sqe->statx_flags = flags;
+}
+
+#endif  // EKAM_HAVE_IO_URING
+
+}  // namespace
+
+IoBatch::IoBatch() {}
+IoBatch::~IoBatch() {}
+
+void IoBatch::stat(const std::string& path, struct stat* output, int* error) {
+  statOps.push_back(StatOp { &path, output, error });
+}
+
+void IoBatch::readFile(const std::string& path, size_t maxSize, std::string* content,
+                       struct stat* stats, int* error) {
+  readOps.push_back(ReadOp { &path, maxSize, content, stats, error, -1, 0 });
+}
+
+void IoBatch::run() {
+  if (statOps.empty() && readOps.empty()) {
+    return;
+  }
+
+  if (isUsingIoUring()) {
+    runWithIoUring();
+  } else {
+    runSynchronously();
+  }
+
+  statOps.clear();
+  readOps.clear();
+}
+
+bool IoBatch::isUsingIoUring() {
+#if EKAM_HAVE_IO_URING
+  return ioUringEnabled && getRing() != NULL;
+#else
+  return false;
+#endif
+}
+
+void IoBatch::setIoUringEnabled(bool enabled) {
+  ioUringEnabled = enabled;
+}
+
+void IoBatch::runSynchronously() {
+  for (StatOp& op: statOps) {
+    int result;
+    do {
+      result = ::stat(op.path->c_str(), op.output);
+    } while (result < 0 && errno == EINTR);
+    *op.error = result < 0 ? errno : 0;
+  }
+
+  for (ReadOp& op: readOps) {
+    do {
+      op.fd = open(op.path->c_str(), O_RDONLY | O_CLOEXEC);
+    } while (op.fd < 0 && errno == EINTR);
+    if (op.fd < 0) {
+      *op.error = errno;
+      continue;
+    }
+
+    *op.error = 0;
+    if (fstat(op.fd, op.stats) < 0) {
+      *op.error = errno;
+    } else if (static_cast<uint64_t>(op.stats->st_size) > op.maxSize) {
+      *op.error = EFBIG;
+    } else {
+      op.content->resize(op.stats->st_size);
+      while (op.bytesRead < op.content->size()) {
+        ssize_t n = read(op.fd, &(*op.content)[op.bytesRead], op.content->size() - op.bytesRead);
+        if (n < 0) {
+          if (errno == EINTR) continue;
+          *op.error = errno;
+          break;
+        } else if (n == 0) {
+          break;
+        }
+        op.bytesRead += n;
+      }
+      op.content->resize(op.bytesRead);
+    }
+
+    closeIgnoringErrors(op.fd);
+    op.fd = -1;
+  }
+}
+
+void IoBatch::runWithIoUring() {
+#if EKAM_HAVE_IO_URING
+  IoUring* ring = getRing();
+
+  // Step 1:  the stat()s, and the opens for the reads, all together.
+  std::vector<struct statx> statxBuffers(statOps.size() + readOps.size());
+  ring->run(statOps.size() + readOps.size(),
+    [&](struct io_uring_sqe* sqe, size_t i) {
+      if (i < statOps.size()) {
+        prepareStatx(sqe, AT_FDCWD, statOps[i].path->c_str(), 0, &statxBuffers[i]);
+      } else {
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<uintptr_t>(readOps[i - statOps.size()].path->c_str());
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+      }
+    },
+    [&](size_t i, int result) {
+      if (i < statOps.size()) {
+        if (result < 0) {
+          *statOps[i].error = -result;
+        } else {
+          *statOps[i].error = 0;
+          fromStatx(statxBuffers[i], statOps[i].output);
+        }
+      } else {
+        ReadOp& op = readOps[i - statOps.size()];
+        *op.error = result < 0 ? -result : 0;
+        op.fd = result;
+      }
+    });
+
+  // Step 2:  stat each opened file.
+  std::vector<ReadOp*> pending;
+  for (ReadOp& op: readOps) {
+    if (op.fd >= 0) {
+      pending.push_back(&op);
+    }
+  }
+
+  static const char EMPTY_PATH[] = "";
+  ring->run(pending.size(),
+    [&](struct io_uring_sqe* sqe, size_t i) {
+      prepareStatx(sqe, pending[i]->fd, EMPTY_PATH, AT_EMPTY_PATH, &statxBuffers[i]);
+    },
+    [&](size_t i, int result) {
+      ReadOp& op = *pending[i];
+      if (result < 0) {
+        *op.error = -result;
+        return;
+      }
+      fromStatx(statxBuffers[i], op.stats);
+      if (static_cast<uint64_t>(op.stats->st_size) > op.maxSize) {
+        *op.error = EFBIG;
+      } else {
+        op.content->resize(op.stats->st_size);
+      }
+    });
+
+  // Step 3:  read, repeating for any short reads until each file is complete or hits EOF.
+  std::vector<ReadOp*> reading;
+  for (ReadOp* op: pending) {
+    if (*op->error == 0) {
+      reading.push_back(op);
+    }
+  }
+  while (!reading.empty()) {
+    std::vector<ReadOp*> stillReading;
+    ring->run(reading.size(),
+      [&](struct io_uring_sqe* sqe, size_t i) {
+        ReadOp& op = *reading[i];
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = op.fd;
+        sqe->addr = reinterpret_cast<uintptr_t>(&(*op.content)[0] + op.bytesRead);
+        sqe->len = op.content->size() - op.bytesRead;
+        sqe->off = op.bytesRead;
+      },
+      [&](size_t i, int result) {
+        ReadOp& op = *reading[i];
+        if (result < 0) {
+          if (result != -EINTR && result != -EAGAIN) {
+            *op.error = -result;
+            op.content->resize(op.bytesRead);
+            return;
+          }
+        } else if (result == 0) {
+          // Truncated since we stat()ed it.
+          op.content->resize(op.bytesRead);
+          return;
+        } else {
+          op.bytesRead += result;
+        }
+        if (op.bytesRead < op.content->size()) {
+          stillReading.push_back(&op);
+        }
+      });
+    reading.swap(stillReading);
+  }
+
+  // Step 4:  close everything.
+  ring->run(pending.size(),
+    [&](struct io_uring_sqe* sqe, size_t i) {
+      sqe->opcode = IORING_OP_CLOSE;
+      sqe->fd = pending[i]->fd;
+    },
+    [&](size_t i, int result) {
+      pending[i]->fd = -1;
+    });
+#else
+  runSynchronously();
+#endif
+}
+
+}  // namespace ekam
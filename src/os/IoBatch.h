@@ -0,0 +1,85 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KENTONSCODE_OS_IOBATCH_H_
+#define KENTONSCODE_OS_IOBATCH_H_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace ekam {
+
+// Performs many small filesystem operations at once.  Where io_uring is available, each step of
+// the batch (all the stats, all the opens, all the reads, ...) is handed to the kernel in as few
+// system calls as the ring size allows, and the kernel is free to service them in parallel.
+// Otherwise the operations are simply performed one at a time with ordinary blocking calls.
+// Either way, run() returns once every queued operation has completed.
+//
+// The strings and output locations passed to the queueing methods must remain valid until run()
+// returns.
+class IoBatch {
+public:
+  IoBatch();
+  ~IoBatch();
+
+  // Queue a stat() of the path.  On completion *error is zero and *output is filled in, or
+  // *error is an errno.
+  void stat(const std::string& path, struct stat* output, int* error);
+
+  // Queue reading an entire file no bigger than `maxSize` bytes.  *stats receives the stats of
+  // the opened file, taken before reading.  A larger file fails with EFBIG, having been
+  // stat()ed but not read.
+  void readFile(const std::string& path, size_t maxSize, std::string* content,
+                struct stat* stats, int* error);
+
+  // Perform everything queued so far.
+  void run();
+
+  // Whether run() will use io_uring.  Can be turned off with setIoUringEnabled(false), e.g. to
+  // compare the two paths.
+  static bool isUsingIoUring();
+  static void setIoUringEnabled(bool enabled);
+
+private:
+  struct StatOp {
+    const std::string* path;
+    struct stat* output;
+    int* error;
+  };
+
+  struct ReadOp {
+    const std::string* path;
+    size_t maxSize;
+    std::string* content;
+    struct stat* stats;
+    int* error;
+    int fd;
+    size_t bytesRead;
+  };
+
+  std::vector<StatOp> statOps;
+  std::vector<ReadOp> readOps;
+
+  void runSynchronously();
+  void runWithIoUring();
+};
+
+}  // namespace ekam
+
+#endif  // KENTONSCODE_OS_IOBATCH_H_
@@ -0,0 +1,233 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares the ways of doing what startup does to every source file:  stat it, then read and
+// hash it.  "one at a time" is the blocking sequence contentHash() performs per file; the two
+// IoBatch runs are the same batched code with and without io_uring.
+//
+// usage:  IoBatch_benchmark [-w] [<directory> | -n <count>]
+//
+// Given a directory, every file beneath it is used.  Otherwise a tree of <count> small files
+// (default 20000) is generated in IoBatch_benchmark.tmp and deleted afterwards.  Before each
+// run, the files' pages are evicted with posix_fadvise() so that reads go to the disk; inodes
+// and dentries stay cached, which requires root to avoid (echo 3 > /proc/sys/vm/drop_caches).
+// -w skips the eviction to measure a warm cache instead.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "IoBatch.h"
+#include "TreeScanner.h"
+#include "base/Hash.h"
+
+namespace ekam {
+namespace {
+
+const size_t MAX_READ_SIZE = 64 << 10;
+const size_t BATCH_SIZE = 256;
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void collectFiles(const TreeScanner::Entry& entry, const std::string& path,
+                  std::vector<std::string>* output) {
+  if (entry.isDirectory) {
+    for (const TreeScanner::Entry& child: entry.children) {
+      collectFiles(child, path + "/" + child.name, output);
+    }
+  } else {
+    output->push_back(path);
+  }
+}
+
+void generateTree(const std::string& root, int count, std::vector<std::string>* output) {
+  mkdir(root.c_str(), 0777);
+  std::string content;
+  for (int i = 0; i < count; i++) {
+    std::string dir = root + "/d" + std::to_string(i / 100);
+    if (i % 100 == 0) {
+      mkdir(dir.c_str(), 0777);
+    }
+    std::string path = dir + "/f" + std::to_string(i) + ".c++";
+    content.assign(1000 + (i * 7919) % 20000, 'a' + i % 26);
+    FILE* out = fopen(path.c_str(), "w");
+    if (out == NULL) {
+      perror(path.c_str());
+      exit(1);
+    }
+    fwrite(content.data(), 1, content.size(), out);
+    fclose(out);
+    output->push_back(path);
+  }
+}
+
+void evict(const std::vector<std::string>& files) {
+  for (const std::string& file: files) {
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd >= 0) {
+      fdatasync(fd);
+      posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+      close(fd);
+    }
+  }
+}
+
+Hash oneAtATime(const std::vector<std::string>& files) {
+  Hash::Builder combined;
+  std::string content;
+  for (const std::string& file: files) {
+    struct stat stats;
+    if (stat(file.c_str(), &stats) < 0 || !S_ISREG(stats.st_mode)) continue;
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) continue;
+    fstat(fd, &stats);
+    if (static_cast<size_t>(stats.st_size) <= MAX_READ_SIZE) {
+      content.resize(stats.st_size);
+      size_t pos = 0;
+      while (pos < content.size()) {
+        ssize_t n = read(fd, &content[pos], content.size() - pos);
+        if (n <= 0) break;
+        pos += n;
+      }
+      content.resize(pos);
+      combined.add(Hash::of(content).toString());
+    }
+    close(fd);
+  }
+  return combined.build();
+}
+
+Hash batched(const std::vector<std::string>& files) {
+  Hash::Builder combined;
+  for (size_t begin = 0; begin < files.size(); begin += BATCH_SIZE) {
+    size_t count = std::min(BATCH_SIZE, files.size() - begin);
+    std::vector<struct stat> stats(count);
+    std::vector<int> errors(count);
+    IoBatch statBatch;
+    for (size_t i = 0; i < count; i++) {
+      statBatch.stat(files[begin + i], &stats[i], &errors[i]);
+    }
+    statBatch.run();
+
+    std::vector<std::string> contents(count);
+    std::vector<struct stat> readStats(count);
+    std::vector<int> readErrors(count, -1);
+    IoBatch readBatch;
+    for (size_t i = 0; i < count; i++) {
+      if (errors[i] == 0 && S_ISREG(stats[i].st_mode)) {
+        readBatch.readFile(files[begin + i], MAX_READ_SIZE,
+                           &contents[i], &readStats[i], &readErrors[i]);
+      }
+    }
+    readBatch.run();
+
+    for (size_t i = 0; i < count; i++) {
+      if (readErrors[i] == 0) {
+        combined.add(Hash::of(contents[i]).toString());
+      }
+    }
+  }
+  return combined.build();
+}
+
+void run(const char* name, const std::vector<std::string>& files, bool warm,
+         const std::function<Hash()>& func) {
+  if (warm) {
+    func();
+  } else {
+    evict(files);
+  }
+
+  double start = now();
+  Hash result = func();
+  double elapsed = now() - start;
+
+  printf("%-24s %8.3f s  %10.0f files/s  %s\n", name, elapsed, files.size() / elapsed,
+         result.toString().substr(0, 16).c_str());
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  bool warm = false;
+  int count = 20000;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "wn:")) != -1) {
+    switch (opt) {
+      case 'w':
+        warm = true;
+        break;
+      case 'n':
+        count = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-w] [<directory> | -n <count>]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  std::vector<std::string> files;
+  std::string generated;
+  if (optind < argc) {
+    TreeScanner scanner;
+    collectFiles(scanner.scan(argv[optind]), argv[optind], &files);
+  } else {
+    generated = "IoBatch_benchmark.tmp";
+    printf("creating %d files in %s...\n", count, generated.c_str());
+    generateTree(generated, count, &files);
+  }
+
+  printf("%zu files, %s cache\n", files.size(), warm ? "warm" : "cold page");
+
+  run("one at a time", files, warm, [&]() { return oneAtATime(files); });
+
+  IoBatch::setIoUringEnabled(false);
+  run("IoBatch, blocking", files, warm, [&]() { return batched(files); });
+
+  IoBatch::setIoUringEnabled(true);
+  if (IoBatch::isUsingIoUring()) {
+    run("IoBatch, io_uring", files, warm, [&]() { return batched(files); });
+  } else {
+    printf("io_uring not available\n");
+  }
+
+  if (!generated.empty()) {
+    std::string command = "rm -rf " + generated;
+    if (system(command.c_str()) != 0) {
+      fprintf(stderr, "failed to remove %s\n", generated.c_str());
+    }
+  }
+  return 0;
+}
+
+}  // namespace ekam
+
+int main(int argc, char* argv[]) {
+  return ekam::main(argc, argv);
+}
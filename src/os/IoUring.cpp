@@ -0,0 +1,232 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "IoUring.h"
+
+#if EKAM_HAVE_IO_URING
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+#include "base/Debug.h"
+#include "OsHandle.h"
+
+namespace ekam {
+
+IoUring::IoUring(unsigned entries)
+    : fd(-1), sqRing(MAP_FAILED), cqRing(MAP_FAILED), sqes(NULL), unsubmitted(0), enterCount(0),
+      bufferRing(NULL), bufferRingSize(0), bufferRingMask(0), buffers(NULL), bufferSize(0) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (fd < 0) {
+    throw OsError("", "io_uring_setup", errno);
+  }
+
+  try {
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap) {
+      sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    }
+
+    sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  fd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+      throw OsError("", "mmap(io_uring sq)", errno);
+    }
+    if (singleMmap) {
+      cqRing = sqRing;
+    } else {
+      cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    fd, IORING_OFF_CQ_RING);
+      if (cqRing == MAP_FAILED) {
+        throw OsError("", "mmap(io_uring cq)", errno);
+      }
+    }
+
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqesMapping = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqesMapping == MAP_FAILED) {
+      throw OsError("", "mmap(io_uring sqes)", errno);
+    }
+    sqes = reinterpret_cast<struct io_uring_sqe*>(sqesMapping);
+
+    char* sq = reinterpret_cast<char*>(sqRing);
+    sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sqEntries = params.sq_entries;
+    sqLocalTail = *sqTail;
+
+    char* cq = reinterpret_cast<char*>(cqRing);
+    cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    probe();
+  } catch (...) {
+    unmap();
+    close(fd);
+    throw;
+  }
+}
+
+IoUring::~IoUring() {
+  // Closing the ring cancels anything still in flight, after which the buffers can go.
+  if (close(fd) < 0) {
+    DEBUG_ERROR << "close(io_uring): " << strerror(errno);
+  }
+  unmap();
+}
+
+bool IoUring::isSupported(int opcode) const {
+  return opcode >= 0 && static_cast<size_t>(opcode) < supportedOps.size() &&
+         supportedOps[opcode];
+}
+
+struct io_uring_sqe* IoUring::getSqe() {
+  if (sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+    return NULL;
+  }
+
+  unsigned index = sqLocalTail & sqMask;
+  struct io_uring_sqe* sqe = &sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqArray[index] = index;
+  ++sqLocalTail;
+  ++unsubmitted;
+  return sqe;
+}
+
+void IoUring::submit(unsigned waitFor) {
+  __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+
+  while (unsubmitted > 0 || waitFor > 0) {
+    int result = syscall(__NR_io_uring_enter, fd, unsubmitted, waitFor,
+                         waitFor > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    ++enterCount;
+    if (result < 0) {
+      if (errno == EINTR) {
+        // Nothing was submitted if there was anything to submit; otherwise a signal cut the
+        // wait short.
+        if (unsubmitted > 0) continue;
+        return;
+      } else if (errno == EAGAIN || errno == EBUSY) {
+        // Out of resources until the caller reaps some completions.
+        return;
+      }
+      throw OsError("", "io_uring_enter", errno);
+    }
+    unsubmitted -= result;
+    // The kernel waits after submitting, so once everything is submitted we're done.
+    if (unsubmitted == 0) return;
+  }
+}
+
+void IoUring::registerBufferRing(uint16_t groupId, char* buffers, unsigned count,
+                                 unsigned bufferSize) {
+  if (bufferRing != NULL) {
+    throw std::logic_error("Only one buffer ring is supported.");
+  }
+
+  size_t pageSize = sysconf(_SC_PAGESIZE);
+  size_t size = (count * sizeof(struct io_uring_buf) + pageSize - 1) / pageSize * pageSize;
+  void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED) {
+    throw OsError("", "mmap(buffer ring)", errno);
+  }
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uintptr_t>(mapping);
+  reg.ring_entries = count;
+  reg.bgid = groupId;
+  if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    int error = errno;
+    munmap(mapping, size);
+    throw OsError("", "io_uring_register(PBUF_RING)", error);
+  }
+
+  bufferRing = reinterpret_cast<struct io_uring_buf_ring*>(mapping);
+  bufferRingSize = size;
+  bufferRingMask = count - 1;
+  this->buffers = buffers;
+  this->bufferSize = bufferSize;
+
+  for (unsigned i = 0; i < count; i++) {
+    returnBuffer(i);
+  }
+}
+
+void IoUring::returnBuffer(uint16_t id) {
+  // The tail is only written by us, so a plain read is fine; the kernel must see the buffer's
+  // entry before the new tail.
+  //
+  // Index the entries by hand:  compiled as C++, the header's flexible array member `bufs` is
+  // pushed off the start of the ring by an empty struct, so the last entry would land past the
+  // end of the mapping.
+  uint16_t tail = bufferRing->tail;
+  struct io_uring_buf* buf =
+      reinterpret_cast<struct io_uring_buf*>(bufferRing) + (tail & bufferRingMask);
+  buf->addr = reinterpret_cast<uintptr_t>(buffers + static_cast<size_t>(id) * bufferSize);
+  buf->len = bufferSize;
+  buf->bid = id;
+  __atomic_store_n(&bufferRing->tail, static_cast<uint16_t>(tail + 1), __ATOMIC_RELEASE);
+}
+
+void IoUring::unmap() {
+  if (bufferRing != NULL) {
+    munmap(bufferRing, bufferRingSize);
+  }
+  if (sqes != NULL) {
+    munmap(sqes, sqesSize);
+  }
+  if (cqRing != MAP_FAILED && cqRing != sqRing) {
+    munmap(cqRing, cqRingSize);
+  }
+  if (sqRing != MAP_FAILED) {
+    munmap(sqRing, sqRingSize);
+  }
+}
+
+void IoUring::probe() {
+  const unsigned OP_COUNT = 256;
+  size_t size = sizeof(struct io_uring_probe) + OP_COUNT * sizeof(struct io_uring_probe_op);
+  std::unique_ptr<char[]> buffer(new char[size]());
+  struct io_uring_probe* probe = reinterpret_cast<struct io_uring_probe*>(buffer.get());
+  if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, OP_COUNT) < 0) {
+    throw OsError("", "io_uring_register(PROBE)", errno);
+  }
+
+  supportedOps.resize(probe->last_op + 1);
+  for (unsigned i = 0; i <= probe->last_op && i < OP_COUNT; i++) {
+    supportedOps[i] = probe->ops[i].flags & IO_URING_OP_SUPPORTED;
+  }
+}
+
+}  // namespace ekam
+
+#endif  // EKAM_HAVE_IO_URING
@@ -0,0 +1,147 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KENTONSCODE_OS_IOURING_H_
+#define KENTONSCODE_OS_IOURING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <vector>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define EKAM_HAVE_IO_URING 1
+#endif
+
+#if EKAM_HAVE_IO_URING
+
+namespace ekam {
+
+// A bare-bones io_uring, talking to the kernel directly since liburing is not a dependency.
+// Like the rest of the os layer, only used from one thread.
+class IoUring {
+public:
+  // Throws OsError if io_uring is unavailable.
+  explicit IoUring(unsigned entries);
+  ~IoUring();
+
+  // Whether the kernel implements the given IORING_OP_*.
+  bool isSupported(int opcode) const;
+
+  // Returns a zeroed submission to fill in, or null if the submission queue is full, in which
+  // case submit() first.
+  struct io_uring_sqe* getSqe();
+
+  // Pass all prepared submissions to the kernel, then wait until at least `waitFor` completions
+  // are available.  Waiting is cut short by signals.
+  void submit(unsigned waitFor = 0);
+
+  // Number of io_uring_enter() calls so far.
+  inline uint64_t getEnterCount() const { return enterCount; }
+
+  // Call func(cqe) for each available completion, then release them.
+  template <typename Func>
+  void forEachCompletion(Func&& func) {
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+      func(cqes[head & cqMask]);
+      ++head;
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+  }
+
+  // Run `count` operations, keeping as many in flight as the ring allows.  prepare(sqe, i) fills
+  // in the submission for operation i; complete(i, result) receives its result, which is a
+  // negative errno on failure.  Must not be mixed with other operations on the same ring.
+  template <typename Prepare, typename Complete>
+  void run(size_t count, Prepare&& prepare, Complete&& complete) {
+    size_t prepared = 0;
+    size_t completed = 0;
+
+    while (true) {
+      // Reap completions first, so that the completion queue can never overflow.
+      forEachCompletion([&](const struct io_uring_cqe& cqe) {
+        complete(static_cast<size_t>(cqe.user_data), cqe.res);
+        ++completed;
+      });
+
+      if (completed == count) {
+        return;
+      }
+
+      while (prepared < count && prepared - completed < sqEntries) {
+        struct io_uring_sqe* sqe = getSqe();
+        if (sqe == NULL) break;
+        prepare(sqe, prepared);
+        sqe->user_data = prepared;
+        ++prepared;
+      }
+
+      submit(1);
+    }
+  }
+
+  // Register a ring of buffers from which the kernel picks one for each completed read submitted
+  // with IOSQE_BUFFER_SELECT and buf_group = `groupId`.  Buffer i of `count` (a power of two) is
+  // `buffers + i * bufferSize`, and is initially available.  Throws OsError if unsupported.
+  void registerBufferRing(uint16_t groupId, char* buffers, unsigned count, unsigned bufferSize);
+
+  // Hand buffer `id` back to the kernel once its contents have been consumed.
+  void returnBuffer(uint16_t id);
+
+private:
+  int fd;
+  void* sqRing;
+  size_t sqRingSize;
+  void* cqRing;
+  size_t cqRingSize;
+  struct io_uring_sqe* sqes;
+  size_t sqesSize;
+
+  unsigned* sqHead;
+  unsigned* sqTail;
+  unsigned sqMask;
+  unsigned* sqArray;
+  unsigned sqEntries;
+  unsigned sqLocalTail;
+  unsigned unsubmitted;
+  uint64_t enterCount;
+
+  unsigned* cqHead;
+  unsigned* cqTail;
+  unsigned cqMask;
+  struct io_uring_cqe* cqes;
+
+  std::vector<bool> supportedOps;
+
+  // The registered buffer ring, if any.
+  struct io_uring_buf_ring* bufferRing;
+  size_t bufferRingSize;
+  unsigned bufferRingMask;
+  char* buffers;
+  unsigned bufferSize;
+
+  void unmap();
+  void probe();
+};
+
+}  // namespace ekam
+
+#endif  // EKAM_HAVE_IO_URING
+
+#endif  // KENTONSCODE_OS_IOURING_H_
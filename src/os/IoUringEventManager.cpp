@@ -0,0 +1,845 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "IoUringEventManager.h"
+
+#if EKAM_HAVE_IO_URING
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <stdexcept>
+
+#include "Pidfd.h"
+#include "base/Debug.h"
+
+namespace ekam {
+
+namespace {
+
+// Added in Linux 6.7; older headers lack it.
+const int OP_READ_MULTISHOT = 49;
+
+uint64_t monotonicMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * UINT64_C(1000000) + ts.tv_nsec / 1000;
+}
+
+}  // namespace
+
+const unsigned IoUringEventManager::RING_ENTRIES;
+const unsigned IoUringEventManager::BUFFER_COUNT;
+const unsigned IoUringEventManager::BUFFER_SIZE;
+const uint16_t IoUringEventManager::BUFFER_GROUP;
+
+// =======================================================================================
+
+// Something submitted to the ring.
+class IoUringEventManager::Operation {
+public:
+  Operation(IoUringEventManager* eventManager, bool keepsLoopRunning)
+      : eventManager(eventManager), keepsLoopRunning(keepsLoopRunning), userData(0),
+        canceled(false) {}
+  virtual ~Operation() {}
+
+  // Fill in the submission, except for user_data.
+  virtual void prepare(struct io_uring_sqe* sqe) = 0;
+
+  // Called for each completion; `final` is false if more will follow.  After the final one, the
+  // operation is deleted unless it was submitted again.
+  virtual void complete(int result, uint32_t flags, bool final) = 0;
+
+  // Called instead of complete() once the operation has been canceled.
+  virtual void discard(int result, uint32_t flags) {}
+
+  bool isSubmitted() const { return userData != 0; }
+
+protected:
+  IoUringEventManager* eventManager;
+
+private:
+  friend class IoUringEventManager;
+
+  bool keepsLoopRunning;
+  uint64_t userData;  // Of the latest submission; zero when not in flight.
+  bool canceled;
+};
+
+struct io_uring_sqe* IoUringEventManager::getSqe() {
+  struct io_uring_sqe* sqe = ring->getSqe();
+  if (sqe == NULL) {
+    ring->submit();
+    sqe = ring->getSqe();
+    if (sqe == NULL) {
+      throw OsError("", "io_uring submission queue", EBUSY);
+    }
+  }
+  return sqe;
+}
+
+void IoUringEventManager::submit(Operation* operation) {
+  struct io_uring_sqe* sqe = getSqe();
+  operation->prepare(sqe);
+  operation->userData = nextUserData++;
+  operation->canceled = false;
+  sqe->user_data = operation->userData;
+  operations[operation->userData] = operation;
+  if (operation->keepsLoopRunning) {
+    ++activeOperations;
+  }
+}
+
+void IoUringEventManager::cancel(Operation* operation) {
+  if (!operation->isSubmitted()) {
+    delete operation;
+    return;
+  }
+  if (operation->canceled) {
+    return;
+  }
+
+  operation->canceled = true;
+  if (operation->keepsLoopRunning) {
+    --activeOperations;
+  }
+
+  // The operation is deleted when its final completion arrives, normally -ECANCELED.
+  struct io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = operation->userData;
+  sqe->user_data = 0;
+}
+
+void IoUringEventManager::setKeepsLoopRunning(Operation* operation, bool keepsLoopRunning) {
+  if (operation->keepsLoopRunning != keepsLoopRunning) {
+    operation->keepsLoopRunning = keepsLoopRunning;
+    if (operation->isSubmitted() && !operation->canceled) {
+      activeOperations += keepsLoopRunning ? 1 : -1;
+    }
+  }
+}
+
+void IoUringEventManager::dispatch(const struct io_uring_cqe& cqe) {
+  if (cqe.user_data == 0) {
+    // The result of a cancellation.  Doesn't matter whether it found anything.
+    return;
+  }
+
+  auto iter = operations.find(cqe.user_data);
+  if (iter == operations.end()) {
+    DEBUG_ERROR << "io_uring completion for unknown operation.";
+    return;
+  }
+  Operation* operation = iter->second;
+
+  bool final = !(cqe.flags & IORING_CQE_F_MORE);
+  if (final) {
+    operations.erase(iter);
+    operation->userData = 0;
+    if (operation->keepsLoopRunning && !operation->canceled) {
+      --activeOperations;
+    }
+  }
+
+  if (operation->canceled) {
+    operation->discard(cqe.res, cqe.flags);
+    if (final) {
+      delete operation;
+    }
+    return;
+  }
+
+  try {
+    operation->complete(cqe.res, cqe.flags, final);
+  } catch (...) {
+    if (final && !operation->isSubmitted()) {
+      delete operation;
+    }
+    throw;
+  }
+  if (final && !operation->isSubmitted()) {
+    delete operation;
+  }
+}
+
+// =======================================================================================
+
+class IoUringEventManager::AsyncCallbackHandler : public PendingRunnable {
+public:
+  AsyncCallbackHandler(IoUringEventManager* eventManager, OwnedPtr<Runnable> runnable)
+      : eventManager(eventManager), called(false), runnable(runnable.release()) {
+    eventManager->asyncCallbacks.push_back(this);
+  }
+  ~AsyncCallbackHandler() {
+    if (!called) {
+      auto iter = std::find(eventManager->asyncCallbacks.begin(),
+                            eventManager->asyncCallbacks.end(), this);
+      if (iter == eventManager->asyncCallbacks.end()) {
+        DEBUG_ERROR << "AsyncCallbackHandler not called but not in asyncCallbacks.";
+      } else {
+        eventManager->asyncCallbacks.erase(iter);
+      }
+    }
+  }
+
+  void run() {
+    called = true;
+    runnable->run();
+  }
+
+private:
+  IoUringEventManager* eventManager;
+  bool called;
+  OwnedPtr<Runnable> runnable;
+};
+
+OwnedPtr<PendingRunnable> IoUringEventManager::runLater(OwnedPtr<Runnable> runnable) {
+  return newOwned<AsyncCallbackHandler>(this, runnable.release());
+}
+
+// =======================================================================================
+
+// A one-shot poll, fulfilling a promise.  Releasing the promise cancels the poll.
+class IoUringEventManager::PollOperation : public Operation {
+public:
+  class Fulfiller : public PromiseFulfiller<void> {
+  public:
+    Fulfiller(Callback* callback, IoUringEventManager* eventManager, int fd, uint32_t events,
+              Fulfiller** slot)
+        : callback(callback), eventManager(eventManager), slot(slot),
+          operation(new PollOperation(eventManager, fd, events, this)) {
+      *slot = this;
+      eventManager->submit(operation);
+    }
+    ~Fulfiller() {
+      if (slot != nullptr) {
+        *slot = nullptr;
+      }
+      if (operation != nullptr) {
+        operation->fulfiller = nullptr;
+        eventManager->cancel(operation);
+      }
+    }
+
+    void ready() {
+      operation = nullptr;
+      *slot = nullptr;
+      slot = nullptr;
+      callback->fulfill();
+    }
+
+    // The IoWatcher is going away.
+    void abandon() {
+      *slot = nullptr;
+      slot = nullptr;
+      try {
+        throw std::logic_error("IoWatcher deleted while waiting for I/O.");
+      } catch (...) {
+        callback->propagateCurrentException();
+      }
+    }
+
+  private:
+    Callback* callback;
+    IoUringEventManager* eventManager;
+    Fulfiller** slot;
+    PollOperation* operation;
+  };
+
+  PollOperation(IoUringEventManager* eventManager, int fd, uint32_t events, Fulfiller* fulfiller)
+      : Operation(eventManager, true), fd(fd), events(events), fulfiller(fulfiller) {}
+
+  void prepare(struct io_uring_sqe* sqe) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+  }
+
+  void complete(int result, uint32_t flags, bool final) {
+    // Errors and hangups count as ready, as with epoll:  the caller finds out when it does I/O.
+    Fulfiller* fulfiller = this->fulfiller;
+    this->fulfiller = nullptr;
+    fulfiller->ready();
+  }
+
+private:
+  int fd;
+  uint32_t events;
+  Fulfiller* fulfiller;
+};
+
+// =======================================================================================
+
+class IoUringEventManager::TimerOperation : public Operation {
+public:
+  class Fulfiller : public PromiseFulfiller<void> {
+  public:
+    Fulfiller(Callback* callback, IoUringEventManager* eventManager, uint64_t milliseconds)
+        : callback(callback), eventManager(eventManager),
+          operation(new TimerOperation(eventManager, milliseconds, this)) {
+      eventManager->submit(operation);
+    }
+    ~Fulfiller() {
+      if (operation != nullptr) {
+        operation->fulfiller = nullptr;
+        eventManager->cancel(operation);
+      }
+    }
+
+    void ready() {
+      operation = nullptr;
+      callback->fulfill();
+    }
+
+  private:
+    Callback* callback;
+    IoUringEventManager* eventManager;
+    TimerOperation* operation;
+  };
+
+  TimerOperation(IoUringEventManager* eventManager, uint64_t milliseconds, Fulfiller* fulfiller)
+      : Operation(eventManager, true), fulfiller(fulfiller) {
+    timeout.tv_sec = milliseconds / 1000;
+    timeout.tv_nsec = (milliseconds % 1000) * 1000000;
+  }
+
+  void prepare(struct io_uring_sqe* sqe) {
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = reinterpret_cast<uintptr_t>(&timeout);
+    sqe->len = 1;
+  }
+
+  void complete(int result, uint32_t flags, bool final) {
+    if (result != -ETIME) {
+      DEBUG_ERROR << "io_uring timeout: " << strerror(-result);
+    }
+    Fulfiller* fulfiller = this->fulfiller;
+    this->fulfiller = nullptr;
+    fulfiller->ready();
+  }
+
+private:
+  // Read by the kernel when the submission is consumed, so it must live here.
+  struct __kernel_timespec timeout;
+  Fulfiller* fulfiller;
+};
+
+Promise<void> IoUringEventManager::afterDelay(uint64_t milliseconds) {
+  return newPromise<TimerOperation::Fulfiller>(this, milliseconds);
+}
+
+// =======================================================================================
+
+// Polls a pidfd, then reaps the process.
+class IoUringEventManager::ProcessExitOperation : public Operation {
+public:
+  class Fulfiller : public PromiseFulfiller<ProcessExitCode> {
+  public:
+    Fulfiller(Callback* callback, IoUringEventManager* eventManager, pid_t pid)
+        : callback(callback), eventManager(eventManager),
+          operation(new ProcessExitOperation(eventManager, pid, this)) {
+      eventManager->submit(operation);
+    }
+    ~Fulfiller() {
+      if (operation != nullptr) {
+        operation->fulfiller = nullptr;
+        eventManager->cancel(operation);
+      }
+    }
+
+    void ready(const ProcessExitCode& exitCode) {
+      operation = nullptr;
+      callback->fulfill(exitCode);
+    }
+
+  private:
+    Callback* callback;
+    IoUringEventManager* eventManager;
+    ProcessExitOperation* operation;
+  };
+
+  ProcessExitOperation(IoUringEventManager* eventManager, pid_t pid, Fulfiller* fulfiller)
+      : Operation(eventManager, true), pidfd(pid), fulfiller(fulfiller) {}
+
+  void prepare(struct io_uring_sqe* sqe) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = pidfd.getHandle()->get();
+    sqe->poll32_events = POLLIN;
+  }
+
+  void complete(int result, uint32_t flags, bool final) {
+    ProcessExitCode exitCode;
+    if (!pidfd.tryReap(&exitCode)) {
+      eventManager->submit(this);
+      return;
+    }
+    Fulfiller* fulfiller = this->fulfiller;
+    this->fulfiller = nullptr;
+    fulfiller->ready(exitCode);
+  }
+
+private:
+  Pidfd pidfd;
+  Fulfiller* fulfiller;
+};
+
+Promise<ProcessExitCode> IoUringEventManager::onProcessExit(pid_t pid) {
+  return newPromise<ProcessExitOperation::Fulfiller>(this, pid);
+}
+
+// =======================================================================================
+
+// Polls the fallback EpollEventManager's epoll fd.  Doesn't by itself keep the loop running.
+class IoUringEventManager::FallbackPollOperation : public Operation {
+public:
+  FallbackPollOperation(IoUringEventManager* eventManager): Operation(eventManager, false) {}
+
+  void prepare(struct io_uring_sqe* sqe) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = eventManager->fallback.getPollFd();
+    sqe->poll32_events = POLLIN;
+  }
+
+  void complete(int result, uint32_t flags, bool final) {
+    // Submitted again before the loop next blocks.
+    eventManager->fallbackPoll = nullptr;
+    eventManager->fallback.pollIo();
+  }
+};
+
+Promise<void> IoUringEventManager::onSignal(int signum) {
+  return fallback.onSignal(signum);
+}
+
+OwnedPtr<EventManager::FileWatcher> IoUringEventManager::watchFile(const std::string& filename) {
+  return fallback.watchFile(filename);
+}
+
+// =======================================================================================
+
+class IoUringEventManager::IoWatcherImpl : public IoWatcher {
+public:
+  IoWatcherImpl(IoUringEventManager* eventManager, int fd)
+      : eventManager(eventManager), fd(fd), readFulfiller(nullptr), writeFulfiller(nullptr),
+        reader(nullptr), pendingRead(nullptr), eof(false), readError(0), starved(false) {}
+  ~IoWatcherImpl();
+
+  // implements IoWatcher ----------------------------------------------------------------
+
+  Promise<void> onReadable() {
+    if (readFulfiller != nullptr) {
+      throw std::logic_error("Already waiting for readability on this fd.");
+    }
+    return newPromise<PollOperation::Fulfiller>(eventManager, fd, POLLIN, &readFulfiller);
+  }
+
+  Promise<void> onWritable() {
+    if (writeFulfiller != nullptr) {
+      throw std::logic_error("Already waiting for writability on this fd.");
+    }
+    return newPromise<PollOperation::Fulfiller>(eventManager, fd, POLLOUT, &writeFulfiller);
+  }
+
+  Promise<size_t> readAsync(void* buffer, size_t size);
+
+  // Called by ReadOperation.
+  void received(int result, uint32_t flags, bool final);
+
+  // Called once buffers are free again after a shortage.
+  void unstarve() {
+    starved = false;
+    if (pendingRead != nullptr) {
+      startReading();
+    }
+  }
+
+private:
+  class ReadFulfiller;
+
+  IoUringEventManager* eventManager;
+  int fd;
+  PollOperation::Fulfiller* readFulfiller;
+  PollOperation::Fulfiller* writeFulfiller;
+
+  // Multishot read in flight, or null.  Only keeps the loop running while a read is pending:
+  // otherwise it is just reading ahead.
+  ReadOperation* reader;
+
+  // Data the kernel has read, waiting to be copied out.
+  struct Chunk {
+    uint16_t bufferId;
+    uint32_t offset;
+    uint32_t size;
+  };
+  std::deque<Chunk> chunks;
+
+  ReadFulfiller* pendingRead;
+  bool eof;
+  int readError;
+  bool starved;
+
+  void startReading();
+  void setPendingRead(ReadFulfiller* fulfiller);
+  size_t copyOut(void* buffer, size_t size);
+};
+
+class IoUringEventManager::ReadOperation : public Operation {
+public:
+  ReadOperation(IoUringEventManager* eventManager, int fd, IoWatcherImpl* watcher,
+                bool keepsLoopRunning)
+      : Operation(eventManager, keepsLoopRunning), fd(fd), watcher(watcher) {}
+
+  void prepare(struct io_uring_sqe* sqe) {
+    sqe->opcode = OP_READ_MULTISHOT;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+  }
+
+  void complete(int result, uint32_t flags, bool final) {
+    watcher->received(result, flags, final);
+  }
+
+  void discard(int result, uint32_t flags) {
+    if (flags & IORING_CQE_F_BUFFER) {
+      ++eventManager->buffersInUse;
+      eventManager->returnBuffer(flags >> IORING_CQE_BUFFER_SHIFT);
+    }
+  }
+
+private:
+  friend class IoWatcherImpl;
+
+  int fd;
+  IoWatcherImpl* watcher;
+};
+
+class IoUringEventManager::IoWatcherImpl::ReadFulfiller : public PromiseFulfiller<size_t> {
+public:
+  ReadFulfiller(Callback* callback, IoWatcherImpl* watcher, void* buffer, size_t size)
+      : callback(callback), watcher(watcher), buffer(buffer), size(size) {
+    watcher->setPendingRead(this);
+  }
+  ~ReadFulfiller() {
+    if (watcher != nullptr) {
+      // Any read in flight carries on; the data is kept for the next readAsync().
+      watcher->setPendingRead(nullptr);
+    }
+  }
+
+  void finish() {
+    IoWatcherImpl* watcher = this->watcher;
+    this->watcher = nullptr;
+    watcher->setPendingRead(nullptr);
+
+    if (!watcher->chunks.empty() || watcher->eof) {
+      callback->fulfill(watcher->copyOut(buffer, size));
+    } else {
+      fail(watcher->readError);
+    }
+  }
+
+  // The IoWatcher is going away.
+  void abandon() {
+    watcher->setPendingRead(nullptr);
+    watcher = nullptr;
+    try {
+      throw std::logic_error("IoWatcher deleted while waiting for I/O.");
+    } catch (...) {
+      callback->propagateCurrentException();
+    }
+  }
+
+private:
+  Callback* callback;
+  IoWatcherImpl* watcher;
+  void* buffer;
+  size_t size;
+
+  void fail(int error) {
+    try {
+      throw OsError("", "read", error);
+    } catch (...) {
+      callback->propagateCurrentException();
+    }
+  }
+};
+
+IoUringEventManager::IoWatcherImpl::~IoWatcherImpl() {
+  if (readFulfiller != nullptr) {
+    readFulfiller->abandon();
+  }
+  if (writeFulfiller != nullptr) {
+    writeFulfiller->abandon();
+  }
+  if (pendingRead != nullptr) {
+    pendingRead->abandon();
+  }
+  if (reader != nullptr) {
+    reader->watcher = nullptr;
+    eventManager->cancel(reader);
+  }
+  for (const Chunk& chunk: chunks) {
+    eventManager->returnBuffer(chunk.bufferId);
+  }
+  if (starved) {
+    auto& starvedWatchers = eventManager->starvedWatchers;
+    starvedWatchers.erase(std::find(starvedWatchers.begin(), starvedWatchers.end(), this));
+  }
+}
+
+Promise<size_t> IoUringEventManager::IoWatcherImpl::readAsync(void* buffer, size_t size) {
+  if (pendingRead != nullptr) {
+    throw std::logic_error("Already reading from this fd.");
+  }
+
+  if (!chunks.empty() || eof) {
+    return newFulfilledPromise(copyOut(buffer, size));
+  } else if (readError != 0) {
+    try {
+      throw OsError("", "read", readError);
+    } catch (...) {
+      return newPromiseFromCurrentException<size_t>();
+    }
+  }
+
+  Promise<size_t> result = newPromise<ReadFulfiller>(this, buffer, size);
+  if (reader == nullptr && !starved) {
+    startReading();
+  }
+  return result;
+}
+
+void IoUringEventManager::IoWatcherImpl::startReading() {
+  reader = new ReadOperation(eventManager, fd, this, pendingRead != nullptr);
+  eventManager->submit(reader);
+}
+
+void IoUringEventManager::IoWatcherImpl::setPendingRead(ReadFulfiller* fulfiller) {
+  pendingRead = fulfiller;
+  if (reader != nullptr) {
+    eventManager->setKeepsLoopRunning(reader, fulfiller != nullptr);
+  }
+}
+
+void IoUringEventManager::IoWatcherImpl::received(int result, uint32_t flags, bool final) {
+  if (final) {
+    reader = nullptr;
+  }
+
+  if (result > 0) {
+    if (flags & IORING_CQE_F_BUFFER) {
+      ++eventManager->buffersInUse;
+      Chunk chunk = { static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT), 0,
+                      static_cast<uint32_t>(result) };
+      chunks.push_back(chunk);
+    } else {
+      DEBUG_ERROR << "io_uring read completed without a buffer.";
+    }
+  } else if (result == 0) {
+    eof = true;
+  } else if (result == -ENOBUFS) {
+    // The kernel ran out of buffers, but some may have been consumed since.  If not, every
+    // buffer holds data nobody has read yet; start again when one is returned.
+    if (eventManager->buffersInUse == BUFFER_COUNT) {
+      starved = true;
+      eventManager->starvedWatchers.push_back(this);
+      ++eventManager->bufferShortageCount;
+    }
+  } else if (result != -EAGAIN && result != -EINTR) {
+    readError = -result;
+  }
+
+  if (pendingRead != nullptr) {
+    if (!chunks.empty() || eof || readError != 0) {
+      pendingRead->finish();
+    } else if (reader == nullptr && !starved) {
+      // The multishot read ended without an error; continue it.
+      startReading();
+    }
+  }
+}
+
+size_t IoUringEventManager::IoWatcherImpl::copyOut(void* buffer, size_t size) {
+  char* output = reinterpret_cast<char*>(buffer);
+  size_t total = 0;
+  while (total < size && !chunks.empty()) {
+    Chunk& chunk = chunks.front();
+    size_t n = std::min<size_t>(size - total, chunk.size);
+    memcpy(output + total,
+           &eventManager->buffers[static_cast<size_t>(chunk.bufferId) * BUFFER_SIZE +
+                                  chunk.offset], n);
+    chunk.offset += n;
+    chunk.size -= n;
+    total += n;
+    if (chunk.size == 0) {
+      uint16_t bufferId = chunk.bufferId;
+      chunks.pop_front();
+      eventManager->returnBuffer(bufferId);
+    }
+  }
+  return total;
+}
+
+OwnedPtr<EventManager::IoWatcher> IoUringEventManager::watchFd(int fd) {
+  return newOwned<IoWatcherImpl>(this, fd);
+}
+
+void IoUringEventManager::returnBuffer(uint16_t id) {
+  ring->returnBuffer(id);
+  --buffersInUse;
+
+  // Wake up whoever ran out.  They may run out again, but only once more buffers are in use.
+  std::deque<IoWatcherImpl*> watchers;
+  watchers.swap(starvedWatchers);
+  for (IoWatcherImpl* watcher: watchers) {
+    watcher->unstarve();
+  }
+}
+
+// =======================================================================================
+
+bool IoUringEventManager::isSupported() {
+  static int supported = -1;
+  if (supported < 0) {
+    supported = false;
+    try {
+      IoUring ring(8);
+      if (!Pidfd::isSupported()) {
+        DEBUG_INFO << "io_uring event loop needs pidfds.";
+      } else if (!ring.isSupported(IORING_OP_POLL_ADD) ||
+                 !ring.isSupported(IORING_OP_ASYNC_CANCEL) ||
+                 !ring.isSupported(IORING_OP_TIMEOUT) ||
+                 !ring.isSupported(OP_READ_MULTISHOT)) {
+        DEBUG_INFO << "io_uring event loop needs multishot reads (Linux 6.7).";
+      } else {
+        supported = true;
+      }
+    } catch (const OsError& e) {
+      DEBUG_INFO << "io_uring not available: " << e.what();
+    }
+  }
+  return supported;
+}
+
+IoUringEventManager::IoUringEventManager()
+    : fallbackPoll(nullptr), nextUserData(1), activeOperations(0), buffersInUse(0),
+      nextCompletion(0),
+      completionCount(0), callbackCount(0), budgetExhaustedCount(0), bufferShortageCount(0) {
+  if (!isSupported()) {
+    throw OsError("", "io_uring event loop", EOPNOTSUPP);
+  }
+
+  ring = newOwned<IoUring>(RING_ENTRIES);
+  buffers.resize(BUFFER_COUNT * BUFFER_SIZE);
+  ring->registerBufferRing(BUFFER_GROUP, buffers.data(), BUFFER_COUNT, BUFFER_SIZE);
+}
+
+IoUringEventManager::~IoUringEventManager() {
+  if (activeOperations > 0) {
+    DEBUG_ERROR << "IoUringEventManager destroyed while promises were waiting on it.";
+  }
+
+  // Closing the ring cancels everything in flight; only then can the operations go.
+  ring.clear();
+  for (auto& entry: operations) {
+    delete entry.second;
+  }
+}
+
+IoUringEventManager::LoopStats IoUringEventManager::getLoopStats() const {
+  LoopStats result;
+  result.enters = ring->getEnterCount();
+  result.completions = completionCount;
+  result.callbacks = callbackCount;
+  result.budgetExhausted = budgetExhaustedCount;
+  result.bufferShortages = bufferShortageCount;
+  return result;
+}
+
+void IoUringEventManager::dumpStats(FILE* out) {
+  LoopStats stats = getLoopStats();
+  fprintf(out, "%-20s %9llu enters %9llu completions %9llu callbacks %9llu over budget "
+               "%llu buffer shortages\n",
+          "event loop", (unsigned long long)stats.enters, (unsigned long long)stats.completions,
+          (unsigned long long)stats.callbacks, (unsigned long long)stats.budgetExhausted,
+          (unsigned long long)stats.bufferShortages);
+  callbackTime.dump(out, "callback time", "us");
+  callbackQueueDepth.dump(out, "callback queue", "");
+  completionTime.dump(out, "I/O handler time", "us");
+}
+
+void IoUringEventManager::loop() {
+  while (handleEvent()) {}
+}
+
+bool IoUringEventManager::handleEvent() {
+  // Run async callbacks first, but only up to the budget, as in EpollEventManager.
+  callbackQueueDepth.add(asyncCallbacks.size());
+  for (int i = 0; i < EpollEventManager::ASYNC_CALLBACK_BUDGET && !asyncCallbacks.empty(); i++) {
+    AsyncCallbackHandler* handler = asyncCallbacks.front();
+    asyncCallbacks.pop_front();
+    ++callbackCount;
+    uint64_t start = monotonicMicros();
+    handler->run();
+    callbackTime.add(monotonicMicros() - start);
+  }
+
+  bool callbacksQueued = !asyncCallbacks.empty();
+  if (callbacksQueued) {
+    ++budgetExhaustedCount;
+  }
+
+  // If a handler threw, finish the completions left over from last time before waiting again.
+  if (nextCompletion >= completions.size()) {
+    bool fallbackActive = fallback.prepareToWait();
+    if (!callbacksQueued && activeOperations == 0 && !fallbackActive) {
+      // Send off any cancellations.
+      ring->submit();
+      DEBUG_INFO << "No more events.";
+      return false;
+    }
+
+    if (fallbackPoll == nullptr) {
+      fallbackPoll = new FallbackPollOperation(this);
+      submit(fallbackPoll);
+    }
+
+    ring->submit(callbacksQueued ? 0 : 1);
+
+    completions.clear();
+    nextCompletion = 0;
+    ring->forEachCompletion([this](const struct io_uring_cqe& cqe) {
+      completions.push_back(cqe);
+    });
+  }
+
+  while (nextCompletion < completions.size()) {
+    ++completionCount;
+    uint64_t start = monotonicMicros();
+    dispatch(completions[nextCompletion++]);
+    completionTime.add(monotonicMicros() - start);
+  }
+
+  return true;
+}
+
+}  // namespace ekam
+
+#endif  // EKAM_HAVE_IO_URING
@@ -0,0 +1,142 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KENTONSCODE_OS_IOURINGEVENTMANAGER_H_
+#define KENTONSCODE_OS_IOURINGEVENTMANAGER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include "EventManager.h"
+#include "EpollEventManager.h"
+#include "IoUring.h"
+#include "base/Histogram.h"
+#include "base/OwnedPtr.h"
+
+#if EKAM_HAVE_IO_URING
+
+namespace ekam {
+
+// An event loop which hands its waiting to io_uring instead of epoll.  Fd readiness, process
+// exits (through pidfds) and timers are each a submission, all sent and waited for in one
+// io_uring_enter() per turn of the loop.  Reads through IoWatcher::readAsync() are multishot:
+// once started, the kernel keeps reading into buffers from a shared pool as data arrives, and
+// readAsync() just copies out what is already there.
+//
+// File watching and onSignal() are delegated to an EpollEventManager whose epoll fd is itself
+// polled through the ring.
+class IoUringEventManager : public RunnableEventManager {
+public:
+  // Whether the kernel has everything needed:  multishot reads are the newest (Linux 6.7).
+  static bool isSupported();
+
+  // Throws OsError if io_uring isn't usable.
+  IoUringEventManager();
+  ~IoUringEventManager();
+
+  struct LoopStats {
+    uint64_t enters;             // io_uring_enter() calls.
+    uint64_t completions;        // Completions handled.
+    uint64_t callbacks;          // Queued callbacks run.
+    uint64_t budgetExhausted;    // Turns which left callbacks queued in order to check for I/O.
+    uint64_t bufferShortages;    // Reads which stalled because every buffer was in use.
+  };
+  LoopStats getLoopStats() const;
+
+  // implements RunnableEventManager -----------------------------------------------------
+  void loop();
+  Promise<void> onSignal(int signum);
+  void dumpStats(FILE* out);
+
+  // implements Executor -----------------------------------------------------------------
+  OwnedPtr<PendingRunnable> runLater(OwnedPtr<Runnable> runnable);
+
+  // implements EventManager -------------------------------------------------------------
+  Promise<ProcessExitCode> onProcessExit(pid_t pid);
+  Promise<void> afterDelay(uint64_t milliseconds);
+  OwnedPtr<IoWatcher> watchFd(int fd);
+  OwnedPtr<FileWatcher> watchFile(const std::string& filename);
+
+private:
+  class AsyncCallbackHandler;
+  class Operation;
+  class PollOperation;
+  class ReadOperation;
+  class TimerOperation;
+  class ProcessExitOperation;
+  class FallbackPollOperation;
+  class IoWatcherImpl;
+
+  static const unsigned RING_ENTRIES = 1024;
+  static const unsigned BUFFER_COUNT = 512;
+  static const unsigned BUFFER_SIZE = 4096;
+  static const uint16_t BUFFER_GROUP = 0;
+
+  // Declared first so that it is destroyed last:  the kernel may write to the buffers until the
+  // ring is closed.
+  std::vector<char> buffers;
+  OwnedPtr<IoUring> ring;
+
+  EpollEventManager fallback;
+  FallbackPollOperation* fallbackPoll;  // Null when not submitted.
+
+  // Operations by the user_data of their latest submission.  An operation belongs to the event
+  // manager until its last completion arrives, since the kernel may still refer to it after
+  // whoever asked for it is gone.
+  std::unordered_map<uint64_t, Operation*> operations;
+  uint64_t nextUserData;
+
+  // Submitted and not canceled operations which should keep the loop running.
+  int activeOperations;
+
+  // Buffers holding data not yet consumed.
+  unsigned buffersInUse;
+
+  // Watchers whose reads stopped because no buffers were free.
+  std::deque<IoWatcherImpl*> starvedWatchers;
+
+  std::deque<AsyncCallbackHandler*> asyncCallbacks;
+
+  // Completions taken from the ring but not yet handled.  If a handler throws, the rest are
+  // handled next time.
+  std::vector<struct io_uring_cqe> completions;
+  size_t nextCompletion;
+
+  uint64_t completionCount;
+  uint64_t callbackCount;
+  uint64_t budgetExhaustedCount;
+  uint64_t bufferShortageCount;
+  Histogram callbackTime;        // Microseconds per runLater() callback.
+  Histogram callbackQueueDepth;  // Callbacks queued at the start of each turn.
+  Histogram completionTime;      // Microseconds spent handling each completion.
+
+  struct io_uring_sqe* getSqe();
+  void submit(Operation* operation);
+  void cancel(Operation* operation);
+  void setKeepsLoopRunning(Operation* operation, bool keepsLoopRunning);
+  void dispatch(const struct io_uring_cqe& cqe);
+  void returnBuffer(uint16_t id);
+  bool handleEvent();
+};
+
+}  // namespace ekam
+
+#endif  // EKAM_HAVE_IO_URING
+
+#endif  // KENTONSCODE_OS_IOURINGEVENTMANAGER_H_
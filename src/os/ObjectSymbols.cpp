@@ -0,0 +1,360 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ObjectSymbols.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include "ByteStream.h"
+
+namespace ekam {
+
+namespace {
+
+// The parts of the ELF format we need.  Defined here rather than taken from <elf.h>, which not
+// every platform has.
+const int EI_CLASS = 4;
+const int EI_DATA = 5;
+const uint8_t ELFCLASS32 = 1;
+const uint8_t ELFCLASS64 = 2;
+const uint8_t ELFDATA2LSB = 1;
+const uint8_t ELFDATA2MSB = 2;
+
+const uint32_t SHT_SYMTAB = 2;
+const uint32_t SHT_NOBITS = 8;
+const uint32_t SHT_SYMTAB_SHNDX = 18;
+
+const uint64_t SHF_WRITE = 1;
+const uint64_t SHF_ALLOC = 2;
+const uint64_t SHF_EXECINSTR = 4;
+
+const uint16_t SHN_UNDEF = 0;
+const uint16_t SHN_LORESERVE = 0xff00;
+const uint16_t SHN_ABS = 0xfff1;
+const uint16_t SHN_COMMON = 0xfff2;
+const uint16_t SHN_XINDEX = 0xffff;
+
+const int STB_LOCAL = 0;
+const int STB_WEAK = 2;
+const int STB_GNU_UNIQUE = 10;
+
+const int STT_OBJECT = 1;
+const int STT_SECTION = 3;
+const int STT_FILE = 4;
+const int STT_COMMON = 5;
+const int STT_GNU_IFUNC = 10;
+
+class FormatError {
+public:
+  FormatError(const std::string& message) : message(message) {}
+  std::string message;
+};
+
+struct Section {
+  uint32_t name;
+  uint32_t type;
+  uint64_t flags;
+  uint64_t offset;
+  uint64_t size;
+  uint32_t link;
+  uint64_t entrySize;
+};
+
+class ElfReader {
+public:
+  ElfReader(const std::string& path) : file(path, O_RDONLY) {
+    struct stat stats;
+    file.stat(&stats);
+    fileSize = stats.st_size;
+
+    std::string ident = readAt(0, 16);
+    if (ident.compare(0, 4, "\x7f" "ELF") != 0) {
+      throw FormatError("not an ELF file");
+    }
+    is64 = ident[EI_CLASS] == ELFCLASS64;
+    if (!is64 && ident[EI_CLASS] != ELFCLASS32) {
+      throw FormatError("unknown ELF class");
+    }
+    bigEndian = ident[EI_DATA] == ELFDATA2MSB;
+    if (!bigEndian && ident[EI_DATA] != ELFDATA2LSB) {
+      throw FormatError("unknown ELF byte order");
+    }
+  }
+
+  void readSymbols(std::vector<ObjectSymbol>* symbols) {
+    readSections();
+
+    const Section* symtab = nullptr;
+    uint32_t symtabIndex = 0;
+    for (uint32_t i = 0; i < sections.size(); i++) {
+      if (sections[i].type == SHT_SYMTAB) {
+        symtab = &sections[i];
+        symtabIndex = i;
+        break;
+      }
+    }
+    if (symtab == nullptr) {
+      // Fully stripped:  nm says "no symbols".
+      return;
+    }
+
+    std::string names = readSection(section(symtab->link));
+    std::string extendedIndexes;
+    for (auto& candidate: sections) {
+      if (candidate.type == SHT_SYMTAB_SHNDX && candidate.link == symtabIndex) {
+        extendedIndexes = readSection(candidate);
+      }
+    }
+
+    size_t entrySize = is64 ? 24 : 16;
+    if (symtab->entrySize != entrySize) {
+      throw FormatError("unexpected symbol table entry size");
+    }
+    std::string table = readSection(*symtab);
+    const char* data = table.data();
+
+    // Entry zero is always the null symbol.
+    for (size_t i = 1; i < table.size() / entrySize; i++) {
+      const char* entry = data + i * entrySize;
+      uint32_t nameOffset = u32(entry);
+      uint8_t info;
+      uint16_t shortIndex;
+      ObjectSymbol symbol;
+      if (is64) {
+        info = entry[4];
+        shortIndex = u16(entry + 6);
+        symbol.value = u64(entry + 8);
+      } else {
+        symbol.value = u32(entry + 4);
+        info = entry[12];
+        shortIndex = u16(entry + 14);
+      }
+      int binding = info >> 4;
+      int type = info & 0xf;
+      if (type == STT_SECTION || type == STT_FILE) {
+        continue;
+      }
+
+      if (nameOffset >= names.size()) {
+        throw FormatError("symbol name out of range");
+      }
+      symbol.name = names.c_str() + nameOffset;
+      if (symbol.name.empty()) {
+        continue;
+      }
+
+      uint32_t index = shortIndex;
+      if (shortIndex == SHN_XINDEX) {
+        if ((i + 1) * 4 > extendedIndexes.size()) {
+          throw FormatError("missing extended section index");
+        }
+        index = u32(extendedIndexes.data() + i * 4);
+      }
+
+      symbol.type = classify(binding, type, shortIndex, index);
+      symbols->push_back(symbol);
+    }
+
+    std::stable_sort(symbols->begin(), symbols->end(),
+        [](const ObjectSymbol& a, const ObjectSymbol& b) { return a.name < b.name; });
+  }
+
+private:
+  ByteStream file;
+  bool is64;
+  bool bigEndian;
+  uint64_t fileSize;
+  std::vector<Section> sections;
+  std::string sectionNames;
+
+  std::string readAt(uint64_t offset, uint64_t size) {
+    if (offset > fileSize || size > fileSize - offset) {
+      throw FormatError("truncated");
+    }
+    std::string result(size, '\0');
+    uint64_t pos = 0;
+    while (pos < size) {
+      size_t n = WRAP_SYSCALL(pread, *file.getHandle(), &result[pos], size - pos, offset + pos);
+      if (n == 0) {
+        throw FormatError("truncated");
+      }
+      pos += n;
+    }
+    return result;
+  }
+
+  uint64_t get(const char* pos, int size) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(pos);
+    uint64_t result = 0;
+    for (int i = 0; i < size; i++) {
+      result |= static_cast<uint64_t>(bytes[bigEndian ? size - 1 - i : i]) << (i * 8);
+    }
+    return result;
+  }
+  uint16_t u16(const char* pos) { return get(pos, 2); }
+  uint32_t u32(const char* pos) { return get(pos, 4); }
+  uint64_t u64(const char* pos) { return get(pos, 8); }
+
+  void readSections() {
+    std::string header = readAt(0, is64 ? 64 : 52);
+    const char* data = header.data();
+    uint64_t sectionOffset = is64 ? u64(data + 40) : u32(data + 32);
+    uint32_t sectionHeaderSize = u16(data + (is64 ? 58 : 46));
+    uint32_t sectionCount = u16(data + (is64 ? 60 : 48));
+    uint32_t namesIndex = u16(data + (is64 ? 62 : 50));
+
+    if (sectionOffset == 0) {
+      return;
+    }
+    if (sectionHeaderSize < (is64 ? 64u : 40u)) {
+      throw FormatError("unexpected section header size");
+    }
+
+    // With too many sections for the header's 16-bit fields, the real values are in section 0.
+    Section first = parseSection(readAt(sectionOffset, sectionHeaderSize).data());
+    if (sectionCount == 0) {
+      sectionCount = first.size;
+    }
+    if (namesIndex == SHN_XINDEX) {
+      namesIndex = first.link;
+    }
+
+    std::string table = readAt(sectionOffset,
+                               static_cast<uint64_t>(sectionCount) * sectionHeaderSize);
+    for (uint32_t i = 0; i < sectionCount; i++) {
+      sections.push_back(parseSection(table.data() + i * sectionHeaderSize));
+    }
+
+    if (namesIndex != SHN_UNDEF && namesIndex < sections.size()) {
+      sectionNames = readSection(sections[namesIndex]);
+    }
+  }
+
+  Section parseSection(const char* data) {
+    Section result;
+    result.name = u32(data);
+    result.type = u32(data + 4);
+    if (is64) {
+      result.flags = u64(data + 8);
+      result.offset = u64(data + 24);
+      result.size = u64(data + 32);
+      result.link = u32(data + 40);
+      result.entrySize = u64(data + 56);
+    } else {
+      result.flags = u32(data + 8);
+      result.offset = u32(data + 16);
+      result.size = u32(data + 20);
+      result.link = u32(data + 24);
+      result.entrySize = u32(data + 36);
+    }
+    return result;
+  }
+
+  const Section& section(uint32_t index) {
+    if (index >= sections.size()) {
+      throw FormatError("section index out of range");
+    }
+    return sections[index];
+  }
+
+  std::string readSection(const Section& section) {
+    if (section.type == SHT_NOBITS) {
+      return std::string();
+    }
+    return readAt(section.offset, section.size);
+  }
+
+  std::string sectionName(const Section& section) {
+    if (section.name >= sectionNames.size()) {
+      return std::string();
+    }
+    return sectionNames.c_str() + section.name;
+  }
+
+  // Follows binutils' choice of letter.
+  char classify(int binding, int type, uint16_t shortIndex, uint32_t index) {
+    if (shortIndex == SHN_COMMON || type == STT_COMMON) {
+      return 'C';
+    }
+    if (shortIndex == SHN_UNDEF) {
+      if (binding == STB_WEAK) {
+        return type == STT_OBJECT ? 'v' : 'w';
+      }
+      return 'U';
+    }
+    if (binding == STB_GNU_UNIQUE) {
+      return 'u';
+    }
+    if (type == STT_GNU_IFUNC) {
+      return 'i';
+    }
+    if (binding == STB_WEAK) {
+      return type == STT_OBJECT ? 'V' : 'W';
+    }
+
+    char letter;
+    if (shortIndex == SHN_ABS) {
+      letter = 'A';
+    } else if (shortIndex >= SHN_LORESERVE && shortIndex != SHN_XINDEX) {
+      letter = '?';
+    } else {
+      const Section& where = section(index);
+      std::string name = sectionName(where);
+      if (where.flags & SHF_EXECINSTR) {
+        letter = 'T';
+      } else if (name.compare(0, 6, ".sdata") == 0) {
+        letter = 'G';
+      } else if (name.compare(0, 5, ".sbss") == 0) {
+        letter = 'S';
+      } else if (where.type == SHT_NOBITS && (where.flags & SHF_ALLOC)) {
+        letter = 'B';
+      } else if ((where.flags & SHF_ALLOC) && (where.flags & SHF_WRITE)) {
+        letter = 'D';
+      } else if (where.flags & SHF_ALLOC) {
+        letter = 'R';
+      } else if (name.compare(0, 6, ".debug") == 0) {
+        letter = 'N';
+      } else {
+        letter = 'n';
+      }
+    }
+
+    if (binding == STB_LOCAL && letter >= 'A' && letter <= 'Z') {
+      letter += 'a' - 'A';
+    }
+    return letter;
+  }
+};
+
+}  // namespace
+
+bool readObjectSymbols(const std::string& path, std::vector<ObjectSymbol>* symbols,
+                       std::string* error) {
+  try {
+    ElfReader reader(path);
+    reader.readSymbols(symbols);
+    return true;
+  } catch (const FormatError& e) {
+    *error = path + ": " + e.message;
+    symbols->clear();
+    return false;
+  }
+}
+
+}  // namespace ekam
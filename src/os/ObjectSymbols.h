@@ -0,0 +1,44 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KENTONSCODE_OS_OBJECTSYMBOLS_H_
+#define KENTONSCODE_OS_OBJECTSYMBOLS_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace ekam {
+
+// A symbol from an object file's symbol table, as `nm` would list it.
+struct ObjectSymbol {
+  std::string name;
+  uint64_t value;
+
+  // nm's letter for the symbol:  e.g. 'T' for a function, 'D', 'B' or 'R' for data, 'U' if
+  // undefined, 'W' or 'V' if weak.  Lower case if local.
+  char type;
+};
+
+// Reads the symbol table of an ELF file (either class, either byte order), sorted by name like
+// nm's default output.  Section and file symbols are skipped, as nm does.  Throws OsError if the
+// file can't be read; returns false, with the reason in `error`, if it isn't ELF or is damaged.
+bool readObjectSymbols(const std::string& path, std::vector<ObjectSymbol>* symbols,
+                       std::string* error);
+
+}  // namespace ekam
+
+#endif  // KENTONSCODE_OS_OBJECTSYMBOLS_H_
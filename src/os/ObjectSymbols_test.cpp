@@ -0,0 +1,189 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ObjectSymbols.h"
+#include "OsHandle.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+namespace ekam {
+namespace {
+
+#define ASSERT(EXPRESSION)                                                    \
+  if (!(EXPRESSION)) {                                                        \
+    fprintf(stderr, "%s:%d: FAILED: %s\n", __FILE__, __LINE__, #EXPRESSION);  \
+    exit(1);                                                                  \
+  }
+
+std::string makeTempDir() {
+  char pattern[] = "/tmp/ekam-test-XXXXXX";
+  ASSERT(mkdtemp(pattern) != NULL);
+  return pattern;
+}
+
+void writeFile(const std::string& path, const char* content) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  ASSERT(fd >= 0);
+  ASSERT(write(fd, content, strlen(content)) == (ssize_t)strlen(content));
+  close(fd);
+}
+
+const char SOURCE[] =
+    "extern \"C\" {\n"
+    "int globalData = 1;\n"
+    "int globalBss;\n"
+    "extern const int globalConst = 2;\n"
+    "static int localData = 3;\n"
+    "void undefinedFunction();\n"
+    "extern int weakUndefined __attribute__((weak));\n"
+    "__attribute__((weak)) void weakFunction() {}\n"
+    "static void localFunction() { undefinedFunction(); }\n"
+    "void globalFunction() { localFunction(); localData += weakUndefined; }\n"
+    "}\n"
+    "inline int inlineFunction() { return globalData; }\n"
+    "int main() { globalFunction(); return inlineFunction(); }\n";
+
+char typeOf(const std::vector<ObjectSymbol>& symbols, const std::string& name) {
+  for (auto& symbol: symbols) {
+    if (symbol.name == name) {
+      return symbol.type;
+    }
+  }
+  return '\0';
+}
+
+// Compiles SOURCE and returns the object's path, or "" if there is no compiler.
+std::string compile(const std::string& dir, const char* flags) {
+  std::string source = dir + "/symbols.c++";
+  std::string object = dir + "/symbols.o";
+  writeFile(source, SOURCE);
+  std::string command = std::string("c++ ") + flags + " -c " + source + " -o " + object +
+                        " 2>/dev/null";
+  if (system(command.c_str()) != 0) {
+    return "";
+  }
+  return object;
+}
+
+void testTypes(const std::string& dir) {
+  std::string object = compile(dir, "-O0");
+  if (object.empty()) {
+    fprintf(stderr, "No C++ compiler; skipping.\n");
+    return;
+  }
+
+  std::vector<ObjectSymbol> symbols;
+  std::string error;
+  ASSERT(readObjectSymbols(object, &symbols, &error));
+
+  ASSERT(typeOf(symbols, "globalData") == 'D');
+  ASSERT(typeOf(symbols, "globalBss") == 'B');
+  ASSERT(typeOf(symbols, "globalConst") == 'R');
+  ASSERT(typeOf(symbols, "_ZL9localData") == 'd');
+  ASSERT(typeOf(symbols, "undefinedFunction") == 'U');
+  ASSERT(typeOf(symbols, "weakUndefined") == 'w');
+  ASSERT(typeOf(symbols, "weakFunction") == 'W');
+  ASSERT(typeOf(symbols, "localFunction") == 't');
+  ASSERT(typeOf(symbols, "globalFunction") == 'T');
+  ASSERT(typeOf(symbols, "_Z14inlineFunctionv") == 'W');
+  ASSERT(typeOf(symbols, "main") == 'T');
+
+  // Same as nm, if we have it.
+  std::string listing = dir + "/symbols.nm";
+  std::string command = "LC_ALL=C nm " + object + " > " + listing + " 2>/dev/null";
+  if (system(command.c_str()) != 0) {
+    fprintf(stderr, "No nm; skipping comparison.\n");
+    return;
+  }
+  FILE* file = fopen(listing.c_str(), "r");
+  ASSERT(file != NULL);
+  char line[1024];
+  size_t count = 0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    char type;
+    char name[1024];
+    ASSERT(sscanf(line + 17, "%c %1023s", &type, name) == 2);
+    ASSERT(count < symbols.size());
+    ASSERT(symbols[count].name == name);
+    ASSERT(symbols[count].type == type);
+    ++count;
+  }
+  fclose(file);
+  ASSERT(count == symbols.size());
+}
+
+// Lots of sections need the extended section index table.
+void testManySections(const std::string& dir) {
+  std::string source = dir + "/many.s";
+  std::string object = dir + "/many.o";
+  std::string code;
+  for (int i = 0; i < 70000; i++) {
+    std::string name = "d" + std::to_string(i);
+    code += ".section .data." + name + ",\"aw\"\n.globl " + name + "\n" + name + ": .byte 0\n";
+  }
+  writeFile(source, code.c_str());
+  std::string command = "c++ -c " + source + " -o " + object + " 2>/dev/null";
+  if (system(command.c_str()) != 0) {
+    fprintf(stderr, "Can't assemble many sections; skipping.\n");
+    return;
+  }
+
+  std::vector<ObjectSymbol> symbols;
+  std::string error;
+  ASSERT(readObjectSymbols(object, &symbols, &error));
+  ASSERT(symbols.size() == 70000);
+  ASSERT(typeOf(symbols, "d0") == 'D');
+  ASSERT(typeOf(symbols, "d69999") == 'D');
+}
+
+void testErrors(const std::string& dir) {
+  std::string notElf = dir + "/not-elf.o";
+  writeFile(notElf, "!<arch>\nnot an object file\n");
+
+  std::vector<ObjectSymbol> symbols;
+  std::string error;
+  ASSERT(!readObjectSymbols(notElf, &symbols, &error));
+  ASSERT(error.find("not an ELF file") != std::string::npos);
+
+  std::string truncated = dir + "/truncated.o";
+  writeFile(truncated, "\x7f" "ELF\x02\x01\x01");
+  ASSERT(!readObjectSymbols(truncated, &symbols, &error));
+
+  bool threw = false;
+  try {
+    readObjectSymbols(dir + "/missing.o", &symbols, &error);
+  } catch (const OsError& e) {
+    threw = true;
+  }
+  ASSERT(threw);
+}
+
+}  // namespace
+}  // namespace ekam
+
+int main(int argc, char* argv[]) {
+  std::string dir = ekam::makeTempDir();
+  ekam::testTypes(dir);
+  ekam::testManySections(dir);
+  ekam::testErrors(dir);
+  std::string command = "rm -rf " + dir;
+  return system(command.c_str());
+}
@@ -0,0 +1,114 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Pidfd.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "base/Debug.h"
+
+namespace ekam {
+
+namespace {
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+// P_PIDFD, which older headers lack.
+const int ID_TYPE_PIDFD = 3;
+
+int pidfdOpen(pid_t pid) {
+  return syscall(SYS_pidfd_open, pid, 0);
+}
+
+int openOrThrow(pid_t pid) {
+  int fd = pidfdOpen(pid);
+  if (fd < 0) {
+    throw OsError("pid " + toString(pid), "pidfd_open", errno);
+  }
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  return fd;
+}
+
+// waitid() with the rusage argument that the glibc wrapper leaves out.
+int waitidWithUsage(int idType, int id, siginfo_t* info, int options, struct rusage* usage) {
+  return syscall(SYS_waitid, idType, id, info, options, usage);
+}
+
+ProcessExitCode decodeSiginfo(const siginfo_t& info) {
+  switch (info.si_code) {
+    case CLD_EXITED:
+      return ProcessExitCode(info.si_status);
+    case CLD_KILLED:
+    case CLD_DUMPED:
+      return ProcessExitCode(ProcessExitCode::SIGNALED, info.si_status);
+    default:
+      DEBUG_ERROR << "Didn't understand process exit status.";
+      return ProcessExitCode(-1);
+  }
+}
+
+}  // namespace
+
+bool Pidfd::isSupported() {
+  static int supported = -1;
+  if (supported < 0) {
+    int fd = pidfdOpen(getpid());
+    supported = fd >= 0;
+    if (fd >= 0) {
+      close(fd);
+    } else {
+      DEBUG_INFO << "pidfd_open: " << strerror(errno) << "; watching processes with SIGCHLD.";
+    }
+  }
+  return supported;
+}
+
+Pidfd::Pidfd(pid_t pid)
+    : pid(pid), handle("pidfd(" + toString(pid) + ")", openOrThrow(pid)) {}
+
+Pidfd::~Pidfd() {}
+
+bool Pidfd::tryReap(ProcessExitCode* exitCode) {
+  siginfo_t info;
+  memset(&info, 0, sizeof(info));
+  struct rusage usage;
+  if (waitidWithUsage(ID_TYPE_PIDFD, handle.get(), &info, WEXITED | WNOHANG, &usage) < 0) {
+    DEBUG_ERROR << "waitid(" << pid << "): " << strerror(errno);
+    *exitCode = ProcessExitCode(-1);
+    return true;
+  }
+  if (info.si_pid == 0) {
+    // Not actually finished.
+    return false;
+  }
+
+  DEBUG_INFO << "Process " << pid << (info.si_code == CLD_EXITED ? " exited with status: "
+                                                                   : " killed by signal: ")
+             << info.si_status;
+  *exitCode = decodeSiginfo(info);
+  exitCode->setResourceUsage(usage);
+  return true;
+}
+
+}  // namespace ekam
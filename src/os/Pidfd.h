@@ -0,0 +1,50 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KENTONSCODE_OS_PIDFD_H_
+#define KENTONSCODE_OS_PIDFD_H_
+
+#include <sys/types.h>
+
+#include "EventManager.h"
+#include "OsHandle.h"
+
+namespace ekam {
+
+// A process file descriptor (Linux 5.3 and later).  It becomes readable when the process exits,
+// and lets exactly that process be reaped, without involving SIGCHLD.
+class Pidfd {
+public:
+  // Whether the kernel supports pidfds.  Checked once.
+  static bool isSupported();
+
+  explicit Pidfd(pid_t pid);
+  ~Pidfd();
+
+  OsHandle* getHandle() { return &handle; }
+
+  // Reaps the process if it has exited, filling in *exitCode, including resource usage.  Returns
+  // false if the process is still running.  If waiting fails, the exit code is -1.
+  bool tryReap(ProcessExitCode* exitCode);
+
+private:
+  pid_t pid;
+  OsHandle handle;
+};
+
+}  // namespace ekam
+
+#endif  // KENTONSCODE_OS_PIDFD_H_
@@ -0,0 +1,76 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ResourceUsage.h"
+
+#include <stdio.h>
+#include <sys/resource.h>
+
+namespace ekam {
+
+namespace {
+
+uint64_t toMicros(const struct timeval& time) {
+  return static_cast<uint64_t>(time.tv_sec) * 1000000 + time.tv_usec;
+}
+
+}  // namespace
+
+ResourceUsage::ResourceUsage()
+    : processCount(0), userMicros(0), systemMicros(0), maxRssKilobytes(0), blockInputs(0),
+      blockOutputs(0), voluntaryContextSwitches(0), involuntaryContextSwitches(0) {}
+
+void ResourceUsage::add(const struct rusage& usage) {
+  ++processCount;
+  userMicros += toMicros(usage.ru_utime);
+  systemMicros += toMicros(usage.ru_stime);
+  // Linux reports ru_maxrss in kilobytes.
+  if (static_cast<uint64_t>(usage.ru_maxrss) > maxRssKilobytes) {
+    maxRssKilobytes = usage.ru_maxrss;
+  }
+  blockInputs += usage.ru_inblock;
+  blockOutputs += usage.ru_oublock;
+  voluntaryContextSwitches += usage.ru_nvcsw;
+  involuntaryContextSwitches += usage.ru_nivcsw;
+}
+
+void ResourceUsage::add(const ResourceUsage& other) {
+  processCount += other.processCount;
+  userMicros += other.userMicros;
+  systemMicros += other.systemMicros;
+  if (other.maxRssKilobytes > maxRssKilobytes) {
+    maxRssKilobytes = other.maxRssKilobytes;
+  }
+  blockInputs += other.blockInputs;
+  blockOutputs += other.blockOutputs;
+  voluntaryContextSwitches += other.voluntaryContextSwitches;
+  involuntaryContextSwitches += other.involuntaryContextSwitches;
+}
+
+std::string ResourceUsage::toString() const {
+  char buffer[256];
+  snprintf(buffer, sizeof(buffer),
+           "%.2fs user %.2fs sys, %llu MB max RSS, %llu blocks in %llu out, "
+           "%llu+%llu context switches",
+           userMicros / 1e6, systemMicros / 1e6,
+           (unsigned long long)(maxRssKilobytes / 1024),
+           (unsigned long long)blockInputs, (unsigned long long)blockOutputs,
+           (unsigned long long)voluntaryContextSwitches,
+           (unsigned long long)involuntaryContextSwitches);
+  return buffer;
+}
+
+}  // namespace ekam
@@ -0,0 +1,52 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KENTONSCODE_OS_RESOURCEUSAGE_H_
+#define KENTONSCODE_OS_RESOURCEUSAGE_H_
+
+#include <stdint.h>
+#include <string>
+
+struct rusage;
+
+namespace ekam {
+
+// Resources used by a set of processes, e.g. all the subprocesses of one action.  Times and
+// counts are summed; memory is the peak of any single process.
+struct ResourceUsage {
+  uint32_t processCount;
+  uint64_t userMicros;
+  uint64_t systemMicros;
+  uint64_t maxRssKilobytes;
+  uint64_t blockInputs;
+  uint64_t blockOutputs;
+  uint64_t voluntaryContextSwitches;
+  uint64_t involuntaryContextSwitches;
+
+  ResourceUsage();
+
+  void add(const struct rusage& usage);
+  void add(const ResourceUsage& other);
+
+  uint64_t cpuMicros() const { return userMicros + systemMicros; }
+
+  // E.g. "1.23s user 0.45s sys, 120 MB max RSS, 8 blocks in 96 out, 40+12 context switches".
+  std::string toString() const;
+};
+
+}  // namespace ekam
+
+#endif  // KENTONSCODE_OS_RESOURCEUSAGE_H_
@@ -19,21 +19,35 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <signal.h>
+#include <spawn.h>
 #include <unistd.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "Cgroup.h"
 #include "OsHandle.h"
 #include "base/Debug.h"
 
+#if defined(__linux__) && !defined(POSIX_SPAWN_SETCGROUP)
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/sched.h>
+#include <sys/syscall.h>
+#if defined(CLONE_INTO_CGROUP) && defined(SYS_clone3)
+#define EKAM_HAVE_CLONE_INTO_CGROUP 1
+#endif
+#endif
+
 namespace ekam {
 
-Subprocess::Subprocess() : doPathLookup(false), pid(-1) {}
+Subprocess::Subprocess() : doPathLookup(false), cgroup(NULL), pid(-1) {}
 
 Subprocess::~Subprocess() {
-  if (pid >= 0) {
+  if (pid >= 0 && cgroup != NULL && cgroup->isFrozen()) {
+    DEBUG_INFO << "Leaving pid frozen in " << cgroup->getPath() << ": " << pid;
+  } else if (pid >= 0) {
     DEBUG_INFO << "Killing pid: " << pid;
     // Kill entire progress group.
     kill(-pid, SIGKILL);
@@ -88,85 +102,322 @@ OwnedPtr<ByteStream> Subprocess::captureStdoutAndStderr() {
   return stdoutAndStderrPipe->releaseReadEnd();
 }
 
-Promise<ProcessExitCode> Subprocess::start(EventManager* eventManager) {
-  pid = fork();
+void Subprocess::setEnvironmentVariable(const std::string& name, const std::string& value) {
+  environment.push_back(name + "=" + value);
+}
 
-  if (pid < 0) {
-    throw OsError("", "fork", errno);
-  } else if (pid == 0) {
-    // In child.
+int Subprocess::spawn() {
+  // Everything the child needs is prepared here, in the parent:  posix_spawn() runs the child on
+  // our memory (clone(CLONE_VM | CLONE_VFORK) in glibc) until it execs, so unlike fork() it does
+  // not have to copy our page tables, which get large after a long session in continuous mode.
+  std::vector<char*> argv;
+  std::string command;
 
-    std::vector<char*> argv;
-    std::string command;
+  for (unsigned int i = 0; i < args.size(); i++) {
+    argv.push_back(const_cast<char*>(args[i].c_str()));
 
-    for (unsigned int i = 0; i < args.size(); i++) {
-      argv.push_back(strdup(args[i].c_str()));
+    if (i > 0) command.push_back(' ');
+    command.append(args[i]);
+  }
+
+  argv.push_back(NULL);
 
-      if (i > 0) command.push_back(' ');
-      command.append(args[i]);
+  char** envp = environ;
+  std::vector<char*> mergedEnvironment;
+  if (!environment.empty()) {
+    for (char** variable = environ; *variable != NULL; ++variable) {
+      bool overridden = false;
+      for (auto& setting: environment) {
+        std::string::size_type nameSize = setting.find_first_of('=') + 1;
+        if (strncmp(*variable, setting.c_str(), nameSize) == 0) {
+          overridden = true;
+          break;
+        }
+      }
+      if (!overridden) {
+        mergedEnvironment.push_back(*variable);
+      }
+    }
+    for (auto& setting: environment) {
+      mergedEnvironment.push_back(const_cast<char*>(setting.c_str()));
     }
+    mergedEnvironment.push_back(NULL);
+    envp = &mergedEnvironment[0];
+  }
 
-    argv.push_back(NULL);
+  DEBUG_INFO << "exec: " << command;
 
-    DEBUG_INFO << "exec: " << command;
+  // (descriptor, target) pairs for the child to dup2(), in order.
+  std::vector<std::pair<int, int> > redirections;
+  if (stdinPipe != NULL) {
+    redirections.push_back(std::make_pair(stdinPipe->getReadFd(), STDIN_FILENO));
+  }
+  if (stdoutPipe != NULL) {
+    redirections.push_back(std::make_pair(stdoutPipe->getWriteFd(), STDOUT_FILENO));
+  }
+  if (stderrPipe != NULL) {
+    redirections.push_back(std::make_pair(stderrPipe->getWriteFd(), STDERR_FILENO));
+  }
+  if (stdoutAndStderrPipe != NULL) {
+    redirections.push_back(std::make_pair(stdoutAndStderrPipe->getWriteFd(), STDOUT_FILENO));
+    redirections.push_back(std::make_pair(STDOUT_FILENO, STDERR_FILENO));
+  }
+  for (unsigned int i = 0; i < inputFds.size(); i++) {
+    redirections.push_back(std::make_pair(inputFdPipes.get(i)->getReadFd(), inputFds[i]));
+  }
+  for (unsigned int i = 0; i < outputFds.size(); i++) {
+    redirections.push_back(std::make_pair(outputFdPipes.get(i)->getWriteFd(), outputFds[i]));
+  }
 
-    if (stdinPipe != NULL) {
-      stdinPipe->attachReadEndForExec(STDIN_FILENO);
-    }
-    if (stdoutPipe != NULL) {
-      stdoutPipe->attachWriteEndForExec(STDOUT_FILENO);
-    }
-    if (stderrPipe != NULL) {
-      stderrPipe->attachWriteEndForExec(STDERR_FILENO);
-    }
-    if (stdoutAndStderrPipe != NULL) {
-      stdoutAndStderrPipe->attachWriteEndForExec(STDOUT_FILENO);
-      dup2(STDOUT_FILENO, STDERR_FILENO);
+  int error;
+#if !defined(POSIX_SPAWN_SETCGROUP) && EKAM_HAVE_CLONE_INTO_CGROUP
+  if (cgroup != NULL) {
+    error = cloneIntoCgroup(&argv[0], envp, redirections);
+    if (error != 0) {
+      pid = -1;
     }
+    return error;
+  }
+#endif
 
-    // Start a new progress group so that we can kill it all at once.
-    // TODO(someday): This means if you ctrl+C ekam itself, the SIGINT is not distributed to jobs
-    //   running under it. Can we fix that? Another thing we could do is put the job into a PID
-    //   namespace but that's a lot more work and requires user namespaces and only works on Linux.
-    //   Probably what we have to do is handle sigint ourselves and redistribute it to all
-    //   children, bleh.
-    setpgid(0, 0);
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attributes;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawnattr_init(&attributes);
 
-    if (doPathLookup) {
-      execvp(executableName.c_str(), &argv[0]);
-    } else {
-      execv(executableName.c_str(), &argv[0]);
-    }
+  for (auto& redirection: redirections) {
+    posix_spawn_file_actions_adddup2(&actions, redirection.first, redirection.second);
+  }
 
-    perror("exec");
-    exit(1);
+  // Start a new progress group so that we can kill it all at once.  The child joins it before
+  // exec, and posix_spawn() doesn't return until then, so we can't end up killing the child
+  // before it is in the group -- which would leave it running while we block in waitpid().
+  // TODO(someday): This means if you ctrl+C ekam itself, the SIGINT is not distributed to jobs
+  //   running under it. Can we fix that? Another thing we could do is put the job into a PID
+  //   namespace but that's a lot more work and requires user namespaces and only works on Linux.
+  //   Probably what we have to do is handle sigint ourselves and redistribute it to all
+  //   children, bleh.
+  short flags = POSIX_SPAWN_SETPGROUP;
+  posix_spawnattr_setpgroup(&attributes, 0);
+
+  // The event loop blocks the signals it reads through signalfd, and the child would inherit
+  // that.  Start it with nothing blocked and the default dispositions.
+  sigset_t signals;
+  sigemptyset(&signals);
+  posix_spawnattr_setsigmask(&attributes, &signals);
+  sigaddset(&signals, SIGUSR1);
+  sigaddset(&signals, SIGCHLD);
+  posix_spawnattr_setsigdefault(&attributes, &signals);
+  flags |= POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+
+#ifdef POSIX_SPAWN_SETCGROUP
+  if (cgroup != NULL) {
+    flags |= POSIX_SPAWN_SETCGROUP;
+    posix_spawnattr_setcgroup_np(&attributes, cgroup->getDirectoryFd());
+  }
+#endif
+
+  posix_spawnattr_setflags(&attributes, flags);
+
+  if (doPathLookup) {
+    error = posix_spawnp(&pid, executableName.c_str(), &actions, &attributes,
+                         &argv[0], envp);
   } else {
-    if (stdoutPipe != NULL) {
-      stdoutPipe.clear();
+    error = posix_spawn(&pid, executableName.c_str(), &actions, &attributes,
+                        &argv[0], envp);
+  }
+
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attributes);
+
+  if (error != 0) {
+    pid = -1;
+  }
+  return error;
+}
+
+#if EKAM_HAVE_CLONE_INTO_CGROUP
+
+namespace {
+
+void exitWithErrno(int errorFd) {
+  int error = errno;
+  ssize_t n = write(errorFd, &error, sizeof(error));
+  (void)n;
+  _exit(127);
+}
+
+// Runs in the child of clone3(), which has a copy of our memory but none of our other threads,
+// so only async-signal-safe calls are allowed.  Does what spawn() asks of posix_spawn().
+void execChild(char** argv, char** envp, const char* executableName, bool doPathLookup,
+               const std::vector<std::pair<int, int> >& redirections, int errorFd) {
+  for (auto& redirection: redirections) {
+    if (redirection.first == redirection.second) {
+      // dup2() would do nothing; the descriptor just has to survive exec.
+      if (fcntl(redirection.first, F_SETFD, 0) < 0) {
+        exitWithErrno(errorFd);
+      }
+    } else if (dup2(redirection.first, redirection.second) < 0) {
+      exitWithErrno(errorFd);
     }
-    if (stdinPipe != NULL) {
-      stdinPipe.clear();
+  }
+
+  if (setpgid(0, 0) < 0) {
+    exitWithErrno(errorFd);
+  }
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = SIG_DFL;
+  sigaction(SIGUSR1, &action, NULL);
+  sigaction(SIGCHLD, &action, NULL);
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigprocmask(SIG_SETMASK, &signals, NULL);
+
+  if (doPathLookup) {
+    execvpe(executableName, argv, envp);
+  } else {
+    execve(executableName, argv, envp);
+  }
+  exitWithErrno(errorFd);
+}
+
+}  // namespace
+
+int Subprocess::cloneIntoCgroup(char** argv, char** envp,
+                                const std::vector<std::pair<int, int> >& redirections) {
+  // glibc's posix_spawn() only learned to start a child in another cgroup in 2.41.  Before that,
+  // use clone3() to create the child in the cgroup, so that nothing it does escapes the cgroup's
+  // limits.  Unlike posix_spawn(), this copies our page tables, like fork().
+  int errorPipe[2];
+  if (pipe2(errorPipe, O_CLOEXEC) < 0) {
+    return errno;
+  }
+
+  struct clone_args args;
+  memset(&args, 0, sizeof(args));
+  args.flags = CLONE_INTO_CGROUP;
+  args.exit_signal = SIGCHLD;
+  args.cgroup = cgroup->getDirectoryFd();
+
+  long result = syscall(SYS_clone3, &args, sizeof(args));
+  if (result == 0) {
+    execChild(argv, envp, executableName.c_str(), doPathLookup, redirections, errorPipe[1]);
+  }
+
+  int error = 0;
+  close(errorPipe[1]);
+  if (result < 0) {
+    error = errno;
+  } else {
+    pid = result;
+
+    // The write end is close-on-exec, so this returns nothing once the child has exec'd, or the
+    // errno that stopped it.  Like posix_spawn(), don't return until then.
+    int childError;
+    ssize_t n;
+    do {
+      n = read(errorPipe[0], &childError, sizeof(childError));
+    } while (n < 0 && errno == EINTR);
+    if (n == sizeof(childError)) {
+      error = childError;
+      int status;
+      waitpid(pid, &status, 0);
     }
+  }
+  close(errorPipe[0]);
+  return error;
+}
+
+#endif  // EKAM_HAVE_CLONE_INTO_CGROUP
+
+bool Subprocess::canStartInCgroup() {
+#if defined(POSIX_SPAWN_SETCGROUP)
+  return true;
+#elif EKAM_HAVE_CLONE_INTO_CGROUP
+  // Ask the kernel to start a child in a cgroup which isn't one.  If it knows CLONE_INTO_CGROUP,
+  // it complains about the descriptor, without creating a process.
+  struct clone_args args;
+  memset(&args, 0, sizeof(args));
+  args.flags = CLONE_INTO_CGROUP;
+  args.exit_signal = SIGCHLD;
+  args.cgroup = INT_MAX;
+  long result = syscall(SYS_clone3, &args, sizeof(args));
+  if (result == 0) {
+    _exit(0);
+  } else if (result > 0) {
+    int status;
+    waitpid(result, &status, 0);
+  }
+  return result < 0 && errno == EBADF;
+#else
+  return false;
+#endif
+}
+
+OwnedPtr<ByteStream> Subprocess::captureInputFd(int fd) {
+  auto pipe = newOwned<Pipe>();
+  OwnedPtr<ByteStream> result = pipe->releaseWriteEnd();
+  inputFds.push_back(fd);
+  inputFdPipes.add(pipe.release());
+  return result.release();
+}
+
+OwnedPtr<ByteStream> Subprocess::captureOutputFd(int fd) {
+  auto pipe = newOwned<Pipe>();
+  OwnedPtr<ByteStream> result = pipe->releaseReadEnd();
+  outputFds.push_back(fd);
+  outputFdPipes.add(pipe.release());
+  return result.release();
+}
+
+Promise<ProcessExitCode> Subprocess::start(EventManager* eventManager) {
+  int error = spawn();
+
+  if (error != 0) {
+    // With fork() this was reported by the child, on its stderr, so report it the same way:  the
+    // action fails and its log says why.
+    std::string message = std::string("exec: ") + strerror(error) + "\n";
     if (stderrPipe != NULL) {
-      stderrPipe.clear();
-    }
-    if (stdoutAndStderrPipe != NULL) {
-      stdoutAndStderrPipe.clear();
+      stderrPipe->releaseWriteEnd()->writeAll(message.data(), message.size());
+    } else if (stdoutAndStderrPipe != NULL) {
+      stdoutAndStderrPipe->releaseWriteEnd()->writeAll(message.data(), message.size());
+    } else {
+      DEBUG_ERROR << executableName << ": exec: " << strerror(error);
     }
+  }
+
+  stdinPipe.clear();
+  stdoutPipe.clear();
+  stderrPipe.clear();
+  stdoutAndStderrPipe.clear();
+  inputFdPipes.clear();
+  outputFdPipes.clear();
+
+  if (error != 0) {
+    return newFulfilledPromise(ProcessExitCode(1));
+  }
+
+  return eventManager->when(eventManager->onProcessExit(pid))(
+    [this](ProcessExitCode exitCode) -> ProcessExitCode {
+      pid = -1;
+      return exitCode;
+    });
+}
+
+void Subprocess::startDetached() {
+  int error = spawn();
+
+  stdinPipe.clear();
+  stdoutPipe.clear();
+  stderrPipe.clear();
+  stdoutAndStderrPipe.clear();
+  inputFdPipes.clear();
+  outputFdPipes.clear();
 
-    // Set the child's process group ID. The child also does this to itself (see above), but we
-    // need to do it in the parent as well to prevent a race condition in which we end up killing
-    // the child before it manages to call setpgid(). If that happens, then the child will keep
-    // going and the parent process will end up blockend on waitpid(). But the child process will
-    // almost certainly make an RPC to the parent process and wait for a reply, leading to
-    // deadlock.
-    setpgid(pid, 0);
-
-    return eventManager->when(eventManager->onProcessExit(pid))(
-      [this](ProcessExitCode exitCode) -> ProcessExitCode {
-        pid = -1;
-        return exitCode;
-      });
+  if (error != 0) {
+    throw OsError(executableName, "exec", error);
   }
 }
 
@@ -18,6 +18,7 @@
 #define KENTONSCODE_OS_SUBPROCESS_H_
 
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "base/OwnedPtr.h"
@@ -27,6 +28,8 @@
 
 namespace ekam {
 
+class Cgroup;
+
 class Subprocess {
 public:
   Subprocess();
@@ -40,15 +43,43 @@ public:
   OwnedPtr<ByteStream> captureStderr();
   OwnedPtr<ByteStream> captureStdoutAndStderr();
 
+  // Connect a pipe to some other file descriptor in the child, e.g. for intercept.so, which
+  // talks to Ekam on descriptors 3 and 4.  captureInputFd() returns the end we write to;
+  // captureOutputFd() the end we read from.
+  OwnedPtr<ByteStream> captureInputFd(int fd);
+  OwnedPtr<ByteStream> captureOutputFd(int fd);
+
+  // Start the process in the given cgroup, which must outlive the Subprocess.  If the cgroup is
+  // frozen when the Subprocess is destroyed, the process is left for the cgroup's owner to deal
+  // with rather than killed.  Only use this if canStartInCgroup().
+  void setCgroup(Cgroup* cgroup) { this->cgroup = cgroup; }
+
+  // Whether the C library or kernel can start processes directly in a cgroup.  Without that,
+  // anything the process forked before being moved would escape the cgroup.
+  static bool canStartInCgroup();
+
+  // Set an environment variable for the child, in addition to those Ekam was started with.
+  void setEnvironmentVariable(const std::string& name, const std::string& value);
+
   Promise<ProcessExitCode> start(EventManager* eventManager);
 
+  // Like start(), but nothing waits for the process to exit, so it doesn't keep the event loop
+  // running.  For long-lived helpers:  the process is killed when the Subprocess is destroyed.
+  // Throws OsError if the process can't be started.
+  void startDetached();
+
 private:
   class CallbackWrapper;
 
+  int spawn();
+  int cloneIntoCgroup(char** argv, char** envp,
+                      const std::vector<std::pair<int, int> >& redirections);
+
   std::string executableName;
   bool doPathLookup;
 
   std::vector<std::string> args;
+  std::vector<std::string> environment;  // "NAME=value"
   OwnedPtrVector<File::DiskRef> diskRefs;
 
   OwnedPtr<Pipe> stdinPipe;
@@ -56,6 +87,13 @@ private:
   OwnedPtr<Pipe> stderrPipe;
   OwnedPtr<Pipe> stdoutAndStderrPipe;
 
+  std::vector<int> inputFds;
+  OwnedPtrVector<Pipe> inputFdPipes;
+  std::vector<int> outputFds;
+  OwnedPtrVector<Pipe> outputFdPipes;
+
+  Cgroup* cgroup;
+
   pid_t pid;
 };
 
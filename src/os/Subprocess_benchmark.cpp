@@ -0,0 +1,141 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures how fast subprocesses can be started as the parent grows.  Each run starts /bin/true
+// repeatedly, once through Subprocess (posix_spawn()) and once with fork() and exec() -- the old
+// implementation -- after the parent has allocated and touched the given amount of memory.
+// fork() has to copy the parent's page tables, so it slows down as the parent grows.
+//
+// usage:  Subprocess_benchmark [-n <spawns per run>] [-m <max parent size in MB>]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <vector>
+
+#include "EpollEventManager.h"
+#include "Subprocess.h"
+
+namespace ekam {
+namespace {
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+long residentMegabytes() {
+  long pages = 0;
+  FILE* file = fopen("/proc/self/statm", "r");
+  if (file != NULL) {
+    if (fscanf(file, "%*s %ld", &pages) != 1) {
+      pages = 0;
+    }
+    fclose(file);
+  }
+  return pages * sysconf(_SC_PAGESIZE) / (1 << 20);
+}
+
+double spawnWithSubprocess(int count) {
+  EpollEventManager eventManager;
+  double start = now();
+  for (int i = 0; i < count; i++) {
+    Subprocess subprocess;
+    subprocess.addArgument("/bin/true");
+    auto op = eventManager.when(subprocess.start(&eventManager))(
+      [](ProcessExitCode exitCode) {
+        if (exitCode.wasSignaled() || exitCode.getExitCode() != 0) {
+          fprintf(stderr, "child failed\n");
+        }
+      });
+    eventManager.loop();
+  }
+  return count / (now() - start);
+}
+
+double spawnWithFork(int count) {
+  char* argv[] = { const_cast<char*>("/bin/true"), NULL };
+  double start = now();
+  for (int i = 0; i < count; i++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      exit(1);
+    } else if (pid == 0) {
+      setpgid(0, 0);
+      execv(argv[0], argv);
+      _exit(1);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+  }
+  return count / (now() - start);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int count = 500;
+  int maxMegabytes = 2048;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:m:")) != -1) {
+    switch (opt) {
+      case 'n':
+        count = atoi(optarg);
+        break;
+      case 'm':
+        maxMegabytes = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n <spawns per run>] [-m <max parent size in MB>]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  printf("%d spawns per run\n", count);
+  printf("%10s %16s %16s\n", "parent RSS", "posix_spawn/s", "fork+exec/s");
+
+  std::vector<char*> ballast;
+  int allocated = 0;
+  for (int megabytes = 0; megabytes <= maxMegabytes;
+       megabytes = megabytes == 0 ? 256 : megabytes * 2) {
+    for (; allocated < megabytes; allocated += 64) {
+      char* block = new char[64 << 20];
+      memset(block, 1, 64 << 20);
+      ballast.push_back(block);
+    }
+
+    double spawnRate = spawnWithSubprocess(count);
+    double forkRate = spawnWithFork(count);
+    printf("%7ld MB %16.0f %16.0f\n", residentMegabytes(), spawnRate, forkRate);
+  }
+
+  for (char* block: ballast) {
+    delete[] block;
+  }
+  return 0;
+}
+
+}  // namespace ekam
+
+int main(int argc, char* argv[]) {
+  return ekam::main(argc, argv);
+}
@@ -0,0 +1,102 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Subprocess.h"
+#include "EpollEventManager.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+namespace ekam {
+namespace {
+
+#define ASSERT(EXPRESSION)                                                    \
+  if (!(EXPRESSION)) {                                                        \
+    fprintf(stderr, "%s:%d: FAILED: %s\n", __FILE__, __LINE__, #EXPRESSION);  \
+    exit(1);                                                                  \
+  }
+
+// Reads everything from the stream into `text`.
+class Slurper {
+public:
+  Slurper(EventManager* eventManager, OwnedPtr<ByteStream> stream)
+      : eventManager(eventManager), stream(stream.release()) {
+    asyncOp = readMore();
+  }
+
+  std::string text;
+
+private:
+  EventManager* eventManager;
+  OwnedPtr<ByteStream> stream;
+  char buffer[256];
+  Promise<void> asyncOp;
+
+  Promise<void> readMore() {
+    return eventManager->when(stream->readAsync(eventManager, buffer, sizeof(buffer)))(
+      [this](size_t size) -> Promise<void> {
+        if (size == 0) {
+          return newFulfilledPromise();
+        }
+        text.append(buffer, size);
+        return readMore();
+      });
+  }
+};
+
+// The value of a "Name:  value" line in /proc/<pid>/status.
+std::string statusField(const std::string& status, const std::string& name) {
+  std::string::size_type pos = status.find("\n" + name + ":");
+  ASSERT(pos != std::string::npos);
+  pos = status.find_first_not_of(" \t", pos + name.size() + 2);
+  return status.substr(pos, status.find('\n', pos) - pos);
+}
+
+void testSignalsUnblocked() {
+  EpollEventManager eventManager;
+
+  // Blocks SIGUSR1 in this process, as ekam does for its stats dump.  SIGCHLD is blocked already.
+  Promise<void> signaled = eventManager.onSignal(SIGUSR1);
+  sigset_t blocked;
+  sigprocmask(SIG_BLOCK, NULL, &blocked);
+  ASSERT(sigismember(&blocked, SIGUSR1));
+
+  Subprocess subprocess;
+  subprocess.addArgument("cat");
+  subprocess.addArgument("/proc/self/status");
+  Slurper output(&eventManager, subprocess.captureStdout());
+
+  int exitCode = -1;
+  Promise<void> exited = eventManager.when(subprocess.start(&eventManager))(
+    [&](ProcessExitCode code) { exitCode = code.getExitCode(); });
+
+  // The loop would otherwise wait for SIGUSR1 forever.
+  signaled.release();
+  eventManager.loop();
+
+  ASSERT(exitCode == 0);
+  ASSERT(statusField(output.text, "SigBlk") == "0000000000000000");
+}
+
+}  // namespace
+}  // namespace ekam
+
+int main(int argc, char* argv[]) {
+  ekam::testSignalsUnblocked();
+  return 0;
+}
@@ -0,0 +1,467 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "TreeScanner.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
+
+#include "base/IgnoreRules.h"
+
+namespace ekam {
+
+namespace {
+
+struct PendingDirectory {
+  TreeScanner::Entry* entry;
+  std::string path;
+  std::string relativePath;  // From the root of the scan; empty for the root itself.
+  bool claimed;              // Already known to be the place to list it.
+};
+
+bool compareByName(const TreeScanner::Entry& a, const TreeScanner::Entry& b) {
+  return a.name < b.name;
+}
+
+// Orders paths component by component, so that everything under "a" comes before "a-b", as in a
+// sorted depth-first walk.
+bool isEarlierPath(const std::string& a, const std::string& b) {
+  return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end(),
+      [](char x, char y) {
+        return (x == '/' ? 0 : static_cast<unsigned char>(x)) <
+               (y == '/' ? 0 : static_cast<unsigned char>(y));
+      });
+}
+
+bool isEarlierPlace(const PendingDirectory& a, const PendingDirectory& b) {
+  return isEarlierPath(a.relativePath, b.relativePath);
+}
+
+std::string childPath(const std::string& relativePath, const std::string& name) {
+  return relativePath.empty() ? name : relativePath + "/" + name;
+}
+
+// Whether `ancestor` is a proper prefix of `path`, both relative to the root of the scan.
+bool isAncestor(const std::string& ancestor, const std::string& path) {
+  return ancestor.empty() ||
+      (path.size() > ancestor.size() && path.compare(0, ancestor.size(), ancestor) == 0 &&
+       path[ancestor.size()] == '/');
+}
+
+}  // namespace
+
+// Shared state for one scan.
+class TreeScanner::Work {
+public:
+  explicit Work(const IgnoreRules* ignoreRules)
+      : ignoreRules(ignoreRules), activeCount(0), directoryCount(0), entryCount(0),
+        ignoredCount(0), loopCount(0), pass(0) {}
+
+  void add(Entry* entry, const std::string& path) {
+    queue.push_back(PendingDirectory { entry, path, std::string(), false });
+  }
+
+  // Lists everything queued, on as many threads as call it.  Directories reached through
+  // symlinks are set aside for claimSymlinked() rather than listed.
+  void run() {
+    std::vector<PendingDirectory> subdirectories;
+    std::vector<PendingDirectory> symlinked;
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true) {
+      while (queue.empty() && activeCount > 0) {
+        condition.wait(lock);
+      }
+      if (queue.empty()) {
+        // Nothing queued and nobody working who could add more:  we're done.
+        condition.notify_all();
+        return;
+      }
+
+      PendingDirectory current = queue.front();
+      queue.pop_front();
+      ++activeCount;
+      lock.unlock();
+
+      subdirectories.clear();
+      symlinked.clear();
+      int ignored = listDirectory(current, &subdirectories, &symlinked);
+
+      lock.lock();
+      --activeCount;
+      ++directoryCount;
+      ignoredCount += ignored;
+      entryCount += current.entry->children.size();
+      // Depth-first tends to keep directory handles and path strings warm.
+      for (auto iter = subdirectories.rbegin(); iter != subdirectories.rend(); ++iter) {
+        queue.push_front(*iter);
+      }
+      pendingSymlinked.insert(pendingSymlinked.end(), symlinked.begin(), symlinked.end());
+      condition.notify_all();
+    }
+  }
+
+  // Between passes of run(), decide which of the directories reached through symlinks need
+  // listing, and queue them for the next pass.  This goes in path order, one at a time, so that
+  // when several symlinks lead to the same directory, the result doesn't depend on which thread
+  // got there first.  Returns false if there is nothing left to do.
+  bool claimSymlinked() {
+    if (pendingSymlinked.empty()) {
+      return false;
+    }
+
+    std::vector<PendingDirectory> places;
+    places.swap(pendingSymlinked);
+    std::sort(places.begin(), places.end(), isEarlierPlace);
+
+    for (PendingDirectory& place: places) {
+      struct stat stats;
+      int result;
+      do {
+        result = stat(place.path.c_str(), &stats);
+      } while (result < 0 && errno == EINTR);
+      if (result < 0) {
+        place.entry->error = errno;
+      } else if (claim(place, stats, false)) {
+        place.claimed = true;
+        queue.push_back(place);
+      }
+    }
+
+    ++pass;
+    return true;
+  }
+
+  // After run() has finished everywhere, fill in the directories which were not listed because
+  // they had been listed elsewhere.
+  void copyDuplicates() {
+    for (Duplicate& duplicate: duplicates) {
+      copyDuplicate(&duplicate);
+    }
+  }
+
+  inline int getDuplicateCount() const { return duplicates.size(); }
+
+  const IgnoreRules* ignoreRules;
+  int activeCount;
+  int directoryCount;
+  int entryCount;
+  int ignoredCount;
+  int loopCount;
+
+private:
+  typedef std::pair<dev_t, ino_t> DirectoryId;
+
+  struct Claim {
+    Entry* entry;
+    std::string relativePath;
+    int pass;
+  };
+
+  struct Duplicate {
+    Entry* entry;
+    DirectoryId original;
+    std::string relativePath;
+    enum { PENDING, COPYING, DONE } state;
+  };
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::deque<PendingDirectory> queue;
+  std::vector<PendingDirectory> pendingSymlinked;
+  int pass;
+
+  // The places in the tree at which each physical directory was listed.  Usually there is just
+  // one; see claim().
+  std::map<DirectoryId, std::vector<Claim> > claims;
+  std::vector<Duplicate> duplicates;
+  std::unordered_map<Entry*, size_t> duplicateIndex;
+
+  // Returns false if the directory must not be listed at this place:  it is a copy of another,
+  // or its own ancestor.  `concurrent` is true during run(), when other threads may be claiming
+  // the same directory.  Without symlinks a directory can only be found twice through bind
+  // mounts; if that happens in the same pass, both places are listed, so that the outcome
+  // doesn't depend on timing.
+  bool claim(const PendingDirectory& directory, const struct stat& stats, bool concurrent) {
+    std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+    if (concurrent) {
+      lock.lock();
+    }
+
+    DirectoryId id(stats.st_dev, stats.st_ino);
+    std::vector<Claim>& places = claims[id];
+    bool isCopy = false;
+    for (const Claim& place: places) {
+      if (isAncestor(place.relativePath, directory.relativePath)) {
+        // Every ancestor has already been claimed, so a loop is always caught here.
+        directory.entry->error = ELOOP;
+        ++loopCount;
+        return false;
+      }
+      if (!concurrent || place.pass < pass) {
+        isCopy = true;
+      }
+    }
+
+    if (isCopy) {
+      duplicateIndex[directory.entry] = duplicates.size();
+      duplicates.push_back(Duplicate { directory.entry, id, directory.relativePath,
+                                       Duplicate::PENDING });
+      return false;
+    }
+
+    places.push_back(Claim { directory.entry, directory.relativePath, pass });
+    return true;
+  }
+
+  // The place to copy a directory's listing from:  the earliest in the tree at which it was
+  // listed.
+  Entry* findOriginal(const DirectoryId& id) {
+    const std::vector<Claim>& places = claims[id];
+    const Claim* result = &places[0];
+    for (const Claim& place: places) {
+      if (isEarlierPath(place.relativePath, result->relativePath)) {
+        result = &place;
+      }
+    }
+    return result->entry;
+  }
+
+  // List one directory into entry->children, leaving out anything matched by `ignoreRules`.
+  // Subdirectories needing a scan are appended to `subdirectories`, or to `symlinked` if they
+  // were reached through a symlink.  Returns the number of entries ignored.
+  int listDirectory(const PendingDirectory& directory,
+                    std::vector<PendingDirectory>* subdirectories,
+                    std::vector<PendingDirectory>* symlinked) {
+    const std::string& path = directory.path;
+    Entry* entry = directory.entry;
+    int ignoredCount = 0;
+
+    int fd;
+    do {
+      fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    } while (fd < 0 && errno == EINTR);
+    if (fd < 0) {
+      entry->error = errno;
+      return 0;
+    }
+
+    struct stat directoryStats;
+    if (!directory.claimed && fstat(fd, &directoryStats) == 0 &&
+        !claim(directory, directoryStats, true)) {
+      close(fd);
+      return 0;
+    }
+
+    DIR* dir = fdopendir(fd);
+    if (dir == NULL) {
+      entry->error = errno;
+      close(fd);
+      return 0;
+    }
+
+    std::set<std::string> symlinkNames;
+    while (true) {
+      errno = 0;
+      struct dirent* dirent = readdir(dir);
+      if (dirent == NULL) {
+        if (errno != 0) {
+          entry->error = errno;
+        }
+        break;
+      }
+
+      if (dirent->d_name[0] == '.') {
+        // Skip hidden files, as well as "." and "..".
+        continue;
+      }
+
+      entry->children.emplace_back();
+      Entry& child = entry->children.back();
+      child.name = dirent->d_name;
+      bool childIsSymlink = dirent->d_type == DT_LNK;
+
+      switch (dirent->d_type) {
+        case DT_DIR:
+          child.isDirectory = true;
+          break;
+        case DT_UNKNOWN:
+        case DT_LNK: {
+          // Not all filesystems fill in d_type, and symlinks must be followed.
+          struct stat stats;
+          int result;
+          do {
+            result = fstatat(dirfd(dir), dirent->d_name, &stats, AT_SYMLINK_NOFOLLOW);
+          } while (result < 0 && errno == EINTR);
+          if (result == 0 && S_ISLNK(stats.st_mode)) {
+            childIsSymlink = true;
+            do {
+              result = fstatat(dirfd(dir), dirent->d_name, &stats, 0);
+            } while (result < 0 && errno == EINTR);
+          }
+          // A dangling symlink is treated like a file, just as DiskFile::isDirectory() would.
+          child.isDirectory = result == 0 && S_ISDIR(stats.st_mode);
+          break;
+        }
+        default:
+          child.isDirectory = false;
+          break;
+      }
+
+      if (ignoreRules != NULL && ignoreRules->matches(
+            childPath(directory.relativePath, child.name), child.isDirectory)) {
+        entry->children.pop_back();
+        ++ignoredCount;
+      } else if (child.isDirectory && childIsSymlink) {
+        symlinkNames.insert(child.name);
+      }
+    }
+
+    closedir(dir);
+
+    if (entry->error != 0) {
+      // Whatever was read before the failure may be missing anything:  report none of it.
+      entry->children.clear();
+      return 0;
+    }
+
+    // Sort before handing out pointers to children, so that they don't move afterwards.
+    std::sort(entry->children.begin(), entry->children.end(), compareByName);
+    for (Entry& child: entry->children) {
+      if (child.isDirectory) {
+        PendingDirectory pending = { &child, path + "/" + child.name,
+            childPath(directory.relativePath, child.name), false };
+        if (symlinkNames.count(child.name) > 0) {
+          symlinked->push_back(pending);
+        } else {
+          subdirectories->push_back(pending);
+        }
+      }
+    }
+
+    return ignoredCount;
+  }
+
+  void copyDuplicate(Duplicate* duplicate) {
+    if (duplicate->state == Duplicate::DONE) {
+      return;
+    } else if (duplicate->state == Duplicate::COPYING) {
+      // The original contains this very directory, through some other duplicate:  a loop that
+      // wasn't visible from any single path.
+      duplicate->entry->error = ELOOP;
+      ++loopCount;
+      return;
+    }
+
+    duplicate->state = Duplicate::COPYING;
+    Entry* original = findOriginal(duplicate->original);
+    completeSubtree(original);
+    if (duplicate->entry->error == 0) {
+      duplicate->entry->error = original->error;
+      duplicate->entry->children = original->children;
+      applyIgnoreRules(duplicate->entry, duplicate->relativePath);
+    }
+    duplicate->state = Duplicate::DONE;
+  }
+
+  // Make sure any duplicates within the subtree have been copied.
+  void completeSubtree(Entry* entry) {
+    for (Entry& child: entry->children) {
+      if (child.isDirectory) {
+        auto iter = duplicateIndex.find(&child);
+        if (iter == duplicateIndex.end()) {
+          completeSubtree(&child);
+        } else {
+          copyDuplicate(&duplicates[iter->second]);
+        }
+      }
+    }
+  }
+
+  // The copied listing was filtered using the original's paths; filter it again using the
+  // duplicate's.  (Anything excluded at the original's path can't come back, though.)
+  void applyIgnoreRules(Entry* entry, const std::string& relativePath) {
+    if (ignoreRules == NULL) {
+      return;
+    }
+
+    std::vector<Entry>& children = entry->children;
+    auto newEnd = std::remove_if(children.begin(), children.end(),
+        [this, &relativePath](const Entry& child) {
+          return ignoreRules->matches(childPath(relativePath, child.name), child.isDirectory);
+        });
+    ignoredCount += children.end() - newEnd;
+    children.erase(newEnd, children.end());
+
+    for (Entry& child: children) {
+      if (child.isDirectory) {
+        applyIgnoreRules(&child, childPath(relativePath, child.name));
+      }
+    }
+  }
+};
+
+TreeScanner::TreeScanner(int threadCount, const IgnoreRules* ignoreRules)
+    : threadCount(threadCount), ignoreRules(ignoreRules), directoryCount(0), entryCount(0),
+      ignoredCount(0), duplicateCount(0), loopCount(0) {
+  if (this->threadCount <= 0) {
+    this->threadCount = std::max(1u, std::thread::hardware_concurrency());
+  }
+}
+
+TreeScanner::~TreeScanner() {}
+
+TreeScanner::Entry TreeScanner::scan(const std::string& path) {
+  Entry root;
+  root.name = path;
+  root.isDirectory = true;
+
+  Work work(ignoreRules);
+  work.add(&root, path);
+
+  do {
+    std::vector<std::thread> threads;
+    for (int i = 1; i < threadCount; i++) {
+      threads.emplace_back([&work]() { work.run(); });
+    }
+    work.run();
+    for (auto& thread: threads) {
+      thread.join();
+    }
+  } while (work.claimSymlinked());
+  work.copyDuplicates();
+
+  directoryCount = work.directoryCount;
+  entryCount = work.entryCount;
+  ignoredCount = work.ignoredCount;
+  duplicateCount = work.getDuplicateCount();
+  loopCount = work.loopCount;
+  return root;
+}
+
+}  // namespace ekam
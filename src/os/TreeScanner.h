@@ -0,0 +1,92 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KENTONSCODE_OS_TREESCANNER_H_
+#define KENTONSCODE_OS_TREESCANNER_H_
+
+#include <string>
+#include <vector>
+
+namespace ekam {
+
+class IgnoreRules;
+
+// Lists an entire directory tree up front, using several threads.  Entry types come from
+// readdir()'s d_type where the filesystem provides it; otherwise (and for symlinks, which are
+// followed) the entry is stat()ed relative to its directory's fd rather than by full path.
+//
+// Hidden files (names starting with '.') are skipped, matching File::list(), as is anything
+// matched by the given IgnoreRules (with paths relative to the root of the scan); ignored
+// directories are never opened.  The result does not depend on thread scheduling:  children are
+// sorted by name.
+//
+// Each physical directory (by device and inode) is read only once.  When symlinks make the same
+// directory appear at several places in the tree, the other places get a copy of its listing, so
+// every name still shows up in the result.  The place that is read is chosen without regard to
+// thread timing:  the directory's real place if that is within the tree, otherwise the symlink
+// to it reached through the fewest other symlinks, and then the first in path order.  This
+// matters when the IgnoreRules treat the places differently.
+// A directory which is its own ancestor (a symlink loop) is reported with error ELOOP and no
+// children.
+class TreeScanner {
+public:
+  struct Entry {
+    std::string name;
+    bool isDirectory;
+
+    // If listing this directory failed, the errno.  `children` is then empty.
+    int error;
+
+    // Sorted by name.  Empty for non-directories.
+    std::vector<Entry> children;
+
+    Entry() : isDirectory(false), error(0) {}
+  };
+
+  // `threadCount` of zero means one per CPU.  `ignoreRules`, if not NULL, must outlive the
+  // scanner.
+  explicit TreeScanner(int threadCount = 0, const IgnoreRules* ignoreRules = NULL);
+  ~TreeScanner();
+
+  // Scan the tree rooted at the given directory.  The root entry's name is `path`.
+  Entry scan(const std::string& path);
+
+  // Total directories and entries seen by the last scan, and entries left out by the
+  // IgnoreRules.
+  inline int getDirectoryCount() const { return directoryCount; }
+  inline int getEntryCount() const { return entryCount; }
+  inline int getIgnoredCount() const { return ignoredCount; }
+
+  // Directories in the last scan which were copies of another place in the tree, and symlink
+  // loops cut off.
+  inline int getDuplicateCount() const { return duplicateCount; }
+  inline int getLoopCount() const { return loopCount; }
+
+private:
+  class Work;
+
+  int threadCount;
+  const IgnoreRules* ignoreRules;
+  int directoryCount;
+  int entryCount;
+  int ignoredCount;
+  int duplicateCount;
+  int loopCount;
+};
+
+}  // namespace ekam
+
+#endif  // KENTONSCODE_OS_TREESCANNER_H_
@@ -0,0 +1,137 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "TreeScanner.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+
+#include "base/IgnoreRules.h"
+
+namespace ekam {
+namespace {
+
+#define ASSERT(EXPRESSION)                                                    \
+  if (!(EXPRESSION)) {                                                        \
+    fprintf(stderr, "%s:%d: FAILED: %s\n", __FILE__, __LINE__, #EXPRESSION);  \
+    exit(1);                                                                  \
+  }
+
+std::string makeTempDir() {
+  char pattern[] = "/tmp/ekam-test-XXXXXX";
+  ASSERT(mkdtemp(pattern) != NULL);
+  return pattern;
+}
+
+void writeFile(const std::string& path) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  ASSERT(fd >= 0);
+  close(fd);
+}
+
+// The tree as one string, e.g. "a/ b c/ d", so that results are easy to compare.
+void describe(const TreeScanner::Entry& entry, const std::string& prefix, std::string* output) {
+  for (const TreeScanner::Entry& child: entry.children) {
+    output->append(" " + prefix + child.name);
+    if (child.isDirectory) {
+      output->append("/");
+      if (child.error != 0) {
+        output->append(strerror(child.error));
+      }
+      describe(child, prefix + child.name + "/", output);
+    }
+  }
+}
+
+std::string scanToString(const std::string& path, int threadCount,
+                         const IgnoreRules* ignoreRules) {
+  TreeScanner scanner(threadCount, ignoreRules);
+  TreeScanner::Entry root = scanner.scan(path);
+  ASSERT(root.error == 0);
+  std::string result;
+  describe(root, "", &result);
+  return result;
+}
+
+void testSymlinkedDirectories() {
+  std::string dir = makeTempDir();
+  std::string src = dir + "/src";
+  std::string outside = dir + "/outside";
+
+  // src/real is also reachable as src/a and src/b; outside/, which isn't in the tree, as src/l1
+  // and src/l2.
+  ASSERT(mkdir(src.c_str(), 0777) == 0);
+  ASSERT(mkdir((src + "/real").c_str(), 0777) == 0);
+  ASSERT(mkdir((src + "/real/sub").c_str(), 0777) == 0);
+  writeFile(src + "/real/x.txt");
+  writeFile(src + "/real/sub/y.txt");
+  ASSERT(symlink("real", (src + "/a").c_str()) == 0);
+  ASSERT(symlink("real", (src + "/b").c_str()) == 0);
+  ASSERT(symlink("..", (src + "/real/up").c_str()) == 0);
+  ASSERT(mkdir(outside.c_str(), 0777) == 0);
+  ASSERT(mkdir((outside + "/sub").c_str(), 0777) == 0);
+  writeFile(outside + "/sub/z.txt");
+  ASSERT(symlink("../outside", (src + "/l1").c_str()) == 0);
+  ASSERT(symlink("../outside", (src + "/l2").c_str()) == 0);
+
+  // Whichever place is listed, the others see everything in it that isn't ignored at their own
+  // path.  Directories ignored at the listed place can't be copied, though, so which place gets
+  // listed must not depend on timing:  src/real rather than its symlinks, and src/l1 before
+  // src/l2.
+  IgnoreRules ignoreRules;
+  ignoreRules.parse("a/x.txt\nl1/sub\n");
+
+  std::string expected =
+      " a/ a/sub/ a/sub/y.txt a/up/" + std::string(strerror(ELOOP)) +
+      " b/ b/sub/ b/sub/y.txt b/up/" + strerror(ELOOP) + " b/x.txt"
+      " l1/ l2/"
+      " real/ real/sub/ real/sub/y.txt real/up/" + strerror(ELOOP) + " real/x.txt";
+
+  {
+    TreeScanner scanner(4, &ignoreRules);
+    TreeScanner::Entry root = scanner.scan(src);
+    std::string result;
+    describe(root, "", &result);
+    ASSERT(result == expected);
+    ASSERT(scanner.getDuplicateCount() == 3);
+    ASSERT(scanner.getLoopCount() == 1);
+  }
+
+  for (int i = 0; i < 50; i++) {
+    ASSERT(scanToString(src, 1 + i % 8, &ignoreRules) == expected);
+  }
+
+  // Without ignore rules every place has everything.
+  std::string all = scanToString(src, 4, NULL);
+  ASSERT(all.find(" l2/sub/z.txt") != std::string::npos);
+  ASSERT(all.find(" a/x.txt") != std::string::npos);
+
+  std::string command = "rm -rf " + dir;
+  ASSERT(system(command.c_str()) == 0);
+}
+
+}  // namespace
+}  // namespace ekam
+
+int main(int argc, char* argv[]) {
+  ekam::testSymlinkedDirectories();
+  return 0;
+}